@@ -45,8 +45,96 @@ static inline void *_get_prefix(prefix_t *prefix)
     return (void*)(prefix + 1);
 }
 
+/*
+ * Parse the prefix quotas of -e prefix_limits, "<prefix>=<size>,...".
+ * A size takes a k, m or g suffix, and 0 is no limit.
+ */
+static ENGINE_ERROR_CODE _prefix_limits_init(struct default_engine *engine)
+{
+    char *str = engine->config.prefix_limits;
+    char *token, *value, *saveptr;
+    int count = 1;
+
+    engine->assoc.prefix_limits = NULL;
+    engine->assoc.prefix_limit_count = 0;
+    if (str == NULL) {
+        return ENGINE_SUCCESS;
+    }
+    for (char *p = str; *p != '\0'; p++) {
+        if (*p == ',') count++;
+    }
+    engine->assoc.prefix_limits = calloc(count, sizeof(prefix_limit_t));
+    if (engine->assoc.prefix_limits == NULL) {
+        return ENGINE_ENOMEM;
+    }
+
+    count = 0;
+    for (token = strtok_r(str, ",", &saveptr); token != NULL;
+         token = strtok_r(NULL, ",", &saveptr)) {
+        prefix_limit_t *limit = &engine->assoc.prefix_limits[count];
+        uint64_t multiplier = 1;
+        uint64_t maxbytes;
+
+        value = strrchr(token, '=');
+        if (value == NULL || value == token) {
+            fprintf(stderr, "Invalid prefix_limits entry: %s\n", token);
+            return ENGINE_EINVAL;
+        }
+        *value++ = '\0';
+        size_t len = strlen(value);
+        if (len > 0) {
+            switch (value[len-1]) {
+            case 'k': case 'K': multiplier = 1024; break;
+            case 'm': case 'M': multiplier = 1024 * 1024; break;
+            case 'g': case 'G': multiplier = 1024 * 1024 * 1024; break;
+            }
+            if (multiplier > 1) value[len-1] = '\0';
+        }
+        if (!safe_strtoull(value, &maxbytes)) {
+            fprintf(stderr, "Invalid prefix_limits size: %s=%s\n", token, value);
+            return ENGINE_EINVAL;
+        }
+        limit->name = token;
+        limit->nname = strlen(token);
+        limit->maxbytes = maxbytes * multiplier;
+        count++;
+    }
+    engine->assoc.prefix_limit_count = count;
+    return ENGINE_SUCCESS;
+}
+
+/* the quota of the given prefix: by its name, or the default one */
+static uint64_t _prefix_maxbytes(struct default_engine *engine, const char *prefix, const size_t nprefix)
+{
+    for (int i = 0; i < engine->assoc.prefix_limit_count; i++) {
+        prefix_limit_t *limit = &engine->assoc.prefix_limits[i];
+        if (limit->nname == nprefix && memcmp(limit->name, prefix, nprefix) == 0) {
+            return limit->maxbytes;
+        }
+    }
+    return engine->config.prefix_maxbytes;
+}
+
+/*
+ * Add or subtract the size to the total bytes of the prefix and of its
+ * parents, whose quotas count the items of their child prefixes as well.
+ * The null prefix is not a parent of the others.
+ */
+static void _prefix_update_tot_bytes(prefix_t *pt, const size_t size, const bool increment)
+{
+    do {
+        if (increment) pt->tot_hash_items_bytes += size;
+        else           pt->tot_hash_items_bytes -= size;
+        pt = pt->parent_prefix;
+    } while (pt != NULL && pt != root_pt);
+}
+
 ENGINE_ERROR_CODE assoc_init(struct default_engine *engine)
 {
+    ENGINE_ERROR_CODE ret = _prefix_limits_init(engine);
+    if (ret != ENGINE_SUCCESS) {
+        return ret;
+    }
     engine->assoc.primary_hashtable = calloc(hashsize(engine->assoc.hashpower), sizeof(void *));
     if (engine->assoc.primary_hashtable == NULL) {
         return ENGINE_ENOMEM;
@@ -60,6 +148,9 @@ ENGINE_ERROR_CODE assoc_init(struct default_engine *engine)
     // initialize noprefix stats info
     memset(&engine->assoc.noprefix_stats, 0, sizeof(prefix_t));
     root_pt = &engine->assoc.noprefix_stats;
+    root_pt->maxbytes = engine->config.prefix_maxbytes;
+    engine->assoc.flush_queue_head = NULL;
+    engine->assoc.flush_queue_tail = NULL;
     return ENGINE_SUCCESS;
 }
 
@@ -299,6 +390,24 @@ static int _prefix_insert(struct default_engine *engine, uint32_t hash, prefix_t
     return 1;
 }
 
+static void _prefix_flush_dequeue(struct default_engine *engine, prefix_t *pt)
+{
+    prefix_t **pos = &engine->assoc.flush_queue_head;
+    prefix_t *prev = NULL;
+
+    while (*pos != pt) {
+        assert(*pos != NULL);
+        prev = *pos;
+        pos = &(*pos)->flush_next;
+    }
+    *pos = pt->flush_next;
+    if (engine->assoc.flush_queue_tail == pt) {
+        engine->assoc.flush_queue_tail = prev;
+    }
+    pt->flush_next = NULL;
+    pt->flush_queued = false;
+}
+
 static void _prefix_delete(struct default_engine *engine, uint32_t prefix_hash, const char *prefix, const uint8_t nprefix)
 {
     prefix_t **prefix_before = _prefixitem_before(engine, prefix_hash, prefix, nprefix);
@@ -306,7 +415,11 @@ static void _prefix_delete(struct default_engine *engine, uint32_t prefix_hash,
     prefix_t *prefix_nxt = NULL;
 
     assert(pt != NULL && pt->parent_prefix != NULL);
+    assert(pt->items_head == NULL && pt->flush_mark == NULL);
 
+    if (pt->flush_queued) {
+        _prefix_flush_dequeue(engine, pt);
+    }
     pt->parent_prefix->prefix_items--;
     engine->assoc.tot_prefix_items--;
 
@@ -318,6 +431,59 @@ static void _prefix_delete(struct default_engine *engine, uint32_t prefix_hash,
     free(pt);
 }
 
+/*
+ * Find the deepest existing prefix of the given key. As in assoc_prefix_link(),
+ * the key is linked to its deepest prefix, which is built with its missing
+ * parents on link. Without any, the null prefix is returned.
+ */
+prefix_t *assoc_prefix_of_key(struct default_engine *engine, const char *key, const size_t nkey)
+{
+    size_t nprefix[DEFAULT_PREFIX_MAX_DEPTH];
+    int prefix_depth = 0;
+    size_t i = 0;
+    char *token;
+    prefix_t *pt;
+
+    while (nkey > i + 1 &&
+           (token = memchr(key + i + 1, engine->config.prefix_delimiter, nkey - i - 1)) != NULL) {
+        i = token - key;
+        nprefix[prefix_depth++] = i;
+        if (prefix_depth >= DEFAULT_PREFIX_MAX_DEPTH) {
+            break;
+        }
+    }
+    while (--prefix_depth >= 0) {
+        pt = assoc_prefix_find(engine, engine->server.core->hash(key, nprefix[prefix_depth], 0),
+                               key, nprefix[prefix_depth]);
+        if (pt != NULL) {
+            return pt;
+        }
+    }
+    return root_pt;
+}
+
+uint64_t assoc_prefix_total_bytes(prefix_t *pt)
+{
+    return pt->hash_items_bytes + pt->list_hash_items_bytes +
+           pt->set_hash_items_bytes + pt->btree_hash_items_bytes;
+}
+
+/*
+ * Get the prefix whose quota the given space does not fit in: the given
+ * prefix, or one of its parents, which count their child prefixes.
+ * Returns NULL if the space fits in all of them.
+ */
+prefix_t *assoc_prefix_over_quota(prefix_t *pt, const size_t space)
+{
+    do {
+        if (pt->maxbytes > 0 && pt->tot_hash_items_bytes + space > pt->maxbytes) {
+            return pt;
+        }
+        pt = pt->parent_prefix;
+    } while (pt != NULL && pt != root_pt);
+    return NULL;
+}
+
 bool assoc_prefix_isvalid(struct default_engine *engine, hash_item *it)
 {
     rel_time_t current_time = engine->server.core->get_current_time();
@@ -330,6 +496,9 @@ bool assoc_prefix_isvalid(struct default_engine *engine, hash_item *it)
         if (pt->oldest_live != 0 && pt->oldest_live <= current_time && it->time <= pt->oldest_live) {
             return false;
         }
+        if (pt->oldest_cas != 0 && (it->iflag & ITEM_WITH_CAS) != 0 && item_get_cas(it) < pt->oldest_cas) {
+            return false;
+        }
     } else {
         /* the prifix of key: given */
         pt = assoc_prefix_find(engine, engine->server.core->hash(item_get_key(it), it->nprefix, 0),
@@ -339,6 +508,9 @@ bool assoc_prefix_isvalid(struct default_engine *engine, hash_item *it)
             if (pt->oldest_live != 0 && pt->oldest_live <= current_time && it->time <= pt->oldest_live) {
                 return false;
             }
+            if (pt->oldest_cas != 0 && (it->iflag & ITEM_WITH_CAS) != 0 && item_get_cas(it) < pt->oldest_cas) {
+                return false;
+            }
             // traversal parent prefixes to validate
             pt = pt->parent_prefix;
         }
@@ -356,30 +528,13 @@ void assoc_prefix_update_size(prefix_t *pt, ENGINE_ITEM_TYPE item_type, const si
         else if (item_type == ITEM_TYPE_LIST)  pt->list_hash_items_bytes += item_size;
         else if (item_type == ITEM_TYPE_SET)   pt->set_hash_items_bytes += item_size;
         else if (item_type == ITEM_TYPE_BTREE) pt->btree_hash_items_bytes += item_size;
-#if 0 // might be used later
-        if (1) {
-            prefix_t *curr_pt = pt->parent_prefix;
-            while (curr_pt != NULL) {
-                curr_pt->tot_hash_items_bytes += item_size;
-                curr_pt = curr_pt->parent_prefix;
-            }
-        }
-#endif
     } else {
         if (item_type == ITEM_TYPE_KV)         pt->hash_items_bytes -= item_size;
         else if (item_type == ITEM_TYPE_LIST)  pt->list_hash_items_bytes -= item_size;
         else if (item_type == ITEM_TYPE_SET)   pt->set_hash_items_bytes -= item_size;
         else if (item_type == ITEM_TYPE_BTREE) pt->btree_hash_items_bytes -= item_size;
-#if 0 // might be used later
-        if (1) {
-            prefix_t *curr_pt = pt->parent_prefix;
-            while (curr_pt != NULL) {
-                curr_pt->tot_hash_items_bytes -= item_size;
-                curr_pt = curr_pt->parent_prefix;
-            }
-        }
-#endif
     }
+    _prefix_update_tot_bytes(pt, item_size, increment);
 }
 
 ENGINE_ERROR_CODE assoc_prefix_link(struct default_engine *engine,
@@ -444,6 +599,7 @@ ENGINE_ERROR_CODE assoc_prefix_link(struct default_engine *engine,
                 memcpy((char*)pt+sizeof(prefix_t)+prefix_list[j].nprefix, "\0", 1);
                 pt->nprefix = prefix_list[j].nprefix;
                 pt->parent_prefix = (j == 0 ? root_pt : prefix_list[j-1].pt);
+                pt->maxbytes = _prefix_maxbytes(engine, key, prefix_list[j].nprefix);
                 time(&pt->create_time);
 
                 // registering allocated prefixes to prefix hastable
@@ -457,6 +613,16 @@ ENGINE_ERROR_CODE assoc_prefix_link(struct default_engine *engine,
 
     assert(pt != NULL);
 
+    // link the item at the head of the prefix item list
+    if (engine->config.prefix_lists) {
+        item_links *links = item_get_links(it);
+        links->p_prev = NULL;
+        links->p_next = pt->items_head;
+        if (links->p_next) item_get_links(links->p_next)->p_prev = it;
+        pt->items_head = it;
+        if (pt->items_tail == NULL) pt->items_tail = it;
+    }
+
     // update prefix information
     if ((it->iflag & ITEM_IFLAG_LIST) != 0) {
         pt->list_hash_items++;
@@ -471,16 +637,7 @@ ENGINE_ERROR_CODE assoc_prefix_link(struct default_engine *engine,
         pt->hash_items++;
         pt->hash_items_bytes += item_size;
     }
-#if 0 // might be used later
-    if (1) {
-        curr_pt = pt->parent_prefix;
-        while (curr_pt != NULL) {
-            curr_pt->tot_hash_items++;
-            curr_pt->tot_hash_items_bytes += item_size;
-            curr_pt = curr_pt->parent_prefix;
-        }
-    }
-#endif
+    _prefix_update_tot_bytes(pt, item_size, true);
 
     *pfx_item = pt;
     return ENGINE_SUCCESS;
@@ -499,6 +656,20 @@ void assoc_prefix_unlink(struct default_engine *engine, hash_item *it, const siz
     }
     assert(pt != NULL);
 
+    // unlink the item from the prefix item list
+    if (engine->config.prefix_lists) {
+        item_links *links = item_get_links(it);
+        if (pt->flush_mark == it) {
+            /* the older items are still to be reclaimed */
+            pt->flush_mark = links->p_next;
+        }
+        if (links->p_prev) item_get_links(links->p_prev)->p_next = links->p_next;
+        else               pt->items_head = links->p_next;
+        if (links->p_next) item_get_links(links->p_next)->p_prev = links->p_prev;
+        else               pt->items_tail = links->p_prev;
+        links->p_next = links->p_prev = NULL;
+    }
+
     // update prefix information
     if ((it->iflag & ITEM_IFLAG_LIST) != 0) {
         pt->list_hash_items--;
@@ -513,16 +684,7 @@ void assoc_prefix_unlink(struct default_engine *engine, hash_item *it, const siz
         pt->hash_items--;
         pt->hash_items_bytes -= item_size;
     }
-#if 0 // might be used later
-    if (1) {
-        prefix_t *curr_pt = pt->parent_prefix;
-        while (curr_pt != NULL) {
-            curr_pt->tot_hash_items--;
-            curr_pt->tot_hash_items_bytes -= item_size;
-            curr_pt = curr_pt->parent_prefix;
-        }
-    }
-#endif
+    _prefix_update_tot_bytes(pt, item_size, false);
 
     while (pt != NULL) {
         prefix_t *parent_pt = pt->parent_prefix;
@@ -540,6 +702,44 @@ void assoc_prefix_unlink(struct default_engine *engine, hash_item *it, const siz
     }
 }
 
+/*
+ * Mark the items the prefix has now, to be reclaimed in the background.
+ * The prefix item list is in link order, so the marked items are
+ * the ones from the list tail up to the current list head.
+ */
+void assoc_prefix_flush_mark(struct default_engine *engine, prefix_t *pt)
+{
+    pt->flush_mark = pt->items_head;
+    if (pt->flush_mark != NULL && pt->flush_queued == false) {
+        pt->flush_next = NULL;
+        if (engine->assoc.flush_queue_tail == NULL) {
+            engine->assoc.flush_queue_head = pt;
+        } else {
+            engine->assoc.flush_queue_tail->flush_next = pt;
+        }
+        engine->assoc.flush_queue_tail = pt;
+        pt->flush_queued = true;
+    }
+}
+
+/*
+ * Get the first prefix having items to be reclaimed after a flush.
+ * The prefixes whose marked items are all gone are dropped from the queue.
+ */
+prefix_t *assoc_prefix_flush_next(struct default_engine *engine)
+{
+    prefix_t *pt;
+
+    while ((pt = engine->assoc.flush_queue_head) != NULL) {
+        if (pt->flush_mark != NULL) {
+            assert(pt->items_tail != NULL);
+            break;
+        }
+        _prefix_flush_dequeue(engine, pt);
+    }
+    return pt;
+}
+
 #if 0 // might be used later
 static uint32_t do_assoc_count_invalid_prefix(struct default_engine *engine)
 {
@@ -561,6 +761,28 @@ static uint32_t do_assoc_count_invalid_prefix(struct default_engine *engine)
 }
 #endif
 
+static int _prefix_stats_line(struct default_engine *engine, char *buf, const size_t size,
+                              const char *format, const char *name, prefix_t *pt)
+{
+    struct tm *t = localtime(&pt->create_time);
+
+    if (engine->config.prefix_quota) {
+        return snprintf(buf, size, format, name,
+                        pt->hash_items+pt->list_hash_items+pt->set_hash_items+pt->btree_hash_items,
+                        pt->hash_items,pt->list_hash_items,pt->set_hash_items,pt->btree_hash_items,
+                        assoc_prefix_total_bytes(pt),
+                        pt->hash_items_bytes,pt->list_hash_items_bytes,pt->set_hash_items_bytes,pt->btree_hash_items_bytes,
+                        pt->maxbytes, pt->evictions,
+                        t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+    }
+    return snprintf(buf, size, format, name,
+                    pt->hash_items+pt->list_hash_items+pt->set_hash_items+pt->btree_hash_items,
+                    pt->hash_items,pt->list_hash_items,pt->set_hash_items,pt->btree_hash_items,
+                    assoc_prefix_total_bytes(pt),
+                    pt->hash_items_bytes,pt->list_hash_items_bytes,pt->set_hash_items_bytes,pt->btree_hash_items_bytes,
+                    t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+}
+
 static ENGINE_ERROR_CODE do_assoc_get_prefix_stats(struct default_engine *engine,
                                                    const char *prefix, const int  nprefix, void *prefix_data)
 {
@@ -568,9 +790,14 @@ static ENGINE_ERROR_CODE do_assoc_get_prefix_stats(struct default_engine *engine
 
     if (nprefix < 0) { // all prefix information
         char *buf;
-        struct tm *t;
         const char *format = "PREFIX %s itm %llu kitm %llu litm %llu sitm %llu bitm %llu "
                              "tsz %llu ktsz %llu ltsz %llu stsz %llu btsz %llu time %04d%02d%02d%02d%02d%02d\r\n";
+        /* with prefix quota: the quota size and the evictions to keep it */
+        const char *qformat = "PREFIX %s itm %llu kitm %llu litm %llu sitm %llu bitm %llu "
+                              "tsz %llu ktsz %llu ltsz %llu stsz %llu btsz %llu qsz %llu qevt %llu "
+                              "time %04d%02d%02d%02d%02d%02d\r\n";
+        bool quota = engine->config.prefix_quota;
+        int nvalues = (quota ? 12 : 10);
         uint32_t i, hsize = hashsize(DEFAULT_PREFIX_HASHPOWER);
         uint32_t num_prefixes = engine->assoc.tot_prefix_items;
         uint32_t tot_prefix_name_len = 0;
@@ -591,8 +818,8 @@ static ENGINE_ERROR_CODE do_assoc_get_prefix_stats(struct default_engine *engine
         }
 
         msize = sizeof(uint32_t) + strlen(format) + tot_prefix_name_len
-                + num_prefixes * (strlen(format) - 2 /* %s */
-                                  + (10 * (20 - 4))) /* %llu replaced by 20-digit num */
+                + num_prefixes * (strlen(quota ? qformat : format) - 2 /* %s */
+                                  + (nvalues * (20 - 4))) /* %llu replaced by 20-digit num */
                 - (5 * (4 - 2)) /* %02d replaced by 2-digit num */
                 + sizeof("END\r\n");
 
@@ -605,26 +832,15 @@ static ENGINE_ERROR_CODE do_assoc_get_prefix_stats(struct default_engine *engine
         pt = root_pt;
         if (pt != NULL && (pt->hash_items > 0 || pt->list_hash_items > 0 || pt->set_hash_items > 0 || pt->btree_hash_items > 0)) {
             /* including null prefix */
-            t = localtime(&pt->create_time);
-            written = snprintf(buf+pos, msize-pos, format, "<null>",
-                               pt->hash_items+pt->list_hash_items+pt->set_hash_items+pt->btree_hash_items,
-                               pt->hash_items,pt->list_hash_items,pt->set_hash_items,pt->btree_hash_items,
-                               pt->hash_items_bytes+pt->list_hash_items_bytes+pt->set_hash_items_bytes+pt->btree_hash_items_bytes,
-                               pt->hash_items_bytes,pt->list_hash_items_bytes,pt->set_hash_items_bytes,pt->btree_hash_items_bytes,
-                               t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+            written = _prefix_stats_line(engine, buf+pos, msize-pos, (quota ? qformat : format), "<null>", pt);
             pos += written;
         }
 
         for (i = 0; i < hsize; i++) {
             pt = engine->assoc.prefix_hashtable[i];
             while (pt) {
-                t = localtime(&pt->create_time);
-                written = snprintf(buf+pos, msize-pos, format, _get_prefix(pt),
-                               pt->hash_items+pt->list_hash_items+pt->set_hash_items+pt->btree_hash_items,
-                               pt->hash_items,pt->list_hash_items,pt->set_hash_items,pt->btree_hash_items,
-                               pt->hash_items_bytes+pt->list_hash_items_bytes+pt->set_hash_items_bytes+pt->btree_hash_items_bytes,
-                               pt->hash_items_bytes,pt->list_hash_items_bytes,pt->set_hash_items_bytes,pt->btree_hash_items_bytes,
-                               t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+                written = _prefix_stats_line(engine, buf+pos, msize-pos, (quota ? qformat : format),
+                                             _get_prefix(pt), pt);
                 pos += written;
                 assert(pos < msize);
                 pt = pt->h_next;
@@ -32,17 +32,34 @@ struct _prefix_t {
     prefix_t *h_next;
 
     rel_time_t oldest_live;
+    uint64_t oldest_cas;
     time_t create_time;
 
     uint64_t list_hash_items_bytes;
     uint64_t set_hash_items_bytes;
     uint64_t btree_hash_items_bytes;
     uint64_t hash_items_bytes;
-    //uint64_t tot_hash_items_bytes;
+    uint64_t tot_hash_items_bytes; /* of the prefix and its child prefixes */
 
     prefix_t *parent_prefix;
+
+    hash_item *items_head;  /* items of the prefix, newest first */
+    hash_item *items_tail;
+    hash_item *flush_mark;  /* the newest item to be reclaimed after a flush */
+    prefix_t *flush_next;   /* next prefix in the flush queue */
+    bool flush_queued;
+
+    uint64_t maxbytes;      /* quota of tot_hash_items_bytes, 0: no limit */
+    uint64_t evictions;     /* # of items evicted to keep the prefix in quota */
 };
 
+/* the quota given to a prefix by name with -e prefix_limits */
+typedef struct {
+    char    *name;
+    size_t   nname;
+    uint64_t maxbytes;
+} prefix_limit_t;
+
 struct assoc {
    /* how many powers of 2's worth of buckets we use */
    unsigned int hashpower;
@@ -52,6 +69,14 @@ struct assoc {
    prefix_t**  prefix_hashtable;
    prefix_t    noprefix_stats;
 
+   /* Prefixes whose flushed items are reclaimed in the background. */
+   prefix_t*   flush_queue_head;
+   prefix_t*   flush_queue_tail;
+
+   /* The quotas of -e prefix_limits, and their number. */
+   prefix_limit_t* prefix_limits;
+   int             prefix_limit_count;
+
    /*
     * Previous hash table. During expansion, we look here for keys that haven't
     * been moved over to the primary yet.
@@ -82,12 +107,18 @@ void              assoc_delete(struct default_engine *engine,
                                uint32_t hash, const char *key, const size_t nkey);
 prefix_t *        assoc_prefix_find(struct default_engine *engine,
                                     uint32_t hash, const char *prefix, const size_t nprefix);
+prefix_t *        assoc_prefix_of_key(struct default_engine *engine,
+                                      const char *key, const size_t nkey);
+uint64_t          assoc_prefix_total_bytes(prefix_t *pt);
+prefix_t *        assoc_prefix_over_quota(prefix_t *pt, const size_t space);
 bool              assoc_prefix_isvalid(struct default_engine *engine, hash_item *it);
 void              assoc_prefix_update_size(prefix_t *pt, ENGINE_ITEM_TYPE item_type,
                                     const size_t item_size, const bool increment);
 ENGINE_ERROR_CODE assoc_prefix_link(struct default_engine *engine,
                                     hash_item *it, const size_t item_size,
                                     prefix_t **pfx_item);
+void              assoc_prefix_flush_mark(struct default_engine *engine, prefix_t *pt);
+prefix_t *        assoc_prefix_flush_next(struct default_engine *engine);
 void              assoc_prefix_unlink(struct default_engine *engine,
                                     hash_item *it, const size_t item_size);
 ENGINE_ERROR_CODE assoc_get_prefix_stats(struct default_engine *engine,
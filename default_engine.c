@@ -111,11 +111,26 @@ static ENGINE_ERROR_CODE  default_set_elem_exist(ENGINE_HANDLE* handle, const vo
                                                  const void* key, const int nkey,
                                                  const void* value, const int nbytes,
                                                  bool *exist, uint16_t vbucket);
+static ENGINE_ERROR_CODE  default_set_elem_mexist(ENGINE_HANDLE* handle, const void* cookie,
+                                                  const void* key, const int nkey,
+                                                  token_t *varray, const int vcount,
+                                                  bool *exist_array, uint16_t vbucket);
+static ENGINE_ERROR_CODE  default_set_elem_setop(ENGINE_HANDLE* handle, const void* cookie,
+                                                 const ENGINE_SET_OPERATION setop,
+                                                 token_t *karray, const int kcount,
+                                                 const void* dkey, const int ndkey,
+                                                 item_attr *dattrp,
+                                                 eitem*** eitem_array, uint32_t* eitem_count,
+                                                 uint16_t vbucket);
 static ENGINE_ERROR_CODE  default_set_elem_get(ENGINE_HANDLE* handle, const void* cookie,
                                                const void* key, const int nkey, const uint32_t count,
                                                const bool delete, const bool drop_if_empty,
                                                eitem** eitem, uint32_t* eitem_count,
                                                uint32_t* flags, bool* dropped, uint16_t vbucket);
+static ENGINE_ERROR_CODE  default_set_elem_sample(ENGINE_HANDLE* handle, const void* cookie,
+                                                  const void* key, const int nkey, const uint32_t count,
+                                                  eitem** eitem, uint32_t* eitem_count,
+                                                  uint32_t* flags, uint16_t vbucket);
 static ENGINE_ERROR_CODE  default_btree_struct_create(ENGINE_HANDLE* handle, const void* cookie,
                                                       const void* key, const int nkey, item_attr *attrp,
                                                       uint16_t vbucket);
@@ -305,7 +320,10 @@ ENGINE_ERROR_CODE create_instance(uint64_t interface, GET_SERVER_API get_server_
          .set_elem_insert   = default_set_elem_insert,
          .set_elem_delete   = default_set_elem_delete,
          .set_elem_exist    = default_set_elem_exist,
+         .set_elem_mexist   = default_set_elem_mexist,
+         .set_elem_setop    = default_set_elem_setop,
          .set_elem_get      = default_set_elem_get,
+         .set_elem_sample   = default_set_elem_sample,
          /* B+Tree functions */
          .btree_struct_create = default_btree_struct_create,
          .btree_elem_alloc   = default_btree_elem_alloc,
@@ -365,6 +383,23 @@ ENGINE_ERROR_CODE create_instance(uint64_t interface, GET_SERVER_API get_server_
          .chunk_size = 48,
          .item_size_max= 1024 * 1024,
          .prefix_delimiter = ':',
+         .coll_del_batch = 100,
+         .coll_del_slice = 500,
+         .lru_segmented = false,
+         .hot_lru_pct = 20,
+         .warm_lru_pct = 40,
+         .lru_second_chance = false,
+         .lru_admission = false,
+         .lru_crawler = false,
+         .lru_crawler_batch = 100,
+         .lru_crawler_sleep = 1000,
+         .expire_wheel = false,
+         .prefix_lists = false,
+         .prefix_maxbytes = 0,
+         .prefix_limits = NULL,
+         .prefix_quota = false,
+         .item_links = false,
+         .evict_cost = false,
        },
       .scrubber = {
          .lock = PTHREAD_MUTEX_INITIALIZER,
@@ -447,7 +482,7 @@ static ENGINE_ERROR_CODE default_item_allocate(ENGINE_HANDLE* handle, const void
                                                const int flags, const rel_time_t exptime)
 {
     struct default_engine* engine = get_handle(handle);
-    size_t ntotal = sizeof(hash_item) + nkey + nbytes;
+    size_t ntotal = ITEM_HEADER_SIZE(engine) + nkey + nbytes;
     if (engine->config.use_cas) {
         ntotal += sizeof(uint64_t);
     }
@@ -554,7 +589,39 @@ static ENGINE_ERROR_CODE default_get_stats(ENGINE_HANDLE* handle, const void* co
         add_stat("sticky_limit", 12, val, len, cookie);
         len = sprintf(val, "%"PRIu64, (uint64_t)engine->config.maxbytes);
         add_stat("engine_maxbytes", 15, val, len, cookie);
+        len = sprintf(val, "%"PRIu64, engine->stats.coll_del_items);
+        add_stat("coll_del_items", 14, val, len, cookie);
+        len = sprintf(val, "%"PRIu64, engine->stats.coll_del_elems);
+        add_stat("coll_del_elems", 14, val, len, cookie);
+        len = sprintf(val, "%"PRIu64, engine->stats.coll_del_slices);
+        add_stat("coll_del_slices", 15, val, len, cookie);
+        len = sprintf(val, "%"PRIu64, engine->stats.coll_del_usec);
+        add_stat("coll_del_usec", 13, val, len, cookie);
+        if (engine->config.expire_wheel) {
+            len = sprintf(val, "%"PRIu64, engine->stats.wheel_reclaimed);
+            add_stat("wheel_reclaimed", 15, val, len, cookie);
+        }
+        if (engine->config.prefix_lists) {
+            len = sprintf(val, "%"PRIu64, engine->stats.flush_prefix_reclaimed);
+            add_stat("flush_prefix_reclaimed", 22, val, len, cookie);
+        }
+        if (engine->config.prefix_quota) {
+            len = sprintf(val, "%"PRIu64, engine->stats.prefix_evictions);
+            add_stat("prefix_evictions", 16, val, len, cookie);
+        }
+        if (engine->config.evict_cost) {
+            len = sprintf(val, "%"PRIu64, engine->stats.evict_trimmed);
+            add_stat("evict_trimmed", 13, val, len, cookie);
+        }
+        if (engine->config.lru_admission) {
+            len = sprintf(val, "%"PRIu64, engine->stats.admission_tested);
+            add_stat("admission_tested", 16, val, len, cookie);
+            len = sprintf(val, "%"PRIu64, engine->stats.admission_rejected);
+            add_stat("admission_rejected", 18, val, len, cookie);
+        }
         pthread_mutex_unlock(&engine->stats.lock);
+        len = sprintf(val, "%u", item_coll_del_queue_size(engine));
+        add_stat("coll_del_queue_size", 19, val, len, cookie);
     } else if (strncmp(stat_key, "slabs", 5) == 0) {
         slabs_stats(engine, add_stat, cookie);
     } else if (strncmp(stat_key, "items", 5) == 0) {
@@ -758,6 +825,32 @@ static ENGINE_ERROR_CODE default_set_elem_exist(ENGINE_HANDLE* handle, const voi
     return set_elem_exist(engine, key, nkey, value, nbytes, exist);
 }
 
+static ENGINE_ERROR_CODE default_set_elem_mexist(ENGINE_HANDLE* handle, const void* cookie,
+                                                 const void* key, const int nkey,
+                                                 token_t *varray, const int vcount,
+                                                 bool *exist_array, uint16_t vbucket)
+{
+    struct default_engine *engine = get_handle(handle);
+    VBUCKET_GUARD(engine, vbucket);
+
+    return set_elem_mexist(engine, key, nkey, varray, vcount, exist_array);
+}
+
+static ENGINE_ERROR_CODE default_set_elem_setop(ENGINE_HANDLE* handle, const void* cookie,
+                                                const ENGINE_SET_OPERATION setop,
+                                                token_t *karray, const int kcount,
+                                                const void* dkey, const int ndkey,
+                                                item_attr *dattrp,
+                                                eitem*** eitem_array, uint32_t* eitem_count,
+                                                uint16_t vbucket)
+{
+    struct default_engine *engine = get_handle(handle);
+    VBUCKET_GUARD(engine, vbucket);
+
+    return set_elem_setop(engine, setop, karray, kcount, dkey, ndkey, dattrp,
+                          (set_elem_item***)eitem_array, eitem_count, cookie);
+}
+
 static ENGINE_ERROR_CODE default_set_elem_get(ENGINE_HANDLE* handle, const void* cookie,
                                               const void* key, const int nkey, const uint32_t count,
                                               const bool delete, const bool drop_if_empty,
@@ -771,6 +864,18 @@ static ENGINE_ERROR_CODE default_set_elem_get(ENGINE_HANDLE* handle, const void*
                         (set_elem_item**)eitem, eitem_count, flags, dropped);
 }
 
+static ENGINE_ERROR_CODE default_set_elem_sample(ENGINE_HANDLE* handle, const void* cookie,
+                                                 const void* key, const int nkey, const uint32_t count,
+                                                 eitem** eitem, uint32_t* eitem_count,
+                                                 uint32_t* flags, uint16_t vbucket)
+{
+    struct default_engine *engine = get_handle(handle);
+    VBUCKET_GUARD(engine, vbucket);
+
+    return set_elem_sample(engine, key, nkey, count,
+                           (set_elem_item**)eitem, eitem_count, flags);
+}
+
 static ENGINE_ERROR_CODE default_btree_struct_create(ENGINE_HANDLE* handle, const void* cookie,
                                                      const void* key, const int nkey, item_attr *attrp,
                                                      uint16_t vbucket)
@@ -979,6 +1084,12 @@ static void default_reset_stats(ENGINE_HANDLE* handle, const void *cookie)
     engine->stats.evictions = 0;
     engine->stats.reclaimed = 0;
     engine->stats.total_items = 0;
+    engine->stats.admission_tested = 0;
+    engine->stats.admission_rejected = 0;
+    engine->stats.wheel_reclaimed = 0;
+    engine->stats.flush_prefix_reclaimed = 0;
+    engine->stats.prefix_evictions = 0;
+    engine->stats.evict_trimmed = 0;
     pthread_mutex_unlock(&engine->stats.lock);
 }
 
@@ -1067,6 +1178,51 @@ static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se, cons
             { .key = "vb0",
               .datatype = DT_BOOL,
               .value.dt_bool = &se->config.vb0 },
+            { .key = "coll_del_batch",
+              .datatype = DT_SIZE,
+              .value.dt_size = &se->config.coll_del_batch },
+            { .key = "coll_del_slice",
+              .datatype = DT_SIZE,
+              .value.dt_size = &se->config.coll_del_slice },
+            { .key = "lru_segmented",
+              .datatype = DT_BOOL,
+              .value.dt_bool = &se->config.lru_segmented },
+            { .key = "hot_lru_pct",
+              .datatype = DT_SIZE,
+              .value.dt_size = &se->config.hot_lru_pct },
+            { .key = "warm_lru_pct",
+              .datatype = DT_SIZE,
+              .value.dt_size = &se->config.warm_lru_pct },
+            { .key = "lru_second_chance",
+              .datatype = DT_BOOL,
+              .value.dt_bool = &se->config.lru_second_chance },
+            { .key = "lru_admission",
+              .datatype = DT_BOOL,
+              .value.dt_bool = &se->config.lru_admission },
+            { .key = "lru_crawler",
+              .datatype = DT_BOOL,
+              .value.dt_bool = &se->config.lru_crawler },
+            { .key = "lru_crawler_batch",
+              .datatype = DT_SIZE,
+              .value.dt_size = &se->config.lru_crawler_batch },
+            { .key = "lru_crawler_sleep",
+              .datatype = DT_SIZE,
+              .value.dt_size = &se->config.lru_crawler_sleep },
+            { .key = "expire_wheel",
+              .datatype = DT_BOOL,
+              .value.dt_bool = &se->config.expire_wheel },
+            { .key = "prefix_lists",
+              .datatype = DT_BOOL,
+              .value.dt_bool = &se->config.prefix_lists },
+            { .key = "prefix_maxbytes",
+              .datatype = DT_SIZE,
+              .value.dt_size = &se->config.prefix_maxbytes },
+            { .key = "prefix_limits",
+              .datatype = DT_STRING,
+              .value.dt_string = &se->config.prefix_limits },
+            { .key = "evict_cost",
+              .datatype = DT_BOOL,
+              .value.dt_bool = &se->config.evict_cost },
             { .key = "config_file",
               .datatype = DT_CONFIGFILE },
             { .key = NULL}
@@ -1077,6 +1233,30 @@ static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se, cons
     if (se->config.vb0) {
         set_vbucket_state(se, 0, VBUCKET_STATE_ACTIVE);
     }
+    if (se->config.coll_del_batch == 0) {
+        se->config.coll_del_batch = 1;
+    }
+    if (se->config.lru_crawler_batch == 0) {
+        se->config.lru_crawler_batch = 1;
+    }
+    /* the prefix quota evicts through the prefix item lists */
+    se->config.prefix_quota = (se->config.prefix_maxbytes > 0 || se->config.prefix_limits != NULL);
+    if (se->config.prefix_quota) {
+        se->config.prefix_lists = true;
+    }
+    /* only the wheel and the prefix item lists chain items through item_links */
+    se->config.item_links = (se->config.expire_wheel || se->config.prefix_lists);
+    /* the second chance is given on a plain LRU */
+    if (se->config.lru_second_chance) {
+        se->config.lru_segmented = false;
+    }
+    /* leave at least 10% of each LRU to the cold segment */
+    if (se->config.hot_lru_pct > 90) {
+        se->config.hot_lru_pct = 90;
+    }
+    if (se->config.hot_lru_pct + se->config.warm_lru_pct > 90) {
+        se->config.warm_lru_pct = 90 - se->config.hot_lru_pct;
+    }
     return ret;
 }
 
@@ -1339,9 +1519,21 @@ const void* item_get_key(const hash_item* item)
     if (item->iflag & ITEM_WITH_CAS) {
         ret += sizeof(uint64_t);
     }
+    if (item->iflag & ITEM_WITH_LINKS) {
+        ret += sizeof(item_links);
+    }
     return ret;
 }
 
+item_links* item_get_links(const hash_item* item)
+{
+    char *ret = (void*)(item + 1);
+    if (item->iflag & ITEM_WITH_CAS) {
+        ret += sizeof(uint64_t);
+    }
+    return (item_links*)ret;
+}
+
 char* item_get_data(const hash_item* item)
 {
     return ((char*)item_get_key(item)) + item->nkey;
@@ -83,6 +83,11 @@ extern "C" {
 #define ITEM_IFLAG_COLL  14  /* collection item: list/set/b+tree */
 #define ITEM_LINKED  (1<<8)
 #define ITEM_SLABBED (2<<8)
+#define ITEM_ACTIVE   (4<<8)  /* read since it was last moved in the LRU */
+#define ITEM_LRU_WARM (8<<8)  /* in the warm segment of the LRU */
+#define ITEM_LRU_COLD (16<<8) /* in the cold segment of the LRU */
+#define ITEM_LRU_TAIL (32<<8) /* not admitted: link it at the tail of the LRU */
+#define ITEM_WITH_LINKS (64<<8) /* item_links follow the header */
 
 #define META_OFFSET_IN_ITEM(nkey,nbytes) ((((nkey)+(nbytes)-1)/8+1)*8)
 
@@ -91,6 +96,7 @@ struct config {
    bool   use_cas;
    size_t verbose;
    rel_time_t oldest_live;
+   uint64_t oldest_cas;     /* items linked before the last flush_all */
    bool   evict_to_free;
    size_t num_threads;
    size_t maxbytes;
@@ -103,6 +109,23 @@ struct config {
    bool   ignore_vbucket;
    char   prefix_delimiter;
    bool   vb0;
+   size_t coll_del_batch;   /* max # of elements dropped per cache lock hold */
+   size_t coll_del_slice;   /* max cache lock hold time of a drop slice (usec) */
+   bool   lru_segmented;    /* split each LRU into hot/warm/cold segments */
+   size_t hot_lru_pct;      /* max % of the items of an LRU in the hot segment */
+   size_t warm_lru_pct;     /* max % of the items of an LRU in the warm segment */
+   bool   lru_second_chance; /* a hit sets the active bit only, read at eviction */
+   bool   lru_admission;    /* admit new items by key access frequency */
+   bool   lru_crawler;      /* reclaim expired items in the background */
+   size_t lru_crawler_batch; /* max # of items checked per cache lock hold */
+   size_t lru_crawler_sleep; /* sleep time between crawler batches (usec) */
+   bool   expire_wheel;     /* unlink expired items through a timer wheel */
+   bool   prefix_lists;     /* link the items of each prefix, for flush_prefix */
+   size_t prefix_maxbytes;  /* max bytes of the items of a prefix, 0: no limit */
+   char  *prefix_limits;    /* max bytes of the named prefixes: "<prefix>=<size>,..." */
+   bool   prefix_quota;     /* a prefix quota is given: set by the two above */
+   bool   item_links;       /* items carry item_links: set by the two above */
+   bool   evict_cost;       /* pick victims by size, rebuild cost and recency */
 };
 
 MEMCACHED_PUBLIC_API
@@ -122,6 +145,16 @@ struct engine_stats {
    uint64_t curr_bytes;
    uint64_t curr_items;
    uint64_t total_items;
+   uint64_t coll_del_items;  /* # of collections dropped by delete thread */
+   uint64_t coll_del_elems;  /* # of elements dropped by delete thread */
+   uint64_t coll_del_slices; /* # of cache lock holds of delete thread */
+   uint64_t coll_del_usec;   /* total cache lock hold time of delete thread */
+   uint64_t admission_tested;   /* # of new items compared with the LRU tail */
+   uint64_t admission_rejected; /* # of new items linked at the LRU tail */
+   uint64_t wheel_reclaimed;    /* # of expired items unlinked by the expiration wheel */
+   uint64_t flush_prefix_reclaimed; /* # of flushed items unlinked by their prefix */
+   uint64_t prefix_evictions;   /* # of items evicted to keep their prefix in quota */
+   uint64_t evict_trimmed;      /* # of elements trimmed instead of evicting collections */
 };
 
 enum scrub_mode {
@@ -184,6 +217,12 @@ struct default_engine {
    pthread_cond_t  coll_del_cond;
    bool            coll_del_sleep;
 
+   /* prefix flush thread, waits on cache_lock */
+   pthread_cond_t  prefix_flush_cond;
+
+   /* sticky manager thread, waits on cache_lock */
+   pthread_cond_t  sticky_cond;
+
    struct config config;
    struct engine_stats stats;
    struct engine_scrubber scrubber;
@@ -197,6 +236,7 @@ struct default_engine {
 char* item_get_meta(const hash_item* item);
 char* item_get_data(const hash_item* item);
 const void* item_get_key(const hash_item* item);
+item_links* item_get_links(const hash_item* item);
 void item_set_cas(ENGINE_HANDLE *handle, const void *cookie,
                   item* item, uint64_t val);
 uint64_t item_get_cas(const hash_item* item);
@@ -0,0 +1,49 @@
+#! /usr/bin/perl
+#
+# Measure the memory efficiency of small items: store COUNT counters with
+# VALUE_SIZE byte values, and show how many bytes each item takes.
+# Compare the servers started with and without "-e expire_wheel=true" or
+# "-e prefix_lists=true", which keep links in every item.
+#
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+
+use FindBin;
+
+@ARGV >= 1 and @ARGV <= 3
+    or die "Usage: $FindBin::Script HOST:PORT [COUNT] [VALUE_SIZE]\n";
+
+my $addr = $ARGV[0];
+my $count = $ARGV[1] || 100_000;
+my $vsize = $ARGV[2] || 10;
+
+my $sock = IO::Socket::INET->new(PeerAddr => $addr,
+                                 Timeout  => 3);
+die "$!\n" unless $sock;
+
+sub stats {
+    my %stats;
+    print $sock "stats\r\n";
+    while (my $line = <$sock>) {
+        last if $line =~ /^END/;
+        $stats{$1} = $2 if $line =~ /^STAT (\S+) (\S+)/;
+    }
+    return \%stats;
+}
+
+my $value = "1" x $vsize;
+my $before = stats();
+foreach my $i (1 .. $count) {
+    print $sock "set counter:$i 0 0 $vsize noreply\r\n$value\r\n";
+}
+my $after = stats();
+
+my $items = $after->{curr_items} - $before->{curr_items};
+my $bytes = $after->{bytes} - $before->{bytes};
+die "no item stored\n" unless $items > 0;
+printf("items stored: %d of %d, evictions: %d\n", $items, $count,
+       $after->{evictions} - $before->{evictions});
+printf("bytes per item: %.1f, payload %d (%.1f%%)\n", $bytes / $items,
+       $vsize, 100 * $vsize / ($bytes / $items));
@@ -492,6 +492,25 @@ extern "C" {
                                             const int nbytes,
                                             bool *exist,
                                             uint16_t vbucket);
+        ENGINE_ERROR_CODE (*set_elem_mexist)(ENGINE_HANDLE* handle,
+                                             const void* cookie,
+                                             const void* key,
+                                             const int nkey,
+                                             token_t *varray,
+                                             const int vcount,
+                                             bool *exist_array,
+                                             uint16_t vbucket);
+        ENGINE_ERROR_CODE (*set_elem_setop)(ENGINE_HANDLE* handle,
+                                            const void* cookie,
+                                            const ENGINE_SET_OPERATION setop,
+                                            token_t *karray,
+                                            const int kcount,
+                                            const void* dkey,
+                                            const int ndkey,
+                                            item_attr *dattrp,
+                                            eitem*** eitem_array,
+                                            uint32_t* eitem_count,
+                                            uint16_t vbucket);
         ENGINE_ERROR_CODE (*set_elem_get)(ENGINE_HANDLE* handle,
                                           const void* cookie,
                                           const void* key,
@@ -504,6 +523,15 @@ extern "C" {
                                           uint32_t* flags,
                                           bool* dropped,
                                           uint16_t vbucket);
+        ENGINE_ERROR_CODE (*set_elem_sample)(ENGINE_HANDLE* handle,
+                                             const void* cookie,
+                                             const void* key,
+                                             const int nkey,
+                                             const uint32_t count,
+                                             eitem** eitem,
+                                             uint32_t* eitem_count,
+                                             uint32_t* flags,
+                                             uint16_t vbucket);
         /*
          * B+Tree Interface
          */
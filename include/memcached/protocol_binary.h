@@ -185,6 +185,7 @@ extern "C"
         /* End TAP */
 
         /* ATTR commands */
+        PROTOCOL_BINARY_CMD_SETATTRQ    = 0x4d,
         PROTOCOL_BINARY_CMD_GETATTR     = 0x4e,
         PROTOCOL_BINARY_CMD_SETATTR     = 0x4f,
 
@@ -223,6 +224,11 @@ extern "C"
         PROTOCOL_BINARY_CMD_BOP_UPSERTQ = 0x7c,
         PROTOCOL_BINARY_CMD_BOP_UPDATEQ = 0x7d,
         PROTOCOL_BINARY_CMD_BOP_DELETEQ = 0x7e,
+        PROTOCOL_BINARY_CMD_BOP_CREATEQ = 0x7f,
+        PROTOCOL_BINARY_CMD_BOP_INCR    = 0x80,
+        PROTOCOL_BINARY_CMD_BOP_DECR    = 0x81,
+        PROTOCOL_BINARY_CMD_BOP_INCRQ   = 0x82,
+        PROTOCOL_BINARY_CMD_BOP_DECRQ   = 0x83,
         /* End B+Tree */
 
         PROTOCOL_BINARY_CMD_FLUSH_PREFIX = 0x90,
@@ -807,6 +813,54 @@ extern "C"
                       sizeof(bkey_range) + sizeof(eflag_filter)];
     } protocol_binary_request_bop_count;
 
+    typedef union {
+        struct {
+            protocol_binary_request_header header;
+            struct {
+                uint8_t  bkey[MAX_BKEY_LENG];
+                uint8_t  nbkey;
+                uint8_t  order;
+                uint8_t  reserved[7];
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_request_header) + MAX_BKEY_LENG+1 + 8];
+    } protocol_binary_request_bop_position;
+
+    typedef union {
+        struct {
+            protocol_binary_request_header header;
+            struct {
+                uint32_t from_posi;
+                uint32_t to_posi;
+                uint8_t  order;
+                uint8_t  reserved1;
+                uint8_t  reserved2;
+                uint8_t  reserved3;
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_request_header) + 12];
+    } protocol_binary_request_bop_gbp;
+
+    typedef union {
+        struct {
+            protocol_binary_request_header header;
+            struct {
+                uint8_t  bkey[MAX_BKEY_LENG];
+                uint8_t  nbkey;
+                uint8_t  eflag[MAX_EFLAG_LENG];
+                uint8_t  neflag;
+                uint64_t delta;
+                uint64_t initial;
+                uint8_t  create;
+                uint8_t  reserved[7];
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_request_header) +
+                      MAX_BKEY_LENG+1 + MAX_EFLAG_LENG+1 + 24];
+    } protocol_binary_request_bop_incr;
+
+    typedef protocol_binary_request_bop_incr protocol_binary_request_bop_decr;
+
 #if defined(SUPPORT_BOP_MGET) || defined(SUPPORT_BOP_SMGET)
     typedef union {
         struct {
@@ -848,6 +902,24 @@ extern "C"
     } protocol_binary_response_bop_get;
 
     typedef protocol_binary_response_bop_get protocol_binary_response_bop_count;
+    /* The body of BOP_GBP is followed by a bkey slot per element,
+     * bkey[MAX_BKEY_LENG] and nbkey as in the requests, then the value
+     * lengths and the values.
+     */
+    typedef protocol_binary_response_bop_get protocol_binary_response_bop_gbp;
+
+    typedef union {
+        struct {
+            protocol_binary_response_header header;
+            struct {
+                uint32_t position;
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_response_header) + 4];
+    } protocol_binary_response_bop_position;
+
+    typedef protocol_binary_response_incr protocol_binary_response_bop_incr;
+    typedef protocol_binary_response_incr protocol_binary_response_bop_decr;
 
 #ifdef SUPPORT_BOP_MGET
     typedef union {
@@ -104,6 +104,8 @@ extern "C" {
         OPERATION_SOP_DELETE,        /**< Set operation with delete element semantics */
         OPERATION_SOP_EXIST,         /**< Set operation with check existence of element semantics */
         OPERATION_SOP_GET,           /**< Set operation with get element semantics */
+        OPERATION_SOP_MEXIST,        /**< Set operation with check existence of multiple elements semantics */
+        OPERATION_SOP_SETOP,         /**< Set operation with intersection/union/difference of sets semantics */
 
         /* b+tree operation */
         OPERATION_BOP_CREATE = 0x70, /**< B+tree operation with create structure semantics */
@@ -157,6 +159,13 @@ extern "C" {
         ATTR_END
     } ENGINE_ITEM_ATTR;
 
+    /* set operation across multiple sets */
+    typedef enum {
+        SET_OPERATION_INTER = 1,
+        SET_OPERATION_UNION,
+        SET_OPERATION_DIFF
+    } ENGINE_SET_OPERATION;
+
     /* btree order for sorting/scanning */
     typedef enum {
         BTREE_ORDER_ASC = 1,
@@ -26,6 +26,7 @@
  * returns true if conversion succeeded.
  */
 #include <memcached/visibility.h>
+#include <memcached/extension.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -39,6 +40,27 @@ MEMCACHED_PUBLIC_API bool safe_strtohexa(const char *str, unsigned char *bin, co
 MEMCACHED_PUBLIC_API void safe_hexatostr(const unsigned char *bin, const int size, char *str);
 MEMCACHED_PUBLIC_API bool mc_isvalidname(const char *str, int len);
 
+/*
+ * Tokenize the command string of the given length by replacing spaces
+ * with '\0' and update the token array with pointer to start of each
+ * token and length. A '\0' in the string also ends the tokenizing.
+ * Returns total number of tokens. The last valid token is the terminal
+ * token (value points to the first unprocessed character of the string,
+ * or NULL if the whole string is scanned, and length zero).
+ *
+ * Usage example:
+ *
+ *  while(tokenize_command(command, ncommand, tokens, max_tokens) > 0) {
+ *      for(int ix = 0; tokens[ix].length != 0; ix++) {
+ *          ...
+ *      }
+ *      ncommand = ncommand - (tokens[ix].value - command);
+ *      command  = tokens[ix].value;
+ *   }
+ */
+MEMCACHED_PUBLIC_API size_t tokenize_command(char *command, const size_t length,
+                                             token_t *tokens, const size_t max_tokens);
+
 #ifndef HAVE_HTONLL
 #define htonll mc_htonll
 #define ntohll mc_ntohll
@@ -0,0 +1,552 @@
+/*
+ * arcus-memcached - Arcus memory cache server
+ * Copyright 2010-2014 NAVER Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "iouring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifdef IORING_RECV_MULTISHOT
+#define USE_RECV_MULTISHOT 1
+#define IO_RING_BGID 0      /* the buffer group of the recvs */
+#endif
+
+struct io_ring {
+    int       fd;
+    unsigned  entries;
+    unsigned  features;
+    unsigned  pending;      /* prepared, not yet submitted */
+    unsigned  inflight;     /* sends submitted, not yet reaped */
+    /* submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_flags;
+    unsigned *sq_array;
+    unsigned  sq_local_tail;
+    struct io_uring_sqe *sqes;
+    /* completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* mappings */
+    void     *sq_ptr;
+    void     *cq_ptr;
+    size_t    sq_size;
+    size_t    cq_size;
+    size_t    sqes_size;
+#ifdef USE_RECV_MULTISHOT
+    /* the buffers provided for the recvs */
+    struct io_uring_buf_ring *br;
+    size_t    br_size;
+    unsigned  br_mask;
+    uint16_t  br_tail;
+    char     *bufs;
+    unsigned  buf_size;
+    unsigned  bufs_free;    /* owned by the kernel, not yet filled */
+    int      *buf_next;     /* links the buffers of a recvq */
+    unsigned *buf_len;      /* the received bytes of a buffer */
+#endif
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+io_ring_t *io_ring_create(unsigned int entries)
+{
+    struct io_uring_params p;
+    io_ring_t *ring;
+
+    if ((ring = calloc(1, sizeof(io_ring_t))) == NULL) {
+        return NULL;
+    }
+    memset(&p, 0, sizeof(p));
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+    ring->entries = p.sq_entries;
+    ring->features = p.features;
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    ring->sq_head  = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+    ring->sq_tail  = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask  = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_flags = (unsigned *)((char *)ring->sq_ptr + p.sq_off.flags);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head  = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail  = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask  = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+    return ring;
+
+fail:
+    if (ring->sq_ptr != MAP_FAILED) {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    close(ring->fd);
+    free(ring);
+    return NULL;
+}
+
+void io_ring_destroy(io_ring_t *ring)
+{
+    if (ring == NULL) return;
+#ifdef USE_RECV_MULTISHOT
+    if (ring->br != NULL) {
+        munmap(ring->br, ring->br_size);
+        free(ring->bufs);
+        free(ring->buf_next);
+        free(ring->buf_len);
+    }
+#endif
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    free(ring);
+}
+
+unsigned int io_ring_space(io_ring_t *ring)
+{
+    /* keep the in-flight entries bounded by the ring size,
+     * so that the completion queue never overflows.
+     */
+    return ring->entries - ring->pending - ring->inflight;
+}
+
+/* the kind of operation is kept in the low bits of its data */
+static uint64_t io_ring_tag(void *data, int op)
+{
+    assert(((uintptr_t)data & 3) == 0);
+    return (uint64_t)(uintptr_t)data | (uint64_t)op;
+}
+
+static struct io_uring_sqe *io_ring_get_sqe(io_ring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    index = ring->sq_local_tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+bool io_ring_prep_sendmsg(io_ring_t *ring, int sfd, const struct msghdr *msg,
+                          int flags, void *data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (io_ring_space(ring) == 0) {
+        return false;
+    }
+    sqe = io_ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = sfd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = (uint32_t)flags;
+    sqe->user_data = io_ring_tag(data, IO_RING_SEND);
+    ring->pending++;
+    return true;
+}
+
+int io_ring_submit(io_ring_t *ring)
+{
+    int ret, submitted = 0;
+
+    /* publish the prepared entries */
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    while (ring->pending > 0) {
+        ret = sys_io_uring_enter(ring->fd, ring->pending, 0, 0);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            /* take back the entries the kernel did not consume */
+            ring->sq_local_tail -= ring->pending;
+            ring->pending = 0;
+            __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+            break;
+        }
+        ring->pending -= (unsigned)ret;
+        ring->inflight += (unsigned)ret;
+        submitted += ret;
+    }
+    return submitted;
+}
+
+int io_ring_fd(io_ring_t *ring)
+{
+    return ring->fd;
+}
+
+#ifdef USE_RECV_MULTISHOT
+static void io_ring_buf_give(io_ring_t *ring, int bid);
+#endif
+
+bool io_ring_reap(io_ring_t *ring, io_ring_cqe_t *cqe)
+{
+    struct io_uring_cqe *e;
+    unsigned head = *ring->cq_head;
+    uint64_t user_data;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+#ifdef IORING_SQ_CQ_OVERFLOW
+        /* the recv completions are not bounded by the ring size, and
+         * the kernel keeps the ones that overflowed the queue for us.
+         */
+        if (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+            (void)sys_io_uring_enter(ring->fd, 0, 0, IORING_ENTER_GETEVENTS);
+        }
+#endif
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+    }
+    e = &ring->cqes[head & *ring->cq_mask];
+    user_data = e->user_data;
+    cqe->data = (void *)(uintptr_t)(user_data & ~(uint64_t)3);
+    cqe->op = (int)(user_data & 3);
+    cqe->res = e->res;
+    cqe->bid = -1;
+    cqe->more = false;
+#ifdef USE_RECV_MULTISHOT
+    if (e->flags & IORING_CQE_F_BUFFER) {
+        int bid = (int)(e->flags >> IORING_CQE_BUFFER_SHIFT);
+        ring->bufs_free--;
+        if (e->res > 0) {
+            cqe->bid = bid;
+        } else {
+            io_ring_buf_give(ring, bid);
+        }
+    }
+    cqe->more = ((e->flags & IORING_CQE_F_MORE) != 0);
+#endif
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    if (cqe->op == IO_RING_SEND) {
+        ring->inflight--;
+    }
+    return true;
+}
+
+#ifdef USE_RECV_MULTISHOT
+/* submit the one entry just prepared, when no send is pending */
+static bool io_ring_submit_one(io_ring_t *ring)
+{
+    int ret;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    do {
+        ret = sys_io_uring_enter(ring->fd, 1, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != 1) {
+        ring->sq_local_tail--;
+        __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+        return false;
+    }
+    return true;
+}
+
+/* give a buffer back to the kernel */
+static void io_ring_buf_give(io_ring_t *ring, int bid)
+{
+    struct io_uring_buf *buf = &ring->br->bufs[ring->br_tail & ring->br_mask];
+
+    buf->addr = (uint64_t)(uintptr_t)(ring->bufs + (size_t)bid * ring->buf_size);
+    buf->len = ring->buf_size;
+    buf->bid = (uint16_t)bid;
+    ring->br_tail++;
+    __atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+    ring->bufs_free++;
+}
+
+bool io_ring_setup_recv(io_ring_t *ring, unsigned int nbufs, unsigned int size)
+{
+    struct io_uring_buf_reg reg;
+    unsigned int i;
+
+    /* nbufs must be a power of 2 */
+    assert(nbufs > 0 && nbufs <= 32768 && (nbufs & (nbufs - 1)) == 0);
+    if (!(ring->features & IORING_FEAT_NODROP)) {
+        errno = ENOTSUP;
+        return false;
+    }
+    ring->br_size = nbufs * sizeof(struct io_uring_buf);
+    ring->br = mmap(NULL, ring->br_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->br == MAP_FAILED) {
+        ring->br = NULL;
+        return false;
+    }
+    ring->bufs = malloc((size_t)nbufs * size);
+    ring->buf_next = malloc(nbufs * sizeof(int));
+    ring->buf_len = malloc(nbufs * sizeof(unsigned));
+    if (ring->bufs == NULL || ring->buf_next == NULL || ring->buf_len == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->br;
+    reg.ring_entries = nbufs;
+    reg.bgid = IO_RING_BGID;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        goto fail;
+    }
+    ring->br_mask = nbufs - 1;
+    ring->br_tail = 0;
+    ring->buf_size = size;
+    ring->bufs_free = 0;
+    for (i = 0; i < nbufs; i++) {
+        io_ring_buf_give(ring, (int)i);
+    }
+    return true;
+
+fail:
+    free(ring->bufs);
+    free(ring->buf_next);
+    free(ring->buf_len);
+    munmap(ring->br, ring->br_size);
+    ring->br = NULL;
+    return false;
+}
+
+unsigned int io_ring_recv_space(io_ring_t *ring)
+{
+    return (ring->br != NULL) ? ring->bufs_free : 0;
+}
+
+bool io_ring_recv(io_ring_t *ring, int sfd, void *data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (ring->br == NULL || ring->pending > 0) {
+        return false;
+    }
+    sqe = io_ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IO_RING_BGID;
+    sqe->user_data = io_ring_tag(data, IO_RING_RECV);
+    return io_ring_submit_one(ring);
+}
+
+bool io_ring_cancel(io_ring_t *ring, int op, void *data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (ring->pending > 0) {
+        return false;
+    }
+    sqe = io_ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = io_ring_tag(data, op);
+    sqe->user_data = io_ring_tag(data, IO_RING_CANCEL);
+    return io_ring_submit_one(ring);
+}
+
+void io_ring_recvq_push(io_ring_t *ring, io_ring_recvq_t *q, int bid, int len)
+{
+    ring->buf_len[bid] = (unsigned)len;
+    ring->buf_next[bid] = -1;
+    if (q->head == -1) {
+        q->head = bid;
+    } else {
+        ring->buf_next[q->tail] = bid;
+    }
+    q->tail = bid;
+    q->count++;
+}
+
+size_t io_ring_recvq_read(io_ring_t *ring, io_ring_recvq_t *q, void *buf, size_t len)
+{
+    size_t copied = 0, n;
+    int bid;
+
+    while (copied < len && (bid = q->head) != -1) {
+        n = ring->buf_len[bid] - q->offset;
+        if (n > len - copied) {
+            n = len - copied;
+        }
+        memcpy((char *)buf + copied,
+               ring->bufs + (size_t)bid * ring->buf_size + q->offset, n);
+        copied += n;
+        q->offset += n;
+        if (q->offset == ring->buf_len[bid]) {
+            q->head = ring->buf_next[bid];
+            q->offset = 0;
+            q->count--;
+            io_ring_buf_give(ring, bid);
+        }
+    }
+    return copied;
+}
+
+void io_ring_recvq_drop(io_ring_t *ring, io_ring_recvq_t *q)
+{
+    int bid;
+
+    while ((bid = q->head) != -1) {
+        q->head = ring->buf_next[bid];
+        io_ring_buf_give(ring, bid);
+    }
+    io_ring_recvq_init(q);
+}
+#endif /* USE_RECV_MULTISHOT */
+
+#else /* !HAVE_LINUX_IO_URING_H */
+
+io_ring_t *io_ring_create(unsigned int entries)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+void io_ring_destroy(io_ring_t *ring)
+{
+}
+
+unsigned int io_ring_space(io_ring_t *ring)
+{
+    return 0;
+}
+
+bool io_ring_prep_sendmsg(io_ring_t *ring, int sfd, const struct msghdr *msg,
+                          int flags, void *data)
+{
+    return false;
+}
+
+int io_ring_submit(io_ring_t *ring)
+{
+    return 0;
+}
+
+int io_ring_fd(io_ring_t *ring)
+{
+    return -1;
+}
+
+bool io_ring_reap(io_ring_t *ring, io_ring_cqe_t *cqe)
+{
+    return false;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+#ifndef USE_RECV_MULTISHOT
+bool io_ring_setup_recv(io_ring_t *ring, unsigned int nbufs, unsigned int size)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+unsigned int io_ring_recv_space(io_ring_t *ring)
+{
+    return 0;
+}
+
+bool io_ring_recv(io_ring_t *ring, int sfd, void *data)
+{
+    return false;
+}
+
+bool io_ring_cancel(io_ring_t *ring, int op, void *data)
+{
+    return false;
+}
+
+void io_ring_recvq_push(io_ring_t *ring, io_ring_recvq_t *q, int bid, int len)
+{
+}
+
+size_t io_ring_recvq_read(io_ring_t *ring, io_ring_recvq_t *q, void *buf, size_t len)
+{
+    return 0;
+}
+
+void io_ring_recvq_drop(io_ring_t *ring, io_ring_recvq_t *q)
+{
+    io_ring_recvq_init(q);
+}
+#endif
+
+void io_ring_recvq_init(io_ring_recvq_t *q)
+{
+    q->head = q->tail = -1;
+    q->count = 0;
+    q->offset = 0;
+}
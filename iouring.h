@@ -0,0 +1,103 @@
+/*
+ * arcus-memcached - Arcus memory cache server
+ * Copyright 2010-2014 NAVER Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef IOURING_H
+#define IOURING_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/*
+ * A minimal io_uring submission/completion ring used by a worker thread
+ * to send the responses of many connections with one system call, and
+ * to receive their requests with multishot recvs into a ring of buffers
+ * provided to the kernel. It talks to the kernel directly, so no liburing
+ * is needed.
+ */
+typedef struct io_ring io_ring_t;
+
+/* the kinds of ring operations */
+#define IO_RING_SEND   0
+#define IO_RING_RECV   1
+#define IO_RING_CANCEL 2
+
+/* a completion of the ring */
+typedef struct {
+    void *data;     /* the data given with the operation */
+    int   op;       /* IO_RING_SEND, IO_RING_RECV or IO_RING_CANCEL */
+    int   res;      /* the result of the operation, or -errno */
+    int   bid;      /* the buffer that a recv filled with res bytes, or -1 */
+    bool  more;     /* the multishot recv goes on after this completion */
+} io_ring_cqe_t;
+
+/* the buffers received for a socket, in their order of arrival */
+typedef struct {
+    int      head;      /* the first buffer, or -1 */
+    int      tail;      /* the last buffer */
+    unsigned count;     /* the # of buffers */
+    unsigned offset;    /* the bytes of the first buffer already read */
+} io_ring_recvq_t;
+
+/* create a ring of the given number of entries, or return NULL if the
+ * kernel (or the build) does not support io_uring.
+ */
+io_ring_t *io_ring_create(unsigned int entries);
+void       io_ring_destroy(io_ring_t *ring);
+
+/* the number of free submission entries */
+unsigned int io_ring_space(io_ring_t *ring);
+
+/* queue a sendmsg() of the socket; data is returned with its completion */
+bool io_ring_prep_sendmsg(io_ring_t *ring, int sfd, const struct msghdr *msg,
+                          int flags, void *data);
+
+/* submit the queued entries without waiting for their completions.
+ * Returns the # of entries submitted, the first ones queued. The others
+ * are taken back, and the caller completes them by itself.
+ */
+int io_ring_submit(io_ring_t *ring);
+
+/* the file descriptor that polls readable while completions are ready */
+int io_ring_fd(io_ring_t *ring);
+
+/* get the next completion; returns false if there is none */
+bool io_ring_reap(io_ring_t *ring, io_ring_cqe_t *cqe);
+
+/* provide nbufs buffers of the given size for the recvs of the ring.
+ * Returns false if the kernel does not support multishot recvs.
+ */
+bool io_ring_setup_recv(io_ring_t *ring, unsigned int nbufs, unsigned int size);
+
+/* the number of buffers left for the recvs */
+unsigned int io_ring_recv_space(io_ring_t *ring);
+
+/* start a multishot recv of the socket, or cancel an operation started
+ * with the given data. They are submitted right away, so no send may be
+ * prepared and not yet submitted.
+ */
+bool io_ring_recv(io_ring_t *ring, int sfd, void *data);
+bool io_ring_cancel(io_ring_t *ring, int op, void *data);
+
+/* the received buffers of a socket. A buffer goes back to the kernel
+ * as soon as it is read through, or dropped.
+ */
+void   io_ring_recvq_init(io_ring_recvq_t *q);
+void   io_ring_recvq_push(io_ring_t *ring, io_ring_recvq_t *q, int bid, int len);
+size_t io_ring_recvq_read(io_ring_t *ring, io_ring_recvq_t *q, void *buf, size_t len);
+void   io_ring_recvq_drop(io_ring_t *ring, io_ring_recvq_t *q);
+
+#endif
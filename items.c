@@ -24,12 +24,18 @@
 #include <time.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <stddef.h> /* offsetof() */
 #include <sys/time.h> /* gettimeofday() */
+#include <unistd.h> /* getpid() */
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "default_engine.h"
 
 /* Forward Declarations */
 static void item_link_q(struct default_engine *engine, hash_item *it);
+static void item_link_q_at(struct default_engine *engine, hash_item *it, const int segment);
 static void item_unlink_q(struct default_engine *engine, hash_item *it);
 static hash_item *do_item_alloc(struct default_engine *engine,
                                 const void *key, const size_t nkey,
@@ -42,10 +48,23 @@ static void do_item_unlink(struct default_engine *engine, hash_item *it);
 static void do_item_release(struct default_engine *engine, hash_item *it);
 static void do_item_update(struct default_engine *engine, hash_item *it);
 static void do_item_lru_reposition(struct default_engine *engine, hash_item *it);
+static void item_wheel_link(struct default_engine *engine, hash_item *it);
+static void item_wheel_unlink(struct default_engine *engine, hash_item *it);
+static int do_item_flush_prefix_reclaim(struct default_engine *engine, const int max_items);
+#ifdef ENABLE_STICKY_ITEM
+static bool do_item_sticky_room(struct default_engine *engine);
+#endif
+static int do_lru_juggle(struct default_engine *engine, const unsigned int lruid, const int max_moves);
 static ENGINE_ERROR_CODE do_item_replace(struct default_engine *engine, hash_item *it, hash_item *new_it);
 static void item_free(struct default_engine *engine, hash_item *it);
 static void push_coll_del_queue(struct default_engine *engine, hash_item *it);
 static void do_coll_all_elem_delete(struct default_engine *engine, hash_item *it);
+static void *do_coll_elem_delete_alloc(struct default_engine *engine, hash_item *it,
+                                       const size_t ntotal, const unsigned int clsid);
+static uint32_t do_coll_elem_delete(struct default_engine *engine, hash_item *it,
+                                    const uint32_t count);
+static uint32_t do_coll_elem_trim(struct default_engine *engine, hash_item *it,
+                                  const uint32_t count);
 extern int  genhash_string_hash(const void* p, size_t nkey);
 
 /*
@@ -55,9 +74,32 @@ extern int  genhash_string_hash(const void* p, size_t nkey);
  */
 #define ITEM_UPDATE_INTERVAL 60
 
+/* segments of a segmented LRU, from the head to the tail */
+#define LRU_SEG_HOT  0
+#define LRU_SEG_WARM 1
+#define LRU_SEG_COLD 2
+
+/* max # of items moved between LRU segments per cache lock hold */
+#define LRU_JUGGLE_BATCH 500
+
+/* pseudo segment: the tail of the LRU, for items not admitted */
+#define LRU_SEG_TAIL 3
+
+/* count-min sketch of the admission filter */
+#define LFU_SKETCH_DEPTH 4
+#define LFU_SKETCH_WIDTH (64 * 1024) /* # of counters per row, power of 2 */
+#define LFU_COUNTER_MAX  15 /* 4-bit counters */
+#define LFU_SKETCH_BYTES (LFU_SKETCH_DEPTH * LFU_SKETCH_WIDTH / 2)
+#define LFU_AGING_ADDS   (LFU_SKETCH_WIDTH * 10)
+
 /* LRU id of small memory items */
 #define LRU_CLSID_FOR_SMALL 0
 
+/* cost-aware eviction */
+#define EVICT_COST_SAMPLES 5  /* # of candidates compared from the LRU tail */
+#define EVICT_TRIM_MIN     64 /* collections over this # of elements are trimmed first */
+#define EVICT_TRIM_BATCH   16 /* # of elements trimmed before retrying the allocation */
+
 /* item type checking */
 #define IS_LIST_ITEM(it)  (((it)->iflag & ITEM_IFLAG_LIST) != 0)
 #define IS_SET_ITEM(it)   (((it)->iflag & ITEM_IFLAG_SET) != 0)
@@ -137,12 +179,12 @@ static inline size_t ITEM_ntotal(struct default_engine *engine, const hash_item
 {
     size_t ret;
     if (IS_COLL_ITEM(item)) {
-        ret = sizeof(*item) + META_OFFSET_IN_ITEM(item->nkey, item->nbytes);
+        ret = ITEM_HEADER_SIZE(engine) + META_OFFSET_IN_ITEM(item->nkey, item->nbytes);
         if (IS_LIST_ITEM(item))     ret += sizeof(list_meta_info);
         else if (IS_SET_ITEM(item)) ret += sizeof(set_meta_info);
         else /* BTREE_ITEM */       ret += sizeof(btree_meta_info);
     } else {
-        ret = sizeof(*item) + item->nkey + item->nbytes;
+        ret = ITEM_HEADER_SIZE(engine) + item->nkey + item->nbytes;
     }
     if (engine->config.use_cas) {
         ret += sizeof(uint64_t);
@@ -161,13 +203,88 @@ static inline size_t ITEM_stotal(struct default_engine *engine, const hash_item
     return stotal;
 }
 
+#ifdef ENABLE_STICKY_ITEM
+/* the LRU of the given item, where its sticky space is accounted */
+static inline unsigned int item_lruid(struct default_engine *engine, const hash_item *it)
+{
+#ifdef USE_SINGLE_LRU_LIST
+    return 1;
+#else
+    if (IS_COLL_ITEM(it) || ITEM_ntotal(engine, it) <= MAX_SM_VALUE_SIZE) {
+        return LRU_CLSID_FOR_SMALL;
+    }
+    return it->slabs_clsid;
+#endif
+}
+
+/* collection items are always in the LRU of small items */
+#ifdef USE_SINGLE_LRU_LIST
+#define COLL_LRU_CLSID 1
+#else
+#define COLL_LRU_CLSID LRU_CLSID_FOR_SMALL
+#endif
+#endif
+
+static uint64_t cas_id = 0;
+
 /* Get the next CAS id for a new item. */
 static uint64_t get_cas_id(void)
 {
-    static uint64_t cas_id = 0;
     return ++cas_id;
 }
 
+/*
+ * The admission filter estimates how often a key was accessed recently
+ * with a count-min sketch. Every lookup that repositions an item in the LRU
+ * is counted, whether the key is found or not: retrievals, the lookup of
+ * a store command, incr/decr, getattr/setattr and collection element reads.
+ * The counters are 4 bits wide, two in a byte, and all of them are halved
+ * after a while, so that the old accesses count less.
+ */
+static inline uint32_t lfu_sketch_index(const uint32_t hv, const int row)
+{
+    uint32_t hv2 = ((hv >> 16) | (hv << 16)) * 0x9E3779B1;
+    return row * LFU_SKETCH_WIDTH + ((hv + row * (hv2 | 1)) & (LFU_SKETCH_WIDTH - 1));
+}
+
+static inline uint8_t lfu_sketch_counter(struct default_engine *engine, const uint32_t idx)
+{
+    return (engine->items.sketch[idx >> 1] >> ((idx & 1) << 2)) & 0x0F;
+}
+
+static void lfu_sketch_add(struct default_engine *engine, const uint32_t hv)
+{
+    uint32_t idx;
+    int row, i;
+
+    for (row = 0; row < LFU_SKETCH_DEPTH; row++) {
+        idx = lfu_sketch_index(hv, row);
+        if (lfu_sketch_counter(engine, idx) < LFU_COUNTER_MAX) {
+            engine->items.sketch[idx >> 1] += (1 << ((idx & 1) << 2));
+        }
+    }
+    if (++engine->items.sketch_adds >= LFU_AGING_ADDS) {
+        /* halve both counters of each byte */
+        for (i = 0; i < LFU_SKETCH_BYTES; i++) {
+            engine->items.sketch[i] = (engine->items.sketch[i] >> 1) & 0x77;
+        }
+        engine->items.sketch_adds = 0;
+    }
+}
+
+static uint32_t lfu_sketch_estimate(struct default_engine *engine, const uint32_t hv)
+{
+    uint32_t freq = LFU_COUNTER_MAX;
+    uint8_t counter;
+    int row;
+
+    for (row = 0; row < LFU_SKETCH_DEPTH; row++) {
+        counter = lfu_sketch_counter(engine, lfu_sketch_index(hv, row));
+        if (counter < freq) freq = counter;
+    }
+    return freq;
+}
+
 /* Enable this for reference-count debugging. */
 #if 0
 # define DEBUG_REFCNT(it,op) \
@@ -186,8 +303,10 @@ static void increase_collection_space(struct default_engine *engine, ENGINE_ITEM
     /* Currently, stats.lock is useless since global cache lock is held. */
     //pthread_mutex_lock(&engine->stats.lock);
 #ifdef ENABLE_STICKY_ITEM
-    if ((info->mflags & COLL_META_FLAG_STICKY) != 0)
+    if ((info->mflags & COLL_META_FLAG_STICKY) != 0) {
         engine->stats.sticky_bytes += inc_space;
+        engine->items.sticky_bytes[COLL_LRU_CLSID] += inc_space;
+    }
 #endif
     assoc_prefix_update_size(info->prefix, item_type, inc_space, true);
     engine->stats.curr_bytes += inc_space;
@@ -202,8 +321,10 @@ static void decrease_collection_space(struct default_engine *engine, ENGINE_ITEM
     /* Currently, stats.lock is useless since global cache lock is held. */
     //pthread_mutex_lock(&engine->stats.lock);
 #ifdef ENABLE_STICKY_ITEM
-    if ((info->mflags & COLL_META_FLAG_STICKY) != 0)
+    if ((info->mflags & COLL_META_FLAG_STICKY) != 0) {
         engine->stats.sticky_bytes -= dec_space;
+        engine->items.sticky_bytes[COLL_LRU_CLSID] -= dec_space;
+    }
 #endif
     assoc_prefix_update_size(info->prefix, item_type, dec_space, false);
     engine->stats.curr_bytes -= dec_space;
@@ -231,6 +352,13 @@ static bool do_item_isvalid(struct default_engine *engine, hash_item *it, rel_ti
         if (engine->config.oldest_live <= current_time && it->time <= engine->config.oldest_live)
             return false; /* flushed by flush_all */
     }
+    /* reads don't relink items in a segmented LRU, so item time alone
+     * can't tell the items linked before an immediate flush_all.
+     */
+    if (engine->config.oldest_cas != 0 && (it->iflag & ITEM_WITH_CAS) != 0) {
+        if (item_get_cas(it) < engine->config.oldest_cas)
+            return false; /* flushed by flush_all */
+    }
     /* check if prefix is valid */
     if (assoc_prefix_isvalid(engine, it) == false) {
         return false;
@@ -262,19 +390,28 @@ static hash_item *do_item_reclaim(struct default_engine *engine, hash_item *it,
     }
     /* collection item or small-sized kv item */
 #endif
+    void *space = NULL;
     if (IS_COLL_ITEM(it))
-        do_coll_all_elem_delete(engine, it);
+        space = do_coll_elem_delete_alloc(engine, it, ntotal, clsid);
     do_item_unlink(engine, it);
 
     /* allocate from slab allocator */
-    it = slabs_alloc(engine, ntotal, clsid);
-    return it;
+    if (space == NULL)
+        space = slabs_alloc(engine, ntotal, clsid);
+    return (hash_item *)space;
 }
 
-static void do_item_evict(struct default_engine *engine, hash_item *it,
-                          const unsigned int lruid,
-                          rel_time_t current_time, const void *cookie)
+/*
+ * Evict the given item. If ntotal is not 0, the space of ntotal is
+ * allocated from the memory it gives back and returned, or NULL.
+ */
+static hash_item *do_item_evict(struct default_engine *engine, hash_item *it,
+                                const unsigned int lruid,
+                                const size_t ntotal, const unsigned int clsid,
+                                rel_time_t current_time, const void *cookie)
 {
+    void *space = NULL;
+
     /* increment # of evicted */
     engine->items.itemstats[lruid].evicted++;
     engine->items.itemstats[lruid].evicted_time = current_time - it->time;
@@ -289,9 +426,93 @@ static void do_item_evict(struct default_engine *engine, hash_item *it,
     }
 
     /* unlink the item */
-    if (IS_COLL_ITEM(it))
-        do_coll_all_elem_delete(engine, it);
+    if (IS_COLL_ITEM(it)) {
+        if (ntotal > 0)
+            space = do_coll_elem_delete_alloc(engine, it, ntotal, clsid);
+        else
+            do_coll_all_elem_delete(engine, it);
+    }
     do_item_unlink(engine, it);
+
+    if (ntotal > 0 && space == NULL)
+        space = slabs_alloc(engine, ntotal, clsid);
+    return (hash_item *)space;
+}
+
+/*
+ * Of the first EVICT_COST_SAMPLES evictable items from the given position
+ * up the LRU, pick the one that gives back the most space for the least
+ * loss: its space scaled by the time since its last access, divided by
+ * its rebuild cost, taken as the number of elements for a collection.
+ */
+static hash_item *do_item_evict_victim(struct default_engine *engine, hash_item *search,
+                                       rel_time_t current_time)
+{
+    hash_item *victim = NULL;
+    uint64_t score, best = 0;
+    uint32_t cost;
+    int samples = 0;
+
+    for (; search != NULL && samples < EVICT_COST_SAMPLES; search = search->prev) {
+        if (search->refcount != 0 || search->nkey == 0 ||
+            do_item_isvalid(engine, search, current_time) == false) {
+            continue; /* left to the reclaim path */
+        }
+        cost = 1;
+        if (IS_COLL_ITEM(search)) {
+            cost += ((coll_meta_info *)item_get_meta(search))->ccnt;
+        }
+        score = (uint64_t)(current_time - search->time + 1) * ITEM_stotal(engine, search) / cost;
+        if (victim == NULL || score > best) {
+            victim = search;
+            best = score;
+        }
+        samples++;
+    }
+    return victim;
+}
+
+/*
+ * Trim a batch of edge elements off the given victim, if it is a big
+ * collection trimmed on overflow anyway. Their space can be used by
+ * small items only. Returns false if the victim is to be evicted.
+ */
+static bool do_item_evict_trim(struct default_engine *engine, hash_item *victim)
+{
+    uint32_t ntrimmed;
+
+    if (IS_COLL_ITEM(victim) == false ||
+        ((coll_meta_info *)item_get_meta(victim))->ccnt <= EVICT_TRIM_MIN) {
+        return false;
+    }
+    ntrimmed = do_coll_elem_trim(engine, victim, EVICT_TRIM_BATCH);
+    if (ntrimmed == 0) {
+        return false; /* not trimmed on overflow */
+    }
+    pthread_mutex_lock(&engine->stats.lock);
+    engine->stats.evict_trimmed += ntrimmed;
+    pthread_mutex_unlock(&engine->stats.lock);
+    return true;
+}
+
+/*
+ * Free space for a new item of the given size with the given victim,
+ * trimming it first if the new item is a small one.
+ */
+static hash_item *do_item_evict_cost(struct default_engine *engine, hash_item *victim,
+                                     const unsigned int lruid,
+                                     const size_t ntotal, const unsigned int clsid,
+                                     rel_time_t current_time, const void *cookie)
+{
+    hash_item *it;
+
+    if (lruid == LRU_CLSID_FOR_SMALL) {
+        while (do_item_evict_trim(engine, victim)) {
+            it = slabs_alloc(engine, ntotal, clsid);
+            if (it != NULL) return it; /* allocated */
+        }
+    }
+    return do_item_evict(engine, victim, lruid, ntotal, clsid, current_time, cookie);
 }
 
 static void do_item_repair(struct default_engine *engine, hash_item *it,
@@ -498,6 +719,11 @@ static void *do_item_alloc_internal(struct default_engine *engine,
             return NULL;
         }
 
+        /* keep the cold segment filled in case the maintainer falls behind */
+        if (engine->config.lru_segmented) {
+            (void)do_lru_juggle(engine, id, 2);
+        }
+
         /*
          * try to get one off the right LRU
          * don't necessariuly unlink the tail because it may be locked: refcount>0
@@ -511,9 +737,31 @@ static void *do_item_alloc_internal(struct default_engine *engine,
                 previt = search->prev;
                 if (do_item_isvalid(engine, search, current_time) == false) {
                     it = do_item_reclaim(engine, search, ntotal, clsid_based_on_ntotal, id);
+                } else if ((search->iflag & ITEM_ACTIVE) != 0 && tries > 100) {
+                    /* read since it fell to the cold segment: give it another chance.
+                     * Only the first 100 tries do so, to find a victim even if
+                     * all the items at the tail were read.
+                     */
+                    search->iflag &= ~ITEM_ACTIVE;
+                    item_unlink_q(engine, search);
+                    if (engine->config.lru_second_chance) {
+                        /* relink it at the LRU head */
+                        item_link_q(engine, search);
+                        engine->items.itemstats[id].second_chances++;
+                    } else {
+                        item_link_q_at(engine, search, LRU_SEG_WARM);
+                        engine->items.itemstats[id].moves_to_warm++;
+                    }
+                } else if (engine->config.evict_cost) {
+                    hash_item *victim = do_item_evict_victim(engine, search, current_time);
+                    if (victim != search) {
+                        previt = search; /* check it again */
+                    }
+                    it = do_item_evict_cost(engine, victim, id, ntotal, clsid_based_on_ntotal,
+                                            current_time, cookie);
                 } else {
-                    do_item_evict(engine, search, id, current_time, cookie);
-                    it = slabs_alloc(engine, ntotal, clsid_based_on_ntotal);
+                    it = do_item_evict(engine, search, id, ntotal, clsid_based_on_ntotal,
+                                       current_time, cookie);
                 }
                 if (it != NULL) break; /* allocated */
                 search = previt;
@@ -558,12 +806,126 @@ static void *do_item_alloc_internal(struct default_engine *engine,
     return (void *)it;
 }
 
+#ifdef ENABLE_STICKY_ITEM
+/*
+ * Check the sticky space for a new sticky item or element.
+ * Near the limit, the sticky manager is woken up to reclaim invalid
+ * sticky items in the background. At the limit, a few items at each
+ * sticky LRU tail are checked in place, so that junk left by a flush
+ * does not fail the store.
+ */
+#define STICKY_RECLAIM_PCT   90 /* wake up the sticky manager over this % of sticky_limit */
+#define STICKY_INLINE_CHECKS 5  /* # of items checked at each sticky LRU tail */
+
+static bool do_item_sticky_room(struct default_engine *engine)
+{
+    rel_time_t current_time;
+    hash_item *search, *previt;
+    int i, checks;
+
+    if (engine->config.sticky_limit == 0) {
+        return false;
+    }
+    if (engine->stats.sticky_bytes >= (engine->config.sticky_limit / 100) * STICKY_RECLAIM_PCT) {
+        pthread_cond_signal(&engine->sticky_cond);
+    }
+    if (engine->stats.sticky_bytes < engine->config.sticky_limit) {
+        return true;
+    }
+    current_time = engine->server.core->get_current_time();
+    for (i = 0; i <= POWER_LARGEST; i++) {
+        search = engine->items.sticky_tails[i];
+        for (checks = 0; search != NULL && checks < STICKY_INLINE_CHECKS; checks++) {
+            previt = search->prev;
+            if (search->nkey > 0 && search->refcount == 0 &&
+                do_item_isvalid(engine, search, current_time) == false) {
+                engine->items.itemstats[i].sticky_reclaimed++;
+                do_item_unlink(engine, search);
+            }
+            search = previt;
+        }
+        if (engine->stats.sticky_bytes < engine->config.sticky_limit) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+/*
+ * Get an item of the prefix to evict for a quota, the oldest first.
+ * Up to 50 items in use are skipped.
+ */
+static hash_item *do_item_prefix_victim(prefix_t *pt)
+{
+    hash_item *search = pt->items_tail;
+    int tries = 50;
+
+    for (; search != NULL && tries > 0; search = item_get_links(search)->p_prev, tries--) {
+        if (search->refcount == 0) {
+            return search;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Keep a prefix and its parents within their quotas by evicting the
+ * items of the prefix, the oldest first, instead of the items of other
+ * prefixes. If it has none left to evict, the items of its parents are
+ * evicted, up to the parent over its quota.
+ * The prefix is the one of a linked collection for the space of its new
+ * element, or NULL for a new item of the given key. The prefix of the key
+ * is looked up again after each eviction, as it is freed with its last item.
+ * Returns false if the space cannot fit in the quotas.
+ */
+static bool do_item_prefix_quota(struct default_engine *engine, prefix_t *pt,
+                                 const void *key, const size_t nkey, const size_t space)
+{
+    prefix_t *over, *victim_pt;
+    hash_item *search;
+
+    while (1) {
+        if (key != NULL) {
+            pt = assoc_prefix_of_key(engine, key, nkey);
+        }
+        if ((over = assoc_prefix_over_quota(pt, space)) == NULL) {
+            return true;
+        }
+        if (space > over->maxbytes) {
+            return false;
+        }
+        for (victim_pt = pt; ; victim_pt = victim_pt->parent_prefix) {
+            search = do_item_prefix_victim(victim_pt);
+            if (search != NULL || victim_pt == over) break;
+        }
+        if (search == NULL) {
+            return false;
+        }
+        over->evictions++;
+        pthread_mutex_lock(&engine->stats.lock);
+        engine->stats.prefix_evictions++;
+        pthread_mutex_unlock(&engine->stats.lock);
+        do_item_unlink(engine, search);
+    }
+}
+
+/* charge the space of a new element to the prefix quota of its collection */
+static inline bool do_coll_prefix_room(struct default_engine *engine, coll_meta_info *info,
+                                       const size_t space)
+{
+    if (engine->config.prefix_quota == false) {
+        return true;
+    }
+    return do_item_prefix_quota(engine, (prefix_t *)info->prefix, NULL, 0, space);
+}
+
 /*@null@*/
 hash_item *do_item_alloc(struct default_engine *engine, const void *key, const size_t nkey,
                          const int flags, const rel_time_t exptime, const int nbytes, const void *cookie)
 {
     hash_item *it = NULL;
-    size_t ntotal = sizeof(hash_item) + nkey + nbytes;
+    size_t ntotal = ITEM_HEADER_SIZE(engine) + nkey + nbytes;
     if (engine->config.use_cas) {
         ntotal += sizeof(uint64_t);
     }
@@ -575,17 +937,49 @@ hash_item *do_item_alloc(struct default_engine *engine, const void *key, const s
 #ifdef ENABLE_STICKY_ITEM
     /* sticky memory limit check */
     if (exptime == (rel_time_t)(-1)) { /* sticky item */
-        if (engine->stats.sticky_bytes >= engine->config.sticky_limit)
+        if (do_item_sticky_room(engine) == false)
             return NULL;
     }
 #endif
 
+    if (engine->config.prefix_quota) {
+        if (do_item_prefix_quota(engine, NULL, key, nkey, slabs_space_size(engine, ntotal)) == false) {
+            return NULL;
+        }
+    }
+
+    uint64_t evictions = engine->stats.evictions;
     it = do_item_alloc_internal(engine, ntotal, id, cookie);
     if (it == NULL)  {
         return NULL;
     }
     assert(it->slabs_clsid == 0);
 
+    /* An item was evicted for the new one. Unless the new key was accessed
+     * more often than the next victim, link the new item at the LRU tail,
+     * so that one-shot keys evict each other instead of frequent ones.
+     */
+    bool admitted = true;
+    if (engine->config.lru_admission && engine->stats.evictions != evictions &&
+        exptime != (rel_time_t)(-1)) {
+#ifdef USE_SINGLE_LRU_LIST
+        unsigned int lruid = 1;
+#else
+        unsigned int lruid = (ntotal <= MAX_SM_VALUE_SIZE ? LRU_CLSID_FOR_SMALL : id);
+#endif
+        hash_item *victim = engine->items.tails[lruid];
+        if (victim != NULL) {
+            uint32_t kfreq = lfu_sketch_estimate(engine, engine->server.core->hash(key, nkey, 0)) + 1;
+            uint32_t vfreq = lfu_sketch_estimate(engine, engine->server.core->hash(item_get_key(victim),
+                                                                                   victim->nkey, 0));
+            admitted = (kfreq >= vfreq);
+            pthread_mutex_lock(&engine->stats.lock);
+            engine->stats.admission_tested++;
+            if (!admitted) engine->stats.admission_rejected++;
+            pthread_mutex_unlock(&engine->stats.lock);
+        }
+    }
+
     it->slabs_clsid = id;
     assert(it != engine->items.heads[it->slabs_clsid]);
 
@@ -593,6 +987,16 @@ hash_item *do_item_alloc(struct default_engine *engine, const void *key, const s
     it->refcount = 1;     /* the caller will have a reference */
     DEBUG_REFCNT(it, '*');
     it->iflag = engine->config.use_cas ? ITEM_WITH_CAS : 0;
+    if (engine->config.item_links) {
+        item_links *links = item_get_links(it);
+        links->x_next = 0;
+        links->x_pprev = NULL;
+        links->p_next = links->p_prev = 0;
+        it->iflag |= ITEM_WITH_LINKS;
+    }
+    if (!admitted) {
+        it->iflag |= ITEM_LRU_TAIL;
+    }
     it->nkey = nkey;
     it->nbytes = nbytes;
     it->flags = flags;
@@ -627,9 +1031,14 @@ static void item_free(struct default_engine *engine, hash_item *it)
     slabs_free(engine, it, ntotal, clsid);
 }
 
-static void item_link_q(struct default_engine *engine, hash_item *it)
+/*
+ * Link the item to its LRU at the head of the given segment.
+ * An LRU that is not segmented has only the hot segment.
+ */
+static void item_link_q_at(struct default_engine *engine, hash_item *it, const int segment)
 {
     hash_item **head, **tail;
+    hash_item *next;
     assert(it->slabs_clsid <= POWER_LARGEST);
     assert((it->iflag & ITEM_SLABBED) == 0);
 
@@ -647,6 +1056,7 @@ static void item_link_q(struct default_engine *engine, hash_item *it)
         head = &engine->items.sticky_heads[clsid];
         tail = &engine->items.sticky_tails[clsid];
         engine->items.sticky_sizes[clsid]++;
+        next = *head;
     } else {
 #endif
         head = &engine->items.heads[clsid];
@@ -659,19 +1069,61 @@ static void item_link_q(struct default_engine *engine, hash_item *it)
                 engine->items.curMK[clsid] = it;
             }
         }
+        if (segment == LRU_SEG_WARM) {
+            /* the warm segment lies between the hot and cold segments */
+            next = (engine->items.warm[clsid] != NULL ? engine->items.warm[clsid]
+                                                      : engine->items.cold[clsid]);
+            engine->items.warm[clsid] = it;
+            engine->items.warm_sizes[clsid]++;
+            it->iflag |= ITEM_LRU_WARM;
+        } else if (segment == LRU_SEG_COLD) {
+            next = engine->items.cold[clsid];
+            engine->items.cold[clsid] = it;
+            it->iflag |= ITEM_LRU_COLD;
+        } else if (segment == LRU_SEG_TAIL) {
+            next = NULL;
+            if (engine->config.lru_segmented) {
+                if (engine->items.cold[clsid] == NULL)
+                    engine->items.cold[clsid] = it;
+                it->iflag |= ITEM_LRU_COLD;
+            } else {
+                engine->items.hot_sizes[clsid]++;
+            }
+        } else {
+            next = *head;
+            engine->items.hot_sizes[clsid]++;
+        }
 #ifdef ENABLE_STICKY_ITEM
     }
 #endif
     assert(it != *head);
     assert((*head && *tail) || (*head == 0 && *tail == 0));
-    it->prev = 0;
-    it->next = *head;
-    if (it->next) it->next->prev = it;
-    *head = it;
-    if (*tail == 0) *tail = it;
+    if (next == NULL) { /* append it to the tail */
+        it->next = 0;
+        it->prev = *tail;
+        if (it->prev) it->prev->next = it;
+        *tail = it;
+        if (*head == 0) *head = it;
+    } else { /* insert it in front of next */
+        it->next = next;
+        it->prev = next->prev;
+        if (it->prev) it->prev->next = it;
+        next->prev = it;
+        if (*head == next) *head = it;
+    }
     return;
 }
 
+static void item_link_q(struct default_engine *engine, hash_item *it)
+{
+    if ((it->iflag & ITEM_LRU_TAIL) != 0) {
+        it->iflag &= ~ITEM_LRU_TAIL;
+        item_link_q_at(engine, it, LRU_SEG_TAIL);
+    } else {
+        item_link_q_at(engine, it, LRU_SEG_HOT);
+    }
+}
+
 static void item_unlink_q(struct default_engine *engine, hash_item *it)
 {
     hash_item **head, **tail;
@@ -695,6 +1147,10 @@ static void item_unlink_q(struct default_engine *engine, hash_item *it)
             engine->items.sticky_curMK[clsid] = it->prev;
         if (engine->items.sticky_scrub[clsid] == it)
             engine->items.sticky_scrub[clsid] = it->next; /* move forward */
+        if (engine->items.sticky_crawl[clsid] == it)
+            engine->items.sticky_crawl[clsid] = it->prev; /* move upward */
+        if (engine->items.sticky_reclaim[clsid] == it)
+            engine->items.sticky_reclaim[clsid] = it->prev; /* move upward */
     } else {
 #endif
         head = &engine->items.heads[clsid];
@@ -710,6 +1166,20 @@ static void item_unlink_q(struct default_engine *engine, hash_item *it)
         }
         if (engine->items.scrub[clsid] == it)
             engine->items.scrub[clsid] = it->next; /* move forward */
+        if (engine->items.crawl[clsid] == it)
+            engine->items.crawl[clsid] = it->prev; /* move upward */
+        /* move segment pointers in LRU */
+        if (engine->items.warm[clsid] == it) {
+            engine->items.warm[clsid] = (it->next != NULL && (it->next->iflag & ITEM_LRU_WARM) != 0)
+                                      ? it->next : NULL;
+        }
+        if (engine->items.cold[clsid] == it)
+            engine->items.cold[clsid] = it->next;
+        if ((it->iflag & ITEM_LRU_WARM) != 0)
+            engine->items.warm_sizes[clsid]--;
+        else if ((it->iflag & ITEM_LRU_COLD) == 0)
+            engine->items.hot_sizes[clsid]--;
+        it->iflag &= ~(ITEM_LRU_WARM | ITEM_LRU_COLD);
 #ifdef ENABLE_STICKY_ITEM
     }
 #endif
@@ -758,6 +1228,7 @@ ENGINE_ERROR_CODE do_item_link(struct default_engine *engine, hash_item *it)
     if (it->exptime == (rel_time_t)(-1)) { /* sticky item */
         engine->stats.sticky_bytes += stotal;
         engine->stats.sticky_items += 1;
+        engine->items.sticky_bytes[item_lruid(engine, it)] += stotal;
     }
 #endif
     engine->stats.curr_bytes += stotal;
@@ -769,6 +1240,7 @@ ENGINE_ERROR_CODE do_item_link(struct default_engine *engine, hash_item *it)
     item_set_cas(NULL, NULL, it, get_cas_id());
 
     item_link_q(engine, it);
+    item_wheel_link(engine, it);
 
     return ENGINE_SUCCESS;
 }
@@ -786,6 +1258,7 @@ void do_item_unlink(struct default_engine *engine, hash_item *it)
         if (it->exptime == (rel_time_t)(-1)) { /* sticky item */
             engine->stats.sticky_bytes -= stotal;
             engine->stats.sticky_items -= 1;
+            engine->items.sticky_bytes[item_lruid(engine, it)] -= stotal;
         }
 #endif
         engine->stats.curr_bytes -= stotal;
@@ -802,6 +1275,7 @@ void do_item_unlink(struct default_engine *engine, hash_item *it)
         assoc_delete(engine, engine->server.core->hash(item_get_key(it), it->nkey, 0),
                      item_get_key(it), it->nkey);
         item_unlink_q(engine, it);
+        item_wheel_unlink(engine, it);
         if (it->refcount == 0) {
             item_free(engine, it);
         }
@@ -824,6 +1298,20 @@ void do_item_update(struct default_engine *engine, hash_item *it)
 {
     rel_time_t current_time = engine->server.core->get_current_time();
     MEMCACHED_ITEM_UPDATE(item_get_key(it), it->nkey, it->nbytes);
+    if ((engine->config.lru_segmented || engine->config.lru_second_chance) &&
+        it->exptime != (rel_time_t)(-1)) {
+        /* The LRU maintainer, or the evictor at the LRU tail, moves
+         * the item by its active bit later, so a read doesn't touch the
+         * LRU list itself.
+         */
+        if ((it->iflag & ITEM_ACTIVE) == 0) {
+            it->iflag |= ITEM_ACTIVE;
+        }
+        if (it->time < current_time - ITEM_UPDATE_INTERVAL) {
+            it->time = current_time;
+        }
+        return;
+    }
     if (it->time < current_time - ITEM_UPDATE_INTERVAL) {
         assert((it->iflag & ITEM_SLABBED) == 0);
 
@@ -845,6 +1333,205 @@ void do_item_lru_reposition(struct default_engine *engine, hash_item *it)
     }
 }
 
+/*
+ * The expiration wheel files every expirable item by its exptime,
+ * so that it's unlinked close to its expiration without being accessed.
+ * An item far from its expiration sits in a coarse slot of an upper level,
+ * and is filed again into a finer slot when the wheel reaches that slot.
+ */
+static hash_item **item_wheel_slot(struct default_engine *engine, rel_time_t exptime)
+{
+    rel_time_t wheel_time = engine->items.wheel_time;
+    rel_time_t delta;
+    int level, shift, base;
+
+    if (exptime <= wheel_time) { /* expired already */
+        return &engine->items.wheel[wheel_time & (WHEEL_L0_SIZE - 1)];
+    }
+    delta = exptime - wheel_time;
+    if (delta < WHEEL_L0_SIZE) {
+        return &engine->items.wheel[exptime & (WHEEL_L0_SIZE - 1)];
+    }
+    base = WHEEL_L0_SIZE;
+    shift = WHEEL_L0_BITS;
+    for (level = 1; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < (1 << (shift + WHEEL_LN_BITS))) break;
+        base += WHEEL_LN_SIZE;
+        shift += WHEEL_LN_BITS;
+    }
+    if (level == WHEEL_LEVELS - 1 && delta >= (1 << (shift + WHEEL_LN_BITS))) {
+        /* too far: put it in the farthest slot, to be filed again later */
+        exptime = wheel_time + (1 << (shift + WHEEL_LN_BITS)) - 1;
+    }
+    return &engine->items.wheel[base + ((exptime >> shift) & (WHEEL_LN_SIZE - 1))];
+}
+
+static void item_wheel_link(struct default_engine *engine, hash_item *it)
+{
+    item_links *links;
+    hash_item **slot;
+    if (!engine->config.expire_wheel) {
+        return;
+    }
+    if (it->exptime == 0 || it->exptime == (rel_time_t)(-1)) {
+        return; /* never expires */
+    }
+    links = item_get_links(it);
+    assert(links->x_pprev == NULL);
+    slot = item_wheel_slot(engine, it->exptime);
+    links->x_next = *slot;
+    if (links->x_next) item_get_links(links->x_next)->x_pprev = &links->x_next;
+    links->x_pprev = slot;
+    *slot = it;
+}
+
+static void item_wheel_unlink(struct default_engine *engine, hash_item *it)
+{
+    item_links *links;
+    if (!engine->config.expire_wheel) {
+        return;
+    }
+    links = item_get_links(it);
+    if (links->x_pprev == NULL) {
+        return; /* not in the wheel */
+    }
+    *links->x_pprev = links->x_next;
+    if (links->x_next) item_get_links(links->x_next)->x_pprev = links->x_pprev;
+    links->x_next = NULL;
+    links->x_pprev = NULL;
+}
+
+/* File the items of the given upper level slot again. */
+static void do_item_wheel_cascade(struct default_engine *engine, hash_item **slot)
+{
+    hash_item *it = *slot;
+    hash_item *next;
+
+    *slot = NULL;
+    while (it != NULL) {
+        item_links *links = item_get_links(it);
+        next = links->x_next;
+        links->x_next = NULL;
+        links->x_pprev = NULL;
+        item_wheel_link(engine, it);
+        it = next;
+    }
+}
+
+/*
+ * Unlink up to max_items expired items from the wheel.
+ * Returns true if the wheel caught up with the current time.
+ */
+static bool do_item_wheel_expire(struct default_engine *engine, const int max_items)
+{
+    rel_time_t current_time = engine->server.core->get_current_time();
+    hash_item **slot;
+    int count = 0;
+    int level, shift, base, index;
+
+    while (engine->items.wheel_time <= current_time) {
+        slot = &engine->items.wheel[engine->items.wheel_time & (WHEEL_L0_SIZE - 1)];
+        while (*slot != NULL && count < max_items) {
+            assert((*slot)->exptime <= current_time);
+            /* unlinking the item removes it from the slot */
+            do_item_unlink(engine, *slot);
+            count++;
+        }
+        if (*slot != NULL) {
+            break;
+        }
+        engine->items.wheel_time++;
+
+        /* file the items of the upper level slots the wheel reached */
+        base = WHEEL_L0_SIZE;
+        shift = WHEEL_L0_BITS;
+        for (level = 1; level < WHEEL_LEVELS; level++) {
+            if ((engine->items.wheel_time & ((1 << shift) - 1)) != 0) break;
+            index = (engine->items.wheel_time >> shift) & (WHEEL_LN_SIZE - 1);
+            do_item_wheel_cascade(engine, &engine->items.wheel[base + index]);
+            base += WHEEL_LN_SIZE;
+            shift += WHEEL_LN_BITS;
+        }
+    }
+    if (count > 0) {
+        pthread_mutex_lock(&engine->stats.lock);
+        engine->stats.wheel_reclaimed += count;
+        pthread_mutex_unlock(&engine->stats.lock);
+    }
+    return (engine->items.wheel_time > current_time);
+}
+
+/* Check if the hot or warm segment of the given LRU is over its share. */
+static bool do_lru_over_share(struct default_engine *engine, const unsigned int lruid)
+{
+    struct items *items = &engine->items;
+    uint64_t hot_limit  = (uint64_t)items->sizes[lruid] * engine->config.hot_lru_pct / 100;
+    uint64_t warm_limit = (uint64_t)items->sizes[lruid] * engine->config.warm_lru_pct / 100;
+
+    return (items->hot_sizes[lruid] > hot_limit || items->warm_sizes[lruid] > warm_limit);
+}
+
+/*
+ * Move up to max_moves items out of the tails of the hot and warm segments
+ * of the given LRU while they are over their share of the LRU.
+ * Items read since their last move stay in the warm segment,
+ * the others fall to the cold segment to be evicted first.
+ * Returns the # of items moved (or invalidated).
+ */
+static int do_lru_juggle(struct default_engine *engine, const unsigned int lruid, const int max_moves)
+{
+    struct items *items = &engine->items;
+    rel_time_t current_time = engine->server.core->get_current_time();
+    uint64_t hot_limit  = (uint64_t)items->sizes[lruid] * engine->config.hot_lru_pct / 100;
+    uint64_t warm_limit = (uint64_t)items->sizes[lruid] * engine->config.warm_lru_pct / 100;
+    hash_item *search;
+    int moves = 0;
+
+    while (moves < max_moves && items->hot_sizes[lruid] > hot_limit) {
+        /* the hot tail is right above the warm or cold segment */
+        if (items->warm[lruid] != NULL)      search = items->warm[lruid]->prev;
+        else if (items->cold[lruid] != NULL) search = items->cold[lruid]->prev;
+        else                                 search = items->tails[lruid];
+        assert(search != NULL && (search->iflag & (ITEM_LRU_WARM|ITEM_LRU_COLD)) == 0);
+        moves++;
+
+        if (search->refcount == 0 && do_item_isvalid(engine, search, current_time) == false) {
+            do_item_invalidate(engine, search, lruid);
+            continue;
+        }
+        item_unlink_q(engine, search);
+        if ((search->iflag & ITEM_ACTIVE) != 0) {
+            search->iflag &= ~ITEM_ACTIVE;
+            item_link_q_at(engine, search, LRU_SEG_WARM);
+            items->itemstats[lruid].moves_to_warm++;
+        } else {
+            item_link_q_at(engine, search, LRU_SEG_COLD);
+            items->itemstats[lruid].moves_to_cold++;
+        }
+    }
+    while (moves < max_moves && items->warm_sizes[lruid] > warm_limit) {
+        /* the warm tail is right above the cold segment */
+        search = (items->cold[lruid] != NULL ? items->cold[lruid]->prev : items->tails[lruid]);
+        assert(search != NULL && (search->iflag & ITEM_LRU_WARM) != 0);
+        moves++;
+
+        if (search->refcount == 0 && do_item_isvalid(engine, search, current_time) == false) {
+            do_item_invalidate(engine, search, lruid);
+            continue;
+        }
+        item_unlink_q(engine, search);
+        if ((search->iflag & ITEM_ACTIVE) != 0) {
+            search->iflag &= ~ITEM_ACTIVE;
+            item_link_q_at(engine, search, LRU_SEG_WARM);
+            items->itemstats[lruid].moves_within_warm++;
+        } else {
+            item_link_q_at(engine, search, LRU_SEG_COLD);
+            items->itemstats[lruid].moves_to_cold++;
+        }
+    }
+    return moves;
+}
+
 ENGINE_ERROR_CODE do_item_replace(struct default_engine *engine, hash_item *it, hash_item *new_it)
 {
     MEMCACHED_ITEM_REPLACE(item_get_key(it), it->nkey, it->nbytes,
@@ -915,9 +1602,32 @@ static void do_item_stats(struct default_engine *engine, ADD_STAT add_stats, con
 #ifdef ENABLE_STICKY_ITEM
             add_statistics(c, add_stats, prefix, i, "sticky", "%u",
                            engine->items.sticky_sizes[i]);
+            add_statistics(c, add_stats, prefix, i, "sticky_bytes", "%"PRIu64,
+                           engine->items.sticky_bytes[i]);
+            add_statistics(c, add_stats, prefix, i, "sticky_reclaimed", "%u",
+                           engine->items.itemstats[i].sticky_reclaimed);
 #endif
             add_statistics(c, add_stats, prefix, i, "age", "%u",
                            (engine->items.tails[i] != NULL ? engine->items.tails[i]->time : 0));
+            if (engine->config.lru_segmented) {
+                unsigned int hot_and_warm = engine->items.hot_sizes[i] + engine->items.warm_sizes[i];
+                add_statistics(c, add_stats, prefix, i, "number_hot", "%u",
+                               engine->items.hot_sizes[i]);
+                add_statistics(c, add_stats, prefix, i, "number_warm", "%u",
+                               engine->items.warm_sizes[i]);
+                add_statistics(c, add_stats, prefix, i, "number_cold", "%u",
+                               engine->items.sizes[i] - hot_and_warm);
+                add_statistics(c, add_stats, prefix, i, "moves_to_cold",
+                               "%u", engine->items.itemstats[i].moves_to_cold);
+                add_statistics(c, add_stats, prefix, i, "moves_to_warm",
+                               "%u", engine->items.itemstats[i].moves_to_warm);
+                add_statistics(c, add_stats, prefix, i, "moves_within_warm",
+                               "%u", engine->items.itemstats[i].moves_within_warm);
+            }
+            if (engine->config.lru_second_chance) {
+                add_statistics(c, add_stats, prefix, i, "second_chances",
+                               "%u", engine->items.itemstats[i].second_chances);
+            }
             add_statistics(c, add_stats, prefix, i, "evicted",
                            "%u", engine->items.itemstats[i].evicted);
             add_statistics(c, add_stats, prefix, i, "evicted_nonzero",
@@ -930,6 +1640,10 @@ static void do_item_stats(struct default_engine *engine, ADD_STAT add_stats, con
                            "%u", engine->items.itemstats[i].tailrepairs);;
             add_statistics(c, add_stats, prefix, i, "reclaimed",
                            "%u", engine->items.itemstats[i].reclaimed);;
+            if (engine->config.lru_crawler) {
+                add_statistics(c, add_stats, prefix, i, "crawler_reclaimed",
+                               "%u", engine->items.itemstats[i].crawler_reclaimed);
+            }
         }
     }
 }
@@ -996,7 +1710,12 @@ static void do_item_stats_sizes(struct default_engine *engine, ADD_STAT add_stat
 hash_item *do_item_get(struct default_engine *engine, const char *key, const size_t nkey, bool LRU_reposition)
 {
     rel_time_t current_time = engine->server.core->get_current_time();
-    hash_item *it = assoc_find(engine, engine->server.core->hash(key, nkey, 0), key, nkey);
+    uint32_t hv = engine->server.core->hash(key, nkey, 0);
+    hash_item *it = assoc_find(engine, hv, key, nkey);
+
+    if (engine->config.lru_admission && LRU_reposition) {
+        lfu_sketch_add(engine, hv);
+    }
 
     if (it != NULL) {
         if (do_item_isvalid(engine, it, current_time)==false) {
@@ -1335,6 +2054,13 @@ static ENGINE_ERROR_CODE do_list_elem_link(struct default_engine *engine,
                                            list_elem_item *elem)
 {
     list_elem_item *prev, *next;
+    size_t stotal = slabs_space_size(engine, (sizeof(list_elem_item)+elem->nbytes));
+
+    /* prefix quota check */
+    if (do_coll_prefix_room(engine, (coll_meta_info *)info, stotal) == false) {
+        return ENGINE_ENOMEM;
+    }
+
     if (index >= 0) {
         if (index == 0) {
             prev = NULL;
@@ -1363,7 +2089,6 @@ static ENGINE_ERROR_CODE do_list_elem_link(struct default_engine *engine,
     info->ccnt++;
 
     if (1) { /* apply memory space */
-        size_t stotal = slabs_space_size(engine, (sizeof(list_elem_item)+elem->nbytes));
         increase_collection_space(engine, ITEM_TYPE_LIST, (coll_meta_info *)info, stotal);
     }
     return ENGINE_SUCCESS;
@@ -1439,6 +2164,14 @@ static inline int set_hash_eq(const int h1, const void *v1, size_t vlen1,
 
 #define SET_GET_HASHIDX(hval, hdepth) \
         (((hval) & (SET_HASHIDX_MASK << ((hdepth)*4))) >> ((hdepth)*4))
+/* The low bits of hash value are used as hash index,
+ * so the tag is taken from the high bits of the mixed hash value.
+ */
+#define SET_GET_HASHTAG(hval) \
+        ((uint16_t)(((uint32_t)(hval) * 0x9E3779B1U) >> 16))
+
+#define SET_ELEM_STATUS_UNLINKED 0
+#define SET_ELEM_STATUS_LINKED   1
 
 static ENGINE_ERROR_CODE do_set_item_find(struct default_engine *engine,
                                           const void *key, const size_t nkey,
@@ -1504,6 +2237,7 @@ static set_hash_node *do_set_node_alloc(struct default_engine *engine,
         node->hdepth      = hash_depth;
         node->tot_hash_cnt = 0;
         node->tot_elem_cnt = 0;
+        node->sub_elem_cnt = 0;
         memset(node->hcnt, 0, SET_HASHTAB_SIZE*sizeof(uint16_t));
         memset(node->htab, 0, SET_HASHTAB_SIZE*sizeof(void*));
     }
@@ -1515,7 +2249,159 @@ static void do_set_node_free(struct default_engine *engine, set_hash_node *node)
     do_mem_slot_free(engine, node, sizeof(set_hash_node));
 }
 
-static set_elem_item *do_set_elem_alloc(struct default_engine *engine,
+/* the smallest capacity that holds the given count of elements */
+static inline int do_set_group_capacity(const int count)
+{
+    int capacity = (count + SET_MIN_GROUP_SIZE - 1) & ~(SET_MIN_GROUP_SIZE - 1);
+    if (capacity < SET_MIN_GROUP_SIZE) {
+        capacity = SET_MIN_GROUP_SIZE;
+    }
+    assert(capacity <= SET_MAX_GROUP_SIZE);
+    return capacity;
+}
+
+/* the capacity of a full group to grow to : about 1.25 times the capacity,
+ * which keeps the unused slots of a group small.
+ */
+static inline int do_set_group_grow_capacity(const int capacity)
+{
+    int grow = capacity + ((capacity/4) & ~(SET_MIN_GROUP_SIZE - 1));
+    if (grow == capacity) {
+        grow += SET_MIN_GROUP_SIZE;
+    }
+    return (grow < SET_MAX_GROUP_SIZE ? grow : SET_MAX_GROUP_SIZE);
+}
+
+/* Allocate a group. If evict_ok is false, the group is allocated only from
+ * free slab space, so that deleting elements never evicts other items.
+ */
+static set_elem_group *do_set_group_alloc(struct default_engine *engine,
+                                          set_meta_info *info, const int capacity,
+                                          const bool evict_ok, const void *cookie)
+{
+    size_t ntotal = SET_GROUP_SIZE(capacity);
+    set_elem_group *grp;
+
+    if (evict_ok) {
+        grp = do_item_alloc_internal(engine, ntotal, LRU_CLSID_FOR_SMALL, cookie);
+    } else {
+        grp = slabs_alloc(engine, ntotal, slabs_clsid(engine, ntotal));
+        if (grp != NULL) grp->slabs_clsid = 0;
+    }
+    if (grp != NULL) {
+        assert(grp->slabs_clsid == 0);
+        grp->slabs_clsid = slabs_clsid(engine, ntotal);
+        grp->refcount    = 0;
+        grp->capacity    = capacity;
+        grp->count       = 0;
+
+        /* apply memory space */
+        size_t stotal = slabs_space_size(engine, ntotal);
+        increase_collection_space(engine, ITEM_TYPE_SET, (coll_meta_info *)info, stotal);
+    }
+    return grp;
+}
+
+static void do_set_group_free(struct default_engine *engine,
+                              set_meta_info *info, set_elem_group *grp)
+{
+    size_t ntotal = SET_GROUP_SIZE(grp->capacity);
+
+    if (info->stotal > 0) { /* apply memory space */
+        size_t stotal = slabs_space_size(engine, ntotal);
+        decrease_collection_space(engine, ITEM_TYPE_SET, (coll_meta_info *)info, stotal);
+    }
+    do_mem_slot_free(engine, grp, ntotal);
+}
+
+static inline void do_set_group_add(set_elem_group *grp, set_elem_item *elem)
+{
+    assert(grp->count < grp->capacity);
+    SET_GROUP_TAGS(grp)[grp->count] = SET_GET_HASHTAG(elem->hval);
+    grp->elem[grp->count] = elem;
+    grp->count++;
+}
+
+static inline void do_set_group_remove(set_elem_group *grp, const int slot)
+{
+    uint16_t *tags = SET_GROUP_TAGS(grp);
+    int last = grp->count - 1;
+
+    /* fill the hole with the last slot to keep the slots dense */
+    if (slot != last) {
+        grp->elem[slot] = grp->elem[last];
+        tags[slot] = tags[last];
+    }
+    grp->count = last;
+}
+
+/* Find the slot holding the given value.
+ * Hash tags of 8 slots are compared at once, and only the slots whose
+ * tag matches are compared by hash value and value itself.
+ * The capacity of a group is a multiple of 4, and the last 4 tags are
+ * loaded alone, so the tag loads never go beyond the group even if
+ * some of the loaded slots are not used.
+ */
+static int do_set_group_find(set_elem_group *grp, const int hval,
+                             const char *val, const int vlen)
+{
+    uint16_t *tags = SET_GROUP_TAGS(grp);
+    uint16_t  htag = SET_GET_HASHTAG(hval);
+    set_elem_item *elem;
+    int slot;
+#ifdef __SSE2__
+    __m128i key = _mm_set1_epi16((short)htag);
+    unsigned int mask;
+    int base;
+
+    for (base = 0; base < grp->count; base += 8) {
+        __m128i cur = (base + 8 <= grp->capacity)
+                    ? _mm_loadu_si128((const __m128i *)&tags[base])
+                    : _mm_loadl_epi64((const __m128i *)&tags[base]);
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi16(cur, key));
+        while (mask != 0) {
+            slot = base + (__builtin_ctz(mask) >> 1);
+            if (slot >= grp->count) break;
+            elem = grp->elem[slot];
+            if (set_hash_eq(hval, val, vlen, elem->hval, elem->value, elem->nbytes))
+                return slot;
+            mask &= ~(3U << ((slot - base) * 2));
+        }
+    }
+#else
+    for (slot = 0; slot < grp->count; slot++) {
+        if (tags[slot] != htag) continue;
+        elem = grp->elem[slot];
+        if (set_hash_eq(hval, val, vlen, elem->hval, elem->value, elem->nbytes))
+            return slot;
+    }
+#endif
+    return -1;
+}
+
+/* Replace the group of the given hash bucket with a new group of the given capacity. */
+static bool do_set_group_resize(struct default_engine *engine,
+                                set_meta_info *info, set_hash_node *node,
+                                const int hidx, const int capacity,
+                                const bool evict_ok, const void *cookie)
+{
+    set_elem_group *old_grp = node->htab[hidx];
+    set_elem_group *new_grp = do_set_group_alloc(engine, info, capacity, evict_ok, cookie);
+    if (new_grp == NULL) {
+        return false;
+    }
+    if (old_grp != NULL) {
+        assert(old_grp->count <= capacity);
+        memcpy(new_grp->elem, old_grp->elem, old_grp->count * sizeof(set_elem_item *));
+        memcpy(SET_GROUP_TAGS(new_grp), SET_GROUP_TAGS(old_grp), old_grp->count * sizeof(uint16_t));
+        new_grp->count = old_grp->count;
+        do_set_group_free(engine, info, old_grp);
+    }
+    node->htab[hidx] = new_grp;
+    return true;
+}
+
+static set_elem_item *do_set_elem_alloc(struct default_engine *engine,
                                         const int nbytes, const void *cookie)
 {
     size_t ntotal = sizeof(set_elem_item) + nbytes;
@@ -1525,8 +2411,8 @@ static set_elem_item *do_set_elem_alloc(struct default_engine *engine,
         assert(elem->slabs_clsid == 0);
         elem->slabs_clsid = slabs_clsid(engine, ntotal);
         elem->refcount    = 1;
-        elem->nbytes      = nbytes;
-        elem->next = (set_elem_item *)ADDR_MEANS_UNLINKED; /* Unliked state */
+        elem->status      = SET_ELEM_STATUS_UNLINKED; /* Unliked state */
+        elem->nbytes      = (uint16_t)nbytes;
     }
     return elem;
 }
@@ -1544,51 +2430,80 @@ static void do_set_elem_release(struct default_engine *engine, set_elem_item *el
     if (elem->refcount != 0) {
         elem->refcount--;
     }
-    if (elem->refcount == 0 && elem->next == (set_elem_item *)ADDR_MEANS_UNLINKED) {
+    if (elem->refcount == 0 && elem->status == SET_ELEM_STATUS_UNLINKED) {
         do_set_elem_free(engine, elem);
     }
 }
 
-static void do_set_node_link(struct default_engine *engine,
-                             set_meta_info *info,
-                             set_hash_node *par_node, const int par_hidx,
-                             set_hash_node *node)
+static ENGINE_ERROR_CODE do_set_node_link(struct default_engine *engine,
+                                          set_meta_info *info,
+                                          set_hash_node *par_node, const int par_hidx,
+                                          set_hash_node *node, const void *cookie)
 {
     if (par_node == NULL) {
         info->root = node;
     } else {
+        set_elem_group *grp = par_node->htab[par_hidx];
         set_elem_item *elem;
-        int num_elems = par_node->hcnt[par_hidx];
-        int hidx, fcnt=0;
+        int hidx, slot;
 
-        while (par_node->htab[par_hidx] != NULL) {
-            elem = par_node->htab[par_hidx];
-            par_node->htab[par_hidx] = elem->next;
+        for (slot = 0; slot < grp->count; slot++) {
+            hidx = SET_GET_HASHIDX(grp->elem[slot]->hval, node->hdepth);
+            node->hcnt[hidx] += 1;
+        }
+        /* allocate all groups of the child node in advance,
+         * so that the parent group is left intact on failure.
+         */
+        for (hidx = 0; hidx < SET_HASHTAB_SIZE; hidx++) {
+            if (node->hcnt[hidx] == 0) continue;
+            node->htab[hidx] = do_set_group_alloc(engine, info,
+                                   do_set_group_capacity(node->hcnt[hidx]), true, cookie);
+            if (node->htab[hidx] == NULL) break;
+        }
+        if (hidx < SET_HASHTAB_SIZE) {
+            for (hidx = 0; hidx < SET_HASHTAB_SIZE; hidx++) {
+                if (node->htab[hidx] != NULL) {
+                    do_set_group_free(engine, info, node->htab[hidx]);
+                    node->htab[hidx] = NULL;
+                }
+                node->hcnt[hidx] = 0;
+            }
+            return ENGINE_ENOMEM;
+        }
 
+        for (slot = 0; slot < grp->count; slot++) {
+            elem = grp->elem[slot];
             hidx = SET_GET_HASHIDX(elem->hval, node->hdepth);
-            elem->next = node->htab[hidx];
-            node->htab[hidx] = elem;
-            node->hcnt[hidx] += 1;
-            fcnt++;
+            do_set_group_add(node->htab[hidx], elem);
         }
-        assert(fcnt == num_elems);
-        node->tot_elem_cnt = fcnt;
+        node->tot_elem_cnt = grp->count;
+        node->sub_elem_cnt = grp->count;
 
         par_node->htab[par_hidx] = node;
         par_node->hcnt[par_hidx] = -1; /* child hash node */
-        par_node->tot_elem_cnt -= fcnt;
+        par_node->tot_elem_cnt -= grp->count;
         par_node->tot_hash_cnt += 1;
+
+        do_set_group_free(engine, info, grp);
     }
 
     if (1) { /* apply memory space */
         size_t stotal = slabs_space_size(engine, sizeof(set_hash_node));
         increase_collection_space(engine, ITEM_TYPE_SET, (coll_meta_info *)info, stotal);
     }
+    return ENGINE_SUCCESS;
 }
 
-static void do_set_node_unlink(struct default_engine *engine,
+/* Unlink the hash node and move its elements into the parent.
+ * Merging a non-empty child node needs a new group in the parent,
+ * which is taken from free slab space only since this runs on deletion.
+ * If it cannot be allocated, the child node is kept and false is returned.
+ * The child node is never merged if alloc_ok is false and it has elements.
+ */
+static bool do_set_node_unlink(struct default_engine *engine,
                                set_meta_info *info,
-                               set_hash_node *par_node, const int par_hidx)
+                               set_hash_node *par_node, const int par_hidx,
+                               const bool alloc_ok)
 {
     set_hash_node *node;
 
@@ -1599,32 +2514,40 @@ static void do_set_node_unlink(struct default_engine *engine,
         assert(node->tot_elem_cnt == 0);
     } else {
         assert(par_node->hcnt[par_hidx] == -1); /* child hash node */
-        set_elem_item *head = NULL;
-        set_elem_item *elem;
-        int hidx, fcnt = 0;
+        set_elem_group *grp = NULL;
+        set_elem_group *child_grp;
+        int hidx, slot, fcnt = 0;
 
         node = (set_hash_node *)par_node->htab[par_hidx];
         assert(node->tot_hash_cnt == 0);
 
+        if (node->tot_elem_cnt > 0) {
+            if (alloc_ok) {
+                grp = do_set_group_alloc(engine, info,
+                                         do_set_group_capacity(node->tot_elem_cnt),
+                                         false, NULL);
+            }
+            if (grp == NULL) {
+                return false;
+            }
+        }
         for (hidx = 0; hidx < SET_HASHTAB_SIZE; hidx++) {
             assert(node->hcnt[hidx] >= 0);
             if (node->hcnt[hidx] > 0) {
-                fcnt += node->hcnt[hidx];
-                while (node->htab[hidx] != NULL) {
-                    elem = node->htab[hidx];
-                    node->htab[hidx] = elem->next;
-                    node->hcnt[hidx] -= 1;
-
-                    elem->next = head;
-                    head = elem;
+                child_grp = node->htab[hidx];
+                for (slot = 0; slot < child_grp->count; slot++) {
+                    do_set_group_add(grp, child_grp->elem[slot]);
                 }
-                assert(node->hcnt[hidx] == 0);
+                fcnt += child_grp->count;
+                do_set_group_free(engine, info, child_grp);
+                node->htab[hidx] = NULL;
+                node->hcnt[hidx] = 0;
             }
         }
         assert(fcnt == node->tot_elem_cnt);
         node->tot_elem_cnt = 0;
 
-        par_node->htab[par_hidx] = head;
+        par_node->htab[par_hidx] = grp;
         par_node->hcnt[par_hidx] = fcnt;
         par_node->tot_elem_cnt += fcnt;
         par_node->tot_hash_cnt -= 1;
@@ -1637,6 +2560,22 @@ static void do_set_node_unlink(struct default_engine *engine,
 
     /* free the node */
     do_set_node_free(engine, node);
+    return true;
+}
+
+/* adjust the subtree element count of the hash nodes
+ * on the path from the root node to the given node.
+ */
+static void do_set_node_count_adjust(set_meta_info *info, set_hash_node *last,
+                                     const int hval, const int delta)
+{
+    set_hash_node *node = info->root;
+
+    while (1) {
+        node->sub_elem_cnt += delta;
+        if (node == last) break;
+        node = node->htab[SET_GET_HASHIDX(hval, node->hdepth)];
+    }
 }
 
 static ENGINE_ERROR_CODE do_set_elem_link(struct default_engine *engine,
@@ -1645,7 +2584,7 @@ static ENGINE_ERROR_CODE do_set_elem_link(struct default_engine *engine,
 {
     assert(info->root != NULL);
     set_hash_node *node = info->root;
-    set_elem_item *find;
+    set_elem_group *grp;
     int hidx;
 
     /* set hash value */
@@ -1653,36 +2592,52 @@ static ENGINE_ERROR_CODE do_set_elem_link(struct default_engine *engine,
 
     while (node != NULL) {
         hidx = SET_GET_HASHIDX(elem->hval, node->hdepth);
-        if (node->hcnt[hidx] >= 0) /* set element hash chain */
+        if (node->hcnt[hidx] >= 0) /* set element group */
             break;
         node = node->htab[hidx];
     }
     assert(node != NULL);
 
-    for (find = node->htab[hidx]; find != NULL; find = find->next) {
-        if (set_hash_eq(elem->hval, elem->value, elem->nbytes,
-                        find->hval, find->value, find->nbytes))
-            break;
-    }
-    if (find != NULL) {
+    if (node->hcnt[hidx] > 0 &&
+        do_set_group_find(node->htab[hidx], elem->hval, elem->value, elem->nbytes) >= 0) {
         return ENGINE_ELEM_EEXISTS;
     }
 
-    if (node->hcnt[hidx] >= SET_MAX_HASHCHAIN_SIZE) {
+    /* prefix quota check */
+    if (do_coll_prefix_room(engine, (coll_meta_info *)info,
+                            slabs_space_size(engine, (sizeof(set_elem_item)+elem->nbytes))) == false) {
+        return ENGINE_ENOMEM;
+    }
+
+    /* all the elements of a full group may go into the same child group */
+    while (node->hcnt[hidx] >= SET_MAX_GROUP_SIZE) {
         set_hash_node *n_node = do_set_node_alloc(engine, node->hdepth+1, cookie);
         if (n_node == NULL) {
             return ENGINE_ENOMEM;
         }
-        do_set_node_link(engine, info, node, hidx, n_node);
-
+        if (do_set_node_link(engine, info, node, hidx, n_node, cookie) != ENGINE_SUCCESS) {
+            do_set_node_free(engine, n_node);
+            return ENGINE_ENOMEM;
+        }
         node = n_node;
         hidx = SET_GET_HASHIDX(elem->hval, node->hdepth);
     }
 
-    elem->next = node->htab[hidx];
-    node->htab[hidx] = elem;
+    grp = node->htab[hidx];
+    if (grp == NULL || grp->count == grp->capacity) {
+        int capacity = (grp == NULL ? SET_MIN_GROUP_SIZE
+                                    : do_set_group_grow_capacity(grp->capacity));
+        if (!do_set_group_resize(engine, info, node, hidx, capacity, true, cookie)) {
+            return ENGINE_ENOMEM;
+        }
+        grp = node->htab[hidx];
+    }
+
+    do_set_group_add(grp, elem);
+    elem->status = SET_ELEM_STATUS_LINKED;
     node->hcnt[hidx] += 1;
     node->tot_elem_cnt += 1;
+    do_set_node_count_adjust(info, node, elem->hval, 1);
 
     info->ccnt++;
 
@@ -1696,14 +2651,20 @@ static ENGINE_ERROR_CODE do_set_elem_link(struct default_engine *engine,
 
 static void do_set_elem_unlink(struct default_engine *engine,
                                set_meta_info *info,
-                               set_hash_node *node, const int hidx,
-                               set_elem_item *prev, set_elem_item *elem)
+                               set_hash_node *node, const int hidx, const int slot)
 {
-    if (prev != NULL) prev->next = elem->next;
-    else              node->htab[hidx] = elem->next;
-    elem->next = (set_elem_item *)ADDR_MEANS_UNLINKED;
+    set_elem_group *grp = node->htab[hidx];
+    set_elem_item *elem = grp->elem[slot];
+
+    do_set_group_remove(grp, slot);
+    if (grp->count == 0) {
+        do_set_group_free(engine, info, grp);
+        node->htab[hidx] = NULL;
+    }
+    elem->status = SET_ELEM_STATUS_UNLINKED;
     node->hcnt[hidx] -= 1;
     node->tot_elem_cnt -= 1;
+    do_set_node_count_adjust(info, node, elem->hval, -1);
 
     info->ccnt--;
 
@@ -1717,29 +2678,76 @@ static void do_set_elem_unlink(struct default_engine *engine,
     }
 }
 
+/* get the element group that the hash value belongs to */
+static set_elem_group *do_set_elem_group_get(set_meta_info *info, const int hval)
+{
+    set_hash_node *node = info->root;
+    int hidx;
+
+    if (node == NULL) {
+        return NULL;
+    }
+    while (node != NULL) {
+        hidx = SET_GET_HASHIDX(hval, node->hdepth);
+        if (node->hcnt[hidx] >= 0) /* set element group */
+            break;
+        node = node->htab[hidx];
+    }
+    assert(node != NULL);
+    return (node->hcnt[hidx] > 0 ? node->htab[hidx] : NULL);
+}
+
+static set_elem_item *do_set_elem_find_hashed(set_meta_info *info, const int hval,
+                                              const char *val, const int vlen)
+{
+    set_elem_group *grp = do_set_elem_group_get(info, hval);
+    int slot;
+
+    if (grp != NULL && (slot = do_set_group_find(grp, hval, val, vlen)) >= 0) {
+        return grp->elem[slot];
+    }
+    return NULL;
+}
+
 static set_elem_item *do_set_elem_find(set_meta_info *info, const char *val, const int vlen)
 {
-    set_elem_item *elem = NULL;
+    return do_set_elem_find_hashed(info, genhash_string_hash(val, vlen), val, vlen);
+}
 
-    if (info->root != NULL) {
-        set_hash_node *node = info->root;
-        int hval = genhash_string_hash(val, vlen);
-        int hidx;
+#define SET_MFIND_BATCH_SIZE 16
 
-        while (node != NULL) {
-            hidx = SET_GET_HASHIDX(hval, node->hdepth);
-            if (node->hcnt[hidx] >= 0) /* set element hash chain */
-                break;
-            node = node->htab[hidx];
-        }
-        assert(node != NULL);
+/* Find multiple values at once.
+ * The values are looked up in batches. The groups of a batch are located
+ * and prefetched first, so that the cache misses on the groups overlap
+ * instead of being taken one by one.
+ */
+static void do_set_elem_mfind(set_meta_info *info, token_t *value_array,
+                              const int value_count, bool *exist_array)
+{
+    set_elem_group *grps[SET_MFIND_BATCH_SIZE];
+    int hvals[SET_MFIND_BATCH_SIZE];
+    int base, bcnt, i;
 
-        for (elem = node->htab[hidx]; elem != NULL; elem = elem->next) {
-            if (set_hash_eq(hval, val, vlen, elem->hval, elem->value, elem->nbytes))
-                break;
+    for (base = 0; base < value_count; base += SET_MFIND_BATCH_SIZE) {
+        bcnt = value_count - base;
+        if (bcnt > SET_MFIND_BATCH_SIZE) bcnt = SET_MFIND_BATCH_SIZE;
+
+        for (i = 0; i < bcnt; i++) {
+            hvals[i] = genhash_string_hash(value_array[base+i].value,
+                                           value_array[base+i].length);
+            grps[i] = do_set_elem_group_get(info, hvals[i]);
+            if (grps[i] != NULL) {
+                __builtin_prefetch(grps[i], 0, 1);
+                __builtin_prefetch(SET_GROUP_TAGS(grps[i]), 0, 1);
+            }
+        }
+        for (i = 0; i < bcnt; i++) {
+            exist_array[base+i] = (grps[i] != NULL &&
+                                   do_set_group_find(grps[i], hvals[i],
+                                                     value_array[base+i].value,
+                                                     value_array[base+i].length) >= 0);
         }
     }
-    return elem;
 }
 
 static ENGINE_ERROR_CODE do_set_elem_traverse_delete(struct default_engine *engine,
@@ -1755,23 +2763,25 @@ static ENGINE_ERROR_CODE do_set_elem_traverse_delete(struct default_engine *engi
         ret = do_set_elem_traverse_delete(engine, info, child_node, hval, val, vlen);
         if (ret == ENGINE_SUCCESS) {
             if (child_node->tot_hash_cnt == 0 &&
-                child_node->tot_elem_cnt < (SET_MAX_HASHCHAIN_SIZE/2)) {
-                do_set_node_unlink(engine, info, node, hidx);
+                child_node->tot_elem_cnt < (SET_MAX_GROUP_SIZE/2)) {
+                (void)do_set_node_unlink(engine, info, node, hidx, true);
             }
         }
     } else {
         ret = ENGINE_ELEM_ENOENT;
         if (node->hcnt[hidx] > 0) {
-            set_elem_item *prev = NULL;
-            set_elem_item *elem = node->htab[hidx];
-            while (elem != NULL) {
-                if (set_hash_eq(hval, val, vlen, elem->hval, elem->value, elem->nbytes))
-                    break;
-                prev = elem;
-                elem = elem->next;
-            }
-            if (elem != NULL) {
-                do_set_elem_unlink(engine, info, node, hidx, prev, elem);
+            set_elem_group *grp = node->htab[hidx];
+            int slot = do_set_group_find(grp, hval, val, vlen);
+            if (slot >= 0) {
+                do_set_elem_unlink(engine, info, node, hidx, slot);
+                /* shrink the group if it is half empty.
+                 * (best effort, from free slab space only)
+                 */
+                if (node->hcnt[hidx] > 0 && grp->capacity > SET_MIN_GROUP_SIZE &&
+                    grp->count <= (grp->capacity/2)) {
+                    (void)do_set_group_resize(engine, info, node, hidx,
+                                              do_set_group_capacity(grp->count), false, NULL);
+                }
                 ret = ENGINE_SUCCESS;
             }
         }
@@ -1789,7 +2799,7 @@ static ENGINE_ERROR_CODE do_set_elem_delete_with_value(struct default_engine *en
         ret = do_set_elem_traverse_delete(engine, info, info->root, hval, val, vlen);
         if (ret == ENGINE_SUCCESS) {
             if (info->root->tot_hash_cnt == 0 && info->root->tot_elem_cnt == 0) {
-                do_set_node_unlink(engine, info, NULL, 0);
+                do_set_node_unlink(engine, info, NULL, 0, false);
             }
         }
     } else {
@@ -1798,6 +2808,11 @@ static ENGINE_ERROR_CODE do_set_elem_delete_with_value(struct default_engine *en
     return ret;
 }
 
+/* Traverse the hash nodes in DFS order.
+ * In delete mode, elements are removed from the tail of each group,
+ * and only empty child nodes are unlinked since the traversal may run
+ * in the middle of freeing items and must not allocate memory.
+ */
 static int do_set_elem_traverse_dfs(struct default_engine *engine,
                                     set_meta_info *info, set_hash_node *node,
                                     const uint32_t count, const bool delete,
@@ -1816,8 +2831,8 @@ static int do_set_elem_traverse_dfs(struct default_engine *engine,
                                             (elem_array==NULL ? NULL : &elem_array[tot_fcnt]));
                 if (delete) {
                     if  (child_node->tot_hash_cnt == 0 &&
-                         child_node->tot_elem_cnt < (SET_MAX_HASHCHAIN_SIZE/2)) {
-                         do_set_node_unlink(engine, info, node, hidx);
+                         child_node->tot_elem_cnt == 0) {
+                         (void)do_set_node_unlink(engine, info, node, hidx, false);
                      }
                 }
                 tot_fcnt += fcnt;
@@ -1830,17 +2845,22 @@ static int do_set_elem_traverse_dfs(struct default_engine *engine,
 
     for (hidx = 0; hidx < SET_HASHTAB_SIZE; hidx++) {
         if (node->hcnt[hidx] > 0) {
+            set_elem_group *grp = node->htab[hidx];
+            set_elem_item *elem;
+            int slot = 0;
             fcnt = 0;
-            set_elem_item *elem = node->htab[hidx];
-            while (elem != NULL) {
+            while (node->hcnt[hidx] > 0) {
+                /* the group is freed when its last element is unlinked */
+                if (delete) slot = node->hcnt[hidx] - 1;
+                elem = grp->elem[slot];
                 if (elem_array) {
                     elem->refcount++;
                     elem_array[tot_fcnt+fcnt] = elem;
                 }
                 fcnt++;
-                if (delete) do_set_elem_unlink(engine, info, node, hidx, NULL, elem);
+                if (delete) do_set_elem_unlink(engine, info, node, hidx, slot);
                 if (count > 0 && (tot_fcnt+fcnt) >= count) break;
-                elem = (delete ? node->htab[hidx] : elem->next);
+                if (!delete && ++slot >= grp->count) break;
             }
             tot_fcnt += fcnt;
             if (count > 0 && tot_fcnt >= count) break;
@@ -1856,7 +2876,7 @@ static uint32_t do_set_elem_delete(struct default_engine *engine,
     if (info->root != NULL) {
         fcnt = do_set_elem_traverse_dfs(engine, info, info->root, count, true, NULL);
         if (info->root->tot_hash_cnt == 0 && info->root->tot_elem_cnt == 0) {
-            do_set_node_unlink(engine, info, NULL, 0);
+            do_set_node_unlink(engine, info, NULL, 0, false);
         }
     }
     return fcnt;
@@ -1870,12 +2890,290 @@ static uint32_t do_set_elem_get(struct default_engine *engine,
     if (info->root != NULL) {
         fcnt = do_set_elem_traverse_dfs(engine, info, info->root, count, delete, elem_array);
         if (delete && info->root->tot_hash_cnt == 0 && info->root->tot_elem_cnt == 0) {
-            do_set_node_unlink(engine, info, NULL, 0);
+            do_set_node_unlink(engine, info, NULL, 0, false);
         }
     }
     return fcnt;
 }
 
+/* get the element at the given position in hash order.
+ * The position is resolved with the subtree element counts,
+ * so that only one path from the root node is visited.
+ */
+static set_elem_item *do_set_elem_at_posi(set_meta_info *info, uint32_t posi)
+{
+    set_hash_node *node = info->root;
+    set_elem_group *grp;
+    uint32_t ecnt;
+    int hidx;
+
+    assert(node != NULL && posi < node->sub_elem_cnt);
+    while (1) {
+        for (hidx = 0; hidx < SET_HASHTAB_SIZE; hidx++) {
+            if (node->hcnt[hidx] == -1) {
+                ecnt = ((set_hash_node *)node->htab[hidx])->sub_elem_cnt;
+            } else {
+                ecnt = node->hcnt[hidx];
+            }
+            if (posi < ecnt) break;
+            posi -= ecnt;
+        }
+        assert(hidx < SET_HASHTAB_SIZE);
+        if (node->hcnt[hidx] >= 0) { /* set element group */
+            grp = (set_elem_group *)node->htab[hidx];
+            return grp->elem[posi];
+        }
+        node = (set_hash_node *)node->htab[hidx];
+    }
+}
+
+/* choose count distinct elements at random (Floyd's algorithm).
+ * A small sample is checked for duplicates against the elements chosen
+ * so far, and a large one against a bitmap of the chosen positions.
+ * returns the number of sampled elements, or -1 on memory shortage.
+ */
+#define SET_SAMPLE_SCAN_COUNT 64 /* max sample count checked without a bitmap */
+
+static int do_set_elem_sample(struct default_engine *engine, set_meta_info *info,
+                              const uint32_t count, set_elem_item **elem_array)
+{
+    uint32_t total = (info->root != NULL ? info->root->sub_elem_cnt : 0);
+    uint32_t scnt = (count > 0 && count < total ? count : total);
+    uint32_t i, j, k, posi;
+    uint8_t *chosen = NULL;
+    set_elem_item *elem;
+
+    assert(total == info->ccnt);
+    if (scnt == 0) {
+        return 0;
+    }
+    if (scnt > SET_SAMPLE_SCAN_COUNT) {
+        chosen = (uint8_t *)calloc((total + 7) / 8, sizeof(uint8_t));
+        if (chosen == NULL) {
+            return -1;
+        }
+    }
+    for (i = 0, j = total - scnt; j < total; i++, j++) {
+        posi = (uint32_t)(rand_r(&engine->items.sample_seed) % (j + 1));
+        if (chosen != NULL) {
+            if (chosen[posi / 8] & (1 << (posi % 8))) {
+                posi = j;
+            }
+            chosen[posi / 8] |= (1 << (posi % 8));
+            elem = do_set_elem_at_posi(info, posi);
+        } else {
+            elem = do_set_elem_at_posi(info, posi);
+            for (k = 0; k < i; k++) {
+                if (elem_array[k] == elem) break;
+            }
+            if (k < i) {
+                elem = do_set_elem_at_posi(info, j);
+            }
+        }
+        elem->refcount++;
+        elem_array[i] = elem;
+    }
+    if (chosen != NULL) {
+        free(chosen);
+    }
+    return (int)scnt;
+}
+
+/* set operation (intersection, union, difference) context */
+typedef struct _set_setop_ctx {
+    ENGINE_SET_OPERATION setop;
+    set_meta_info **infos;      /* meta info of the given sets (NULL if not found) */
+    int             count;      /* number of the given sets */
+    int             base;       /* index of the set being traversed */
+    bool            collect;    /* collect the result elements, or only count them */
+    set_elem_item **elem_array; /* result elements, grown on demand */
+    uint32_t        elem_size;  /* size of elem_array */
+    uint32_t        elem_count; /* number of result elements */
+} set_setop_ctx;
+
+static bool do_set_setop_match(set_setop_ctx *ctx, set_elem_item *elem)
+{
+    set_meta_info *info;
+    int i;
+
+    for (i = 0; i < ctx->count; i++) {
+        if (i == ctx->base) continue;
+        info = ctx->infos[i];
+        switch (ctx->setop) {
+          case SET_OPERATION_INTER: /* must be in all the other sets */
+            if (info == NULL ||
+                do_set_elem_find_hashed(info, elem->hval, elem->value, elem->nbytes) == NULL)
+                return false;
+            break;
+          case SET_OPERATION_DIFF: /* must not be in the following sets */
+            if (info != NULL &&
+                do_set_elem_find_hashed(info, elem->hval, elem->value, elem->nbytes) != NULL)
+                return false;
+            break;
+          case SET_OPERATION_UNION: /* must not be in the preceding sets */
+            if (i > ctx->base) return true;
+            if (info != NULL &&
+                do_set_elem_find_hashed(info, elem->hval, elem->value, elem->nbytes) != NULL)
+                return false;
+            break;
+        }
+    }
+    return true;
+}
+
+/* grow the result element array of a set operation by doubling */
+#define SET_SETOP_INITIAL_SIZE 64
+
+static ENGINE_ERROR_CODE do_set_setop_grow(set_setop_ctx *ctx)
+{
+    set_elem_item **new_array;
+    uint32_t new_size;
+
+    if (ctx->elem_size >= MAX_SET_SIZE) {
+        return ENGINE_EOVERFLOW;
+    }
+    new_size = (ctx->elem_size == 0 ? SET_SETOP_INITIAL_SIZE : ctx->elem_size * 2);
+    if (new_size > MAX_SET_SIZE) new_size = MAX_SET_SIZE;
+    new_array = realloc(ctx->elem_array, new_size * sizeof(set_elem_item *));
+    if (new_array == NULL) {
+        return ENGINE_ENOMEM;
+    }
+    ctx->elem_array = new_array;
+    ctx->elem_size = new_size;
+    return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE do_set_setop_traverse(set_setop_ctx *ctx, set_hash_node *node)
+{
+    ENGINE_ERROR_CODE ret;
+    set_elem_group *grp;
+    set_elem_item *elem;
+    int hidx, slot;
+
+    for (hidx = 0; hidx < SET_HASHTAB_SIZE; hidx++) {
+        if (node->hcnt[hidx] == -1) {
+            ret = do_set_setop_traverse(ctx, (set_hash_node *)node->htab[hidx]);
+            if (ret != ENGINE_SUCCESS) return ret;
+        } else if (node->hcnt[hidx] > 0) {
+            grp = node->htab[hidx];
+            for (slot = 0; slot < grp->count; slot++) {
+                elem = grp->elem[slot];
+                if (!do_set_setop_match(ctx, elem)) continue;
+                if (ctx->collect) {
+                    if (ctx->elem_count >= ctx->elem_size) {
+                        ret = do_set_setop_grow(ctx);
+                        if (ret != ENGINE_SUCCESS) return ret;
+                    }
+                    elem->refcount++;
+                    ctx->elem_array[ctx->elem_count] = elem;
+                }
+                ctx->elem_count++;
+            }
+        }
+    }
+    return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE do_set_setop(set_setop_ctx *ctx)
+{
+    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
+    int i;
+
+    if (ctx->setop == SET_OPERATION_INTER) {
+        /* traverse the smallest set and probe the others */
+        ctx->base = 0;
+        for (i = 0; i < ctx->count; i++) {
+            if (ctx->infos[i] == NULL) return ENGINE_SUCCESS; /* empty result */
+            if (ctx->infos[i]->ccnt < ctx->infos[ctx->base]->ccnt)
+                ctx->base = i;
+        }
+        if (ctx->infos[ctx->base]->root != NULL) {
+            ret = do_set_setop_traverse(ctx, ctx->infos[ctx->base]->root);
+        }
+    } else if (ctx->setop == SET_OPERATION_DIFF) {
+        ctx->base = 0;
+        if (ctx->infos[0] != NULL && ctx->infos[0]->root != NULL) {
+            ret = do_set_setop_traverse(ctx, ctx->infos[0]->root);
+        }
+    } else { /* SET_OPERATION_UNION */
+        for (i = 0; i < ctx->count && ret == ENGINE_SUCCESS; i++) {
+            ctx->base = i;
+            if (ctx->infos[i] != NULL && ctx->infos[i]->root != NULL) {
+                ret = do_set_setop_traverse(ctx, ctx->infos[i]->root);
+            }
+        }
+    }
+    return ret;
+}
+
+/* Store the result elements into the destination set.
+ * The destination set is newly created with the given attributes,
+ * and replaces the existing item of the same key if any.
+ * It is linked before the elements are added, like the set created by
+ * sop insert, so that its space is accounted to its prefix.
+ */
+static ENGINE_ERROR_CODE do_set_setop_store(struct default_engine *engine,
+                                            const char *dkey, const size_t ndkey,
+                                            item_attr *dattrp,
+                                            set_elem_item **elem_array, const uint32_t elem_count,
+                                            const void *cookie)
+{
+    hash_item     *it, *old_it;
+    set_meta_info *info;
+    set_hash_node *r_node;
+    set_elem_item *elem;
+    ENGINE_ERROR_CODE ret;
+    uint32_t i;
+
+    if (elem_count > dattrp->maxcount) {
+        return ENGINE_EOVERFLOW;
+    }
+    it = do_set_item_alloc(engine, dkey, ndkey, dattrp, cookie);
+    if (it == NULL) {
+        return ENGINE_ENOMEM;
+    }
+    old_it = do_item_get(engine, dkey, ndkey, false);
+    if (old_it != NULL) {
+        do_item_unlink(engine, old_it);
+        do_item_release(engine, old_it);
+    }
+    ret = do_item_link(engine, it);
+    if (ret == ENGINE_SUCCESS) {
+        info = (set_meta_info *)item_get_meta(it);
+        if (elem_count > 0) {
+            r_node = do_set_node_alloc(engine, 0, cookie);
+            if (r_node == NULL) {
+                ret = ENGINE_ENOMEM;
+            } else {
+                do_set_node_link(engine, info, NULL, 0, r_node, cookie);
+            }
+        }
+        for (i = 0; i < elem_count && ret == ENGINE_SUCCESS; i++) {
+#ifdef ENABLE_STICKY_ITEM
+            /* sticky memory limit check */
+            if ((info->mflags & COLL_META_FLAG_STICKY) != 0) {
+                if (do_item_sticky_room(engine) == false) {
+                    ret = ENGINE_ENOMEM; break;
+                }
+            }
+#endif
+            elem = do_set_elem_alloc(engine, elem_array[i]->nbytes, cookie);
+            if (elem == NULL) {
+                ret = ENGINE_ENOMEM; break;
+            }
+            memcpy(elem->value, elem_array[i]->value, elem_array[i]->nbytes);
+            ret = do_set_elem_link(engine, info, elem, cookie);
+            do_set_elem_release(engine, elem);
+        }
+        if (ret != ENGINE_SUCCESS) {
+            /* do not leave a partial result */
+            do_item_unlink(engine, it);
+        }
+    }
+    do_item_release(engine, it);
+    return ret;
+}
+
 /*
  * B+TREE collection management
  */
@@ -3353,11 +4651,16 @@ static ENGINE_ERROR_CODE do_btree_elem_replace(struct default_engine *engine, bt
     if (new_stotal > old_stotal) {
         /* sticky memory limit check */
         if ((info->mflags & COLL_META_FLAG_STICKY) != 0) {
-            if (engine->stats.sticky_bytes >= engine->config.sticky_limit)
+            if (do_item_sticky_room(engine) == false)
                 return ENGINE_ENOMEM;
         }
     }
 #endif
+    /* prefix quota check */
+    if (new_stotal > old_stotal) {
+        if (do_coll_prefix_room(engine, (coll_meta_info *)info, new_stotal - old_stotal) == false)
+            return ENGINE_ENOMEM;
+    }
 
     if (old_elem->refcount > 0) {
         old_elem->status = BTREE_ITEM_STATUS_UNLINK;
@@ -3758,10 +5061,15 @@ static ENGINE_ERROR_CODE do_btree_elem_link(struct default_engine *engine,
 #ifdef ENABLE_STICKY_ITEM
         /* sticky memory limit check */
         if ((info->mflags & COLL_META_FLAG_STICKY) != 0) {
-            if (engine->stats.sticky_bytes >= engine->config.sticky_limit)
+            if (do_item_sticky_room(engine) == false)
                 return ENGINE_ENOMEM;
         }
 #endif
+        /* prefix quota check */
+        if (do_coll_prefix_room(engine, (coll_meta_info *)info,
+                                slabs_space_size(engine, BTREE_ELEM_SIZE(elem))) == false) {
+            return ENGINE_ENOMEM;
+        }
 
         if (info->ccnt > 0) { /* overflow check */
             res = do_btree_overflow_check(info, elem, &ovfl_type);
@@ -4614,11 +5922,27 @@ static int check_expired_collections(struct default_engine *engine, const int cl
                     do_item_invalidate(engine, it, id);
                     if (++unlink_count > 10) break;
                 } else {
-                    if (engine->config.evict_to_free != 0) {
-                        do_item_evict(engine, it, id, current_time, NULL);
-                        if (++unlink_count > 10) break;
-                    }
-                }
+                    if (engine->config.lru_second_chance && (it->iflag & ITEM_ACTIVE) != 0) {
+                        /* give it another chance at the LRU head */
+                        it->iflag &= ~ITEM_ACTIVE;
+                        item_unlink_q(engine, it);
+                        item_link_q(engine, it);
+                        engine->items.itemstats[id].second_chances++;
+                    } else if (engine->config.evict_to_free != 0) {
+                        if (engine->config.evict_cost) {
+                            hash_item *victim = do_item_evict_victim(engine, it, current_time);
+                            if (victim != it) {
+                                search = it; /* check it again */
+                            }
+                            if (do_item_evict_trim(engine, victim) == false) {
+                                (void)do_item_evict(engine, victim, id, 0, 0, current_time, NULL);
+                            }
+                        } else {
+                            (void)do_item_evict(engine, it, id, 0, 0, current_time, NULL);
+                        }
+                        if (++unlink_count > 10) break;
+                    }
+                }
             } else {
                 search = search->prev; tries--;
             }
@@ -4628,23 +5952,91 @@ static int check_expired_collections(struct default_engine *engine, const int cl
     return unlink_count;
 }
 
-static void do_coll_all_elem_delete(struct default_engine *engine, hash_item *it)
+static uint32_t do_coll_elem_delete(struct default_engine *engine, hash_item *it,
+                                    const uint32_t count)
 {
+    uint32_t ndeleted = 0;
     if (IS_LIST_ITEM(it)) {
         list_meta_info *info = (list_meta_info *)item_get_meta(it);
-        (void)do_list_elem_delete(engine, info, 0, info->mcnt);
-        assert(info->head == NULL && info->tail == NULL);
+        ndeleted = do_list_elem_delete(engine, info, 0, count);
     } else if (IS_SET_ITEM(it)) {
         set_meta_info *info = (set_meta_info *)item_get_meta(it);
-        (void)do_set_elem_delete(engine, info, info->mcnt);
-        assert(info->root == NULL);
+        ndeleted = do_set_elem_delete(engine, info, count);
     } else if (IS_BTREE_ITEM(it)) {
         btree_meta_info *info = (btree_meta_info *)item_get_meta(it);
         bkey_range bkrange_space;
         get_bkey_full_range(info->bktype, true, &bkrange_space);
-        (void)do_btree_elem_delete(engine, info, BKEY_RANGE_TYPE_ASC, &bkrange_space, NULL, info->mcnt);
-        assert(info->root == NULL);
+        ndeleted = do_btree_elem_delete(engine, info, BKEY_RANGE_TYPE_ASC, &bkrange_space, NULL, count);
+    }
+    return ndeleted;
+}
+
+/*
+ * Trim some elements off the collection as its overflow action does.
+ * Only lists and b+trees trimmed on overflow are trimmed.
+ */
+static uint32_t do_coll_elem_trim(struct default_engine *engine, hash_item *it,
+                                  const uint32_t count)
+{
+    uint32_t ntrimmed = 0;
+    if (IS_LIST_ITEM(it)) {
+        list_meta_info *info = (list_meta_info *)item_get_meta(it);
+        uint32_t tcount = (count < info->ccnt ? count : info->ccnt);
+        if (info->ovflact == OVFL_HEAD_TRIM) {
+            ntrimmed = do_list_elem_delete(engine, info, 0, tcount);
+        } else if (info->ovflact == OVFL_TAIL_TRIM) {
+            ntrimmed = do_list_elem_delete(engine, info, -(int)tcount, tcount);
+        }
+    } else if (IS_BTREE_ITEM(it)) {
+        btree_meta_info *info = (btree_meta_info *)item_get_meta(it);
+        bkey_range bkrange_space;
+        if (info->ovflact == OVFL_SMALLEST_TRIM || info->ovflact == OVFL_SMALLEST_SILENT_TRIM) {
+            get_bkey_full_range(info->bktype, true, &bkrange_space);
+            ntrimmed = do_btree_elem_delete(engine, info, BKEY_RANGE_TYPE_ASC, &bkrange_space, NULL, count);
+        } else if (info->ovflact == OVFL_LARGEST_TRIM || info->ovflact == OVFL_LARGEST_SILENT_TRIM) {
+            get_bkey_full_range(info->bktype, false, &bkrange_space);
+            ntrimmed = do_btree_elem_delete(engine, info, BKEY_RANGE_TYPE_DSC, &bkrange_space, NULL, count);
+        }
+        if (ntrimmed > 0 &&
+            (info->ovflact == OVFL_SMALLEST_TRIM || info->ovflact == OVFL_LARGEST_TRIM)) {
+            info->has_trimmed = 1;
+        }
     }
+    return ntrimmed;
+}
+
+static void do_coll_all_elem_delete(struct default_engine *engine, hash_item *it)
+{
+    /* Called while evicting or reclaiming a collection item under cache_lock.
+     * Only one batch of elements is deleted in place. If the collection has
+     * more elements, it is pushed into the collection delete queue when it is
+     * freed, and the delete thread drops the remaining elements incrementally.
+     */
+    (void)do_coll_elem_delete(engine, it, engine->config.coll_del_batch);
+}
+
+/* max # of batches of elements deleted in place for an allocation */
+#define COLL_DEL_ALLOC_BATCHES 10
+
+static void *do_coll_elem_delete_alloc(struct default_engine *engine, hash_item *it,
+                                       const size_t ntotal, const unsigned int clsid)
+{
+    /* Called while evicting or reclaiming a collection item under cache_lock
+     * to allocate the space of a new item. A batch of elements is not always
+     * enough for it, so the batches are deleted in place until the space is
+     * allocated, up to COLL_DEL_ALLOC_BATCHES batches. The delete thread drops
+     * the remaining elements as in do_coll_all_elem_delete().
+     */
+    coll_meta_info *info = (coll_meta_info *)item_get_meta(it);
+    void *space = NULL;
+    int batches;
+
+    for (batches = 0; batches < COLL_DEL_ALLOC_BATCHES && info->ccnt > 0; batches++) {
+        (void)do_coll_elem_delete(engine, it, engine->config.coll_del_batch);
+        space = slabs_alloc(engine, ntotal, clsid);
+        if (space != NULL) break;
+    }
+    return space;
 }
 
 static void coll_del_thread_sleep(struct default_engine *engine)
@@ -4671,6 +6063,68 @@ static void coll_del_thread_sleep(struct default_engine *engine)
     pthread_mutex_unlock(&engine->coll_del_lock);
 }
 
+/* # of elements deleted at a time within a time-sliced cache lock hold */
+#define COLL_DEL_SLICE_STEP 10
+
+static uint64_t coll_del_elapsed_usec(const struct timeval *start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000
+           + (now.tv_usec - start->tv_usec);
+}
+
+/*
+ * Drop all elements of the given collection item and free it.
+ * The elements are deleted incrementally, so that each cache_lock hold
+ * deletes at most coll_del_batch elements and lasts no longer than
+ * coll_del_slice microseconds (if coll_del_slice is not 0).
+ */
+static void coll_del_item_drop(struct default_engine *engine, hash_item *it)
+{
+    coll_meta_info *info = (coll_meta_info *)item_get_meta(it);
+    struct timeval start;
+    uint64_t elapsed;
+    uint32_t batch_size, step_size;
+    uint32_t deleted;
+    bool dropped = false;
+
+    while (dropped == false) {
+        batch_size = engine->config.coll_del_batch;
+        step_size  = (engine->config.coll_del_slice == 0 ? batch_size
+                      : (batch_size < COLL_DEL_SLICE_STEP ? batch_size : COLL_DEL_SLICE_STEP));
+        deleted = 0;
+
+        pthread_mutex_lock(&engine->cache_lock);
+        gettimeofday(&start, NULL);
+        while (1) {
+            deleted += do_coll_elem_delete(engine, it, step_size);
+            if (info->ccnt == 0) {
+                item_free(engine, it);
+                dropped = true;
+                break;
+            }
+            if (deleted >= batch_size) break;
+            if (engine->config.coll_del_slice != 0 &&
+                coll_del_elapsed_usec(&start) >= engine->config.coll_del_slice) break;
+            if ((batch_size - deleted) < step_size) {
+                step_size = batch_size - deleted;
+            }
+        }
+        pthread_mutex_unlock(&engine->cache_lock);
+        elapsed = coll_del_elapsed_usec(&start);
+
+        pthread_mutex_lock(&engine->stats.lock);
+        engine->stats.coll_del_elems += deleted;
+        engine->stats.coll_del_slices += 1;
+        engine->stats.coll_del_usec += elapsed;
+        if (dropped) {
+            engine->stats.coll_del_items += 1;
+        }
+        pthread_mutex_unlock(&engine->stats.lock);
+    }
+}
+
 static void *collection_delete_thread(void *arg)
 {
     struct default_engine *engine = arg;
@@ -4730,58 +6184,309 @@ static void *collection_delete_thread(void *arg)
             coll_del_thread_sleep(engine);
             continue;
         }
-        if (IS_LIST_ITEM(it)) {
-            bool dropped = false;
-            list_meta_info *info;
-            while (dropped == false) {
-                pthread_mutex_lock(&engine->cache_lock);
-                info = (list_meta_info *)item_get_meta(it);
-                //deleted_cnt = do_list_elem_delete(engine, info, 0, 30);
-                (void)do_list_elem_delete(engine, info, 0, 30);
-                if (info->ccnt == 0) {
-                    assert(info->head == NULL && info->tail == NULL);
-                    item_free(engine, it);
-                    dropped = true;
-                }
-                pthread_mutex_unlock(&engine->cache_lock);
+        coll_del_item_drop(engine, it);
+    }
+    return NULL;
+}
+
+/*
+ * The LRU maintainer thread keeps the segments of each LRU in their shares,
+ * so that neither reads nor allocations have to reorder the LRU lists.
+ * A pass checks all the LRUs in one cache lock hold, and releases the lock
+ * only after a batch of moves in an LRU over its share. So the LRUs with
+ * nothing to move cost no lock round trip of their own.
+ * It sleeps longer while there is nothing to move. Allocations move a few
+ * items as well, so the cold segment keeps filled between the passes.
+ */
+#define LRU_MAINTAINER_MIN_SLEEP 10000   /* 10ms */
+#define LRU_MAINTAINER_MAX_SLEEP 1000000 /* 1s */
+
+static void *lru_maintainer_thread(void *arg)
+{
+    struct default_engine *engine = arg;
+    useconds_t sleep_usec = LRU_MAINTAINER_MIN_SLEEP;
+    int moves, i;
+
+    while (engine->initialized) {
+        moves = 0;
+        pthread_mutex_lock(&engine->cache_lock);
+        for (i = 0; i <= POWER_LARGEST; i++) {
+            if (engine->items.tails[i] == NULL || !do_lru_over_share(engine, i)) {
+                continue;
             }
-        } else if (IS_SET_ITEM(it)) {
-            bool dropped = false;
-            set_meta_info *info;
-            while (dropped == false) {
+            moves += do_lru_juggle(engine, i, LRU_JUGGLE_BATCH);
+            /* let the workers in between the batches */
+            pthread_mutex_unlock(&engine->cache_lock);
+            pthread_mutex_lock(&engine->cache_lock);
+        }
+        pthread_mutex_unlock(&engine->cache_lock);
+        if (moves > 0) {
+            sleep_usec /= 2;
+            if (sleep_usec < LRU_MAINTAINER_MIN_SLEEP)
+                sleep_usec = LRU_MAINTAINER_MIN_SLEEP;
+        } else {
+            sleep_usec *= 2;
+            if (sleep_usec > LRU_MAINTAINER_MAX_SLEEP)
+                sleep_usec = LRU_MAINTAINER_MAX_SLEEP;
+        }
+        usleep(sleep_usec);
+    }
+    return NULL;
+}
+
+/*
+ * The LRU crawler walks each LRU and sticky LRU from the tail upward,
+ * and unlinks the expired or flushed items it meets, so that they don't
+ * wait for an allocation or an access to be reclaimed. The cursor of each
+ * LRU is moved by item_unlink_q() when the item under it is unlinked.
+ */
+#define LRU_CRAWLER_PASS_SLEEP 1000000 /* 1s between two passes */
+
+/* Check up to max_checks items from the cursor, and return the # of them. */
+static int do_lru_crawl(struct default_engine *engine, hash_item **cursor,
+                        const unsigned int lruid, const int max_checks)
+{
+    rel_time_t current_time = engine->server.core->get_current_time();
+    hash_item *search;
+    int checks = 0;
+
+    while (*cursor != NULL && checks < max_checks) {
+        search = *cursor;
+        *cursor = search->prev;
+        checks++;
+        if (search->nkey > 0 && search->refcount == 0 &&
+            do_item_isvalid(engine, search, current_time) == false) {
+            engine->items.itemstats[lruid].crawler_reclaimed++;
+            do_item_unlink(engine, search);
+        }
+    }
+    return checks;
+}
+
+static void *lru_crawler_thread(void *arg)
+{
+    struct default_engine *engine = arg;
+    unsigned int left[MAX_NUMBER_OF_SLAB_CLASSES];
+    unsigned int sticky_left[MAX_NUMBER_OF_SLAB_CLASSES];
+    unsigned int batch_size = engine->config.lru_crawler_batch;
+    unsigned int batch;
+    bool crawling;
+    int i, checks;
+
+    while (engine->initialized) {
+        /* start a pass: visit the items present at the start only,
+         * or a pass may never end under heavy stores.
+         */
+        pthread_mutex_lock(&engine->cache_lock);
+        for (i = 0; i <= POWER_LARGEST; i++) {
+            engine->items.crawl[i] = engine->items.tails[i];
+            engine->items.sticky_crawl[i] = engine->items.sticky_tails[i];
+            left[i] = engine->items.sizes[i];
+            sticky_left[i] = engine->items.sticky_sizes[i];
+        }
+        pthread_mutex_unlock(&engine->cache_lock);
+
+        crawling = true;
+        while (crawling && engine->initialized) {
+            crawling = false;
+            for (i = 0; i <= POWER_LARGEST; i++) {
+                if (left[i] == 0 && sticky_left[i] == 0) continue;
                 pthread_mutex_lock(&engine->cache_lock);
-                info = (set_meta_info *)item_get_meta(it);
-                //deleted_cnt = do_set_elem_delete(engine, info, 30);
-                (void)do_set_elem_delete(engine, info, 30);
-                if (info->ccnt == 0) {
-                    assert(info->root == NULL);
-                    item_free(engine, it);
-                    dropped = true;
+                if (left[i] > 0) {
+                    batch = (left[i] < batch_size ? left[i] : batch_size);
+                    checks = do_lru_crawl(engine, &engine->items.crawl[i], i, batch);
+                    left[i] = (checks == 0 ? 0 : left[i] - checks);
+                }
+                if (sticky_left[i] > 0) {
+                    batch = (sticky_left[i] < batch_size ? sticky_left[i] : batch_size);
+                    checks = do_lru_crawl(engine, &engine->items.sticky_crawl[i], i, batch);
+                    sticky_left[i] = (checks == 0 ? 0 : sticky_left[i] - checks);
                 }
                 pthread_mutex_unlock(&engine->cache_lock);
+                if (left[i] > 0 || sticky_left[i] > 0) {
+                    crawling = true;
+                }
+            }
+            if (crawling && engine->config.lru_crawler_sleep > 0) {
+                usleep(engine->config.lru_crawler_sleep);
             }
         }
-        else if (IS_BTREE_ITEM(it)) {
-            bkey_range bkrange_space;
-            bool dropped = false;
-            btree_meta_info *info = (btree_meta_info *)item_get_meta(it);
-            get_bkey_full_range(info->bktype, true, &bkrange_space);
-            while (dropped == false) {
-                pthread_mutex_lock(&engine->cache_lock);
-                info = (btree_meta_info *)item_get_meta(it);
-                //deleted_cnt = do_btree_elem_delete(engine, info, BKEY_RANGE_TYPE_ASC, &bkrange_space, NULL, 100);
-                (void)do_btree_elem_delete(engine, info, BKEY_RANGE_TYPE_ASC, &bkrange_space, NULL, 100);
-                if (info->ccnt == 0) {
-                    assert(info->root == NULL);
-                    item_free(engine, it);
-                    dropped = true;
-                }
+
+        pthread_mutex_lock(&engine->cache_lock);
+        for (i = 0; i <= POWER_LARGEST; i++) {
+            engine->items.crawl[i] = NULL;
+            engine->items.sticky_crawl[i] = NULL;
+        }
+        pthread_mutex_unlock(&engine->cache_lock);
+        usleep(LRU_CRAWLER_PASS_SLEEP);
+    }
+    return NULL;
+}
+
+/*
+ * The item expire thread runs the expiration wheel as time goes.
+ * It unlinks at most WHEEL_EXPIRE_BATCH items per cache lock hold.
+ */
+#define WHEEL_EXPIRE_BATCH 100
+#define WHEEL_EXPIRE_SLEEP 100000 /* 100ms */
+
+static void *item_expire_thread(void *arg)
+{
+    struct default_engine *engine = arg;
+    bool caught_up;
+
+    while (engine->initialized) {
+        pthread_mutex_lock(&engine->cache_lock);
+        caught_up = do_item_wheel_expire(engine, WHEEL_EXPIRE_BATCH);
+        pthread_mutex_unlock(&engine->cache_lock);
+        if (caught_up) {
+            usleep(WHEEL_EXPIRE_SLEEP);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * The prefix flush thread reclaims the items flushed by flush_prefix.
+ * It unlinks at most PREFIX_FLUSH_BATCH items per cache lock hold,
+ * and waits on cache_lock to be woken up by the next flush_prefix.
+ */
+#define PREFIX_FLUSH_BATCH 100
+#define PREFIX_FLUSH_WAIT  100000 /* 100ms */
+
+static void *prefix_flush_thread(void *arg)
+{
+    struct default_engine *engine = arg;
+    struct timeval  tv;
+    struct timespec to;
+
+    pthread_mutex_lock(&engine->cache_lock);
+    while (engine->initialized) {
+        if (do_item_flush_prefix_reclaim(engine, PREFIX_FLUSH_BATCH) > 0) {
+            /* let the workers in between the batches */
+            pthread_mutex_unlock(&engine->cache_lock);
+            pthread_mutex_lock(&engine->cache_lock);
+            continue;
+        }
+        gettimeofday(&tv, NULL);
+        tv.tv_usec += PREFIX_FLUSH_WAIT;
+        if (tv.tv_usec >= 1000000) {
+            tv.tv_sec += 1;
+            tv.tv_usec -= 1000000;
+        }
+        to.tv_sec = tv.tv_sec;
+        to.tv_nsec = tv.tv_usec * 1000;
+        pthread_cond_timedwait(&engine->prefix_flush_cond, &engine->cache_lock, &to);
+    }
+    pthread_mutex_unlock(&engine->cache_lock);
+    return NULL;
+}
+
+#ifdef ENABLE_STICKY_ITEM
+/*
+ * The sticky manager reclaims invalid sticky items in the background,
+ * once a flush_all takes effect or while the sticky space is over
+ * STICKY_RECLAIM_PCT of sticky_limit. A pass walks the sticky LRUs from
+ * the tails, checking at most STICKY_RECLAIM_BATCH items per cache lock
+ * hold. A pass that reclaims nothing backs off up to STICKY_MANAGER_IDLE.
+ */
+#define STICKY_RECLAIM_BATCH 100
+#define STICKY_MANAGER_WAIT  100000 /* 100ms */
+#define STICKY_MANAGER_IDLE  64     /* max backoff in seconds */
+
+static int do_sticky_reclaim(struct default_engine *engine, const unsigned int lruid,
+                             const int max_checks, int *reclaimed)
+{
+    rel_time_t current_time = engine->server.core->get_current_time();
+    hash_item **cursor = &engine->items.sticky_reclaim[lruid];
+    hash_item *search;
+    int checks = 0;
+
+    while (*cursor != NULL && checks < max_checks) {
+        search = *cursor;
+        *cursor = search->prev;
+        checks++;
+        if (search->nkey > 0 && search->refcount == 0 &&
+            do_item_isvalid(engine, search, current_time) == false) {
+            engine->items.itemstats[lruid].sticky_reclaimed++;
+            do_item_unlink(engine, search);
+            (*reclaimed)++;
+        }
+    }
+    return checks;
+}
+
+static void *sticky_manager_thread(void *arg)
+{
+    struct default_engine *engine = arg;
+    unsigned int left[MAX_NUMBER_OF_SLAB_CLASSES];
+    rel_time_t flushed = 0; /* the oldest_live of the last flush handled */
+    rel_time_t current_time;
+    rel_time_t resume = 0;  /* no watermark pass before this time */
+    unsigned int backoff = 0;
+    unsigned int batch;
+    struct timeval  tv;
+    struct timespec to;
+    bool crawling;
+    int i, checks, reclaimed;
+
+    pthread_mutex_lock(&engine->cache_lock);
+    while (engine->initialized) {
+        current_time = engine->server.core->get_current_time();
+        if (engine->config.oldest_live != 0 && engine->config.oldest_live != flushed &&
+            engine->config.oldest_live <= current_time) {
+            flushed = engine->config.oldest_live;
+        } else if (current_time < resume || engine->config.sticky_limit == 0 ||
+                   engine->stats.sticky_bytes < (engine->config.sticky_limit / 100) * STICKY_RECLAIM_PCT) {
+            /* nothing to do, or backing off */
+            gettimeofday(&tv, NULL);
+            tv.tv_usec += STICKY_MANAGER_WAIT;
+            if (tv.tv_usec >= 1000000) {
+                tv.tv_sec += 1;
+                tv.tv_usec -= 1000000;
+            }
+            to.tv_sec = tv.tv_sec;
+            to.tv_nsec = tv.tv_usec * 1000;
+            pthread_cond_timedwait(&engine->sticky_cond, &engine->cache_lock, &to);
+            continue;
+        }
+
+        /* start a pass: visit the sticky items present at the start only */
+        for (i = 0; i <= POWER_LARGEST; i++) {
+            engine->items.sticky_reclaim[i] = engine->items.sticky_tails[i];
+            left[i] = engine->items.sticky_sizes[i];
+        }
+        reclaimed = 0;
+        crawling = true;
+        while (crawling && engine->initialized) {
+            crawling = false;
+            for (i = 0; i <= POWER_LARGEST; i++) {
+                if (left[i] == 0) continue;
+                batch = (left[i] < STICKY_RECLAIM_BATCH ? left[i] : STICKY_RECLAIM_BATCH);
+                checks = do_sticky_reclaim(engine, i, batch, &reclaimed);
+                left[i] = (engine->items.sticky_reclaim[i] == NULL || checks >= left[i])
+                        ? 0 : left[i] - checks;
+                if (left[i] > 0) crawling = true;
+                /* let the workers in between the batches */
                 pthread_mutex_unlock(&engine->cache_lock);
+                pthread_mutex_lock(&engine->cache_lock);
             }
         }
+        for (i = 0; i <= POWER_LARGEST; i++) {
+            engine->items.sticky_reclaim[i] = NULL;
+        }
+        if (reclaimed == 0) {
+            /* the sticky space is full of valid items */
+            backoff = (backoff == 0 ? 1 : (backoff < STICKY_MANAGER_IDLE ? backoff * 2 : backoff));
+            resume = current_time + backoff;
+        } else {
+            backoff = 0;
+        }
     }
+    pthread_mutex_unlock(&engine->cache_lock);
     return NULL;
 }
+#endif
 
 void coll_del_thread_wakeup(struct default_engine *engine)
 {
@@ -4793,6 +6498,15 @@ void coll_del_thread_wakeup(struct default_engine *engine)
     pthread_mutex_unlock(&engine->coll_del_lock);
 }
 
+unsigned int item_coll_del_queue_size(struct default_engine *engine)
+{
+    unsigned int size;
+    pthread_mutex_lock(&engine->coll_del_lock);
+    size = engine->coll_del_queue.size;
+    pthread_mutex_unlock(&engine->coll_del_lock);
+    return size;
+}
+
 /********************************* ITEM ACCESS *******************************/
 
 /*
@@ -4942,7 +6656,25 @@ ENGINE_ERROR_CODE arithmetic(struct default_engine *engine,
 }
 
 /*
- * Flushes expired items after a flush_all call
+ * Check if the item belongs to the given prefix of flush_prefix.
+ * A negative nprefix is of flush_all, which takes every item.
+ */
+static bool do_item_of_prefix(struct default_engine *engine, hash_item *it,
+                              const char *prefix, const int nprefix)
+{
+    if (nprefix < 0) { /* flush all */
+        return true;
+    }
+    if (nprefix == 0) { /* null prefix */
+        return (it->nprefix == it->nkey);
+    }
+    char *key = (char*)item_get_key(it);
+    return (it->nkey > nprefix && memcmp(prefix, key, nprefix) == 0 &&
+            *(key + nprefix) == engine->config.prefix_delimiter);
+}
+
+/*
+ * Flushes expired items after a flush_all or flush_prefix call
  */
 
 static ENGINE_ERROR_CODE do_item_flush_expired(struct default_engine *engine,
@@ -4951,6 +6683,14 @@ static ENGINE_ERROR_CODE do_item_flush_expired(struct default_engine *engine,
 {
     hash_item *iter, *next;
     rel_time_t oldest_live;
+    /* A segmented or second chance LRU is not sorted in time order, so the
+     * items touched in the last second can be anywhere in it. The CAS checking
+     * expires them, but without CAS they are flushed by time as well, like
+     * memcached does, rather than walking the whole LRU under the cache lock.
+     * Then the items stored in the rest of the second are flushed, too.
+     */
+    bool time_only = ((engine->config.lru_segmented || engine->config.lru_second_chance) &&
+                      !engine->config.use_cas);
 
     if (nprefix >= 0) { /* flush the given prefix */
         prefix_t *pt;
@@ -4966,8 +6706,17 @@ static ENGINE_ERROR_CODE do_item_flush_expired(struct default_engine *engine,
         }
 
         if (when <= 0) {
-            pt->oldest_live = engine->server.core->get_current_time() - 1;
+            pt->oldest_live = engine->server.core->get_current_time() - (time_only ? 0 : 1);
+            pt->oldest_cas = cas_id + 1;
+            if (engine->config.prefix_lists) {
+                /* The prefix links its own items. Hand them over to
+                 * the prefix flush thread instead of walking the LRUs.
+                 */
+                assoc_prefix_flush_mark(engine, pt);
+                pthread_cond_signal(&engine->prefix_flush_cond);
+            }
         } else {
+            /* The oldest_live checking will auto-expire the items. */
             pt->oldest_live = engine->server.core->realtime(when) - 1;
         }
         oldest_live = pt->oldest_live;
@@ -4976,9 +6725,16 @@ static ENGINE_ERROR_CODE do_item_flush_expired(struct default_engine *engine,
             logger->log(EXTENSION_LOG_INFO, NULL, "flush prefix=%s when=%u client_ip=%s",
                         ((prefix==NULL) ? "null" : prefix), (unsigned)when, engine->server.core->get_client_ip(cookie));
         }
+        if (engine->config.prefix_lists) {
+            return ENGINE_SUCCESS;
+        }
     } else { /* flush all */
         if (when <= 0) {
-            engine->config.oldest_live = engine->server.core->get_current_time() - 1;
+            engine->config.oldest_live = engine->server.core->get_current_time() - (time_only ? 0 : 1);
+            engine->config.oldest_cas = cas_id + 1;
+#ifdef ENABLE_STICKY_ITEM
+            pthread_cond_signal(&engine->sticky_cond);
+#endif
         } else {
             engine->config.oldest_live = engine->server.core->realtime(when) - 1;
         }
@@ -4999,28 +6755,14 @@ static ENGINE_ERROR_CODE do_item_flush_expired(struct default_engine *engine,
              * only need to walk back until we hit an item older than the
              * oldest_live time.
              * The oldest_live checking will auto-expire the remaining items.
+             * With time_only, every item is expired by the oldest_live time.
              */
             for (iter = engine->items.heads[i]; iter != NULL; iter = next) {
-                if (iter->time >= oldest_live) {
-                    next = iter->next;
-                    if (nprefix >= 0) {
-                        bool found = false;
-                        if (nprefix == 0) {
-                            if (iter->nprefix == iter->nkey)
-                                found = true;
-                        } else { /* nprefix > 0 */
-                            char *iter_key = (char*)item_get_key(iter);
-                            if (iter->nkey > nprefix && memcmp(prefix,iter_key,nprefix) == 0 &&
-                                *(iter_key + nprefix) == engine->config.prefix_delimiter)
-                                found = true;
-                        }
-                        if (found == true && (iter->iflag & ITEM_SLABBED) == 0) {
-                            do_item_unlink(engine, iter);
-                        }
-                    } else { /* flush all */
-                        if ((iter->iflag & ITEM_SLABBED) == 0) {
-                            do_item_unlink(engine, iter);
-                        }
+                next = iter->next;
+                if (iter->time >= oldest_live && !time_only) {
+                    if ((iter->iflag & ITEM_SLABBED) == 0 &&
+                        do_item_of_prefix(engine, iter, prefix, nprefix)) {
+                        do_item_unlink(engine, iter);
                     }
                 } else {
                     /* We've hit the first old item. Continue to the next queue. */
@@ -5034,25 +6776,9 @@ static ENGINE_ERROR_CODE do_item_flush_expired(struct default_engine *engine,
             for (iter = engine->items.sticky_heads[i]; iter != NULL; iter = next) {
                 if (iter->time >= oldest_live) {
                     next = iter->next;
-
-                    if (nprefix >= 0) {
-                        bool found = false;
-                        if (nprefix == 0) {
-                            if (iter->nprefix == iter->nkey)
-                                found = true;
-                        } else { /* nprefix > 0 */
-                            char *iter_key = (char*)item_get_key(iter);
-                            if (iter->nkey > nprefix && memcmp(prefix,iter_key,nprefix) == 0 &&
-                                *(iter_key + nprefix) == engine->config.prefix_delimiter)
-                                found = true;
-                        }
-                        if (found == true && (iter->iflag & ITEM_SLABBED) == 0) {
-                            do_item_unlink(engine, iter);
-                        }
-                    } else { /* flush all */
-                        if ((iter->iflag & ITEM_SLABBED) == 0) {
-                            do_item_unlink(engine, iter);
-                        }
+                    if ((iter->iflag & ITEM_SLABBED) == 0 &&
+                        do_item_of_prefix(engine, iter, prefix, nprefix)) {
+                        do_item_unlink(engine, iter);
                     }
                 } else {
                     /* We've hit the first old item. Continue to the next queue. */
@@ -5067,6 +6793,31 @@ static ENGINE_ERROR_CODE do_item_flush_expired(struct default_engine *engine,
     return ENGINE_SUCCESS;
 }
 
+/*
+ * Unlink up to max_items items marked by flush_prefix, the oldest first.
+ * Returns the number of items unlinked.
+ */
+static int do_item_flush_prefix_reclaim(struct default_engine *engine, const int max_items)
+{
+    prefix_t *pt;
+    int count = 0;
+
+    while (count < max_items) {
+        /* look up the queue again, the prefix is freed with its last item */
+        if ((pt = assoc_prefix_flush_next(engine)) == NULL) {
+            break;
+        }
+        do_item_unlink(engine, pt->items_tail);
+        count++;
+    }
+    if (count > 0) {
+        pthread_mutex_lock(&engine->stats.lock);
+        engine->stats.flush_prefix_reclaimed += count;
+        pthread_mutex_unlock(&engine->stats.lock);
+    }
+    return count;
+}
+
 void item_flush_expired(struct default_engine *engine, time_t when, const void* cookie)
 {
     pthread_mutex_lock(&engine->cache_lock);
@@ -5126,6 +6877,20 @@ ENGINE_ERROR_CODE item_init(struct default_engine *engine)
     engine->coll_del_queue.head = engine->coll_del_queue.tail = NULL;
     engine->coll_del_queue.size = 0;
     engine->coll_del_sleep = false;
+    pthread_cond_init(&engine->prefix_flush_cond, NULL);
+#ifdef ENABLE_STICKY_ITEM
+    pthread_cond_init(&engine->sticky_cond, NULL);
+#endif
+
+    if (engine->config.lru_admission) {
+        engine->items.sketch = calloc(LFU_SKETCH_BYTES, sizeof(uint8_t));
+        if (engine->items.sketch == NULL) {
+            fprintf(stderr, "Can't allocate the admission sketch\n");
+            return ENGINE_ENOMEM;
+        }
+    }
+
+    engine->items.sample_seed = (unsigned int)(time(NULL) ^ getpid());
 
     pthread_t tid;
     int ret = pthread_create(&tid, NULL, collection_delete_thread, engine);
@@ -5133,6 +6898,42 @@ ENGINE_ERROR_CODE item_init(struct default_engine *engine)
         fprintf(stderr, "Can't create thread: %s\n", strerror(ret));
         return ENGINE_FAILED;
     }
+    if (engine->config.prefix_lists) {
+        ret = pthread_create(&tid, NULL, prefix_flush_thread, engine);
+        if (ret != 0) {
+            fprintf(stderr, "Can't create thread: %s\n", strerror(ret));
+            return ENGINE_FAILED;
+        }
+    }
+#ifdef ENABLE_STICKY_ITEM
+    ret = pthread_create(&tid, NULL, sticky_manager_thread, engine);
+    if (ret != 0) {
+        fprintf(stderr, "Can't create thread: %s\n", strerror(ret));
+        return ENGINE_FAILED;
+    }
+#endif
+    if (engine->config.expire_wheel) {
+        engine->items.wheel_time = engine->server.core->get_current_time();
+        ret = pthread_create(&tid, NULL, item_expire_thread, engine);
+        if (ret != 0) {
+            fprintf(stderr, "Can't create thread: %s\n", strerror(ret));
+            return ENGINE_FAILED;
+        }
+    }
+    if (engine->config.lru_segmented) {
+        ret = pthread_create(&tid, NULL, lru_maintainer_thread, engine);
+        if (ret != 0) {
+            fprintf(stderr, "Can't create thread: %s\n", strerror(ret));
+            return ENGINE_FAILED;
+        }
+    }
+    if (engine->config.lru_crawler) {
+        ret = pthread_create(&tid, NULL, lru_crawler_thread, engine);
+        if (ret != 0) {
+            fprintf(stderr, "Can't create thread: %s\n", strerror(ret));
+            return ENGINE_FAILED;
+        }
+    }
     return ENGINE_SUCCESS;
 }
 
@@ -5219,7 +7020,7 @@ ENGINE_ERROR_CODE list_elem_insert(struct default_engine *engine,
 #ifdef ENABLE_STICKY_ITEM
             /* sticky memory limit check */
             if ((info->mflags & COLL_META_FLAG_STICKY) != 0) {
-                if (engine->stats.sticky_bytes >= engine->config.sticky_limit) {
+                if (do_item_sticky_room(engine) == false) {
                     ret = ENGINE_ENOMEM; break;
                 }
             }
@@ -5475,7 +7276,7 @@ ENGINE_ERROR_CODE set_elem_insert(struct default_engine *engine, const char *key
 #ifdef ENABLE_STICKY_ITEM
             /* sticky memory limit check */
             if ((info->mflags & COLL_META_FLAG_STICKY) != 0) {
-                if (engine->stats.sticky_bytes >= engine->config.sticky_limit) {
+                if (do_item_sticky_room(engine) == false) {
                     ret = ENGINE_ENOMEM; break;
                 }
             }
@@ -5514,7 +7315,7 @@ ENGINE_ERROR_CODE set_elem_insert(struct default_engine *engine, const char *key
                     }
                     ret = ENGINE_ENOMEM; break;
                 }
-                do_set_node_link(engine, info, NULL, 0, r_node);
+                do_set_node_link(engine, info, NULL, 0, r_node, cookie);
                 new_root_flag = true;
             }
 
@@ -5522,7 +7323,7 @@ ENGINE_ERROR_CODE set_elem_insert(struct default_engine *engine, const char *key
             if (ret != ENGINE_SUCCESS) {
                 if (new_root_flag) {
                     /* unlink the root node and free it */
-                    do_set_node_unlink(engine, info, NULL, 0);
+                    do_set_node_unlink(engine, info, NULL, 0, false);
                 }
                 if (*created) {
                     /* unlink the created set item and free it*/
@@ -5598,6 +7399,103 @@ ENGINE_ERROR_CODE set_elem_exist(struct default_engine *engine,
     return ret;
 }
 
+ENGINE_ERROR_CODE set_elem_mexist(struct default_engine *engine,
+                                  const char *key, const size_t nkey,
+                                  token_t *value_array, const int value_count,
+                                  bool *exist_array)
+{
+    hash_item     *it;
+    set_meta_info *info;
+    ENGINE_ERROR_CODE ret;
+
+    pthread_mutex_lock(&engine->cache_lock);
+    ret = do_set_item_find(engine, key, nkey, true, &it);
+    if (ret == ENGINE_SUCCESS) {
+        info = (set_meta_info *)item_get_meta(it);
+        do {
+            if ((info->mflags & COLL_META_FLAG_READABLE) == 0) {
+                ret = ENGINE_UNREADABLE; break;
+            }
+            do_set_elem_mfind(info, value_array, value_count, exist_array);
+        } while (0);
+        do_item_release(engine, it);
+    }
+    pthread_mutex_unlock(&engine->cache_lock);
+    return ret;
+}
+
+ENGINE_ERROR_CODE set_elem_setop(struct default_engine *engine,
+                                 const ENGINE_SET_OPERATION setop,
+                                 token_t *key_array, const int key_count,
+                                 const char *dkey, const size_t ndkey, item_attr *dattrp,
+                                 set_elem_item ***elem_array, uint32_t *elem_count,
+                                 const void *cookie)
+{
+    hash_item    **its;
+    set_meta_info **infos;
+    set_setop_ctx  ctx;
+    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
+    uint32_t i;
+    int k;
+
+    its = (hash_item **)malloc(key_count * (sizeof(hash_item *) + sizeof(set_meta_info *)));
+    if (its == NULL) {
+        return ENGINE_ENOMEM;
+    }
+    infos = (set_meta_info **)&its[key_count];
+
+    pthread_mutex_lock(&engine->cache_lock);
+    for (k = 0; k < key_count; k++) {
+        ret = do_set_item_find(engine, key_array[k].value, key_array[k].length, true, &its[k]);
+        if (ret == ENGINE_SUCCESS) {
+            infos[k] = (set_meta_info *)item_get_meta(its[k]);
+            if ((infos[k]->mflags & COLL_META_FLAG_READABLE) == 0) {
+                ret = ENGINE_UNREADABLE; k++; break;
+            }
+        } else if (ret == ENGINE_KEY_ENOENT) {
+            /* a missing set is regarded as an empty set */
+            infos[k] = NULL;
+            ret = ENGINE_SUCCESS;
+        } else { /* ENGINE_EBADTYPE */
+            break;
+        }
+    }
+
+    if (ret == ENGINE_SUCCESS) {
+        ctx.setop = setop;
+        ctx.infos = infos;
+        ctx.count = key_count;
+        ctx.collect = (elem_array != NULL || dkey != NULL);
+        ctx.elem_array = NULL;
+        ctx.elem_size = 0;
+        ctx.elem_count = 0;
+        ret = do_set_setop(&ctx);
+        if (ret == ENGINE_SUCCESS && dkey != NULL) {
+            ret = do_set_setop_store(engine, dkey, ndkey, dattrp,
+                                     ctx.elem_array, ctx.elem_count, cookie);
+        }
+        if (ret == ENGINE_SUCCESS) {
+            *elem_count = ctx.elem_count;
+        }
+        if (ret == ENGINE_SUCCESS && dkey == NULL && elem_array != NULL) {
+            /* the caller releases the elements and frees the array */
+            *elem_array = ctx.elem_array;
+        } else if (ctx.elem_array != NULL) {
+            for (i = 0; i < ctx.elem_count; i++) {
+                do_set_elem_release(engine, ctx.elem_array[i]);
+            }
+            free(ctx.elem_array);
+        }
+    }
+
+    while (--k >= 0) {
+        if (its[k] != NULL) do_item_release(engine, its[k]);
+    }
+    pthread_mutex_unlock(&engine->cache_lock);
+    free(its);
+    return ret;
+}
+
 ENGINE_ERROR_CODE set_elem_get(struct default_engine *engine,
                                const char *key, const size_t nkey, const uint32_t count,
                                const bool delete, const bool drop_if_empty,
@@ -5636,6 +7534,40 @@ ENGINE_ERROR_CODE set_elem_get(struct default_engine *engine,
     return ret;
 }
 
+ENGINE_ERROR_CODE set_elem_sample(struct default_engine *engine,
+                                  const char *key, const size_t nkey, const uint32_t count,
+                                  set_elem_item **elem_array, uint32_t *elem_count,
+                                  uint32_t *flags)
+{
+    hash_item     *it;
+    set_meta_info *info;
+    ENGINE_ERROR_CODE ret;
+    int scnt;
+
+    pthread_mutex_lock(&engine->cache_lock);
+    ret = do_set_item_find(engine, key, nkey, true, &it);
+    if (ret == ENGINE_SUCCESS) {
+        info = (set_meta_info *)item_get_meta(it);
+        do {
+            if ((info->mflags & COLL_META_FLAG_READABLE) == 0) {
+                ret = ENGINE_UNREADABLE; break;
+            }
+            scnt = do_set_elem_sample(engine, info, count, elem_array);
+            if (scnt < 0) {
+                ret = ENGINE_ENOMEM; break;
+            }
+            if (scnt == 0) {
+                ret = ENGINE_ELEM_ENOENT; break;
+            }
+            *elem_count = (uint32_t)scnt;
+            *flags = it->flags;
+        } while (0);
+        do_item_release(engine, it);
+    }
+    pthread_mutex_unlock(&engine->cache_lock);
+    return ret;
+}
+
 /*
  * B+TREE Interface Functions
  */
@@ -6326,6 +8258,7 @@ ENGINE_ERROR_CODE item_setattr(struct default_engine *engine,
             for (i = 0; i < attr_count; i++) {
                 if (attr_ids[i] == ATTR_EXPIRETIME) {
                     if (it->exptime != attr_data->exptime) {
+                        item_wheel_unlink(engine, it);
                         if (attr_data->exptime == 0 || it->exptime == 0) {
                             it->exptime = attr_data->exptime;
                             /* reposition it in LRU in order to keep curMK/lowMK concept. */
@@ -6333,6 +8266,7 @@ ENGINE_ERROR_CODE item_setattr(struct default_engine *engine,
                         } else {
                             it->exptime = attr_data->exptime;
                         }
+                        item_wheel_link(engine, it);
                     }
                 }
                 else if (attr_ids[i] == ATTR_MAXCOUNT) {
@@ -39,6 +39,22 @@ typedef struct _hash_item {
                          */
 } hash_item;
 
+/*
+ * The chains of an item other than the LRU and hash chains. They follow
+ * the header (and the CAS) of every item only if the expiration wheel or
+ * the prefix item lists are turned on.
+ */
+typedef struct _item_links {
+    struct _hash_item *x_next;   /* expiration wheel chain next */
+    struct _hash_item **x_pprev; /* expiration wheel chain prev's next */
+    struct _hash_item *p_next;   /* prefix chain next (older) */
+    struct _hash_item *p_prev;   /* prefix chain prev (newer) */
+} item_links;
+
+/* size of the item header, the links included */
+#define ITEM_HEADER_SIZE(e) \
+        (sizeof(hash_item) + ((e)->config.item_links ? sizeof(item_links) : 0))
+
 /* list element */
 typedef struct _list_elem_item {
     unsigned short refcount;      /* reference count */
@@ -54,9 +70,9 @@ typedef struct _list_elem_item {
 typedef struct _set_elem_item {
     unsigned short refcount;      /* reference count */
     uint8_t  slabs_clsid;         /* which slab class we're in */
+    uint8_t  status;              /* 1(linked) or 0(unlinked) */
     uint32_t hval;                /* hash value */
-    struct _set_elem_item *next;  /* hash chain next */
-    uint32_t nbytes;              /**< The total size of the data (in bytes) */
+    uint16_t nbytes;              /**< The total size of the data (in bytes) */
     char     value[1];            /**< the data itself */
 } set_elem_item;
 
@@ -97,7 +113,26 @@ typedef struct _list_meta_info {
 /* set meta info */
 #define SET_HASHTAB_SIZE 16
 #define SET_HASHIDX_MASK 0x0000000F
-#define SET_MAX_HASHCHAIN_SIZE 64
+#define SET_MIN_GROUP_SIZE 4
+#define SET_MAX_GROUP_SIZE 128
+
+/* set element group : the elements of a hash bucket.
+ * The element slots are kept dense and each slot has a 16-bit hash tag
+ * placed right after the element pointers. The tag array is scanned
+ * before comparing element values.
+ */
+typedef struct _set_elem_group {
+    unsigned short refcount;      /* reference count */
+    uint8_t  slabs_clsid;         /* which slab class we're in */
+    uint8_t  capacity;            /* # of slots : multiple of 4 */
+    uint16_t count;               /* # of used slots */
+    uint16_t dummy;
+    set_elem_item *elem[1];       /* elem[capacity], followed by tag[capacity] */
+} set_elem_group;
+
+#define SET_GROUP_SIZE(capacity) \
+        (offsetof(set_elem_group, elem) + (capacity)*(sizeof(set_elem_item *)+sizeof(uint16_t)))
+#define SET_GROUP_TAGS(grp) ((uint16_t *)&(grp)->elem[(grp)->capacity])
 
 typedef struct _set_hash_node {
     unsigned short refcount;      /* reference count */
@@ -105,6 +140,7 @@ typedef struct _set_hash_node {
     uint8_t  hdepth;
     uint16_t tot_elem_cnt;
     uint16_t tot_hash_cnt;
+    uint32_t sub_elem_cnt;        /* elements in the subtree rooted at this node */
     int16_t  hcnt[SET_HASHTAB_SIZE];
     void    *htab[SET_HASHTAB_SIZE];
 } set_hash_node;
@@ -179,6 +215,16 @@ typedef struct _btree_scan_info {
     uint32_t         kidx; /* An index in the given key array as a parameter */
 } btree_scan_info;
 
+/* hierarchical timer wheel of the expirable items:
+ * 256 slots of 1 second, and 3 levels of 64 slots of 256, 16384 and 1048576 seconds.
+ */
+#define WHEEL_L0_BITS  8
+#define WHEEL_LN_BITS  6
+#define WHEEL_LEVELS   4
+#define WHEEL_L0_SIZE  (1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SIZE  (1 << WHEEL_LN_BITS)
+#define WHEEL_SLOTS    (WHEEL_L0_SIZE + (WHEEL_LEVELS - 1) * WHEEL_LN_SIZE)
+
 /* common meta info of list and set */
 typedef struct _coll_meta_info {
     int32_t  mcnt;      /* maximum count */
@@ -198,6 +244,12 @@ typedef struct {
     unsigned int outofmemory;
     unsigned int tailrepairs;
     unsigned int reclaimed;
+    unsigned int moves_to_cold;
+    unsigned int moves_to_warm;
+    unsigned int moves_within_warm;
+    unsigned int crawler_reclaimed;
+    unsigned int second_chances;
+    unsigned int sticky_reclaimed;
 } itemstats_t;
 
 struct items {
@@ -206,13 +258,26 @@ struct items {
    hash_item   *lowMK[MAX_NUMBER_OF_SLAB_CLASSES]; /* low mark for invalidation(expire/flush) check */
    hash_item   *curMK[MAX_NUMBER_OF_SLAB_CLASSES]; /* cur mark for invalidation(expire/flush) check */
    hash_item   *scrub[MAX_NUMBER_OF_SLAB_CLASSES]; /* scrub mark */
+   hash_item   *warm[MAX_NUMBER_OF_SLAB_CLASSES];  /* first item of the warm segment */
+   hash_item   *cold[MAX_NUMBER_OF_SLAB_CLASSES];  /* first item of the cold segment */
    hash_item   *sticky_heads[MAX_NUMBER_OF_SLAB_CLASSES];
    hash_item   *sticky_tails[MAX_NUMBER_OF_SLAB_CLASSES];
    hash_item   *sticky_curMK[MAX_NUMBER_OF_SLAB_CLASSES]; /* cur mark for invalidation(expire/flush) check */
    hash_item   *sticky_scrub[MAX_NUMBER_OF_SLAB_CLASSES]; /* scrub mark */
+   hash_item   *crawl[MAX_NUMBER_OF_SLAB_CLASSES];        /* LRU crawler cursor */
+   hash_item   *sticky_crawl[MAX_NUMBER_OF_SLAB_CLASSES]; /* LRU crawler cursor */
+   hash_item   *sticky_reclaim[MAX_NUMBER_OF_SLAB_CLASSES]; /* sticky manager cursor */
+   uint64_t     sticky_bytes[MAX_NUMBER_OF_SLAB_CLASSES];   /* sticky space of each LRU */
    unsigned int sizes[MAX_NUMBER_OF_SLAB_CLASSES];
    unsigned int sticky_sizes[MAX_NUMBER_OF_SLAB_CLASSES];
+   unsigned int hot_sizes[MAX_NUMBER_OF_SLAB_CLASSES];
+   unsigned int warm_sizes[MAX_NUMBER_OF_SLAB_CLASSES];
    itemstats_t  itemstats[MAX_NUMBER_OF_SLAB_CLASSES];
+   uint8_t     *sketch;      /* count-min sketch of recent key accesses, 2 counters a byte */
+   uint32_t     sketch_adds; /* # of sketch increments since the last aging */
+   hash_item   *wheel[WHEEL_SLOTS]; /* expiration wheel slots */
+   rel_time_t   wheel_time;         /* the time of the next wheel slot to expire */
+   unsigned int sample_seed;        /* rand_r() state of set element sampling */
 };
 
 /* item queue */
@@ -350,6 +415,8 @@ ENGINE_ERROR_CODE add_delta(struct default_engine *engine, hash_item *item, cons
 
 void coll_del_thread_wakeup(struct default_engine *engine);
 
+unsigned int item_coll_del_queue_size(struct default_engine *engine);
+
 ENGINE_ERROR_CODE item_init(struct default_engine *engine);
 
 ENGINE_ERROR_CODE list_struct_create(struct default_engine *engine,
@@ -408,12 +475,29 @@ ENGINE_ERROR_CODE set_elem_exist(struct default_engine *engine,
                                  const char *value, const size_t nbytes,
                                  bool *exist);
 
+ENGINE_ERROR_CODE set_elem_mexist(struct default_engine *engine,
+                                  const char *key, const size_t nkey,
+                                  token_t *value_array, const int value_count,
+                                  bool *exist_array);
+
+ENGINE_ERROR_CODE set_elem_setop(struct default_engine *engine,
+                                 const ENGINE_SET_OPERATION setop,
+                                 token_t *key_array, const int key_count,
+                                 const char *dkey, const size_t ndkey, item_attr *dattrp,
+                                 set_elem_item ***elem_array, uint32_t *elem_count,
+                                 const void *cookie);
+
 ENGINE_ERROR_CODE set_elem_get(struct default_engine *engine,
                                const char *key, const size_t nkey, const uint32_t count,
                                const bool delete, const bool drop_if_empty,
                                set_elem_item **elem_array, uint32_t *elem_count,
                                uint32_t *flags, bool *dropped);
 
+ENGINE_ERROR_CODE set_elem_sample(struct default_engine *engine,
+                                  const char *key, const size_t nkey, const uint32_t count,
+                                  set_elem_item **elem_array, uint32_t *elem_count,
+                                  uint32_t *flags);
+
 ENGINE_ERROR_CODE btree_struct_create(struct default_engine *engine,
                                       const char *key, const size_t nkey,
                                       item_attr *attrp, const void *cookie);
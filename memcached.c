@@ -55,6 +55,13 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <stddef.h>
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define USE_ZEROCOPY 1
+#endif
 
 static inline void item_set_cas(const void *cookie, item *it, uint64_t cas) {
     settings.engine.v1->item_set_cas(settings.engine.v0, cookie, it, cas);
@@ -66,14 +73,14 @@ static inline void item_set_cas(const void *cookie, item *it, uint64_t cas) {
 
 /* The item must always be called "it" */
 #define SLAB_GUTS(conn, thread_stats, slab_op, thread_op) \
-    thread_stats->slab_stats[info.clsid].slab_op++;
+    THREAD_STATS_ADD(thread_stats->slab_stats[info.clsid].slab_op, 1);
 
 #define THREAD_GUTS(conn, thread_stats, slab_op, thread_op) \
-    thread_stats->thread_op++;
+    THREAD_STATS_ADD(thread_stats->thread_op, 1);
 
 #define THREAD_GUTS2(conn, thread_stats, slab_op, thread_op) \
-    thread_stats->slab_op++; \
-    thread_stats->thread_op++;
+    THREAD_STATS_ADD(thread_stats->slab_op, 1); \
+    THREAD_STATS_ADD(thread_stats->thread_op, 1);
 
 #define SLAB_THREAD_GUTS(conn, thread_stats, slab_op, thread_op) \
     SLAB_GUTS(conn, thread_stats, slab_op, thread_op) \
@@ -84,9 +91,7 @@ static inline void item_set_cas(const void *cookie, item *it, uint64_t cas) {
     struct thread_stats *thread_stats = \
         &independent_stats->thread_stats[conn->thread->index]; \
     topkeys_t *topkeys = independent_stats->topkeys; \
-    pthread_mutex_lock(&thread_stats->mutex); \
     GUTS(conn, thread_stats, slab_op, thread_op); \
-    pthread_mutex_unlock(&thread_stats->mutex); \
     TK(topkeys, slab_op, key, nkey, current_time); \
 }
 
@@ -123,26 +128,20 @@ static inline void item_set_cas(const void *cookie, item *it, uint64_t cas) {
 #define STATS_NOKEY(conn, op) { \
     struct thread_stats *thread_stats = \
         get_thread_stats(conn); \
-    pthread_mutex_lock(&thread_stats->mutex); \
-    thread_stats->op++; \
-    pthread_mutex_unlock(&thread_stats->mutex); \
+    THREAD_STATS_ADD(thread_stats->op, 1); \
 }
 
 #define STATS_NOKEY2(conn, op1, op2) { \
     struct thread_stats *thread_stats = \
         get_thread_stats(conn); \
-    pthread_mutex_lock(&thread_stats->mutex); \
-    thread_stats->op1++; \
-    thread_stats->op2++; \
-    pthread_mutex_unlock(&thread_stats->mutex); \
+    THREAD_STATS_ADD(thread_stats->op1, 1); \
+    THREAD_STATS_ADD(thread_stats->op2, 1); \
 }
 
 #define STATS_ADD(conn, op, amt) { \
     struct thread_stats *thread_stats = \
         get_thread_stats(conn); \
-    pthread_mutex_lock(&thread_stats->mutex); \
-    thread_stats->op += amt; \
-    pthread_mutex_unlock(&thread_stats->mutex); \
+    THREAD_STATS_ADD(thread_stats->op, amt); \
 }
 
 volatile sig_atomic_t memcached_shutdown;
@@ -195,11 +194,20 @@ static void settings_init(void);
 static void event_handler(const int fd, const short which, void *arg);
 static bool update_event(conn *c, const int new_flags);
 static void complete_nread(conn *c);
-static void process_command(conn *c, char *command);
+static void process_command(conn *c, char *command, size_t cmdlen);
 static void write_and_free(conn *c, char *buf, int bytes);
 static int ensure_iov_space(conn *c);
 static int add_iov(conn *c, const void *buf, int len);
+static int add_iov_copy(conn *c, const void *buf, int len);
+static int add_iov_printf(conn *c, const char *fmt, ...);
+static int add_iov_value(conn *c, const void *buf, int len);
 static int add_msghdr(conn *c);
+static void conn_zerocopy_release(conn *c, bool all);
+static void conn_recv_cancel(conn *c);
+#ifdef USE_ZEROCOPY
+static void conn_zerocopy_reap(conn *c);
+static void conn_zerocopy_park(conn *c, LIBEVENT_THREAD *thread, int sfd);
+#endif
 
 
 /* time handling */
@@ -230,9 +238,15 @@ enum transmit_result {
     TRANSMIT_COMPLETE,   /** All done writing. */
     TRANSMIT_INCOMPLETE, /** More data remaining to write. */
     TRANSMIT_SOFT_ERROR, /** Can't write any more right now. */
-    TRANSMIT_HARD_ERROR  /** Can't write (c->state is set to conn_closing) */
+    TRANSMIT_HARD_ERROR, /** Can't write (c->state is set to conn_closing) */
+    TRANSMIT_DEFERRED    /** Queued to the thread's batched sends. */
 };
 
+/* batched send states */
+#define SEND_STATE_NONE   0
+#define SEND_STATE_QUEUED 1
+#define SEND_STATE_DONE   2
+
 static enum transmit_result transmit(conn *c);
 
 #define REALTIME_MAXDELTA 60*60*24*30
@@ -289,7 +303,6 @@ static rel_time_t realtime(const time_t exptime) {
     }
 }
 
-#if defined(SUPPORT_BOP_MGET) || defined(SUPPORT_BOP_SMGET)
 static int tokenize_keys(char *keystr, char delimiter, int keycnt, token_t *tokens) {
     int ntokens = 0;
     char *s, *e;
@@ -323,7 +336,6 @@ static int tokenize_keys(char *keystr, char delimiter, int keycnt, token_t *toke
         return -1; /* some errors */
     }
 }
-#endif
 
 static void stats_init(void) {
     stats.daemon_conns = 0;
@@ -345,7 +357,7 @@ static void stats_reset(const void *cookie) {
     stats.total_conns = 0;
     stats_prefix_clear();
     STATS_UNLOCK();
-    threadlocal_stats_reset(get_independent_stats(conn)->thread_stats);
+    threadlocal_stats_reset(get_independent_stats(conn));
     settings.engine.v1->reset_stats(settings.engine.v0, cookie);
 }
 
@@ -377,6 +389,9 @@ static void settings_init(void) {
     settings.binding_protocol = negotiating_prot;
     settings.item_size_max = 1024 * 1024; /* The famous 1MB upper limit. */
     settings.topkeys = 0;
+    settings.io_uring = false;
+    settings.reuseport = false;
+    settings.zerocopy_min = 0;
     settings.require_sasl = false;
     settings.extensions.logger = get_stderr_logger();
 }
@@ -465,6 +480,179 @@ void safe_close(int sfd) {
  */
 cache_t *conn_cache;      /* suffix cache */
 
+/*
+ * Output arena.
+ * Small response fragments (headers, short values) are copied into blocks
+ * owned by the connection, so that consecutive fragments are sent from a
+ * single iovec (see add_iov). The blocks never move once handed out, and
+ * are recycled after the whole response has been transmitted.
+ */
+static char *obuf_reserve(conn *c, uint32_t len) {
+    obuf_block *b = c->obuf_tail;
+
+    if (b == NULL || b->size - b->used < len) {
+        uint32_t size = (len > OBUF_BLOCK_SIZE) ? len : OBUF_BLOCK_SIZE;
+        obuf_block *nb = malloc(sizeof(obuf_block) + size);
+        if (nb == NULL) {
+            return NULL;
+        }
+        nb->next = NULL;
+        nb->size = size;
+        nb->used = 0;
+        if (b == NULL) {
+            c->obuf = nb;
+        } else {
+            b->next = nb;
+        }
+        c->obuf_tail = b = nb;
+        c->obuf_bytes += size;
+    }
+    return b->data + b->used;
+}
+
+/* Releases the arena of the connection, keeping the first block if asked. */
+static void obuf_release(conn *c, bool keep_first) {
+    obuf_block *b = c->obuf;
+    obuf_block *next;
+
+    if (b == NULL) {
+        return;
+    }
+    if (keep_first) {
+        b->used = 0;
+        c->obuf_bytes = b->size;
+        next = b->next;
+        b->next = NULL;
+        c->obuf_tail = b;
+    } else {
+        next = b;
+        c->obuf = c->obuf_tail = NULL;
+        c->obuf_bytes = 0;
+    }
+    while (next != NULL) {
+        b = next;
+        next = b->next;
+        free(b);
+    }
+}
+
+/*
+ * Account the buffer sizes of the connection in the global stats.
+ * Only the changes since the last call are applied, so this is cheap
+ * enough to be called in between requests.
+ */
+static void conn_update_memstats(conn *c) {
+    uint32_t rbuf = c->rsize;
+    uint32_t wbuf = c->wsize;
+    uint32_t iov  = c->iovsize * sizeof(struct iovec)
+                  + c->msgsize * sizeof(struct msghdr)
+                  + c->hdrsize * UDP_HEADER_SIZE;
+    uint32_t list = c->isize * sizeof(item *)
+                  + c->zcsize * sizeof(zc_hold);
+    uint32_t pipe = (c->pipe_response != NULL ? PIPE_MAX_RES_SIZE : 0);
+    uint32_t obuf = c->obuf_bytes;
+
+    if (rbuf == c->membytes.rbuf && wbuf == c->membytes.wbuf &&
+        iov == c->membytes.iov && list == c->membytes.list &&
+        pipe == c->membytes.pipe && obuf == c->membytes.obuf) {
+        return;
+    }
+
+    STATS_LOCK();
+    stats.conn_rbuf_bytes += (int64_t)rbuf - c->membytes.rbuf;
+    stats.conn_wbuf_bytes += (int64_t)wbuf - c->membytes.wbuf;
+    stats.conn_iov_bytes  += (int64_t)iov  - c->membytes.iov;
+    stats.conn_list_bytes += (int64_t)list - c->membytes.list;
+    stats.conn_pipe_bytes += (int64_t)pipe - c->membytes.pipe;
+    stats.conn_obuf_bytes += (int64_t)obuf - c->membytes.obuf;
+    STATS_UNLOCK();
+
+    c->membytes.rbuf = rbuf;
+    c->membytes.wbuf = wbuf;
+    c->membytes.iov  = iov;
+    c->membytes.list = list;
+    c->membytes.pipe = pipe;
+    c->membytes.obuf = obuf;
+}
+
+/*
+ * Attach a pipe response buffer to the connection.
+ * The buffers are kept in a per thread cache, so that only the connections
+ * actively pipelining hold one.
+ */
+static bool conn_pipe_buffer_attach(conn *c) {
+    if (c->pipe_response == NULL) {
+        c->pipe_response = cache_alloc(c->thread->pipe_cache);
+        if (c->pipe_response == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void conn_pipe_buffer_detach(conn *c) {
+    if (c->pipe_response != NULL) {
+        cache_free(c->thread->pipe_cache, c->pipe_response);
+        c->pipe_response = NULL;
+        c->pipe_resptr = NULL;
+    }
+}
+
+/*
+ * The read buffer cache of the thread for the given size,
+ * or NULL if buffers of the size are not pooled.
+ */
+static cache_t *rbuf_cache(conn *c, uint32_t size) {
+    if (c->thread == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < RBUF_CLASSES; i++) {
+        if (size == (DATA_BUFFER_SIZE << (2 * (i + 1)))) {
+            return c->thread->rbuf_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/* the smallest read buffer size that holds nbytes */
+static uint32_t rbuf_size_for(uint32_t nbytes) {
+    uint32_t size = DATA_BUFFER_SIZE;
+    while (size < nbytes) {
+        size <<= 2;
+    }
+    return size;
+}
+
+/*
+ * Move the unread input of the connection to a read buffer of the given
+ * size. The buffers of the pooled sizes come from and go back to the
+ * caches of the thread, so growing and shrinking does not go to malloc.
+ * A pooled buffer must never be passed to free().
+ *
+ * Returns false on out-of-memory, leaving the read buffer as it was.
+ */
+static bool conn_rbuf_resize(conn *c, uint32_t size) {
+    cache_t *cache = rbuf_cache(c, size);
+    char *buf;
+
+    assert(size >= c->rbytes);
+    buf = (cache != NULL ? cache_alloc(cache) : malloc(size));
+    if (buf == NULL) {
+        return false;
+    }
+    if (c->rbytes > 0) {
+        memcpy(buf, c->rcurr, c->rbytes);
+    }
+    if ((cache = rbuf_cache(c, c->rsize)) != NULL) {
+        cache_free(cache, c->rbuf);
+    } else {
+        free(c->rbuf);
+    }
+    c->rbuf = c->rcurr = buf;
+    c->rsize = size;
+    return true;
+}
+
 /**
  * Reset all of the dynamic buffers used by a connection back to their
  * default sizes. The strategy for resizing the buffers is to allocate a
@@ -513,16 +701,7 @@ static bool conn_reset_buffersize(conn *c) {
         }
     }
 
-    if (c->suffixsize != SUFFIX_LIST_INITIAL) {
-        void *ptr = malloc(sizeof(char *) * SUFFIX_LIST_INITIAL);
-        if (ptr != NULL) {
-            free(c->suffixlist);
-            c->suffixlist = ptr;
-            c->suffixsize = SUFFIX_LIST_INITIAL;
-        } else {
-            ret = false;
-        }
-    }
+    obuf_release(c, false);
 
     if (c->iovsize != IOV_LIST_INITIAL) {
         void *ptr = malloc(sizeof(struct iovec) * IOV_LIST_INITIAL);
@@ -569,7 +748,6 @@ static int conn_constructor(void *buffer, void *unused1, int unused2) {
         free(c->rbuf);
         free(c->wbuf);
         free(c->ilist);
-        free(c->suffixlist);
         free(c->iov);
         free(c->msglist);
         settings.extensions.logger->log(EXTENSION_LOG_WARNING,
@@ -581,6 +759,7 @@ static int conn_constructor(void *buffer, void *unused1, int unused2) {
     STATS_LOCK();
     stats.conn_structs++;
     STATS_UNLOCK();
+    conn_update_memstats(c);
 
     return 0;
 }
@@ -597,12 +776,20 @@ static void conn_destructor(void *buffer, void *unused) {
     free(c->rbuf);
     free(c->wbuf);
     free(c->ilist);
-    free(c->suffixlist);
     free(c->iov);
     free(c->msglist);
+    free(c->hdrbuf);
+    free(c->zclist);
+    obuf_release(c, false);
 
     STATS_LOCK();
     stats.conn_structs--;
+    stats.conn_rbuf_bytes -= c->membytes.rbuf;
+    stats.conn_wbuf_bytes -= c->membytes.wbuf;
+    stats.conn_iov_bytes  -= c->membytes.iov;
+    stats.conn_list_bytes -= c->membytes.list;
+    stats.conn_pipe_bytes -= c->membytes.pipe;
+    stats.conn_obuf_bytes -= c->membytes.obuf;
     STATS_UNLOCK();
 }
 
@@ -674,14 +861,13 @@ conn *conn_new(const int sfd, STATE_FUNC init_state,
     c->cmd = -1;
     c->ascii_cmd = NULL;
     c->rbytes = c->wbytes = 0;
+    c->rbuf_want = 0;
     c->wcurr = c->wbuf;
     c->rcurr = c->rbuf;
     c->ritem = 0;
     c->rlbytes = 0;
     c->icurr = c->ilist;
-    c->suffixcurr = c->suffixlist;
     c->ileft = 0;
-    c->suffixleft = 0;
     c->iovused = 0;
     c->msgcurr = 0;
     c->msgused = 0;
@@ -693,13 +879,38 @@ conn *conn_new(const int sfd, STATE_FUNC init_state,
 
     c->coll_mkeys = 0;
     c->coll_eitem = 0;
-    c->coll_resps = 0;
 
     // COMMAND PIPELINING
     c->pipe_state = PIPE_STATE_OFF;
     c->pipe_count = 0;
     c->noreply = false;
 
+    c->send_next = NULL;
+    c->send_state = SEND_STATE_NONE;
+
+    io_ring_recvq_init(&c->recv_queue);
+    c->recv_armed = false;
+    c->recv_cancel = false;
+    c->recv_wait = false;
+    c->recv_ended = false;
+    c->recv_parked = false;
+    c->recv_res = 0;
+
+    c->zcused = 0;
+    c->zc_sent = c->zc_done = 0;
+    c->zc_nooo = 0;
+    c->zc_used = false;
+    c->zerocopy = false;
+    c->zc_parked = false;
+    c->zc_reset = false;
+#ifdef USE_ZEROCOPY
+    if (settings.zerocopy_min > 0 && init_state != conn_listening &&
+        !IS_UDP(transport) && !settings.socketpath) {
+        int on = 1;
+        c->zerocopy = (setsockopt(sfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0);
+    }
+#endif
+
     event_set(&c->event, sfd, event_flags, event_handler, (void *)c);
     event_base_set(base, &c->event);
     c->ev_flags = event_flags;
@@ -741,9 +952,6 @@ static void conn_coll_eitem_free(conn *c) {
       case OPERATION_LOP_GET:
         settings.engine.v1->list_elem_release(settings.engine.v0, c, c->coll_eitem, c->coll_ecount);
         free(c->coll_eitem);
-        if (c->coll_resps != NULL) {
-            free(c->coll_resps); c->coll_resps = NULL;
-        }
         break;
       case OPERATION_SOP_INSERT:
         settings.engine.v1->set_elem_release(settings.engine.v0, c, &c->coll_eitem, 1);
@@ -752,12 +960,18 @@ static void conn_coll_eitem_free(conn *c) {
       case OPERATION_SOP_EXIST:
         free(c->coll_eitem);
         break;
+      case OPERATION_SOP_MEXIST:
+        free(c->coll_eitem);
+        free(c->coll_mkeys); c->coll_mkeys = NULL;
+        break;
+      case OPERATION_SOP_SETOP:
+        settings.engine.v1->set_elem_release(settings.engine.v0, c, c->coll_eitem, c->coll_ecount);
+        free(c->coll_eitem);
+        free(c->coll_mkeys); c->coll_mkeys = NULL;
+        break;
       case OPERATION_SOP_GET:
         settings.engine.v1->set_elem_release(settings.engine.v0, c, c->coll_eitem, c->coll_ecount);
         free(c->coll_eitem);
-        if (c->coll_resps != NULL) {
-            free(c->coll_resps); c->coll_resps = NULL;
-        }
         break;
       case OPERATION_BOP_INSERT:
       case OPERATION_BOP_UPSERT:
@@ -771,9 +985,6 @@ static void conn_coll_eitem_free(conn *c) {
       case OPERATION_BOP_GBP: /* get by position */
         settings.engine.v1->btree_elem_release(settings.engine.v0, c, c->coll_eitem, c->coll_ecount);
         free(c->coll_eitem);
-        if (c->coll_resps != NULL) {
-            free(c->coll_resps); c->coll_resps = NULL;
-        }
         break;
 #if defined(SUPPORT_BOP_MGET) || defined(SUPPORT_BOP_SMGET)
 #ifdef SUPPORT_BOP_MGET
@@ -801,7 +1012,7 @@ static void conn_cleanup(conn *c) {
         c->item = 0;
     }
 
-    if (c->coll_eitem != NULL) {
+    if (c->coll_eitem != NULL || c->coll_mkeys != NULL) {
         conn_coll_eitem_free(c);
     }
 
@@ -811,10 +1022,9 @@ static void conn_cleanup(conn *c) {
         }
     }
 
-    if (c->suffixleft != 0) {
-        for (; c->suffixleft > 0; c->suffixleft--, c->suffixcurr++) {
-            cache_free(c->thread->suffix_cache, *(c->suffixcurr));
-        }
+    obuf_release(c, true);
+    if (!c->zc_parked) {
+        conn_zerocopy_release(c, true);
     }
 
     if (c->write_and_free) {
@@ -827,6 +1037,18 @@ static void conn_cleanup(conn *c) {
         c->sasl_conn = NULL;
     }
 
+    conn_pipe_buffer_detach(c);
+
+    /* give a pooled read buffer back to the thread,
+     * conn_reset_buffersize() allocates the default one again.
+     */
+    cache_t *cache = rbuf_cache(c, c->rsize);
+    if (cache != NULL) {
+        cache_free(cache, c->rbuf);
+        c->rbuf = c->rcurr = NULL;
+        c->rsize = c->rbytes = 0;
+    }
+
     c->engine_storage = NULL;
     c->tap_iterator = NULL;
     c->thread = NULL;
@@ -838,17 +1060,45 @@ static void conn_cleanup(conn *c) {
 
 void conn_close(conn *c) {
     assert(c != NULL);
+    int zc_sfd = -1;
 
     /* delete the event, the socket and the conn */
     if (c->sfd != -1) {
         MEMCACHED_CONN_RELEASE(c->sfd);
         event_del(&c->event);
+        if (c->recv_armed) {
+            /* the recv completions refer to the conn,
+             * keep it until the last one is reaped.
+             */
+            conn_recv_cancel(c);
+            if (!c->recv_cancel) {
+                /* ends the recv with the end of stream */
+                shutdown(c->sfd, SHUT_RDWR);
+            }
+            c->recv_parked = true;
+        }
+        if (c->recv_queue.count > 0) {
+            io_ring_recvq_drop(c->thread->io_ring, &c->recv_queue);
+        }
+#ifdef USE_ZEROCOPY
+        if (c->zc_done != c->zc_sent) {
+            conn_zerocopy_reap(c);
+        }
+#endif
 
         if (settings.verbose > 1) {
             settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
                                             "<%d connection closed.\n", c->sfd);
         }
-        safe_close(c->sfd);
+        if (c->zc_done != c->zc_sent && c->zcused > 0) {
+            /* the kernel may still read the held items,
+             * keep the socket to get the completions of the sends.
+             */
+            zc_sfd = c->sfd;
+            c->zc_parked = true;
+        } else {
+            safe_close(c->sfd);
+        }
         c->sfd = -1;
     }
 
@@ -871,8 +1121,12 @@ void conn_close(conn *c) {
     }
     c->thread->pending_io = list_remove(c->thread->pending_io, c);
     c->thread->pending_close = list_remove(c->thread->pending_close, c);
+    if (c->thread->type == GENERAL && !IS_UDP(c->transport)) {
+        c->thread->conn_count--;
+    }
     UNLOCK_THREAD(c->thread);
 
+    LIBEVENT_THREAD *thread = c->thread;
     conn_cleanup(c);
 
     /*
@@ -881,7 +1135,22 @@ void conn_close(conn *c) {
      * size
      */
     conn_reset_buffersize(c);
+    conn_update_memstats(c);
     assert(c->thread == NULL);
+    if (c->recv_parked) {
+        /* freed by conn_recv_complete() */
+        c->thread = thread;
+        return;
+    }
+#ifdef USE_ZEROCOPY
+    if (c->zc_parked) {
+        conn_zerocopy_park(c, thread, zc_sfd);
+        return;
+    }
+#else
+    (void)thread;
+    (void)zc_sfd;
+#endif
     cache_free(conn_cache, c);
 }
 
@@ -899,20 +1168,15 @@ static void conn_shrink(conn *c) {
     if (IS_UDP(c->transport))
         return;
 
-    if (c->rsize > READ_BUFFER_HIGHWAT && c->rbytes < DATA_BUFFER_SIZE) {
-        char *newbuf;
-
-        if (c->rcurr != c->rbuf)
-            memmove(c->rbuf, c->rcurr, (size_t)c->rbytes);
-
-        newbuf = (char *)realloc((void *)c->rbuf, DATA_BUFFER_SIZE);
-
-        if (newbuf) {
-            c->rbuf = newbuf;
-            c->rsize = DATA_BUFFER_SIZE;
+    /* Fit the read buffer to the input buffered lately, so a connection
+     * keeps a grown buffer while its requests stay large.
+     */
+    if (c->rsize > DATA_BUFFER_SIZE && c->rbytes < DATA_BUFFER_SIZE) {
+        uint32_t size = rbuf_size_for(2 * c->rbuf_want > c->rbytes ?
+                                      2 * c->rbuf_want : c->rbytes);
+        if (size < c->rsize) {
+            (void)conn_rbuf_resize(c, size); /* keep the old one on failure */
         }
-        /* TODO check other branch... */
-        c->rcurr = c->rbuf;
     }
 
     if (c->isize > ITEM_LIST_HIGHWAT) {
@@ -1063,6 +1327,21 @@ static int add_iov(conn *c, const void *buf, int len) {
 
     assert(c != NULL);
 
+    /* Extend the last iovec if the fragment directly follows it in memory,
+     * which is the case for the fragments copied into the output arena.
+     */
+    m = &c->msglist[c->msgused - 1];
+    if (buf != NULL && m->msg_iovlen > 0) {
+        struct iovec *last = &m->msg_iov[m->msg_iovlen - 1];
+        limit_to_mtu = IS_UDP(c->transport) || (1 == c->msgused);
+        if ((char *)last->iov_base + last->iov_len == (char *)buf &&
+            (!limit_to_mtu || c->msgbytes + len <= UDP_MAX_PAYLOAD_SIZE)) {
+            last->iov_len += len;
+            c->msgbytes += len;
+            return 0;
+        }
+    }
+
     do {
         m = &c->msglist[c->msgused - 1];
 
@@ -1105,6 +1384,82 @@ static int add_iov(conn *c, const void *buf, int len) {
     return 0;
 }
 
+/*
+ * Adds a fragment written at obuf_reserve() to the response.
+ */
+static int add_iov_obuf(conn *c, char *buf, int len) {
+    assert(buf == c->obuf_tail->data + c->obuf_tail->used);
+    c->obuf_tail->used += len;
+    return add_iov(c, buf, len);
+}
+
+/*
+ * Adds a fragment to the response, copying it into the output arena if it
+ * is small. Large fragments are referenced as they are, so their memory
+ * must stay valid until the response has been sent.
+ *
+ * Returns 0 on success, -1 on out-of-memory.
+ */
+static int add_iov_copy(conn *c, const void *buf, int len) {
+    char *ptr;
+
+    if (len > OBUF_COPY_MAX) {
+        return add_iov(c, buf, len);
+    }
+    if ((ptr = obuf_reserve(c, len)) == NULL) {
+        return -1;
+    }
+    memcpy(ptr, buf, len);
+    return add_iov_obuf(c, ptr, len);
+}
+
+/*
+ * Formats a fragment of the response directly into the output arena.
+ *
+ * Returns 0 on success, -1 on out-of-memory.
+ */
+static int add_iov_printf(conn *c, const char *fmt, ...) {
+    va_list ap;
+    char *ptr;
+    int len;
+
+    if ((ptr = obuf_reserve(c, OBUF_FMT_MAX)) == NULL) {
+        return -1;
+    }
+    va_start(ap, fmt);
+    len = vsnprintf(ptr, OBUF_FMT_MAX, fmt, ap);
+    va_end(ap);
+    if (len < 0 || len >= OBUF_FMT_MAX) {
+        return -1;
+    }
+    return add_iov_obuf(c, ptr, len);
+}
+
+/*
+ * Adds the value of an item to the response. A large value is sent with
+ * MSG_ZEROCOPY in a message header of its own, so that no other memory
+ * of the connection is pinned by the kernel; the item is held until the
+ * send is completed (see conn_zerocopy_hold).
+ *
+ * Returns 0 on success, -1 on out-of-memory.
+ */
+static int add_iov_value(conn *c, const void *buf, int len) {
+#ifdef USE_ZEROCOPY
+    if (c->zerocopy && (uint32_t)len >= settings.zerocopy_min) {
+        if ((c->msglist[c->msgused - 1].msg_iovlen > 0 || c->msgused == 1) &&
+            add_msghdr(c) != 0) {
+            return -1;
+        }
+        /* msg_flags is not used by sendmsg(), it marks the zerocopy message */
+        c->msglist[c->msgused - 1].msg_flags = MSG_ZEROCOPY;
+        if (add_iov(c, buf, len) != 0) {
+            return -1;
+        }
+        return add_msghdr(c);
+    }
+#endif
+    return add_iov_copy(c, buf, len);
+}
 
 /*
  * Constructs a set of UDP headers and attaches them to the outgoing messages.
@@ -1162,6 +1517,19 @@ static void out_string(conn *c, const char *str) {
                                             ">%d %s\n", c->sfd, str);
     }
 
+    if (c->pipe_state != PIPE_STATE_OFF && c->pipe_count == 0) {
+        if (!conn_pipe_buffer_attach(c)) {
+            /* end the pipe with a framed memory overflow error that omits
+             * the response of this command, as a full pipe buffer does.
+             * the following commands start a new pipe.
+             */
+            str = "RESPONSE   0\r\nPIPE_ERROR memory overflow";
+            len = strlen(str);
+            c->pipe_state = PIPE_STATE_OFF;
+            c->noreply = false;
+        }
+    }
+
     if (c->pipe_state != PIPE_STATE_OFF) {
         assert(c->pipe_state == PIPE_STATE_ON);
         if (c->pipe_count == 0) {
@@ -1460,99 +1828,295 @@ static void process_sop_exist_complete(conn *c) {
     c->coll_eitem = NULL;
 }
 
-static int make_bop_elem_response(char *bufptr, eitem_info *info)
+/* tokenize the value list of sop mexist: "<bytes> <data>\r\n" repeated */
+static int tokenize_sop_values(char *vptr, const int vlen, const int vcnt, token_t *tokens)
 {
-    char *tmpptr = bufptr;
+    char *endp = vptr + vlen;
+    char *sptr;
+    uint32_t nbytes;
+    int i;
 
-    /* bkey */
-    if (info->nscore > 0) {
-        memcpy(tmpptr, "0x", 2); tmpptr += 2;
-        safe_hexatostr(info->score, info->nscore, tmpptr);
-        tmpptr += strlen(tmpptr);
-    } else {
-        sprintf(tmpptr, "%"PRIu64"", *(uint64_t*)info->score);
-        tmpptr += strlen(tmpptr);
-    }
-    /* eflag */
-    if (info->neflag > 0) {
-        memcpy(tmpptr, " 0x", 3); tmpptr += 3;
-        safe_hexatostr(info->eflag, info->neflag, tmpptr);
-        tmpptr += strlen(tmpptr);
+    for (i = 0; i < vcnt; i++) {
+        if ((sptr = memchr(vptr, ' ', endp - vptr)) == NULL || sptr == vptr) {
+            return -1;
+        }
+        *sptr = '\0';
+        if (! safe_strtoul(vptr, &nbytes) || nbytes > MAX_ELEMENT_BYTES - 2) {
+            return -1;
+        }
+        vptr = sptr + 1;
+        if ((uint32_t)(endp - vptr) < (nbytes + 2) || strncmp(vptr + nbytes, "\r\n", 2) != 0) {
+            return -1;
+        }
+        /* set element values are kept with the trailing "\r\n" */
+        tokens[i].value  = vptr;
+        tokens[i].length = nbytes + 2;
+        vptr += (nbytes + 2);
     }
-    /* nbytes */
-    sprintf(tmpptr, " %u ", info->nbytes-2);
-    tmpptr += strlen(tmpptr);
-
-    return (int)(tmpptr - bufptr);
+    return (vptr == endp ? vcnt : -1);
 }
 
-static void process_bop_insert_complete(conn *c) {
-    assert(c->coll_op == OPERATION_BOP_INSERT ||
-           c->coll_op == OPERATION_BOP_UPSERT);
+static void process_sop_mexist_complete(conn *c) {
+    assert(c->coll_op == OPERATION_SOP_MEXIST);
     assert(c->coll_eitem != NULL);
-    eitem *elem = (eitem *)c->coll_eitem;
 
-    eitem_info info;
-    settings.engine.v1->get_btree_elem_info(settings.engine.v0, c, elem, &info);
-
-    if (strncmp((char*)info.value + info.nbytes - 2, "\r\n", 2) != 0) {
-        // release the btree element
-        settings.engine.v1->btree_elem_release(settings.engine.v0, c, &c->coll_eitem, 1);
-        c->coll_eitem = NULL;
-        out_string(c, "CLIENT_ERROR bad data chunk");
+    ENGINE_ERROR_CODE ret;
+    token_t *value_tokens = (token_t *)c->coll_eitem;
+    bool    *exist_array = (bool *)&value_tokens[c->coll_numkeys];
+    char    *respbuf = (char *)&exist_array[c->coll_numkeys];
+    char    *resultptr;
+    uint32_t i;
+
+    if (tokenize_sop_values((char*)c->coll_mkeys, c->coll_lenkeys,
+                            c->coll_numkeys, value_tokens) == -1) {
+        ret = ENGINE_EBADVALUE;
     } else {
-        eitem_result trim_result; // contain the info of an element trimmed by maxcount overflow
-        bool created;
-        bool replaced;
-        bool replace_if_exist = (c->coll_op == OPERATION_BOP_UPSERT ? true : false);
-        ENGINE_ERROR_CODE ret = settings.engine.v1->btree_elem_insert(settings.engine.v0, c,
-                                                    c->coll_key, c->coll_nkey, elem, replace_if_exist,
-                                                    c->coll_attrp, &replaced, &created,
-                                                    (c->coll_drop ? &trim_result : NULL), 0);
-
-        // release the btree element inserted.
-        settings.engine.v1->btree_elem_release(settings.engine.v0, c, &c->coll_eitem, 1);
-        c->coll_eitem = NULL;
-
+        ret = settings.engine.v1->set_elem_mexist(settings.engine.v0, c,
+                                                  c->coll_key, c->coll_nkey,
+                                                  value_tokens, c->coll_numkeys,
+                                                  exist_array, 0);
         if (settings.detail_enabled) {
-            stats_prefix_record_bop_insert(c->coll_key, c->coll_nkey, (ret==ENGINE_SUCCESS));
+            stats_prefix_record_sop_exist(c->coll_key, c->coll_nkey, (ret==ENGINE_SUCCESS));
         }
+    }
 
-        switch (ret) {
-        case ENGINE_SUCCESS:
-            STATS_HITS(c, bop_insert, c->coll_key, c->coll_nkey);
-            if (c->coll_drop && trim_result.elems != NULL) { /* getrim flag */
-                assert(trim_result.count == 1);
-                char  buffer[256];
-                char *respptr = &buffer[0];
-                int   resplen;
-
-                /* return the trimmed element info to the client */
-                sprintf(respptr, "VALUE %u %u\r\n", htonl(trim_result.flags), trim_result.count);
-                resplen = strlen(respptr);
-
-                /* get trimmed element info */
-                settings.engine.v1->get_btree_elem_info(settings.engine.v0, c, trim_result.elems, &info);
-                resplen += make_bop_elem_response(respptr + resplen, &info);
+    if (ret == ENGINE_SUCCESS) {
+        resultptr = respbuf + sprintf(respbuf, "RESULT %u\r\n", c->coll_numkeys);
+        for (i = 0; i < c->coll_numkeys; i++) {
+            *resultptr++ = (exist_array[i] ? '1' : '0');
+        }
+        resultptr += sprintf(resultptr, "\r\nEND\r\n");
+        if ((add_iov(c, respbuf, resultptr - respbuf) != 0) ||
+            (IS_UDP(c->transport) && build_udp_headers(c) != 0)) {
+            ret = ENGINE_ENOMEM;
+        }
+    }
 
-                /* add io vectors */
-                if ((add_iov(c, respptr, resplen) != 0) ||
-                    (add_iov(c, info.value, info.nbytes) != 0) ||
-                    (add_iov(c, "TRIMMED\r\n", strlen("TRIMMED\r\n")) != 0))
-                {
-                    settings.engine.v1->btree_elem_release(settings.engine.v0, c,
-                                                           &trim_result.elems, trim_result.count);
-                    out_string(c, "SERVER_ERROR out of memory writing get response");
-                } else {
-                    /* prepare for writing response */
-                    c->coll_eitem = trim_result.elems;
-                    c->coll_ecount = trim_result.count; /* trim_result.count == 1 */
-                    conn_set_state(c, conn_mwrite);
-                }
-            } else {
-                /* no getrim flag or no trimmed element */
-                if (replaced == false) {
-                    if (created == false) out_string(c, "STORED");
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        STATS_HITS(c, sop_exist, c->coll_key, c->coll_nkey);
+        /* Remember this command so we can garbage collect it later */
+        c->coll_op = OPERATION_SOP_MEXIST;
+        conn_set_state(c, conn_mwrite);
+        c->msgcurr = 0;
+        break;
+    case ENGINE_DISCONNECT:
+        c->state = conn_closing;
+        break;
+    case ENGINE_KEY_ENOENT:
+    case ENGINE_UNREADABLE:
+        STATS_MISS(c, sop_exist, c->coll_key, c->coll_nkey);
+        if (ret == ENGINE_KEY_ENOENT) out_string(c, "NOT_FOUND");
+        else                          out_string(c, "UNREADABLE");
+        break;
+    default:
+        STATS_NOKEY(c, cmd_sop_exist);
+        if (ret == ENGINE_EBADTYPE) out_string(c, "TYPE_MISMATCH");
+        else if (ret == ENGINE_EBADVALUE) out_string(c, "CLIENT_ERROR bad data chunk");
+        else if (ret == ENGINE_ENOMEM) out_string(c, "SERVER_ERROR out of memory writing get response");
+        else out_string(c, "SERVER_ERROR internal");
+    }
+
+    if (ret != ENGINE_SUCCESS) {
+        free((void *)c->coll_mkeys);
+        c->coll_mkeys = NULL;
+        free((void *)c->coll_eitem);
+        c->coll_eitem = NULL;
+    }
+}
+
+static void process_sop_setop_complete(conn *c) {
+    assert(c->coll_op == OPERATION_SOP_SETOP);
+
+    ENGINE_ERROR_CODE ret;
+    eitem  **elem_array = NULL;
+    uint32_t elem_count = 0;
+    token_t  key_tokens[MAX_SOP_SETOP_KEY_COUNT];
+    uint32_t i;
+
+    if ((strncmp((char*)c->coll_mkeys + c->coll_lenkeys - 2, "\r\n", 2) != 0) ||
+        (tokenize_keys((char*)c->coll_mkeys, ',', c->coll_numkeys, key_tokens) == -1)) {
+        ret = ENGINE_EBADVALUE;
+    } else {
+        ret = settings.engine.v1->set_elem_setop(settings.engine.v0, c, c->coll_setop,
+                                                 key_tokens, c->coll_numkeys,
+                                                 c->coll_key, c->coll_nkey, c->coll_attrp,
+                                                 (c->coll_cntonly ? NULL : &elem_array),
+                                                 &elem_count, 0);
+        if (c->coll_key != NULL && settings.detail_enabled) {
+            stats_prefix_record_sop_create(c->coll_key, c->coll_nkey);
+        }
+    }
+
+    if (ret == ENGINE_SUCCESS && c->coll_key == NULL && !c->coll_cntonly) {
+        eitem_info info;
+        do {
+            if (add_iov_printf(c, "RESULT %u\r\n", elem_count) != 0) {
+                ret = ENGINE_ENOMEM; break;
+            }
+
+            for (i = 0; i < elem_count; i++) {
+                settings.engine.v1->get_set_elem_info(settings.engine.v0, c, elem_array[i], &info);
+                if ((add_iov_printf(c, "%u ", info.nbytes-2) != 0) ||
+                    (add_iov_copy(c, info.value, info.nbytes) != 0)) {
+                    ret = ENGINE_ENOMEM; break;
+                }
+            }
+            if (ret == ENGINE_ENOMEM) break;
+
+            if ((add_iov_copy(c, "END\r\n", 5) != 0) ||
+                (IS_UDP(c->transport) && build_udp_headers(c) != 0)) {
+                ret = ENGINE_ENOMEM; break;
+            }
+        } while(0);
+
+        if (ret == ENGINE_SUCCESS) {
+            STATS_NOKEY2(c, cmd_sop_setop, sop_setop_oks);
+            /* Remember this command so we can garbage collect it later */
+            c->coll_eitem  = (void *)elem_array;
+            c->coll_ecount = elem_count;
+            c->coll_op     = OPERATION_SOP_SETOP;
+            conn_set_state(c, conn_mwrite);
+            c->msgcurr     = 0;
+            return;
+        }
+        /* ENGINE_ENOMEM */
+        settings.engine.v1->set_elem_release(settings.engine.v0, c, elem_array, elem_count);
+        free((void *)elem_array);
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        {
+        char buffer[64];
+        STATS_NOKEY2(c, cmd_sop_setop, sop_setop_oks);
+        if (c->coll_key != NULL) sprintf(buffer, "STORED %u", elem_count);
+        else                     sprintf(buffer, "COUNT=%u", elem_count);
+        out_string(c, buffer);
+        }
+        break;
+    case ENGINE_DISCONNECT:
+        c->state = conn_closing;
+        break;
+    default:
+        STATS_NOKEY(c, cmd_sop_setop);
+        if (ret == ENGINE_EBADTYPE) out_string(c, "TYPE_MISMATCH");
+        else if (ret == ENGINE_UNREADABLE) out_string(c, "UNREADABLE");
+        else if (ret == ENGINE_EOVERFLOW) out_string(c, "OVERFLOWED");
+        else if (ret == ENGINE_EBADVALUE) out_string(c, "CLIENT_ERROR bad data chunk");
+        else if (ret == ENGINE_PREFIX_ENAME) out_string(c, "CLIENT_ERROR invalid prefix name");
+        else if (ret == ENGINE_ENOMEM) out_string(c, "SERVER_ERROR out of memory");
+        else out_string(c, "SERVER_ERROR internal");
+    }
+
+    free((void *)c->coll_mkeys);
+    c->coll_mkeys = NULL;
+    free((void *)c->coll_eitem);
+    c->coll_eitem = NULL;
+}
+
+static int make_bop_elem_response(char *bufptr, eitem_info *info)
+{
+    char *tmpptr = bufptr;
+
+    /* bkey */
+    if (info->nscore > 0) {
+        memcpy(tmpptr, "0x", 2); tmpptr += 2;
+        safe_hexatostr(info->score, info->nscore, tmpptr);
+        tmpptr += strlen(tmpptr);
+    } else {
+        sprintf(tmpptr, "%"PRIu64"", *(uint64_t*)info->score);
+        tmpptr += strlen(tmpptr);
+    }
+    /* eflag */
+    if (info->neflag > 0) {
+        memcpy(tmpptr, " 0x", 3); tmpptr += 3;
+        safe_hexatostr(info->eflag, info->neflag, tmpptr);
+        tmpptr += strlen(tmpptr);
+    }
+    /* nbytes */
+    sprintf(tmpptr, " %u ", info->nbytes-2);
+    tmpptr += strlen(tmpptr);
+
+    return (int)(tmpptr - bufptr);
+}
+
+/*
+ * Adds a b+tree element to the response: the element header is written in
+ * the output arena, followed by the value if it is small.
+ *
+ * Returns 0 on success, -1 on out-of-memory.
+ */
+static int add_iov_bop_elem(conn *c, eitem_info *info)
+{
+    char *ptr = obuf_reserve(c, OBUF_FMT_MAX);
+
+    if (ptr == NULL ||
+        add_iov_obuf(c, ptr, make_bop_elem_response(ptr, info)) != 0) {
+        return -1;
+    }
+    return add_iov_copy(c, info->value, info->nbytes);
+}
+
+static void process_bop_insert_complete(conn *c) {
+    assert(c->coll_op == OPERATION_BOP_INSERT ||
+           c->coll_op == OPERATION_BOP_UPSERT);
+    assert(c->coll_eitem != NULL);
+    eitem *elem = (eitem *)c->coll_eitem;
+
+    eitem_info info;
+    settings.engine.v1->get_btree_elem_info(settings.engine.v0, c, elem, &info);
+
+    if (strncmp((char*)info.value + info.nbytes - 2, "\r\n", 2) != 0) {
+        // release the btree element
+        settings.engine.v1->btree_elem_release(settings.engine.v0, c, &c->coll_eitem, 1);
+        c->coll_eitem = NULL;
+        out_string(c, "CLIENT_ERROR bad data chunk");
+    } else {
+        eitem_result trim_result; // contain the info of an element trimmed by maxcount overflow
+        bool created;
+        bool replaced;
+        bool replace_if_exist = (c->coll_op == OPERATION_BOP_UPSERT ? true : false);
+        ENGINE_ERROR_CODE ret = settings.engine.v1->btree_elem_insert(settings.engine.v0, c,
+                                                    c->coll_key, c->coll_nkey, elem, replace_if_exist,
+                                                    c->coll_attrp, &replaced, &created,
+                                                    (c->coll_drop ? &trim_result : NULL), 0);
+
+        // release the btree element inserted.
+        settings.engine.v1->btree_elem_release(settings.engine.v0, c, &c->coll_eitem, 1);
+        c->coll_eitem = NULL;
+
+        if (settings.detail_enabled) {
+            stats_prefix_record_bop_insert(c->coll_key, c->coll_nkey, (ret==ENGINE_SUCCESS));
+        }
+
+        switch (ret) {
+        case ENGINE_SUCCESS:
+            STATS_HITS(c, bop_insert, c->coll_key, c->coll_nkey);
+            if (c->coll_drop && trim_result.elems != NULL) { /* getrim flag */
+                assert(trim_result.count == 1);
+
+                /* get trimmed element info */
+                settings.engine.v1->get_btree_elem_info(settings.engine.v0, c, trim_result.elems, &info);
+
+                /* return the trimmed element info to the client */
+                if ((add_iov_printf(c, "VALUE %u %u\r\n", htonl(trim_result.flags), trim_result.count) != 0) ||
+                    (add_iov_bop_elem(c, &info) != 0) ||
+                    (add_iov_copy(c, "TRIMMED\r\n", strlen("TRIMMED\r\n")) != 0))
+                {
+                    settings.engine.v1->btree_elem_release(settings.engine.v0, c,
+                                                           &trim_result.elems, trim_result.count);
+                    out_string(c, "SERVER_ERROR out of memory writing get response");
+                } else {
+                    /* prepare for writing response */
+                    c->coll_eitem = trim_result.elems;
+                    c->coll_ecount = trim_result.count; /* trim_result.count == 1 */
+                    conn_set_state(c, conn_mwrite);
+                }
+            } else {
+                /* no getrim flag or no trimmed element */
+                if (replaced == false) {
+                    if (created == false) out_string(c, "STORED");
                     else                  out_string(c, "CREATED_STORED");
                 } else {
                     out_string(c, "REPLACED");
@@ -1665,13 +2229,7 @@ static void process_bop_mget_complete(conn *c) {
         uint32_t flags, k, e;
         bool trimmed;
         eitem_info info;
-        char *resultptr;
-        char *valuestrp = (char*)elem_array + (c->coll_numkeys * c->coll_rcount * sizeof(eitem*));
-        int   resultlen;
-        int   nvaluestr;
-
-        sprintf(valuestrp, "VALUE "); nvaluestr = strlen("VALUE ");
-        resultptr = valuestrp + nvaluestr;
+        const char *result;
 
         if (c->coll_bkrange.to_nbkey == BKEY_NULL) {
             memcpy(c->coll_bkrange.to_bkey, c->coll_bkrange.from_bkey,
@@ -1695,28 +2253,20 @@ static void process_bop_mget_complete(conn *c) {
             }
 
             if (ret == ENGINE_SUCCESS) {
-                sprintf(resultptr, " %s %u %u\r\n",
-                        (trimmed==false ? "OK" : "TRIMMED"), htonl(flags), cur_elem_count);
-                if ((add_iov(c, valuestrp, nvaluestr) != 0) ||
-                    (add_iov(c, key_tokens[k].value, key_tokens[k].length) != 0) ||
-                    (add_iov(c, resultptr, strlen(resultptr)) != 0)) {
+                if (add_iov_printf(c, "VALUE %.*s %s %u %u\r\n",
+                                   (int)key_tokens[k].length, key_tokens[k].value,
+                                   (trimmed==false ? "OK" : "TRIMMED"), htonl(flags), cur_elem_count) != 0) {
                     STATS_NOKEY(c, cmd_bop_get);
                     ret = ENGINE_ENOMEM; break;
                 }
-                resultptr += strlen(resultptr);
 
                 for (e = 0; e < cur_elem_count; e++) {
                     settings.engine.v1->get_btree_elem_info(settings.engine.v0, c,
                                                             elem_array[tot_elem_count+e], &info);
-                    sprintf(resultptr, "ELEMENT ");
-                    resultlen = strlen(resultptr);
-                    resultlen += make_bop_elem_response(resultptr + resultlen, &info);
-
-                    if ((add_iov(c, resultptr, resultlen) != 0) ||
-                        (add_iov(c, info.value, info.nbytes) != 0)) {
+                    if ((add_iov_copy(c, "ELEMENT ", 8) != 0) ||
+                        (add_iov_bop_elem(c, &info) != 0)) {
                         ret = ENGINE_ENOMEM; break;
                     }
-                    resultptr += resultlen;
                 }
                 if (ret == ENGINE_SUCCESS) {
                     STATS_ELEM_HITS(c, bop_get, key_tokens[k].value, key_tokens[k].length);
@@ -1730,35 +2280,32 @@ static void process_bop_mget_complete(conn *c) {
             } else {
                 if (ret == ENGINE_ELEM_ENOENT) {
                     STATS_NONE_HITS(c, bop_get,  key_tokens[k].value, key_tokens[k].length);
-                    sprintf(resultptr, " %s\r\n", "NOT_FOUND_ELEMENT");
+                    result = "NOT_FOUND_ELEMENT";
                 }
                 else if (ret == ENGINE_KEY_ENOENT || ret == ENGINE_EBKEYOOR || ret == ENGINE_UNREADABLE) {
                     STATS_MISS(c, bop_get, key_tokens[k].value, key_tokens[k].length);
-                    if (ret == ENGINE_KEY_ENOENT)    sprintf(resultptr, " %s\r\n", "NOT_FOUND");
-                    else if (ret == ENGINE_EBKEYOOR) sprintf(resultptr, " %s\r\n", "OUT_OF_RANGE");
-                    else                             sprintf(resultptr, " %s\r\n", "UNREADABLE");
+                    if (ret == ENGINE_KEY_ENOENT)    result = "NOT_FOUND";
+                    else if (ret == ENGINE_EBKEYOOR) result = "OUT_OF_RANGE";
+                    else                             result = "UNREADABLE";
                 }
                 else if (ret == ENGINE_EBADTYPE || ret == ENGINE_EBADBKEY) {
                     STATS_NOKEY(c, cmd_bop_get);
-                    if (ret == ENGINE_EBADTYPE) sprintf(resultptr, " %s\r\n", "TYPE_MISMATCH");
-                    else                        sprintf(resultptr, " %s\r\n", "BKEY_MISMATCH");
+                    if (ret == ENGINE_EBADTYPE) result = "TYPE_MISMATCH";
+                    else                        result = "BKEY_MISMATCH";
                 }
                 else {
                     break; // ENGINE_DISCONNECT or SEVERE error
                 }
 
-                if ((add_iov(c, valuestrp, nvaluestr) != 0) ||
-                    (add_iov(c, key_tokens[k].value, key_tokens[k].length) != 0) ||
-                    (add_iov(c, resultptr, strlen(resultptr)) != 0)) {
+                if (add_iov_printf(c, "VALUE %.*s %s\r\n",
+                                   (int)key_tokens[k].length, key_tokens[k].value, result) != 0) {
                     ret = ENGINE_ENOMEM; break;
                 }
-                resultptr += strlen(resultptr);
             }
         }
         if (k == c->coll_numkeys) {
             ret = ENGINE_SUCCESS;
-            sprintf(resultptr, "END\r\n");
-            if ((add_iov(c, resultptr, strlen(resultptr)) != 0) ||
+            if ((add_iov_copy(c, "END\r\n", 5) != 0) ||
                 (IS_UDP(c->transport) && build_udp_headers(c) != 0)) {
                 ret = ENGINE_ENOMEM;
             }
@@ -1814,7 +2361,6 @@ static void process_bop_smget_complete(conn *c) {
     int smget_count = c->coll_roffset + c->coll_rcount;
     int elem_array_size = smget_count * (sizeof(eitem*) + (2*sizeof(uint32_t)));
     int keys_array_size = c->coll_numkeys * sizeof(token_t);
-    int kmis_array_size = c->coll_numkeys * sizeof(uint32_t);
     char *vptr = (char*)c->coll_mkeys;
     char delimiter = ',';
 
@@ -1851,62 +2397,49 @@ static void process_bop_smget_complete(conn *c) {
     switch (ret) {
     case ENGINE_SUCCESS:
         {
-        eitem_info info[elem_count+1]; /* elem_count might be 0. */
-        char *respptr = ((char*)kmis_array + kmis_array_size);
-        int   resplen;
+        eitem_info info;
+        const char *tail;
 
+        /* the response strings and small element values are
+         * written in the output arena of the connection.
+         */
         do {
-            sprintf(respptr, "VALUE %u\r\n", elem_count);
-            if (add_iov(c, respptr, strlen(respptr)) != 0) {
+            if (add_iov_printf(c, "VALUE %u\r\n", elem_count) != 0) {
                 ret = ENGINE_ENOMEM; break;
             }
-            respptr += strlen(respptr);
 
             for (i = 0; i < elem_count; i++) {
                 idx = kfnd_array[i];
-                if (add_iov(c, keys_array[idx].value, keys_array[idx].length) != 0) {
-                    ret = ENGINE_ENOMEM; break;
-                }
                 settings.engine.v1->get_btree_elem_info(settings.engine.v0, c,
-                                                        elem_array[i], &info[i]);
-                /* flags */
-                sprintf(respptr, " %u ", htonl(flag_array[i]));
-                resplen = strlen(respptr);
-                resplen += make_bop_elem_response(respptr + resplen, &info[i]);
-                if ((add_iov(c, respptr, resplen) != 0) ||
-                    (add_iov(c, info[i].value, info[i].nbytes) != 0)) {
+                                                        elem_array[i], &info);
+                /* key and flags */
+                if ((add_iov_printf(c, "%.*s %u ", (int)keys_array[idx].length,
+                                    keys_array[idx].value, htonl(flag_array[i])) != 0) ||
+                    (add_iov_bop_elem(c, &info) != 0)) {
                     ret = ENGINE_ENOMEM; break;
                 }
-                respptr += resplen;
             }
             if (ret == ENGINE_ENOMEM) break;
 
-            sprintf(respptr, "MISSED_KEYS %u\r\n", kmis_count);
-            if (add_iov(c, respptr, strlen(respptr)) != 0) {
+            if (add_iov_printf(c, "MISSED_KEYS %u\r\n", kmis_count) != 0) {
                 ret = ENGINE_ENOMEM; break;
             }
-            respptr += strlen(respptr);
 
-            if (kmis_count > 0) {
-                sprintf(respptr, "\r\n"); resplen = 2;
-                for (i = 0; i < kmis_count; i++) {
-                    /* the last key string does not have delimiter character */
-                    idx = kmis_array[i];
-                    if ((add_iov(c, keys_array[idx].value, keys_array[idx].length) != 0) ||
-                        (add_iov(c, respptr, resplen) != 0)) {
-                        ret = ENGINE_ENOMEM; break;
-                    }
+            for (i = 0; i < kmis_count; i++) {
+                idx = kmis_array[i];
+                if (add_iov_printf(c, "%.*s\r\n", (int)keys_array[idx].length,
+                                   keys_array[idx].value) != 0) {
+                    ret = ENGINE_ENOMEM; break;
                 }
-                respptr += resplen;
-                if (ret == ENGINE_ENOMEM) break;
             }
+            if (ret == ENGINE_ENOMEM) break;
 
             if (trimmed == true) {
-                sprintf(respptr, (duplicated ? "DUPLICATED_TRIMMED\r\n" : "TRIMMED\r\n"));
+                tail = (duplicated ? "DUPLICATED_TRIMMED\r\n" : "TRIMMED\r\n");
             } else {
-                sprintf(respptr, (duplicated ? "DUPLICATED\r\n" : "END\r\n"));
+                tail = (duplicated ? "DUPLICATED\r\n" : "END\r\n");
             }
-            if ((add_iov(c, respptr, strlen(respptr)) != 0) ||
+            if ((add_iov_copy(c, tail, strlen(tail)) != 0) ||
                 (IS_UDP(c->transport) && build_udp_headers(c) != 0)) {
                 ret = ENGINE_ENOMEM; break;
             }
@@ -1956,11 +2489,14 @@ static void process_bop_smget_complete(conn *c) {
 static void complete_update_ascii(conn *c) {
     assert(c != NULL);
 
-    if (c->coll_eitem != NULL) {
+    /* sop setop reads its keys without an element array */
+    if (c->coll_eitem != NULL || c->coll_mkeys != NULL) {
         if (c->coll_op == OPERATION_LOP_INSERT)  process_lop_insert_complete(c);
         else if (c->coll_op == OPERATION_SOP_INSERT) process_sop_insert_complete(c);
         else if (c->coll_op == OPERATION_SOP_DELETE) process_sop_delete_complete(c);
         else if (c->coll_op == OPERATION_SOP_EXIST) process_sop_exist_complete(c);
+        else if (c->coll_op == OPERATION_SOP_MEXIST) process_sop_mexist_complete(c);
+        else if (c->coll_op == OPERATION_SOP_SETOP) process_sop_setop_complete(c);
         else if (c->coll_op == OPERATION_BOP_INSERT ||
                  c->coll_op == OPERATION_BOP_UPSERT) process_bop_insert_complete(c);
         else if (c->coll_op == OPERATION_BOP_UPDATE) process_bop_update_complete(c);
@@ -2664,7 +3200,7 @@ static void process_bin_get(conn *c) {
         }
 
         /* Add the data minus the CRLF */
-        add_iov(c, info.value[0].iov_base, info.value[0].iov_len - 2);
+        add_iov_value(c, info.value[0].iov_base, info.value[0].iov_len - 2);
         conn_set_state(c, conn_mwrite);
         /* Remember this command so we can garbage collect it later */
         c->item = it;
@@ -2984,21 +3520,17 @@ static void bin_read_chunk(conn *c, enum bin_substates next_substate, uint32_t c
     /* Ok... do we have room for everything in our buffer? */
     ptrdiff_t offset = c->rcurr + sizeof(protocol_binary_request_header) - c->rbuf;
     if (c->rlbytes > c->rsize - offset) {
-        size_t nsize = c->rsize;
         size_t size = c->rlbytes + sizeof(protocol_binary_request_header);
 
-        while (size > nsize) {
-            nsize *= 2;
-        }
-
-        if (nsize != c->rsize) {
+        if (size > c->rsize) {
+            size_t nsize = rbuf_size_for(size);
             if (settings.verbose > 1) {
                 settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
                         "%d: Need to grow buffer from %lu to %lu\n",
                         c->sfd, (unsigned long)c->rsize, (unsigned long)nsize);
             }
-            char *newm = realloc(c->rbuf, nsize);
-            if (newm == NULL) {
+            /* the packet is moved to the front of the new buffer */
+            if (!conn_rbuf_resize(c, nsize)) {
                 if (settings.verbose) {
                     settings.extensions.logger->log(EXTENSION_LOG_INFO, c,
                             "%d: Failed to grow buffer.. closing connection\n",
@@ -3007,11 +3539,6 @@ static void bin_read_chunk(conn *c, enum bin_substates next_substate, uint32_t c
                 conn_set_state(c, conn_closing);
                 return;
             }
-
-            c->rbuf= newm;
-            /* rcurr should point to the same offset in the packet */
-            c->rcurr = c->rbuf + offset - sizeof(protocol_binary_request_header);
-            c->rsize = nsize;
         }
         if (c->rbuf != c->rcurr) {
             memmove(c->rbuf, c->rcurr, c->rbytes);
@@ -4998,77 +5525,467 @@ static void process_bin_bop_count(conn *c) {
     }
 }
 
-#if defined(SUPPORT_BOP_MGET) || defined(SUPPORT_BOP_SMGET)
-static void process_bin_bop_prepare_nread_keys(conn *c) {
+static void process_bin_bop_position(conn *c) {
     assert(c != NULL);
-    assert(c->cmd == PROTOCOL_BINARY_CMD_BOP_MGET || c->cmd == PROTOCOL_BINARY_CMD_BOP_SMGET);
-
+    assert(c->cmd == PROTOCOL_BINARY_CMD_BOP_POSITION);
     char *key = binary_get_key(c);
-    uint32_t nkey = c->binary_header.request.keylen;
-    size_t vlen = 0;
+    int  nkey = c->binary_header.request.keylen;
 
-    if (nkey + c->binary_header.request.extlen <= c->binary_header.request.bodylen) {
-        vlen = c->binary_header.request.bodylen - (nkey + c->binary_header.request.extlen);
-    } else {
-        handle_binary_protocol_error(c);
+    /* fix byteorder in the request */
+    protocol_binary_request_bop_position* req = binary_get_request(c);
+    bkey_range *bkrange = &c->coll_bkrange;
+    if (req->message.body.nbkey > MAX_BKEY_LENG) {
+        write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL, 0);
         return;
     }
-
-    /* fix byteorder in the request */
-    protocol_binary_request_bop_mkeys* req = binary_get_request(c);
-    bkey_range   *bkrange = &req->message.body.bkrange;
-    if (bkrange->from_nbkey == 0) {
+    if (req->message.body.nbkey == 0) {
         uint64_t bkey_temp;
-        memcpy((unsigned char*)&bkey_temp, bkrange->from_bkey, sizeof(uint64_t));
+        memcpy((unsigned char*)&bkey_temp, req->message.body.bkey, sizeof(uint64_t));
         bkey_temp = ntohll(bkey_temp);
         memcpy(bkrange->from_bkey, (unsigned char*)&bkey_temp, sizeof(uint64_t));
-        //*(uint64_t*)bkrange->from_bkey = ntohll(*(uint64_t*)bkrange->from_bkey);
-    }
-    if (bkrange->to_nbkey   == 0) {
-        uint64_t bkey_temp;
-        memcpy((unsigned char*)&bkey_temp, bkrange->to_bkey, sizeof(uint64_t));
-        bkey_temp = ntohll(bkey_temp);
-        memcpy(bkrange->to_bkey, (unsigned char*)&bkey_temp, sizeof(uint64_t));
-        //*(uint64_t*)bkrange->to_bkey   = ntohll(*(uint64_t*)bkrange->to_bkey);
+    } else {
+        memcpy(bkrange->from_bkey, req->message.body.bkey, req->message.body.nbkey);
     }
-    req->message.body.req_offset = ntohl(req->message.body.req_offset);
-    req->message.body.req_count  = ntohl(req->message.body.req_count);
-    req->message.body.key_count  = ntohl(req->message.body.key_count);
+    bkrange->from_nbkey = req->message.body.nbkey;
+    bkrange->to_nbkey   = BKEY_NULL;
 
     if (settings.verbose > 1) {
-        fprintf(stderr, "<%d BOP %s ", c->sfd, (c->cmd==PROTOCOL_BINARY_CMD_BOP_MGET ? "MGET" : "SMGET"));
+        fprintf(stderr, "<%d BOP POSITION ", c->sfd);
         for (int ii = 0; ii < nkey; ++ii) {
             fprintf(stderr, "%c", key[ii]);
         }
-        fprintf(stderr, " ReqOffset(%u) ReqCount(%u) KeyCount(%u)\n",
-                req->message.body.req_offset, req->message.body.req_count, req->message.body.key_count);
+        fprintf(stderr, " NBKey(%d) Order(%s)\n", req->message.body.nbkey,
+                (req->message.body.order == BTREE_ORDER_DESC ? "desc" : "asc"));
     }
 
-    eitem *elem=NULL;
+    if (req->message.body.order != BTREE_ORDER_ASC &&
+        req->message.body.order != BTREE_ORDER_DESC) {
+        write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL, 0);
+        return;
+    }
+
+    int position;
 
     ENGINE_ERROR_CODE ret = c->aiostat;
     c->aiostat = ENGINE_SUCCESS;
-    c->ewouldblock = false;
 
     if (ret == ENGINE_SUCCESS) {
-        int need_size = 0;
+        ret = settings.engine.v1->btree_posi_find(settings.engine.v0, c, key, nkey, bkrange,
+                                                  (ENGINE_BTREE_ORDER)req->message.body.order,
+                                                  &position, c->binary_header.request.vbucket);
+    }
 
-        /* validation checking on arguments */
-        if (req->message.body.key_count < 1 || vlen < 1 || req->message.body.req_count < 1) {
-            ret = ENGINE_EBADVALUE; goto done;
-        }
-#ifdef SUPPORT_BOP_MGET
-        if (c->cmd == PROTOCOL_BINARY_CMD_BOP_MGET) {
-            int bmget_count;
-            int elem_array_size;
+    if (settings.detail_enabled) {
+        stats_prefix_record_bop_position(key, nkey, (ret==ENGINE_SUCCESS || ret==ENGINE_ELEM_ENOENT));
+    }
 
-            if (req->message.body.key_count > MAX_BMGET_KEY_COUNT ||
-                req->message.body.req_count > MAX_BMGET_ELM_COUNT ||
-                (req->message.body.req_offset + req->message.body.req_count) > MAX_BTREE_SIZE) {
-                ret = ENGINE_EBADVALUE; goto done;
-            }
-            bmget_count = req->message.body.key_count * req->message.body.req_count;
-            elem_array_size = bmget_count * sizeof(eitem*);
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        STATS_ELEM_HITS(c, bop_position, key, nkey);
+        protocol_binary_response_bop_position* rsp = (protocol_binary_response_bop_position*)c->wbuf;
+        rsp->message.body.position = htonl((uint32_t)position);
+        write_bin_response(c, &rsp->message.body, 0, 0, sizeof(rsp->message.body));
+        break;
+    case ENGINE_ELEM_ENOENT:
+        STATS_NONE_HITS(c, bop_position, key, nkey);
+        write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_ELEM_ENOENT, 0);
+        break;
+    case ENGINE_EWOULDBLOCK:
+        c->ewouldblock = true;
+        break;
+    case ENGINE_DISCONNECT:
+        c->state = conn_closing;
+        break;
+    case ENGINE_KEY_ENOENT:
+    case ENGINE_UNREADABLE:
+        STATS_MISS(c, bop_position, key, nkey);
+        if (ret == ENGINE_KEY_ENOENT)
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, 0);
+        else
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_UNREADABLE, 0);
+        break;
+    default:
+        STATS_NOKEY(c, cmd_bop_position);
+        if (ret == ENGINE_EBADTYPE)
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EBADTYPE, 0);
+        else if (ret == ENGINE_EBADBKEY)
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EBADBKEY, 0);
+        else
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL, 0);
+    }
+}
+
+/*
+ * A bkey of a binary response takes a slot of the request layout:
+ * MAX_BKEY_LENG bytes and the bkey length. A 64 bit bkey (length 0) is
+ * put in network byte order in the first 8 bytes.
+ */
+#define BIN_BKEY_SLOT_SIZE (MAX_BKEY_LENG+1)
+
+static void bin_bkey_slot_fill(unsigned char *slot, const eitem_info *info)
+{
+    memset(slot, 0, BIN_BKEY_SLOT_SIZE);
+    if (info->nscore == 0) {
+        uint64_t bkey_temp;
+        memcpy((unsigned char*)&bkey_temp, info->score, sizeof(uint64_t));
+        bkey_temp = htonll(bkey_temp);
+        memcpy(slot, (unsigned char*)&bkey_temp, sizeof(uint64_t));
+    } else {
+        memcpy(slot, info->score, info->nscore);
+    }
+    slot[MAX_BKEY_LENG] = info->nscore;
+}
+
+static void process_bin_bop_gbp(conn *c) {
+    assert(c != NULL);
+    assert(c->cmd == PROTOCOL_BINARY_CMD_BOP_GBP);
+    char *key = binary_get_key(c);
+    int  nkey = c->binary_header.request.keylen;
+
+    /* fix byteorder in the request */
+    protocol_binary_request_bop_gbp* req = binary_get_request(c);
+    uint32_t from_posi = ntohl(req->message.body.from_posi);
+    uint32_t to_posi   = ntohl(req->message.body.to_posi);
+
+    if (settings.verbose > 1) {
+        fprintf(stderr, "<%d BOP GBP ", c->sfd);
+        for (int ii = 0; ii < nkey; ++ii) {
+            fprintf(stderr, "%c", key[ii]);
+        }
+        fprintf(stderr, " Order(%s) Position(%u..%u)\n",
+                (req->message.body.order == BTREE_ORDER_DESC ? "desc" : "asc"),
+                from_posi, to_posi);
+    }
+
+    if (req->message.body.order != BTREE_ORDER_ASC &&
+        req->message.body.order != BTREE_ORDER_DESC) {
+        write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL, 0);
+        return;
+    }
+
+    eitem  **elem_array = NULL;
+    uint32_t elem_count;
+    uint32_t flags, i;
+    int      est_count;
+    int      need_size;
+
+    ENGINE_ERROR_CODE ret = c->aiostat;
+    c->aiostat = ENGINE_SUCCESS;
+
+    if (from_posi > MAX_BTREE_SIZE) from_posi = MAX_BTREE_SIZE;
+    if (to_posi   > MAX_BTREE_SIZE) to_posi   = MAX_BTREE_SIZE;
+
+    if (ret == ENGINE_SUCCESS) {
+        est_count = (from_posi <= to_posi ? (to_posi - from_posi + 1)
+                                          : (from_posi - to_posi + 1));
+        /* the bkeys and value lengths of the response follow the element array */
+        need_size = est_count * (sizeof(eitem*)+BIN_BKEY_SLOT_SIZE+sizeof(uint32_t));
+        if ((elem_array = (eitem **)malloc(need_size)) == NULL) {
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM, 0);
+            return;
+        }
+
+        ret = settings.engine.v1->btree_elem_get_by_posi(settings.engine.v0, c, key, nkey,
+                                                         (ENGINE_BTREE_ORDER)req->message.body.order,
+                                                         from_posi, to_posi,
+                                                         elem_array, &elem_count, &flags,
+                                                         c->binary_header.request.vbucket);
+    }
+
+    if (settings.detail_enabled) {
+        stats_prefix_record_bop_gbp(key, nkey, (ret==ENGINE_SUCCESS || ret==ENGINE_ELEM_ENOENT));
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        {
+        protocol_binary_response_bop_gbp* rsp = (protocol_binary_response_bop_gbp*)c->wbuf;
+        unsigned char *bkeyptr = (unsigned char *)&elem_array[elem_count];
+        uint32_t *vlenptr = (uint32_t *)(bkeyptr + (BIN_BKEY_SLOT_SIZE * elem_count));
+        uint32_t  bodylen;
+        eitem_info info;
+
+        bodylen = sizeof(rsp->message.body) + (elem_count * (BIN_BKEY_SLOT_SIZE+sizeof(uint32_t)));
+        for (i = 0; i < elem_count; i++) {
+            settings.engine.v1->get_btree_elem_info(settings.engine.v0, c, elem_array[i], &info);
+            bin_bkey_slot_fill(bkeyptr + (BIN_BKEY_SLOT_SIZE * i), &info);
+            vlenptr[i] = htonl(info.nbytes - 2);
+            bodylen += (info.nbytes - 2);
+        }
+        add_bin_header(c, 0, sizeof(rsp->message.body), 0, bodylen);
+
+        // add the flags and count
+        rsp->message.body.flags = flags;
+        rsp->message.body.count = htonl(elem_count);
+        add_iov(c, &rsp->message.body, sizeof(rsp->message.body));
+
+        // add bkeys and value lengths
+        add_iov(c, (char*)bkeyptr, elem_count*(BIN_BKEY_SLOT_SIZE+sizeof(uint32_t)));
+
+        /* Add the data without CRLF */
+        for (i = 0; i < elem_count; i++) {
+            settings.engine.v1->get_btree_elem_info(settings.engine.v0, c, elem_array[i], &info);
+            if (add_iov(c, info.value, info.nbytes - 2) != 0) {
+                ret = ENGINE_ENOMEM;
+                break;
+            }
+        }
+
+        if (ret == ENGINE_SUCCESS) {
+            STATS_ELEM_HITS(c, bop_gbp, key, nkey);
+            /* Remember this command so we can garbage collect it later */
+            c->coll_eitem  = (void *)elem_array;
+            c->coll_ecount = elem_count;
+            c->coll_op     = OPERATION_BOP_GBP;
+            conn_set_state(c, conn_mwrite);
+        } else {
+            STATS_NOKEY(c, cmd_bop_gbp);
+            settings.engine.v1->btree_elem_release(settings.engine.v0, c, elem_array, elem_count);
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM, 0);
+        }
+        }
+        break;
+    case ENGINE_ELEM_ENOENT:
+        STATS_NONE_HITS(c, bop_gbp, key, nkey);
+        write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_ELEM_ENOENT, 0);
+        break;
+    case ENGINE_EWOULDBLOCK:
+        c->ewouldblock = true;
+        break;
+    case ENGINE_DISCONNECT:
+        c->state = conn_closing;
+        break;
+    case ENGINE_KEY_ENOENT:
+    case ENGINE_UNREADABLE:
+        STATS_MISS(c, bop_gbp, key, nkey);
+        if (ret == ENGINE_KEY_ENOENT)
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, 0);
+        else
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_UNREADABLE, 0);
+        break;
+    default:
+        STATS_NOKEY(c, cmd_bop_gbp);
+        if (ret == ENGINE_EBADTYPE)
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EBADTYPE, 0);
+        else
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL, 0);
+    }
+
+    if (ret != ENGINE_SUCCESS && elem_array != NULL) {
+        free((void *)elem_array);
+    }
+}
+
+static void process_bin_bop_arithmetic(conn *c) {
+    assert(c != NULL);
+    assert(c->cmd == PROTOCOL_BINARY_CMD_BOP_INCR ||
+           c->cmd == PROTOCOL_BINARY_CMD_BOP_DECR);
+    char *key = binary_get_key(c);
+    int  nkey = c->binary_header.request.keylen;
+    bool incr = (c->cmd == PROTOCOL_BINARY_CMD_BOP_INCR);
+
+    /* fix byteorder in the request */
+    protocol_binary_request_bop_incr* req = binary_get_request(c);
+    bkey_range *bkrange = &c->coll_bkrange;
+    if (req->message.body.nbkey > MAX_BKEY_LENG) {
+        write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL, 0);
+        return;
+    }
+    if (req->message.body.nbkey == 0) {
+        uint64_t bkey_temp;
+        memcpy((unsigned char*)&bkey_temp, req->message.body.bkey, sizeof(uint64_t));
+        bkey_temp = ntohll(bkey_temp);
+        memcpy(bkrange->from_bkey, (unsigned char*)&bkey_temp, sizeof(uint64_t));
+    } else {
+        memcpy(bkrange->from_bkey, req->message.body.bkey, req->message.body.nbkey);
+    }
+    bkrange->from_nbkey = req->message.body.nbkey;
+    bkrange->to_nbkey   = BKEY_NULL;
+    req->message.body.delta   = ntohll(req->message.body.delta);
+    req->message.body.initial = ntohll(req->message.body.initial);
+
+    if (settings.verbose > 1) {
+        fprintf(stderr, "<%d BOP %s ", c->sfd, (incr ? "INCR" : "DECR"));
+        for (int ii = 0; ii < nkey; ++ii) {
+            fprintf(stderr, "%c", key[ii]);
+        }
+        fprintf(stderr, " NBKey(%d) Delta(%"PRIu64")", req->message.body.nbkey,
+                req->message.body.delta);
+        if (req->message.body.create) {
+            fprintf(stderr, " Create Initial(%"PRIu64") NEFlag(%d)",
+                    req->message.body.initial, req->message.body.neflag);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    if (req->message.body.delta < 1 ||
+        (req->message.body.neflag > MAX_EFLAG_LENG)) {
+        write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL, 0);
+        return;
+    }
+
+    eflag_t  eflagspc;
+    eflag_t *eflagptr = NULL;
+    uint64_t result;
+
+    if (req->message.body.create && req->message.body.neflag > 0) {
+        memcpy(eflagspc.val, req->message.body.eflag, req->message.body.neflag);
+        eflagspc.len = req->message.body.neflag;
+        eflagptr = &eflagspc;
+    }
+
+    ENGINE_ERROR_CODE ret = c->aiostat;
+    c->aiostat = ENGINE_SUCCESS;
+
+    if (ret == ENGINE_SUCCESS) {
+        ret = settings.engine.v1->btree_elem_arithmetic(settings.engine.v0, c, key, nkey, bkrange,
+                                                        incr, (bool)req->message.body.create,
+                                                        req->message.body.delta,
+                                                        req->message.body.initial, eflagptr,
+                                                        &result, c->binary_header.request.vbucket);
+    }
+
+    if (settings.detail_enabled) {
+        if (incr) {
+            stats_prefix_record_bop_incr(key, nkey, (ret==ENGINE_SUCCESS || ret==ENGINE_ELEM_ENOENT));
+        } else {
+            stats_prefix_record_bop_decr(key, nkey, (ret==ENGINE_SUCCESS || ret==ENGINE_ELEM_ENOENT));
+        }
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        if (incr) {
+            STATS_ELEM_HITS(c, bop_incr, key, nkey);
+        } else {
+            STATS_ELEM_HITS(c, bop_decr, key, nkey);
+        }
+        protocol_binary_response_bop_incr* rsp = (protocol_binary_response_bop_incr*)c->wbuf;
+        rsp->message.body.value = htonll(result);
+        write_bin_response(c, &rsp->message.body, 0, 0, sizeof(rsp->message.body));
+        break;
+    case ENGINE_KEY_ENOENT:
+        if (incr) {
+            STATS_MISS(c, bop_incr, key, nkey);
+        } else {
+            STATS_MISS(c, bop_decr, key, nkey);
+        }
+        write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, 0);
+        break;
+    case ENGINE_ELEM_ENOENT:
+        if (incr) {
+            STATS_NONE_HITS(c, bop_incr, key, nkey);
+        } else {
+            STATS_NONE_HITS(c, bop_decr, key, nkey);
+        }
+        write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_ELEM_ENOENT, 0);
+        break;
+    case ENGINE_EWOULDBLOCK:
+        c->ewouldblock = true;
+        break;
+    case ENGINE_DISCONNECT:
+        c->state = conn_closing;
+        break;
+    case ENGINE_EINVAL:
+        if (incr) {
+            STATS_NOKEY(c, cmd_bop_incr);
+        } else {
+            STATS_NOKEY(c, cmd_bop_decr);
+        }
+        write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_DELTA_BADVAL, 0);
+        break;
+    default:
+        if (incr) {
+            STATS_NOKEY(c, cmd_bop_incr);
+        } else {
+            STATS_NOKEY(c, cmd_bop_decr);
+        }
+        if (ret == ENGINE_EBADTYPE)
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EBADTYPE, 0);
+        else if (ret == ENGINE_EBADBKEY)
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EBADBKEY, 0);
+        else if (ret == ENGINE_EBKEYOOR)
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EBKEYOOR, 0);
+        else if (ret == ENGINE_EOVERFLOW)
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EOVERFLOW, 0);
+        else if (ret == ENGINE_ENOMEM)
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM, 0);
+        else
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL, 0);
+    }
+}
+
+#if defined(SUPPORT_BOP_MGET) || defined(SUPPORT_BOP_SMGET)
+static void process_bin_bop_prepare_nread_keys(conn *c) {
+    assert(c != NULL);
+    assert(c->cmd == PROTOCOL_BINARY_CMD_BOP_MGET || c->cmd == PROTOCOL_BINARY_CMD_BOP_SMGET);
+
+    char *key = binary_get_key(c);
+    uint32_t nkey = c->binary_header.request.keylen;
+    size_t vlen = 0;
+
+    if (nkey + c->binary_header.request.extlen <= c->binary_header.request.bodylen) {
+        vlen = c->binary_header.request.bodylen - (nkey + c->binary_header.request.extlen);
+    } else {
+        handle_binary_protocol_error(c);
+        return;
+    }
+
+    /* fix byteorder in the request */
+    protocol_binary_request_bop_mkeys* req = binary_get_request(c);
+    bkey_range   *bkrange = &req->message.body.bkrange;
+    if (bkrange->from_nbkey == 0) {
+        uint64_t bkey_temp;
+        memcpy((unsigned char*)&bkey_temp, bkrange->from_bkey, sizeof(uint64_t));
+        bkey_temp = ntohll(bkey_temp);
+        memcpy(bkrange->from_bkey, (unsigned char*)&bkey_temp, sizeof(uint64_t));
+        //*(uint64_t*)bkrange->from_bkey = ntohll(*(uint64_t*)bkrange->from_bkey);
+    }
+    if (bkrange->to_nbkey   == 0) {
+        uint64_t bkey_temp;
+        memcpy((unsigned char*)&bkey_temp, bkrange->to_bkey, sizeof(uint64_t));
+        bkey_temp = ntohll(bkey_temp);
+        memcpy(bkrange->to_bkey, (unsigned char*)&bkey_temp, sizeof(uint64_t));
+        //*(uint64_t*)bkrange->to_bkey   = ntohll(*(uint64_t*)bkrange->to_bkey);
+    }
+    req->message.body.req_offset = ntohl(req->message.body.req_offset);
+    req->message.body.req_count  = ntohl(req->message.body.req_count);
+    req->message.body.key_count  = ntohl(req->message.body.key_count);
+
+    if (settings.verbose > 1) {
+        fprintf(stderr, "<%d BOP %s ", c->sfd, (c->cmd==PROTOCOL_BINARY_CMD_BOP_MGET ? "MGET" : "SMGET"));
+        for (int ii = 0; ii < nkey; ++ii) {
+            fprintf(stderr, "%c", key[ii]);
+        }
+        fprintf(stderr, " ReqOffset(%u) ReqCount(%u) KeyCount(%u)\n",
+                req->message.body.req_offset, req->message.body.req_count, req->message.body.key_count);
+    }
+
+    eitem *elem=NULL;
+
+    ENGINE_ERROR_CODE ret = c->aiostat;
+    c->aiostat = ENGINE_SUCCESS;
+    c->ewouldblock = false;
+
+    if (ret == ENGINE_SUCCESS) {
+        int need_size = 0;
+
+        /* validation checking on arguments */
+        if (req->message.body.key_count < 1 || vlen < 1 || req->message.body.req_count < 1) {
+            ret = ENGINE_EBADVALUE; goto done;
+        }
+#ifdef SUPPORT_BOP_MGET
+        if (c->cmd == PROTOCOL_BINARY_CMD_BOP_MGET) {
+            int bmget_count;
+            int elem_array_size;
+
+            if (req->message.body.key_count > MAX_BMGET_KEY_COUNT ||
+                req->message.body.req_count > MAX_BMGET_ELM_COUNT ||
+                (req->message.body.req_offset + req->message.body.req_count) > MAX_BTREE_SIZE) {
+                ret = ENGINE_EBADVALUE; goto done;
+            }
+            bmget_count = req->message.body.key_count * req->message.body.req_count;
+            elem_array_size = bmget_count * sizeof(eitem*);
 
             need_size = elem_array_size;
         }
@@ -6134,6 +7051,18 @@ static void dispatch_bin_command(conn *c) {
     case PROTOCOL_BINARY_CMD_BOP_DELETEQ:
         c->cmd = PROTOCOL_BINARY_CMD_BOP_DELETE;
         break;
+    case PROTOCOL_BINARY_CMD_BOP_CREATEQ:
+        c->cmd = PROTOCOL_BINARY_CMD_BOP_CREATE;
+        break;
+    case PROTOCOL_BINARY_CMD_BOP_INCRQ:
+        c->cmd = PROTOCOL_BINARY_CMD_BOP_INCR;
+        break;
+    case PROTOCOL_BINARY_CMD_BOP_DECRQ:
+        c->cmd = PROTOCOL_BINARY_CMD_BOP_DECR;
+        break;
+    case PROTOCOL_BINARY_CMD_SETATTRQ:
+        c->cmd = PROTOCOL_BINARY_CMD_SETATTR;
+        break;
     default:
         c->noreply = false;
     }
@@ -6347,6 +7276,28 @@ static void dispatch_bin_command(conn *c) {
                 protocol_error = 1;
             }
             break;
+        case PROTOCOL_BINARY_CMD_BOP_POSITION:
+            if (keylen > 0 && extlen == (MAX_BKEY_LENG+1+8) && bodylen == (keylen + extlen)) {
+                bin_read_key(c, bin_reading_bop_position, (MAX_BKEY_LENG+1+8));
+            } else {
+                protocol_error = 1;
+            }
+            break;
+        case PROTOCOL_BINARY_CMD_BOP_GBP:
+            if (keylen > 0 && extlen == 12 && bodylen == (keylen + extlen)) {
+                bin_read_key(c, bin_reading_bop_gbp, 12);
+            } else {
+                protocol_error = 1;
+            }
+            break;
+        case PROTOCOL_BINARY_CMD_BOP_INCR:
+        case PROTOCOL_BINARY_CMD_BOP_DECR:
+            if (keylen > 0 && extlen == (MAX_BKEY_LENG+1+MAX_EFLAG_LENG+1+24) && bodylen == (keylen + extlen)) {
+                bin_read_key(c, bin_reading_bop_arithmetic, (MAX_BKEY_LENG+1+MAX_EFLAG_LENG+1+24));
+            } else {
+                protocol_error = 1;
+            }
+            break;
 #if defined(SUPPORT_BOP_MGET) || defined(SUPPORT_BOP_SMGET)
 #ifdef SUPPORT_BOP_MGET
         case PROTOCOL_BINARY_CMD_BOP_MGET:
@@ -6851,6 +7802,15 @@ static void complete_nread_binary(conn *c) {
     case bin_reading_bop_count:
         process_bin_bop_count(c);
         break;
+    case bin_reading_bop_position:
+        process_bin_bop_position(c);
+        break;
+    case bin_reading_bop_gbp:
+        process_bin_bop_gbp(c);
+        break;
+    case bin_reading_bop_arithmetic:
+        process_bin_bop_arithmetic(c);
+        break;
 #if defined(SUPPORT_BOP_MGET) || defined(SUPPORT_BOP_SMGET)
     case bin_reading_bop_prepare_nread_keys:
         process_bin_bop_prepare_nread_keys(c);
@@ -6890,10 +7850,14 @@ static void reset_cmd_handler(conn *c) {
         settings.engine.v1->release(settings.engine.v0, c, c->item);
         c->item = NULL;
     }
-    if (c->coll_eitem != NULL) {
+    if (c->coll_eitem != NULL || c->coll_mkeys != NULL) {
         conn_coll_eitem_free(c);
     }
+    if (c->pipe_state == PIPE_STATE_OFF) {
+        conn_pipe_buffer_detach(c);
+    }
     conn_shrink(c);
+    conn_update_memstats(c);
     if (c->rbytes > 0) {
         conn_set_state(c, conn_parse_cmd);
     } else {
@@ -6944,77 +7908,22 @@ static void complete_nread(conn *c) {
     assert(c->protocol == ascii_prot
            || c->protocol == binary_prot);
 
-    if (c->protocol == ascii_prot) {
-        complete_nread_ascii(c);
-    } else if (c->protocol == binary_prot) {
-        complete_nread_binary(c);
-    }
-}
-
-#define COMMAND_TOKEN 0
-#define SUBCOMMAND_TOKEN 1
-#define PREFIX_TOKEN 1
-#define KEY_TOKEN 1
-#define LOP_KEY_TOKEN 2
-#define SOP_KEY_TOKEN 2
-#define BOP_KEY_TOKEN 2
-
-#define MAX_TOKENS 30
-
-/*
- * Tokenize the command string by replacing whitespace with '\0' and update
- * the token array tokens with pointer to start of each token and length.
- * Returns total number of tokens.  The last valid token is the terminal
- * token (value points to the first unprocessed character of the string and
- * length zero).
- *
- * Usage example:
- *
- *  while(tokenize_command(command, ncommand, tokens, max_tokens) > 0) {
- *      for(int ix = 0; tokens[ix].length != 0; ix++) {
- *          ...
- *      }
- *      ncommand = tokens[ix].value - command;
- *      command  = tokens[ix].value;
- *   }
- */
-static size_t tokenize_command(char *command, token_t *tokens, const size_t max_tokens) {
-    char *s, *e;
-    size_t ntokens = 0;
-
-    assert(command != NULL && tokens != NULL && max_tokens > 1);
-
-    for (s = e = command; ntokens < max_tokens - 1; ++e) {
-        if (*e == ' ') {
-            if (s != e) {
-                tokens[ntokens].value = s;
-                tokens[ntokens].length = e - s;
-                ntokens++;
-                *e = '\0';
-            }
-            s = e + 1;
-        }
-        else if (*e == '\0') {
-            if (s != e) {
-                tokens[ntokens].value = s;
-                tokens[ntokens].length = e - s;
-                ntokens++;
-            }
-
-            break; /* string end */
-        }
+    if (c->protocol == ascii_prot) {
+        complete_nread_ascii(c);
+    } else if (c->protocol == binary_prot) {
+        complete_nread_binary(c);
     }
+}
 
-    /*
-     * If we scanned the whole string, the terminal value pointer is null,
-     * otherwise it is the first unprocessed character.
-     */
-    tokens[ntokens].value =  *e == '\0' ? NULL : e;
-    tokens[ntokens].length = 0;
-    ntokens++;
+#define COMMAND_TOKEN 0
+#define SUBCOMMAND_TOKEN 1
+#define PREFIX_TOKEN 1
+#define KEY_TOKEN 1
+#define LOP_KEY_TOKEN 2
+#define SOP_KEY_TOKEN 2
+#define BOP_KEY_TOKEN 2
 
-    return ntokens;
-}
+#define MAX_TOKENS 30
 
 static void detokenize(token_t *tokens, int ntokens, char **out, int *nbytes) {
     int i, nb;
@@ -7224,8 +8133,7 @@ static void process_stats_prefix(conn *c, const char *prefix, const int nprefix)
 static void aggregate_callback(void *in, void *out) {
     struct thread_stats *out_thread_stats = out;
     struct independent_stats *in_independent_stats = in;
-    threadlocal_stats_aggregate(in_independent_stats->thread_stats,
-                                out_thread_stats);
+    threadlocal_stats_aggregate(in_independent_stats, out_thread_stats);
 }
 
 /* return server specific stats only */
@@ -7242,8 +8150,7 @@ static void server_stats(ADD_STAT add_stats, conn *c, bool aggregate) {
                                             aggregate_callback,
                                             &thread_stats);
     } else {
-        threadlocal_stats_aggregate(get_independent_stats(c)->thread_stats,
-                                    &thread_stats);
+        threadlocal_stats_aggregate(get_independent_stats(c), &thread_stats);
     }
 
     struct slab_stats slab_stats;
@@ -7292,6 +8199,7 @@ static void server_stats(ADD_STAT add_stats, conn *c, bool aggregate) {
     APPEND_STAT("cmd_sop_delete", "%"PRIu64, thread_stats.cmd_sop_delete);
     APPEND_STAT("cmd_sop_get", "%"PRIu64, thread_stats.cmd_sop_get);
     APPEND_STAT("cmd_sop_exist", "%"PRIu64, thread_stats.cmd_sop_exist);
+    APPEND_STAT("cmd_sop_setop", "%"PRIu64, thread_stats.cmd_sop_setop);
     APPEND_STAT("cmd_bop_create", "%"PRIu64, thread_stats.cmd_bop_create);
     APPEND_STAT("cmd_bop_insert", "%"PRIu64, thread_stats.cmd_bop_insert);
     APPEND_STAT("cmd_bop_update", "%"PRIu64, thread_stats.cmd_bop_update);
@@ -7314,6 +8222,8 @@ static void server_stats(ADD_STAT add_stats, conn *c, bool aggregate) {
     APPEND_STAT("auth_errors", "%"PRIu64, thread_stats.auth_errors);
     APPEND_STAT("get_hits", "%"PRIu64, slab_stats.get_hits);
     APPEND_STAT("get_misses", "%"PRIu64, thread_stats.get_misses);
+    APPEND_STAT("get_hit_ratio", "%.2f", (slab_stats.get_hits + thread_stats.get_misses) == 0 ? 0.0 :
+                100.0 * slab_stats.get_hits / (slab_stats.get_hits + thread_stats.get_misses));
     APPEND_STAT("delete_misses", "%"PRIu64, thread_stats.delete_misses);
     APPEND_STAT("delete_hits", "%"PRIu64, slab_stats.delete_hits);
     APPEND_STAT("incr_misses", "%"PRIu64, thread_stats.incr_misses);
@@ -7343,6 +8253,7 @@ static void server_stats(ADD_STAT add_stats, conn *c, bool aggregate) {
     APPEND_STAT("sop_get_none_hits", "%"PRIu64, thread_stats.sop_get_none_hits);
     APPEND_STAT("sop_exist_misses", "%"PRIu64, thread_stats.sop_exist_misses);
     APPEND_STAT("sop_exist_hits", "%"PRIu64, thread_stats.sop_exist_hits);
+    APPEND_STAT("sop_setop_oks", "%"PRIu64, thread_stats.sop_setop_oks);
     APPEND_STAT("bop_create_oks", "%"PRIu64, thread_stats.bop_create_oks);
     APPEND_STAT("bop_insert_misses", "%"PRIu64, thread_stats.bop_insert_misses);
     APPEND_STAT("bop_insert_hits", "%"PRIu64, thread_stats.bop_insert_hits);
@@ -7385,6 +8296,17 @@ static void server_stats(ADD_STAT add_stats, conn *c, bool aggregate) {
     APPEND_STAT("rejected_conns", "%" PRIu64, (unsigned long long)stats.rejected_conns);
     APPEND_STAT("threads", "%d", settings.num_threads);
     APPEND_STAT("conn_yields", "%" PRIu64, (unsigned long long)thread_stats.conn_yields);
+    APPEND_STAT("conn_migrations", "%" PRIu64, (unsigned long long)thread_stats.conn_migrations);
+    if (settings.zerocopy_min > 0) {
+        APPEND_STAT("zerocopy_sends", "%" PRIu64, (unsigned long long)thread_stats.zerocopy_sends);
+        APPEND_STAT("zerocopy_bytes", "%" PRIu64, (unsigned long long)thread_stats.zerocopy_bytes);
+        APPEND_STAT("zerocopy_fallbacks", "%" PRIu64, (unsigned long long)thread_stats.zerocopy_fallbacks);
+    }
+    if (settings.io_uring) {
+        APPEND_STAT("io_uring_submits", "%" PRIu64, (unsigned long long)thread_stats.io_uring_submits);
+        APPEND_STAT("io_uring_sends", "%" PRIu64, (unsigned long long)thread_stats.io_uring_sends);
+        APPEND_STAT("io_uring_recvs", "%" PRIu64, (unsigned long long)thread_stats.io_uring_recvs);
+    }
     STATS_UNLOCK();
 
     /*
@@ -7465,6 +8387,9 @@ static void process_stat_settings(ADD_STAT add_stats, void *c) {
     APPEND_STAT("tcp_backlog", "%d", settings.backlog);
     APPEND_STAT("binding_protocol", "%s",
                 prot_text(settings.binding_protocol));
+    APPEND_STAT("net_io_backend", "%s", threads_use_io_uring() ? "io_uring" : "epoll");
+    APPEND_STAT("reuseport", "%s", settings.reuseport ? "yes" : "no");
+    APPEND_STAT("zerocopy_min", "%u", settings.zerocopy_min);
 #ifdef SASL_ENABLED
     APPEND_STAT("auth_enabled_sasl", "%s", "yes");
 #else
@@ -7497,6 +8422,37 @@ static void process_stat_settings(ADD_STAT add_stats, void *c) {
     }
 }
 
+static void process_stat_conns(ADD_STAT add_stats, void *c) {
+    uint64_t rbuf, wbuf, iov, list, pipe, obuf, structs;
+    unsigned int curr_conns, conn_structs;
+    assert(add_stats);
+
+    STATS_LOCK();
+    curr_conns = stats.curr_conns;
+    conn_structs = stats.conn_structs;
+    rbuf = stats.conn_rbuf_bytes;
+    wbuf = stats.conn_wbuf_bytes;
+    iov  = stats.conn_iov_bytes;
+    list = stats.conn_list_bytes;
+    pipe = stats.conn_pipe_bytes;
+    obuf = stats.conn_obuf_bytes;
+    STATS_UNLOCK();
+    structs = (uint64_t)conn_structs * sizeof(conn);
+
+    APPEND_STAT("curr_connections", "%u", curr_conns);
+    APPEND_STAT("connection_structures", "%u", conn_structs);
+    APPEND_STAT("conn_struct_size", "%lu", (unsigned long)sizeof(conn));
+    APPEND_STAT("conn_struct_bytes", "%"PRIu64, structs);
+    APPEND_STAT("conn_rbuf_bytes", "%"PRIu64, rbuf);
+    APPEND_STAT("conn_wbuf_bytes", "%"PRIu64, wbuf);
+    APPEND_STAT("conn_iov_bytes", "%"PRIu64, iov);
+    APPEND_STAT("conn_list_bytes", "%"PRIu64, list);
+    APPEND_STAT("conn_pipe_bytes", "%"PRIu64, pipe);
+    APPEND_STAT("conn_obuf_bytes", "%"PRIu64, obuf);
+    APPEND_STAT("conn_total_bytes", "%"PRIu64, structs + rbuf + wbuf + iov + list + pipe + obuf);
+    threads_load_stats(add_stats, c);
+}
+
 static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
     const char *subcommand = tokens[SUBCOMMAND_TOKEN].value;
     assert(c != NULL);
@@ -7524,6 +8480,8 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
         return ;
     } else if (strcmp(subcommand, "settings") == 0) {
         process_stat_settings(&append_stats, c);
+    } else if (strcmp(subcommand, "conns") == 0) {
+        process_stat_conns(&append_stats, c);
     } else if (strcmp(subcommand, "cachedump") == 0) {
         char *buf = NULL;
         unsigned int bytes = 0, id, limit = 0;
@@ -7636,39 +8594,6 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
     }
 }
 
-/**
- * Get a suffix buffer and insert it into the list of used suffix buffers
- * @param c the connection object
- * @return a pointer to a new suffix buffer or NULL if allocation failed
- */
-static char *get_suffix_buffer(conn *c) {
-    if (c->suffixleft == c->suffixsize) {
-        char **new_suffix_list;
-        size_t sz = sizeof(char*) * c->suffixsize * 2;
-
-        new_suffix_list = realloc(c->suffixlist, sz);
-        if (new_suffix_list) {
-            c->suffixsize *= 2;
-            c->suffixlist = new_suffix_list;
-        } else {
-            if (settings.verbose > 1) {
-                settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
-                        "=%d Failed to resize suffix buffer\n", c->sfd);
-            }
-
-            return NULL;
-        }
-    }
-
-    char *suffix = cache_alloc(c->thread->suffix_cache);
-    if (suffix != NULL) {
-        *(c->suffixlist + c->suffixleft) = suffix;
-        ++c->suffixleft;
-    }
-
-    return suffix;
-}
-
 /* ntokens is overwritten here... shrug.. */
 static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens, bool return_cas)
 {
@@ -7721,61 +8646,34 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                     }
                 }
 
-                /* Rebuild the suffix */
-                char *suffix = get_suffix_buffer(c);
-                if (suffix == NULL) {
-                    out_string(c, "SERVER_ERROR out of memory rebuilding suffix");
-                    settings.engine.v1->release(settings.engine.v0, c, it);
-                    return;
-                }
-                int suffix_len = snprintf(suffix, SUFFIX_SIZE,
-                                          " %u %u\r\n", htonl(info.flags),
-                                          info.nbytes - 2);
-
                 /*
-                 * Construct the response. Each hit adds three elements to the
+                 * Construct the response. Each hit adds two elements to the
                  * outgoing data list:
-                 *   "VALUE "
-                 *   key
-                 *   " " + flags + " " + data length + "\r\n" + data (with \r\n)
+                 *   "VALUE " + key + " " + flags + " " + data length
+                 *            (+ " " + cas) + "\r\n", formatted in the output arena
+                 *   data (with \r\n), also copied into the arena if it is small
+                 * so that the responses of small items go out in one iovec,
+                 * or sent with MSG_ZEROCOPY if it is large enough (-Z option).
                  */
 
                 MEMCACHED_COMMAND_GET(c->sfd, info.key, info.nkey,
                                       info.nbytes, info.cas);
-                if (return_cas)
-                {
-
-                  char *cas = get_suffix_buffer(c);
-                  if (cas == NULL) {
-                    out_string(c, "SERVER_ERROR out of memory making CAS suffix");
-                    settings.engine.v1->release(settings.engine.v0, c, it);
-                    return;
-                  }
-                  int cas_len = snprintf(cas, SUFFIX_SIZE, " %"PRIu64"\r\n",
-                                         info.cas);
-                  if (add_iov(c, "VALUE ", 6) != 0 ||
-                      add_iov(c, info.key, info.nkey) != 0 ||
-                      add_iov(c, suffix, suffix_len - 2) != 0 ||
-                      add_iov(c, cas, cas_len) != 0 ||
-                      add_iov(c, info.value[0].iov_base, info.value[0].iov_len) != 0)
-                      {
-                          settings.engine.v1->release(settings.engine.v0, c, it);
-                          break;
-                      }
+                int ret;
+                if (return_cas) {
+                    ret = add_iov_printf(c, "VALUE %.*s %u %u %"PRIu64"\r\n",
+                                         (int)info.nkey, (char*)info.key,
+                                         htonl(info.flags), info.nbytes - 2, info.cas);
+                } else {
+                    ret = add_iov_printf(c, "VALUE %.*s %u %u\r\n",
+                                         (int)info.nkey, (char*)info.key,
+                                         htonl(info.flags), info.nbytes - 2);
                 }
-                else
-                {
-                  if (add_iov(c, "VALUE ", 6) != 0 ||
-                      add_iov(c, info.key, info.nkey) != 0 ||
-                      add_iov(c, suffix, suffix_len) != 0 ||
-                      add_iov(c, info.value[0].iov_base, info.value[0].iov_len) != 0)
-                      {
-                          settings.engine.v1->release(settings.engine.v0, c, it);
-                          break;
-                      }
+                if (ret != 0 ||
+                    add_iov_value(c, info.value[0].iov_base, info.value[0].iov_len) != 0) {
+                    settings.engine.v1->release(settings.engine.v0, c, it);
+                    break;
                 }
 
-
                 if (settings.verbose > 1) {
                     settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
                                                     ">%d sending key %s\n",
@@ -7800,7 +8698,8 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
          * of tokens.
          */
         if(key_token->value != NULL) {
-            ntokens = tokenize_command(key_token->value, tokens, MAX_TOKENS);
+            ntokens = tokenize_command(key_token->value, strlen(key_token->value),
+                                       tokens, MAX_TOKENS);
             key_token = tokens;
         }
 
@@ -7808,7 +8707,6 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
 
     c->icurr = c->ilist;
     c->ileft = i;
-    c->suffixcurr = c->suffixlist;
 
     if (settings.verbose > 1) {
         settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
@@ -7820,7 +8718,7 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
         reliable to add END\r\n to the buffer, because it might not end
         in \r\n. So we send SERVER_ERROR instead.
     */
-    if (key_token->value != NULL || add_iov(c, "END\r\n", 5) != 0
+    if (key_token->value != NULL || add_iov_copy(c, "END\r\n", 5) != 0
         || (IS_UDP(c->transport) && build_udp_headers(c) != 0)) {
         out_string(c, "SERVER_ERROR out of memory writing get response");
     }
@@ -8333,37 +9231,26 @@ static void process_lop_get(conn *c, char *key, size_t nkey,
     case ENGINE_SUCCESS:
         {
         eitem_info info;
-        char *respbuf; /* response string buffer */
-        char *respptr;
 
+        /* the response strings and small element values are
+         * written in the output arena of the connection.
+         */
         do {
-            need_size = ((2*lenstr_size) + 30) /* response head and tail size */
-                      + (elem_count * (lenstr_size+2)); /* response body size */
-            if ((respbuf = (char*)malloc(need_size)) == NULL) {
-                ret = ENGINE_ENOMEM; break;
-            }
-            respptr = respbuf;
-
-            sprintf(respptr, "VALUE %u %u\r\n", htonl(flags), elem_count);
-            if (add_iov(c, respptr, strlen(respptr)) != 0) {
+            if (add_iov_printf(c, "VALUE %u %u\r\n", htonl(flags), elem_count) != 0) {
                 ret = ENGINE_ENOMEM; break;
             }
-            respptr += strlen(respptr);
 
             for (i = 0; i < elem_count; i++) {
                 settings.engine.v1->get_list_elem_info(settings.engine.v0, c, elem_array[i], &info);
-                sprintf(respptr, "%u ", info.nbytes-2);
-                if ((add_iov(c, respptr, strlen(respptr)) != 0) ||
-                    (add_iov(c, info.value, info.nbytes) != 0)) {
+                if ((add_iov_printf(c, "%u ", info.nbytes-2) != 0) ||
+                    (add_iov_copy(c, info.value, info.nbytes) != 0)) {
                     ret = ENGINE_ENOMEM; break;
                 }
-                respptr += strlen(respptr);
             }
             if (ret == ENGINE_ENOMEM) break;
 
-            sprintf(respptr, "%s\r\n",
-                    (delete ? (dropped ? "DELETED_DROPPED" : "DELETED") : "END"));
-            if ((add_iov(c, respptr, strlen(respptr)) != 0) ||
+            if ((add_iov_printf(c, "%s\r\n",
+                                (delete ? (dropped ? "DELETED_DROPPED" : "DELETED") : "END")) != 0) ||
                 (IS_UDP(c->transport) && build_udp_headers(c) != 0)) {
                 ret = ENGINE_ENOMEM; break;
             }
@@ -8373,14 +9260,12 @@ static void process_lop_get(conn *c, char *key, size_t nkey,
             STATS_ELEM_HITS(c, lop_get, key, nkey);
             c->coll_eitem  = (void *)elem_array;
             c->coll_ecount = elem_count;
-            c->coll_resps  = respbuf;
             c->coll_op     = OPERATION_LOP_GET;
             conn_set_state(c, conn_mwrite);
             c->msgcurr     = 0;
         } else { /* ENGINE_ENOMEM */
             STATS_NOKEY(c, cmd_lop_get);
             settings.engine.v1->list_elem_release(settings.engine.v0, c, elem_array, elem_count);
-            free(respbuf);
             out_string(c, "SERVER_ERROR out of memory writing get response");
         }
         }
@@ -8677,7 +9562,7 @@ static void process_lop_command(conn *c, token_t *tokens, const size_t ntokens)
 }
 
 static void process_sop_get(conn *c, char *key, size_t nkey, uint32_t count,
-                            bool delete, bool drop_if_empty)
+                            bool delete, bool drop_if_empty, bool sample)
 {
     eitem  **elem_array = NULL;
     uint32_t elem_count;
@@ -8697,9 +9582,14 @@ static void process_sop_get(conn *c, char *key, size_t nkey, uint32_t count,
             return;
         }
 
-        ret = settings.engine.v1->set_elem_get(settings.engine.v0, c, key, nkey, req_count,
-                                               delete, drop_if_empty, elem_array, &elem_count,
-                                               &flags, &dropped, 0);
+        if (sample) {
+            ret = settings.engine.v1->set_elem_sample(settings.engine.v0, c, key, nkey, req_count,
+                                                      elem_array, &elem_count, &flags, 0);
+        } else {
+            ret = settings.engine.v1->set_elem_get(settings.engine.v0, c, key, nkey, req_count,
+                                                   delete, drop_if_empty, elem_array, &elem_count,
+                                                   &flags, &dropped, 0);
+        }
     }
 
     if (settings.detail_enabled) {
@@ -8710,37 +9600,26 @@ static void process_sop_get(conn *c, char *key, size_t nkey, uint32_t count,
     case ENGINE_SUCCESS:
         {
         eitem_info info;
-        char *respbuf; /* response string buffer */
-        char *respptr;
 
+        /* the response strings and small element values are
+         * written in the output arena of the connection.
+         */
         do {
-            need_size = ((2*lenstr_size) + 30) /* response head and tail size */
-                      + (elem_count * (lenstr_size+2)); /* response body size */
-            if ((respbuf = (char*)malloc(need_size)) == NULL) {
-                ret = ENGINE_ENOMEM; break;
-            }
-            respptr = respbuf;
-
-            sprintf(respptr, "VALUE %u %u\r\n", htonl(flags), elem_count);
-            if (add_iov(c, respptr, strlen(respptr)) != 0) {
+            if (add_iov_printf(c, "VALUE %u %u\r\n", htonl(flags), elem_count) != 0) {
                 ret = ENGINE_ENOMEM; break;
             }
-            respptr += strlen(respptr);
 
             for (i = 0; i < elem_count; i++) {
                 settings.engine.v1->get_set_elem_info(settings.engine.v0, c, elem_array[i], &info);
-                sprintf(respptr, "%u ", info.nbytes-2);
-                if ((add_iov(c, respptr, strlen(respptr)) != 0) ||
-                    (add_iov(c, info.value, info.nbytes) != 0)) {
+                if ((add_iov_printf(c, "%u ", info.nbytes-2) != 0) ||
+                    (add_iov_copy(c, info.value, info.nbytes) != 0)) {
                     ret = ENGINE_ENOMEM; break;
                 }
-                respptr += strlen(respptr);
             }
             if (ret == ENGINE_ENOMEM) break;
 
-            sprintf(respptr, "%s\r\n",
-                    (delete ? (dropped ? "DELETED_DROPPED" : "DELETED") : "END"));
-            if ((add_iov(c, respptr, strlen(respptr)) != 0) ||
+            if ((add_iov_printf(c, "%s\r\n",
+                                (delete ? (dropped ? "DELETED_DROPPED" : "DELETED") : "END")) != 0) ||
                 (IS_UDP(c->transport) && build_udp_headers(c) != 0)) {
                 ret = ENGINE_ENOMEM; break;
             }
@@ -8750,14 +9629,12 @@ static void process_sop_get(conn *c, char *key, size_t nkey, uint32_t count,
             STATS_ELEM_HITS(c, sop_get, key, nkey);
             c->coll_eitem  = (void *)elem_array;
             c->coll_ecount = elem_count;
-            c->coll_resps  = respbuf;
             c->coll_op     = OPERATION_SOP_GET;
             conn_set_state(c, conn_mwrite);
             c->msgcurr     = 0;
         } else { /* ENGINE_ENOMEM */
             STATS_NOKEY(c, cmd_sop_get);
             settings.engine.v1->set_elem_release(settings.engine.v0, c, elem_array, elem_count);
-            free(respbuf);
             out_string(c, "SERVER_ERROR out of memory writing get response");
         }
         }
@@ -8781,6 +9658,7 @@ static void process_sop_get(conn *c, char *key, size_t nkey, uint32_t count,
     default:
         STATS_NOKEY(c, cmd_sop_get);
         if (ret == ENGINE_EBADTYPE) out_string(c, "TYPE_MISMATCH");
+        else if (ret == ENGINE_ENOMEM) out_string(c, "SERVER_ERROR out of memory");
         else out_string(c, "SERVER_ERROR internal");
     }
 
@@ -8863,6 +9741,68 @@ static void process_sop_prepare_nread(conn *c, int cmd, size_t vlen, char *key,
     }
 }
 
+static void process_sop_prepare_nread_mdata(conn *c, int cmd, size_t vlen, char *key, size_t nkey) {
+    eitem *elem = NULL;
+
+    ENGINE_ERROR_CODE ret = c->aiostat;
+    c->aiostat = ENGINE_SUCCESS;
+    c->ewouldblock = false;
+
+    if (ret == ENGINE_SUCCESS) {
+        if (cmd == OPERATION_SOP_MEXIST) {
+            /* value tokens, exist flags and the result response */
+            int need_size = c->coll_numkeys * (sizeof(token_t) + sizeof(bool) + 1)
+                          + lenstr_size + 20;
+            if ((elem = (eitem *)malloc(need_size)) == NULL) {
+                ret = ENGINE_ENOMEM;
+            }
+        }
+        /* the result elements of OPERATION_SOP_SETOP are returned
+         * in an array allocated by the engine. */
+        if (ret == ENGINE_SUCCESS) {
+            if ((c->coll_mkeys = malloc(vlen)) == NULL) {
+                if (elem != NULL) free((void*)elem);
+                ret = ENGINE_ENOMEM;
+            }
+        }
+    }
+
+    if (settings.detail_enabled && ret != ENGINE_SUCCESS && cmd == OPERATION_SOP_MEXIST) {
+        stats_prefix_record_sop_exist(key, nkey, false);
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        c->ritem       = (char *)c->coll_mkeys;
+        c->rlbytes     = vlen;
+        c->coll_eitem  = (void *)elem;
+        c->coll_ecount = 0;
+        c->coll_op     = cmd;
+        c->coll_key    = key;
+        c->coll_nkey   = nkey;
+        conn_set_state(c, conn_nread);
+        break;
+    case ENGINE_EWOULDBLOCK:
+        c->ewouldblock = true;
+        break;
+    case ENGINE_DISCONNECT:
+        c->state = conn_closing;
+        break;
+    default:
+        if (cmd == OPERATION_SOP_MEXIST) {
+            STATS_NOKEY(c, cmd_sop_exist);
+        } else {
+            STATS_NOKEY(c, cmd_sop_setop);
+        }
+        if (ret == ENGINE_ENOMEM) out_string(c, "SERVER_ERROR out of memory");
+        else out_string(c, "SERVER_ERROR internal");
+
+        /* swallow the data line */
+        c->write_and_go = conn_swallow;
+        c->sbytes = vlen;
+    }
+}
+
 static void process_sop_create(conn *c, char *key, size_t nkey, item_attr *attrp) {
     ENGINE_ERROR_CODE ret;
     ret = settings.engine.v1->set_struct_create(settings.engine.v0, c, key, nkey, attrp, 0);
@@ -8998,10 +9938,91 @@ static void process_sop_command(conn *c, token_t *tokens, const size_t ntokens)
 
         process_sop_prepare_nread(c, (int)OPERATION_SOP_EXIST, vlen, key, nkey);
     }
+    else if ((ntokens == 6) && strcmp(subcommand, "mexist") == 0)
+    {
+        uint32_t lenvalues, numvalues;
+
+        if ((! safe_strtoul(tokens[SOP_KEY_TOKEN+1].value, &lenvalues)) ||
+            (! safe_strtoul(tokens[SOP_KEY_TOKEN+2].value, &numvalues))) {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+
+        /* validation checking on arguments */
+        if (lenvalues < 1 || numvalues < 1 || numvalues > MAX_SOP_MEXIST_COUNT ||
+            lenvalues > numvalues * (MAX_ELEMENT_BYTES + lenstr_size)) {
+            /* ENGINE_EBADVALUE */
+            out_string(c, "CLIENT_ERROR bad value"); return;
+        }
+        lenvalues += 2;
+
+        c->coll_numkeys = numvalues;
+        c->coll_lenkeys = lenvalues;
+
+        process_sop_prepare_nread_mdata(c, (int)OPERATION_SOP_MEXIST, lenvalues, key, nkey);
+    }
+    else if ((ntokens == 5 || ntokens == 6 || (ntokens >= 10 && ntokens <= 12)) &&
+             (strcmp(subcommand, "inter") == 0 || strcmp(subcommand, "union") == 0 ||
+              strcmp(subcommand, "diff") == 0))
+    {
+        uint32_t lenkeys, numkeys;
+        int read_ntokens = SOP_KEY_TOKEN + 2;
+        int rest_ntokens = ntokens - read_ntokens - 1;
+
+        if ((! safe_strtoul(tokens[SOP_KEY_TOKEN].value, &lenkeys)) ||
+            (! safe_strtoul(tokens[SOP_KEY_TOKEN+1].value, &numkeys))) {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+
+        c->coll_cntonly = false;
+        c->coll_key  = NULL;
+        c->coll_nkey = 0;
+        c->coll_attrp = NULL;
+        if (rest_ntokens == 1) {
+            if (strcmp(tokens[read_ntokens].value, "count") != 0) {
+                out_string(c, "CLIENT_ERROR bad command line format");
+                return;
+            }
+            c->coll_cntonly = true;
+        } else if (rest_ntokens > 1) {
+            if (strcmp(tokens[read_ntokens].value, "store") != 0 ||
+                tokens[read_ntokens+1].length > KEY_MAX_LENGTH) {
+                out_string(c, "CLIENT_ERROR bad command line format");
+                return;
+            }
+            c->coll_key  = tokens[read_ntokens+1].value;
+            c->coll_nkey = tokens[read_ntokens+1].length;
+            c->coll_attrp = &c->coll_attr_space;
+            if (get_coll_create_attr_from_tokens(&tokens[read_ntokens+2], rest_ntokens-2,
+                                                 ITEM_TYPE_SET, c->coll_attrp) != 0) {
+                out_string(c, "CLIENT_ERROR bad command line format");
+                return;
+            }
+        }
+
+        /* validation checking on arguments */
+        if (lenkeys < 1 || numkeys < 1 || numkeys > MAX_SOP_SETOP_KEY_COUNT ||
+            lenkeys > numkeys * (KEY_MAX_LENGTH + 1)) {
+            /* ENGINE_EBADVALUE */
+            out_string(c, "CLIENT_ERROR bad value"); return;
+        }
+        lenkeys += 2;
+
+        if (strcmp(subcommand, "inter") == 0)      c->coll_setop = SET_OPERATION_INTER;
+        else if (strcmp(subcommand, "union") == 0) c->coll_setop = SET_OPERATION_UNION;
+        else                                       c->coll_setop = SET_OPERATION_DIFF;
+        c->coll_numkeys = numkeys;
+        c->coll_lenkeys = lenkeys;
+
+        process_sop_prepare_nread_mdata(c, (int)OPERATION_SOP_SETOP, lenkeys,
+                                        c->coll_key, c->coll_nkey);
+    }
     else if ((ntokens==5 || ntokens==6) && (strcmp(subcommand, "get") == 0))
     {
         bool delete = false;
         bool drop_if_empty = false;
+        bool sample = false;
         uint32_t count = 0;
 
         if (! safe_strtoul(tokens[SOP_KEY_TOKEN+1].value, &count)) {
@@ -9015,13 +10036,15 @@ static void process_sop_command(conn *c, token_t *tokens, const size_t ntokens)
             } else if (strcmp(tokens[SOP_KEY_TOKEN+2].value, "drop")==0) {
                 delete = true;
                 drop_if_empty = true;
+            } else if (strcmp(tokens[SOP_KEY_TOKEN+2].value, "random")==0) {
+                sample = true;
             } else {
                 out_string(c, "CLIENT_ERROR bad command line format");
                 return;
             }
         }
 
-        process_sop_get(c, key, nkey, count, delete, drop_if_empty);
+        process_sop_get(c, key, nkey, count, delete, drop_if_empty, sample);
     }
     else
     {
@@ -9070,41 +10093,30 @@ static void process_bop_get(conn *c, char *key, size_t nkey,
     case ENGINE_SUCCESS:
         {
         eitem_info info;
-        char *respbuf; /* response string buffer */
-        char *respptr;
-        int   resplen;
+        const char *tail;
 
+        /* the response strings and small element values are
+         * written in the output arena of the connection.
+         */
         do {
-            need_size = ((2*lenstr_size) + 30) /* response head and tail size */
-                      + (elem_count * ((MAX_BKEY_LENG*2+2) + (MAX_EFLAG_LENG*2+2) + lenstr_size+3)); /* response body size */
-            if ((respbuf = (char*)malloc(need_size)) == NULL) {
-                ret = ENGINE_ENOMEM; break;
-            }
-            respptr = respbuf;
-
-            sprintf(respptr, "VALUE %u %u\r\n", htonl(flags), elem_count);
-            if (add_iov(c, respptr, strlen(respptr)) != 0) {
+            if (add_iov_printf(c, "VALUE %u %u\r\n", htonl(flags), elem_count) != 0) {
                 ret = ENGINE_ENOMEM; break;
             }
-            respptr += strlen(respptr);
 
             for (i = 0; i < elem_count; i++) {
                 settings.engine.v1->get_btree_elem_info(settings.engine.v0, c, elem_array[i], &info);
-                resplen = make_bop_elem_response(respptr, &info);
-                if ((add_iov(c, respptr, resplen) != 0) ||
-                    (add_iov(c, info.value, info.nbytes) != 0)) {
+                if (add_iov_bop_elem(c, &info) != 0) {
                     ret = ENGINE_ENOMEM; break;
                 }
-                respptr += resplen;
             }
             if (ret == ENGINE_ENOMEM) break;
 
             if (delete) {
-                sprintf(respptr, "%s\r\n", (dropped_trimmed ? "DELETED_DROPPED" : "DELETED"));
+                tail = (dropped_trimmed ? "DELETED_DROPPED" : "DELETED");
             } else {
-                sprintf(respptr, "%s\r\n", (dropped_trimmed ? "TRIMMED" : "END"));
+                tail = (dropped_trimmed ? "TRIMMED" : "END");
             }
-            if ((add_iov(c, respptr, strlen(respptr)) != 0) ||
+            if ((add_iov_printf(c, "%s\r\n", tail) != 0) ||
                 (IS_UDP(c->transport) && build_udp_headers(c) != 0)) {
                 ret = ENGINE_ENOMEM; break;
             }
@@ -9114,14 +10126,12 @@ static void process_bop_get(conn *c, char *key, size_t nkey,
             STATS_ELEM_HITS(c, bop_get, key, nkey);
             c->coll_eitem  = (void *)elem_array;
             c->coll_ecount = elem_count;
-            c->coll_resps  = respbuf;
             c->coll_op     = OPERATION_BOP_GET;
             conn_set_state(c, conn_mwrite);
             c->msgcurr     = 0;
         } else { /* ENGINE_ENOMEM */
             STATS_NOKEY(c, cmd_bop_get);
             settings.engine.v1->btree_elem_release(settings.engine.v0, c, elem_array, elem_count);
-            free(respbuf);
             out_string(c, "SERVER_ERROR out of memory writing get response");
         }
         }
@@ -9293,37 +10303,26 @@ static void process_bop_gbp(conn *c, char *key, size_t nkey, ENGINE_BTREE_ORDER
     case ENGINE_SUCCESS:
         {
         eitem_info info;
-        char *respbuf; /* response string buffer */
-        char *respptr;
-        int   resplen;
+        const char *tail;
 
+        /* the response strings and small element values are
+         * written in the output arena of the connection.
+         */
         do {
-            need_size = ((2*lenstr_size) + 30) /* response head and tail size */
-                      + (elem_count * ((MAX_BKEY_LENG*2+2) + (MAX_EFLAG_LENG*2+2) + lenstr_size+3)); /* result body size */
-            if ((respbuf = (char*)malloc(need_size)) == NULL) {
-                ret = ENGINE_ENOMEM; break;
-            }
-            respptr = respbuf;
-
-            sprintf(respptr, "VALUE %u %u\r\n", htonl(flags), elem_count);
-            if (add_iov(c, respptr, strlen(respptr)) != 0) {
+            if (add_iov_printf(c, "VALUE %u %u\r\n", htonl(flags), elem_count) != 0) {
                 ret = ENGINE_ENOMEM; break;
             }
-            respptr += strlen(respptr);
 
             for (i = 0; i < elem_count; i++) {
                 settings.engine.v1->get_btree_elem_info(settings.engine.v0, c, elem_array[i], &info);
-                resplen = make_bop_elem_response(respptr, &info);
-                if ((add_iov(c, respptr, resplen) != 0) ||
-                    (add_iov(c, info.value, info.nbytes) != 0)) {
+                if (add_iov_bop_elem(c, &info) != 0) {
                     ret = ENGINE_ENOMEM; break;
                 }
-                respptr += resplen;
             }
             if (ret == ENGINE_ENOMEM) break;
 
-            sprintf(respptr, "%s\r\n", "END");
-            if ((add_iov(c, respptr, strlen(respptr)) != 0) ||
+            tail = "END";
+            if ((add_iov_printf(c, "%s\r\n", tail) != 0) ||
                 (IS_UDP(c->transport) && build_udp_headers(c) != 0)) {
                 ret = ENGINE_ENOMEM; break;
             }
@@ -9333,14 +10332,12 @@ static void process_bop_gbp(conn *c, char *key, size_t nkey, ENGINE_BTREE_ORDER
             STATS_ELEM_HITS(c, bop_gbp, key, nkey);
             c->coll_eitem  = (void *)elem_array;
             c->coll_ecount = elem_count;
-            c->coll_resps  = respbuf;
             c->coll_op     = OPERATION_BOP_GBP;
             conn_set_state(c, conn_mwrite);
             c->msgcurr     = 0;
         } else { /* ENGINE_ENOMEM */
             STATS_NOKEY(c, cmd_bop_gbp);
             settings.engine.v1->btree_elem_release(settings.engine.v0, c, elem_array, elem_count);
-            free(respbuf);
             out_string(c, "SERVER_ERROR out of memory writing get response");
         }
         }
@@ -9496,11 +10493,9 @@ static void process_bop_prepare_nread_keys(conn *c, int cmd, size_t vlen) {
 #ifdef SUPPORT_BOP_MGET
         if (cmd == OPERATION_BOP_MGET) {
             int bmget_count = c->coll_numkeys * c->coll_rcount;
-            int elem_array_size = bmget_count * sizeof(eitem*);
-            int respon_hdr_size = c->coll_numkeys * ((lenstr_size*2)+30);
-            int respon_bdy_size = bmget_count * ((MAX_BKEY_LENG*2+2)+(MAX_EFLAG_LENG*2+2)+lenstr_size+15);
 
-            need_size = elem_array_size + respon_hdr_size + respon_bdy_size;
+            /* the response is written in the output arena */
+            need_size = bmget_count * sizeof(eitem*);
         }
 #endif
 #ifdef SUPPORT_BOP_SMGET
@@ -9509,16 +10504,13 @@ static void process_bop_prepare_nread_keys(conn *c, int cmd, size_t vlen) {
             int elem_array_size; /* elem pointer array where the found elements will be saved */
             int keys_array_size; /* keyinfo(token_t) array where the address and length of keys are to be saved */
             int kmis_array_size; /* key index array where the missed key indexes are to be saved */
-            int respon_hdr_size; /* the size of response head and tail */
-            int respon_bdy_size; /* the size of response body */
 
             elem_array_size = smget_count * (sizeof(eitem*) + (2*sizeof(uint32_t)));
             keys_array_size = c->coll_numkeys * sizeof(token_t);
             kmis_array_size = c->coll_numkeys * sizeof(uint32_t);
-            respon_hdr_size = (2*lenstr_size) + 30; /* result head and tail size */
-            respon_bdy_size = smget_count * ((MAX_BKEY_LENG*2+2)+(MAX_EFLAG_LENG*2+2)+(lenstr_size*2)+5); /* result body size */
 
-            need_size = elem_array_size + keys_array_size + kmis_array_size + respon_hdr_size + respon_bdy_size;
+            /* the response is written in the output arena */
+            need_size = elem_array_size + keys_array_size + kmis_array_size;
         }
 #endif
         assert(need_size > 0);
@@ -10705,44 +11697,421 @@ static void process_setattr_command(conn *c, token_t *tokens, const size_t ntoke
             break;
         }
     }
-    if (i < ntokens-1) {
-        out_string(c, "ATTR_ERROR not found");
+    if (i < ntokens-1) {
+        out_string(c, "ATTR_ERROR not found");
+        return;
+    }
+
+    ENGINE_ERROR_CODE ret;
+    ret = settings.engine.v1->setattr(settings.engine.v0, c, key, nkey,
+                                      attr_ids, attr_count, &attr_data, 0);
+
+    if (settings.detail_enabled) {
+        stats_prefix_record_setattr(key, nkey);
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        STATS_HITS(c, setattr, key, nkey);
+        out_string(c, "OK");
+        break;
+    case ENGINE_DISCONNECT:
+        c->state = conn_closing;
+        break;
+    case ENGINE_KEY_ENOENT:
+        STATS_MISS(c, setattr, key, nkey);
+        out_string(c, "NOT_FOUND");
+        break;
+    default:
+        STATS_NOKEY(c, cmd_setattr);
+        if (ret == ENGINE_EBADATTR) out_string(c, "ATTR_ERROR not found");
+        else if (ret == ENGINE_EBADVALUE) out_string(c, "ATTR_ERROR bad value");
+        else out_string(c, "SERVER_ERROR internal");
+    }
+}
+
+static void process_flush_all_command(conn *c, token_t *tokens, const size_t ntokens) {
+    time_t exptime;
+
+    set_noreply_maybe(c, tokens, ntokens);
+
+    if (ntokens == (c->noreply ? 3 : 2)) {
+        exptime = 0;
+    } else {
+        exptime = strtol(tokens[1].value, NULL, 10);
+        if(errno == ERANGE) {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+    }
+
+    ENGINE_ERROR_CODE ret;
+    ret = settings.engine.v1->flush(settings.engine.v0, c, exptime);
+    if (ret == ENGINE_SUCCESS) {
+        out_string(c, "OK");
+    } else if (ret == ENGINE_ENOTSUP) {
+        out_string(c, "SERVER_ERROR not supported");
+    } else {
+        out_string(c, "SERVER_ERROR failed to flush cache");
+    }
+    STATS_NOKEY(c, cmd_flush);
+}
+
+static void process_flush_prefix_command(conn *c, token_t *tokens, const size_t ntokens) {
+    time_t exptime;
+
+    set_noreply_maybe(c, tokens, ntokens);
+
+    if (ntokens == (c->noreply ? 4 : 3)) {
+        exptime = 0;
+    } else {
+        exptime = strtol(tokens[2].value, NULL, 10);
+        if (errno == ERANGE) {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+    }
+
+    ENGINE_ERROR_CODE ret;
+    char *prefix = tokens[PREFIX_TOKEN].value;
+    size_t nprefix = tokens[PREFIX_TOKEN].length;
+    if (nprefix == 4 && strncmp(prefix, "null", 4) == 0) {
+        /* flush null prefix */
+        prefix = NULL;
+        nprefix = 0;
+    }
+
+    ret = settings.engine.v1->flush_prefix(settings.engine.v0, c, prefix, nprefix, exptime);
+    if (settings.detail_enabled) {
+        if (ret == ENGINE_SUCCESS || ret == ENGINE_PREFIX_ENOENT) {
+            if (stats_prefix_delete(prefix, nprefix) == 0) { /* found */
+                ret = ENGINE_SUCCESS;
+            }
+        }
+    }
+
+    if (ret == ENGINE_SUCCESS) {
+        out_string(c, "OK");
+    } else if (ret == ENGINE_DISCONNECT) {
+        c->state = conn_closing;
+    } else if (ret == ENGINE_PREFIX_ENOENT) {
+        out_string(c, "NOT_FOUND");
+    } else if (ret == ENGINE_ENOTSUP) {
+        out_string(c, "SERVER_ERROR not supported");
+    } else {
+        out_string(c, "SERVER_ERROR failed to flush cache");
+    }
+
+    STATS_NOKEY(c, cmd_flush_prefix);
+}
+
+static void process_config_command(conn *c, token_t *tokens, const size_t ntokens) {
+    if ((ntokens == 3 || ntokens == 4) && strcmp(tokens[COMMAND_TOKEN+1].value, "maxconns") == 0) {
+        process_maxconns_command(c, tokens, ntokens);
+    } else if ((ntokens == 3 || ntokens == 4) && (strcmp(tokens[COMMAND_TOKEN+1].value, "memlimit") == 0)) {
+        process_memlimit_command(c, tokens, ntokens);
+#ifdef ENABLE_JUNK_ITEM_TIME
+    } else if ((ntokens == 3 || ntokens == 4) && (strcmp(tokens[COMMAND_TOKEN+1].value, "junktime") == 0)) {
+        process_junktime_command(c, tokens, ntokens);
+#endif
+    } else if ((ntokens >= 3 || ntokens <= 5) && (strcmp(tokens[COMMAND_TOKEN+1].value, "verbosity") == 0)) {
+        process_verbosity_command(c, tokens, ntokens);
+    } else {
+        out_string(c, "CLIENT_ERROR bad command line format");
+    }
+}
+
+#ifdef ENABLE_ZK_INTEGRATION
+static void process_set_zk_ensemble_command(conn *c, token_t *tokens, const size_t ntokens) {
+    /* The ensemble is a comma separated list of host:port addresses.
+     * host1:port1,host2:port2,...
+     */
+    char *out_str = "ERROR";
+    if (arcus_zk_cfg == NULL)
+        out_str = "ERROR not using ZooKeeper";
+    else if (0 != arcus_zk_set_ensemble(tokens[COMMAND_TOKEN+1].value))
+        out_str = "ERROR failed to set the new ensemble address (check logs)";
+    else
+        out_str = "OK";
+    out_string(c, out_str);
+}
+
+static void process_show_zk_ensemble_command(conn *c, token_t *tokens, const size_t ntokens) {
+    char *out_str = "ERROR";
+    char buf[1024];
+    if (arcus_zk_cfg == NULL)
+        out_str = "ERROR not using ZooKeeper";
+    else if (0 != arcus_zk_get_ensemble_str(buf, sizeof(buf)-16))
+        out_str = "ERROR failed to get the ensemble address";
+    else {
+        strcat(buf, "\r\n\n");
+        out_str = buf;
+    }
+    out_string(c, out_str);
+}
+#endif
+
+static void process_help_command(conn *c, token_t *tokens, const size_t ntokens) {
+    char *type = tokens[COMMAND_TOKEN+1].value;
+
+    if (ntokens > 2 && strcmp(type, "kv") == 0) {
+
+        out_string(c,
+        "\t" "set|add|replace <key> <flags> <exptime> <bytes> [noreply]\\r\\n<data>\\r\\n" "\n"
+        "\t" "append|prepend <key> <flags> <exptime> <bytes> [noreply]\\r\\n<data>\\r\\n" "\n"
+        "\t" "cas <key> <flags> <exptime> <bytes> <cas unique> [noreply]\\r\\n<data>\\r\\n" "\n"
+        "\t" "get <key>[,<key>...]\\r\\n" "\n"
+        "\t" "gets <key>[,<key>...]\\r\\n" "\n"
+        "\t" "incr|decr <key> <delta> [<flags> <exptime> <initial>] [noreply]\\r\\n" "\n"
+        "\t" "delete <key> [<time>] [noreply]\\r\\n" "\n"
+        );
+
+    } else if (ntokens > 2 && strcmp(type, "list") == 0) {
+
+        out_string(c,
+        "\t" "lop create <key> <attributes> [noreply]\\r\\n" "\n"
+        "\t" "lop insert <key> <index> <bytes> [create <attributes>] [noreply|pipe]\\r\\n<data>\\r\\n" "\n"
+        "\t" "lop delete <key> <index or range> [drop] [noreply|pipe]\\r\\n" "\n"
+        "\t" "lop get <key> <index or range> [delete|drop]\\r\\n" "\n"
+        "\n"
+        "\t" "* <attributes> : <flags> <exptime> <maxcount> [<ovflaction>] [unreadable]" "\n"
+        );
+
+    } else if (ntokens > 2 && strcmp(type, "set") == 0) {
+
+        out_string(c,
+        "\t" "sop create <key> <attributes> [noreply]\\r\\n" "\n"
+        "\t" "sop insert <key> <bytes> [create <attributes>] [noreply|pipe]\\r\\n<data>\\r\\n" "\n"
+        "\t" "sop delete <key> <bytes> [drop] [noreply|pipe]\\r\\n<data>\\r\\n" "\n"
+        "\t" "sop get <key> <count> [delete|drop|random]\\r\\n" "\n"
+        "\t" "sop exist <key> <bytes> [pipe]\\r\\n<data>\\r\\n" "\n"
+        "\t" "sop mexist <key> <lenvalues> <numvalues>\\r\\n<bytes> <data>\\r\\n...<bytes> <data>\\r\\n" "\n"
+        "\t" "sop inter|union|diff <lenkeys> <numkeys> [count|store <dstkey> <attributes>]\\r\\n<\"comma separated keys\">\\r\\n" "\n"
+        "\n"
+        "\t" "* <attributes> : <flags> <exptime> <maxcount> [<ovflaction>] [unreadable]" "\n"
+        );
+
+    } else if (ntokens > 2 && strcmp(type, "btree") == 0) {
+
+        out_string(c,
+        "\t" "bop create <key> <attributes> [noreply]\\r\\n" "\n"
+        "\t" "bop insert|upsert <key> <bkey> [<eflag>] <bytes> [create <attributes>] [noreply|pipe|getrim]\\r\\n<data>\\r\\n" "\n"
+        "\t" "bop update <key> <bkey> [<eflag_update>] <bytes> [noreply|pipe]\\r\\n<data>\\r\\n" "\n"
+        "\t" "bop delete <key> <bkey or \"bkey range\"> [<eflag_filter>] [<count>] [drop] [noreply|pipe]\\r\\n" "\n"
+        "\t" "bop get <key> <bkey or \"bkey range\"> [<eflag_filter>] [[<offset>] <count>] [delete|drop]\\r\\n" "\n"
+        "\t" "bop count <key> <bkey or \"bkey range\"> [<eflag_filter>] \\r\\n" "\n"
+        "\t" "bop incr|decr <key> <bkey> <value> [noreply|pipe]\\r\\n" "\n"
+        "\t" "bop mget <lenkeys> <numkeys> <bkey or \"bkey range\"> [<eflag_filter>] [<offset>] <count>\\r\\n<\"comma separated keys\">\\r\\n" "\n"
+        "\t" "bop smget <lenkeys> <numkeys> <bkey or \"bkey range\"> [<eflag_filter>] [<offset>] <count>\\r\\n<\"comma separated keys\">\\r\\n" "\n"
+        "\t" "bop position <key> <bkey> <order>\\r\\n" "\n"
+        "\t" "bop gbp <key> <order> <position or \"position range\">\\r\\n" "\n"
+        "\n"
+        "\t" "* <attributes> : <flags> <exptime> <maxcount> [<ovflaction>] [unreadable]" "\n"
+        "\t" "* <eflag_update> : [<fwhere> <bitwop>] <fvalue>" "\n"
+        "\t" "* <eflag_filter> : <fwhere> [<bitwop> <foperand>] <compop> <fvalue>" "\n"
+        "\t" "                 : <fwhere> [<bitwop> <foperand>] EQ|NE <comma separated fvalue list>" "\n"
+        "\t" "* <bitwop> : &, |, ^" "\n"
+        "\t" "* <compop> : EQ, NE, LT, LE, GT, GE" "\n"
+        );
+
+    } else if (ntokens > 2 && strcmp(type, "attr") == 0) {
+
+        out_string(c,
+        "\t" "getattr <key> [<attribute name> ...]\\r\\n" "\n"
+        "\t" "setattr <key> <name>=<value> [<name>=value> ...]\\r\\n" "\n"
+        );
+
+    } else if (ntokens > 2 && strcmp(type, "admin") == 0) {
+
+        out_string(c,
+        "\t" "flush_all [<delay>] [noreply]\\r\\n" "\n"
+        "\t" "flush_prefix <prefix> [<delay>] [noreply]\\r\\n" "\n"
+        "\n"
+        "\t" "scrub [stale]\\r\\n" "\n"
+        "\n"
+        "\t" "stats\\r\\n" "\n"
+        "\t" "stats settings\\r\\n" "\n"
+        "\t" "stats conns\\r\\n" "\n"
+        "\t" "stats items\\r\\n" "\n"
+        "\t" "stats slabs\\r\\n" "\n"
+        "\t" "stats prefixes\\r\\n" "\n"
+        "\t" "stats detail [on|off|dump]\\r\\n" "\n"
+        "\t" "stats scrub\\r\\n" "\n"
+        "\t" "stats cachedump <slab_clsid> <limit> [forward|backward [sticky]]\\r\\n" "\n"
+        "\t" "stats reset\\r\\n" "\n"
+        "\n"
+        "\t" "config verbosity [<verbose>]\\r\\n" "\n"
+        "\t" "config memlimit [<memsize(MB)>]\\r\\n" "\n"
+        "\t" "config maxconns [<maxconn>]\\r\\n" "\n"
+        );
+
+    } else {
+       out_string(c,
+       "\t" "* Usage: help [kv | list | set | btree | attr | admin ]" "\n"
+       );
+    }
+}
+
+static void process_extension_command(conn *c, token_t *tokens, size_t ntokens) {
+    if (settings.extensions.ascii == NULL) {
+        out_string(c, "ERROR");
+        return;
+    }
+
+    EXTENSION_ASCII_PROTOCOL_DESCRIPTOR *cmd;
+    size_t nbytes = 0;
+    char *ptr;
+
+    if (ntokens > 0) {
+        if (ntokens == MAX_TOKENS) {
+            out_string(c, "ERROR too many arguments");
+            return;
+        }
+
+        if (tokens[ntokens - 1].length == 0) {
+            --ntokens;
+        }
+    }
+
+    /* ntokens must be larger than 0 in order to avoid segfault in the next for statement. */
+    if (ntokens <= 0) {
+        out_string(c, "ERROR");
         return;
     }
 
-    ENGINE_ERROR_CODE ret;
-    ret = settings.engine.v1->setattr(settings.engine.v0, c, key, nkey,
-                                      attr_ids, attr_count, &attr_data, 0);
+    for (cmd = settings.extensions.ascii; cmd != NULL; cmd = cmd->next) {
+        if (cmd->accept(cmd->cookie, c, ntokens, tokens, &nbytes, &ptr)) {
+            break;
+        }
+    }
 
-    if (settings.detail_enabled) {
-        stats_prefix_record_setattr(key, nkey);
+    if (cmd == NULL) {
+        /* Unify the response string in case of command mismatch */
+        /* out_string(c, "ERROR unknown command"); */
+        out_string(c, "ERROR");
+    } else if (nbytes == 0) {
+        if (!cmd->execute(cmd->cookie, c, ntokens, tokens,
+                          ascii_response_handler)) {
+            conn_set_state(c, conn_closing);
+        } else {
+            if (c->dynamic_buffer.buffer != NULL) {
+                write_and_free(c, c->dynamic_buffer.buffer,
+                               c->dynamic_buffer.offset);
+                c->dynamic_buffer.buffer = NULL;
+            } else {
+                conn_set_state(c, conn_new_cmd);
+            }
+        }
+    } else {
+        c->rlbytes = nbytes;
+        c->ritem = ptr;
+        c->ascii_cmd = cmd;
+        /* NOT SUPPORTED YET! */
+        conn_set_state(c, conn_nread);
     }
+}
 
-    switch (ret) {
-    case ENGINE_SUCCESS:
-        STATS_HITS(c, setattr, key, nkey);
-        out_string(c, "OK");
-        break;
-    case ENGINE_DISCONNECT:
-        c->state = conn_closing;
-        break;
-    case ENGINE_KEY_ENOENT:
-        STATS_MISS(c, setattr, key, nkey);
-        out_string(c, "NOT_FOUND");
-        break;
-    default:
-        STATS_NOKEY(c, cmd_setattr);
-        if (ret == ENGINE_EBADATTR) out_string(c, "ATTR_ERROR not found");
-        else if (ret == ENGINE_EBADVALUE) out_string(c, "ATTR_ERROR bad value");
-        else out_string(c, "SERVER_ERROR internal");
+/*
+ * ASCII command dispatch table.
+ * The commands are looked up by name and token count instead of
+ * walking a chain of strcmp() calls, so frequent commands come first.
+ */
+enum ascii_cmd {
+    ASCII_CMD_GET = 0,
+    ASCII_CMD_BGET,
+    ASCII_CMD_GETS,
+    ASCII_CMD_SET,
+    ASCII_CMD_ADD,
+    ASCII_CMD_REPLACE,
+    ASCII_CMD_PREPEND,
+    ASCII_CMD_APPEND,
+    ASCII_CMD_CAS,
+    ASCII_CMD_INCR,
+    ASCII_CMD_DECR,
+    ASCII_CMD_DELETE,
+    ASCII_CMD_LOP,
+    ASCII_CMD_SOP,
+    ASCII_CMD_BOP,
+    ASCII_CMD_GETATTR,
+    ASCII_CMD_SETATTR,
+    ASCII_CMD_STATS,
+    ASCII_CMD_FLUSH_ALL,
+    ASCII_CMD_FLUSH_PREFIX,
+    ASCII_CMD_CONFIG,
+    ASCII_CMD_VERSION,
+    ASCII_CMD_QUIT,
+#ifdef ENABLE_ZK_INTEGRATION
+    ASCII_CMD_SET_ZK_ENSEMBLE,
+    ASCII_CMD_SHOW_ZK_ENSEMBLE,
+#endif
+    ASCII_CMD_HELP
+};
+
+/* bit mask of the allowed token counts, including the terminal token */
+#define NTOKENS_ONE(n)          (1U << (n))
+#define NTOKENS_RANGE(min, max) ((~0U >> (31 - (max))) & ~(NTOKENS_ONE(min) - 1))
+
+typedef struct {
+    const char     *name;
+    size_t          nlen;
+    uint32_t        ntokens_mask;
+    enum ascii_cmd  cmd;
+} ascii_cmd_entry;
+
+#define ASCII_CMD(name, mask, cmd) { name, sizeof(name)-1, mask, cmd }
+
+static const ascii_cmd_entry ascii_cmd_table[] = {
+    ASCII_CMD("get",          NTOKENS_RANGE(3, MAX_TOKENS),  ASCII_CMD_GET),
+    ASCII_CMD("set",          NTOKENS_RANGE(6, 7),           ASCII_CMD_SET),
+    ASCII_CMD("bop",          NTOKENS_RANGE(5, 14),          ASCII_CMD_BOP),
+    ASCII_CMD("sop",          NTOKENS_RANGE(5, 12),          ASCII_CMD_SOP),
+    ASCII_CMD("lop",          NTOKENS_RANGE(5, 13),          ASCII_CMD_LOP),
+    ASCII_CMD("delete",       NTOKENS_RANGE(3, 5),           ASCII_CMD_DELETE),
+    ASCII_CMD("gets",         NTOKENS_RANGE(3, MAX_TOKENS),  ASCII_CMD_GETS),
+    ASCII_CMD("incr",         NTOKENS_RANGE(4, 5) | NTOKENS_RANGE(7, 8), ASCII_CMD_INCR),
+    ASCII_CMD("decr",         NTOKENS_RANGE(4, 5) | NTOKENS_RANGE(7, 8), ASCII_CMD_DECR),
+    ASCII_CMD("add",          NTOKENS_RANGE(6, 7),           ASCII_CMD_ADD),
+    ASCII_CMD("replace",      NTOKENS_RANGE(6, 7),           ASCII_CMD_REPLACE),
+    ASCII_CMD("prepend",      NTOKENS_RANGE(6, 7),           ASCII_CMD_PREPEND),
+    ASCII_CMD("append",       NTOKENS_RANGE(6, 7),           ASCII_CMD_APPEND),
+    ASCII_CMD("cas",          NTOKENS_RANGE(7, 8),           ASCII_CMD_CAS),
+    ASCII_CMD("getattr",      NTOKENS_RANGE(3, 11),          ASCII_CMD_GETATTR),
+    ASCII_CMD("setattr",      NTOKENS_RANGE(4, 8),           ASCII_CMD_SETATTR),
+    ASCII_CMD("bget",         NTOKENS_RANGE(3, MAX_TOKENS),  ASCII_CMD_BGET),
+    ASCII_CMD("stats",        NTOKENS_RANGE(2, MAX_TOKENS),  ASCII_CMD_STATS),
+    ASCII_CMD("flush_all",    NTOKENS_RANGE(2, 4),           ASCII_CMD_FLUSH_ALL),
+    ASCII_CMD("flush_prefix", NTOKENS_RANGE(3, 5),           ASCII_CMD_FLUSH_PREFIX),
+    ASCII_CMD("config",       NTOKENS_RANGE(3, MAX_TOKENS),  ASCII_CMD_CONFIG),
+    ASCII_CMD("version",      NTOKENS_ONE(2),                ASCII_CMD_VERSION),
+    ASCII_CMD("quit",         NTOKENS_ONE(2),                ASCII_CMD_QUIT),
+#ifdef ENABLE_ZK_INTEGRATION
+    ASCII_CMD("set_zk_ensemble",  NTOKENS_ONE(3),            ASCII_CMD_SET_ZK_ENSEMBLE),
+    ASCII_CMD("show_zk_ensemble", NTOKENS_ONE(2),            ASCII_CMD_SHOW_ZK_ENSEMBLE),
+#endif
+    ASCII_CMD("help",         NTOKENS_RANGE(2, MAX_TOKENS),  ASCII_CMD_HELP)
+};
+
+static const ascii_cmd_entry *lookup_ascii_command(token_t *token, const size_t ntokens)
+{
+    const ascii_cmd_entry *entry;
+    int i;
+
+    for (i = 0; i < sizeof(ascii_cmd_table)/sizeof(ascii_cmd_entry); i++) {
+        entry = &ascii_cmd_table[i];
+        if (entry->nlen == token->length && entry->name[0] == token->value[0] &&
+            memcmp(entry->name, token->value, entry->nlen) == 0) {
+            /* a known command with a wrong token count is handled as unknown */
+            return (entry->ntokens_mask & NTOKENS_ONE(ntokens)) ? entry : NULL;
+        }
     }
+    return NULL;
 }
 
-static void process_command(conn *c, char *command) {
+static void process_command(conn *c, char *command, size_t cmdlen) {
 
     token_t tokens[MAX_TOKENS];
     size_t ntokens;
-    int comm;
+    const ascii_cmd_entry *entry;
 
     assert(c != NULL);
 
@@ -10766,341 +12135,93 @@ static void process_command(conn *c, char *command) {
         return;
     }
 
-    ntokens = tokenize_command(command, tokens, MAX_TOKENS);
-    if (ntokens >= 3 &&
-        ((strcmp(tokens[COMMAND_TOKEN].value, "get") == 0) ||
-         (strcmp(tokens[COMMAND_TOKEN].value, "bget") == 0))) {
+    ntokens = tokenize_command(command, cmdlen, tokens, MAX_TOKENS);
+    entry = (ntokens >= 2 ? lookup_ascii_command(&tokens[COMMAND_TOKEN], ntokens) : NULL);
+    if (entry == NULL) {
+        process_extension_command(c, tokens, ntokens);
+        return;
+    }
 
+    switch (entry->cmd) {
+    case ASCII_CMD_GET:
+    case ASCII_CMD_BGET:
         process_get_command(c, tokens, ntokens, false);
-
-    } else if ((ntokens == 6 || ntokens == 7) &&
-               ((strcmp(tokens[COMMAND_TOKEN].value, "add") == 0 && (comm = (int)OPERATION_ADD)) ||
-                (strcmp(tokens[COMMAND_TOKEN].value, "set") == 0 && (comm = (int)OPERATION_SET)) ||
-                (strcmp(tokens[COMMAND_TOKEN].value, "replace") == 0 && (comm = (int)OPERATION_REPLACE)) ||
-                (strcmp(tokens[COMMAND_TOKEN].value, "prepend") == 0 && (comm = (int)OPERATION_PREPEND)) ||
-                (strcmp(tokens[COMMAND_TOKEN].value, "append") == 0 && (comm = (int)OPERATION_APPEND)) )) {
-
-        process_update_command(c, tokens, ntokens, (ENGINE_STORE_OPERATION)comm, false);
-
-    } else if ((ntokens == 7 || ntokens == 8) && (strcmp(tokens[COMMAND_TOKEN].value, "cas") == 0 && (comm = (int)OPERATION_CAS))) {
-
-        process_update_command(c, tokens, ntokens, (ENGINE_STORE_OPERATION)comm, true);
-
-    } else if ((ntokens == 4 || ntokens == 5 || ntokens == 7 || ntokens == 8) && (strcmp(tokens[COMMAND_TOKEN].value, "incr") == 0)) {
-
-        process_arithmetic_command(c, tokens, ntokens, 1);
-
-    } else if (ntokens >= 3 && (strcmp(tokens[COMMAND_TOKEN].value, "gets") == 0)) {
-
+        break;
+    case ASCII_CMD_GETS:
         process_get_command(c, tokens, ntokens, true);
-
-    } else if ((ntokens == 4 || ntokens == 5 || ntokens == 7 || ntokens == 8) && (strcmp(tokens[COMMAND_TOKEN].value, "decr") == 0)) {
-
+        break;
+    case ASCII_CMD_SET:
+        process_update_command(c, tokens, ntokens, OPERATION_SET, false);
+        break;
+    case ASCII_CMD_ADD:
+        process_update_command(c, tokens, ntokens, OPERATION_ADD, false);
+        break;
+    case ASCII_CMD_REPLACE:
+        process_update_command(c, tokens, ntokens, OPERATION_REPLACE, false);
+        break;
+    case ASCII_CMD_PREPEND:
+        process_update_command(c, tokens, ntokens, OPERATION_PREPEND, false);
+        break;
+    case ASCII_CMD_APPEND:
+        process_update_command(c, tokens, ntokens, OPERATION_APPEND, false);
+        break;
+    case ASCII_CMD_CAS:
+        process_update_command(c, tokens, ntokens, OPERATION_CAS, true);
+        break;
+    case ASCII_CMD_INCR:
+        process_arithmetic_command(c, tokens, ntokens, 1);
+        break;
+    case ASCII_CMD_DECR:
         process_arithmetic_command(c, tokens, ntokens, 0);
-
-    } else if (ntokens >= 3 && ntokens <= 5 && (strcmp(tokens[COMMAND_TOKEN].value, "delete") == 0)) {
-
+        break;
+    case ASCII_CMD_DELETE:
         process_delete_command(c, tokens, ntokens);
-
-    } else if (ntokens >= 5 && ntokens <= 13 && (strcmp(tokens[COMMAND_TOKEN].value, "lop") == 0)) {
-
+        break;
+    case ASCII_CMD_LOP:
         process_lop_command(c, tokens, ntokens);
-
-    } else if (ntokens >= 5 && ntokens <= 12 && (strcmp(tokens[COMMAND_TOKEN].value, "sop") == 0)) {
-
+        break;
+    case ASCII_CMD_SOP:
         process_sop_command(c, tokens, ntokens);
-
-    } else if (ntokens >= 5 && ntokens <= 14 && (strcmp(tokens[COMMAND_TOKEN].value, "bop") == 0)) {
-
+        break;
+    case ASCII_CMD_BOP:
         process_bop_command(c, tokens, ntokens);
-
-    } else if (ntokens >= 3 && ntokens <= 11 && (strcmp(tokens[COMMAND_TOKEN].value, "getattr") == 0)) {
-
+        break;
+    case ASCII_CMD_GETATTR:
         process_getattr_command(c, tokens, ntokens);
-
-    } else if (ntokens >= 4 && ntokens <= 8  && (strcmp(tokens[COMMAND_TOKEN].value, "setattr") == 0)) {
-
+        break;
+    case ASCII_CMD_SETATTR:
         process_setattr_command(c, tokens, ntokens);
-
-    } else if (ntokens >= 2 && (strcmp(tokens[COMMAND_TOKEN].value, "stats") == 0)) {
-
+        break;
+    case ASCII_CMD_STATS:
         process_stat(c, tokens, ntokens);
-
-    } else if (ntokens >= 2 && ntokens <= 4 && (strcmp(tokens[COMMAND_TOKEN].value, "flush_all") == 0)) {
-        time_t exptime;
-
-        set_noreply_maybe(c, tokens, ntokens);
-
-        if (ntokens == (c->noreply ? 3 : 2)) {
-            exptime = 0;
-        } else {
-            exptime = strtol(tokens[1].value, NULL, 10);
-            if(errno == ERANGE) {
-                out_string(c, "CLIENT_ERROR bad command line format");
-                return;
-            }
-        }
-
-        ENGINE_ERROR_CODE ret;
-        ret = settings.engine.v1->flush(settings.engine.v0, c, exptime);
-        if (ret == ENGINE_SUCCESS) {
-            out_string(c, "OK");
-        } else if (ret == ENGINE_ENOTSUP) {
-            out_string(c, "SERVER_ERROR not supported");
-        } else {
-            out_string(c, "SERVER_ERROR failed to flush cache");
-        }
-        STATS_NOKEY(c, cmd_flush);
-        return;
-    } else if (ntokens >= 3 && ntokens <= 5 && (strcmp(tokens[COMMAND_TOKEN].value, "flush_prefix") == 0)) {
-        time_t exptime;
-
-        set_noreply_maybe(c, tokens, ntokens);
-
-        if (ntokens == (c->noreply ? 4 : 3)) {
-            exptime = 0;
-        } else {
-            exptime = strtol(tokens[2].value, NULL, 10);
-            if (errno == ERANGE) {
-                out_string(c, "CLIENT_ERROR bad command line format");
-                return;
-            }
-        }
-
-        ENGINE_ERROR_CODE ret;
-        char *prefix = tokens[PREFIX_TOKEN].value;
-        size_t nprefix = tokens[PREFIX_TOKEN].length;
-        if (nprefix == 4 && strncmp(prefix, "null", 4) == 0) {
-            /* flush null prefix */
-            prefix = NULL;
-            nprefix = 0;
-        }
-
-        ret = settings.engine.v1->flush_prefix(settings.engine.v0, c, prefix, nprefix, exptime);
-        if (settings.detail_enabled) {
-            if (ret == ENGINE_SUCCESS || ret == ENGINE_PREFIX_ENOENT) {
-                if (stats_prefix_delete(prefix, nprefix) == 0) { /* found */
-                    ret = ENGINE_SUCCESS;
-                }
-            }
-        }
-
-        if (ret == ENGINE_SUCCESS) {
-            out_string(c, "OK");
-        } else if (ret == ENGINE_DISCONNECT) {
-            c->state = conn_closing;
-        } else if (ret == ENGINE_PREFIX_ENOENT) {
-            out_string(c, "NOT_FOUND");
-        } else if (ret == ENGINE_ENOTSUP) {
-            out_string(c, "SERVER_ERROR not supported");
-        } else {
-            out_string(c, "SERVER_ERROR failed to flush cache");
-        }
-
-        STATS_NOKEY(c, cmd_flush_prefix);
-        return;
-    } else if (ntokens > 2 && (strcmp(tokens[COMMAND_TOKEN].value, "config") == 0)) {
-
-        if ((ntokens == 3 || ntokens == 4) && strcmp(tokens[COMMAND_TOKEN+1].value, "maxconns") == 0) {
-            process_maxconns_command(c, tokens, ntokens);
-        } else if ((ntokens == 3 || ntokens == 4) && (strcmp(tokens[COMMAND_TOKEN+1].value, "memlimit") == 0)) {
-            process_memlimit_command(c, tokens, ntokens);
-#ifdef ENABLE_JUNK_ITEM_TIME
-        } else if ((ntokens == 3 || ntokens == 4) && (strcmp(tokens[COMMAND_TOKEN+1].value, "junktime") == 0)) {
-            process_junktime_command(c, tokens, ntokens);
-#endif
-        } else if ((ntokens >= 3 || ntokens <= 5) && (strcmp(tokens[COMMAND_TOKEN+1].value, "verbosity") == 0)) {
-            process_verbosity_command(c, tokens, ntokens);
-        } else {
-            out_string(c, "CLIENT_ERROR bad command line format");
-        }
-
-    } else if (ntokens == 2 && (strcmp(tokens[COMMAND_TOKEN].value, "version") == 0)) {
-
+        break;
+    case ASCII_CMD_FLUSH_ALL:
+        process_flush_all_command(c, tokens, ntokens);
+        break;
+    case ASCII_CMD_FLUSH_PREFIX:
+        process_flush_prefix_command(c, tokens, ntokens);
+        break;
+    case ASCII_CMD_CONFIG:
+        process_config_command(c, tokens, ntokens);
+        break;
+    case ASCII_CMD_VERSION:
         out_string(c, "VERSION " VERSION);
-
-    } else if (ntokens == 2 && (strcmp(tokens[COMMAND_TOKEN].value, "quit") == 0)) {
-
+        break;
+    case ASCII_CMD_QUIT:
         conn_set_state(c, conn_closing);
+        break;
 #ifdef ENABLE_ZK_INTEGRATION
-    } else if (ntokens == 3 && (strcmp(tokens[COMMAND_TOKEN].value, "set_zk_ensemble") == 0)) {
-        /* The ensemble is a comma separated list of host:port addresses.
-         * host1:port1,host2:port2,...
-         */
-        char *out_str = "ERROR";
-        if (arcus_zk_cfg == NULL)
-            out_str = "ERROR not using ZooKeeper";
-        else if (0 != arcus_zk_set_ensemble(tokens[COMMAND_TOKEN+1].value))
-            out_str = "ERROR failed to set the new ensemble address (check logs)";
-        else
-            out_str = "OK";
-        out_string(c, out_str);
-    } else if (ntokens == 2 && (strcmp(tokens[COMMAND_TOKEN].value, "show_zk_ensemble") == 0)) {
-        char *out_str = "ERROR";
-        char buf[1024];
-        if (arcus_zk_cfg == NULL)
-            out_str = "ERROR not using ZooKeeper";
-        else if (0 != arcus_zk_get_ensemble_str(buf, sizeof(buf)-16))
-            out_str = "ERROR failed to get the ensemble address";
-        else {
-            strcat(buf, "\r\n\n");
-            out_str = buf;
-        }
-        out_string(c, out_str);
+    case ASCII_CMD_SET_ZK_ENSEMBLE:
+        process_set_zk_ensemble_command(c, tokens, ntokens);
+        break;
+    case ASCII_CMD_SHOW_ZK_ENSEMBLE:
+        process_show_zk_ensemble_command(c, tokens, ntokens);
+        break;
 #endif
-    } else if ((ntokens >= 2) && (strcmp(tokens[COMMAND_TOKEN].value, "help") == 0)) {
-
-        char *type = tokens[COMMAND_TOKEN+1].value;
-
-        if (ntokens > 2 && strcmp(type, "kv") == 0) {
-
-            out_string(c,
-            "\t" "set|add|replace <key> <flags> <exptime> <bytes> [noreply]\\r\\n<data>\\r\\n" "\n"
-            "\t" "append|prepend <key> <flags> <exptime> <bytes> [noreply]\\r\\n<data>\\r\\n" "\n"
-            "\t" "cas <key> <flags> <exptime> <bytes> <cas unique> [noreply]\\r\\n<data>\\r\\n" "\n"
-            "\t" "get <key>[,<key>...]\\r\\n" "\n"
-            "\t" "gets <key>[,<key>...]\\r\\n" "\n"
-            "\t" "incr|decr <key> <delta> [<flags> <exptime> <initial>] [noreply]\\r\\n" "\n"
-            "\t" "delete <key> [<time>] [noreply]\\r\\n" "\n"
-            );
-
-        } else if (ntokens > 2 && strcmp(type, "list") == 0) {
-
-            out_string(c,
-            "\t" "lop create <key> <attributes> [noreply]\\r\\n" "\n"
-            "\t" "lop insert <key> <index> <bytes> [create <attributes>] [noreply|pipe]\\r\\n<data>\\r\\n" "\n"
-            "\t" "lop delete <key> <index or range> [drop] [noreply|pipe]\\r\\n" "\n"
-            "\t" "lop get <key> <index or range> [delete|drop]\\r\\n" "\n"
-            "\n"
-            "\t" "* <attributes> : <flags> <exptime> <maxcount> [<ovflaction>] [unreadable]" "\n"
-            );
-
-        } else if (ntokens > 2 && strcmp(type, "set") == 0) {
-
-            out_string(c,
-            "\t" "sop create <key> <attributes> [noreply]\\r\\n" "\n"
-            "\t" "sop insert <key> <bytes> [create <attributes>] [noreply|pipe]\\r\\n<data>\\r\\n" "\n"
-            "\t" "sop delete <key> <bytes> [drop] [noreply|pipe]\\r\\n<data>\\r\\n" "\n"
-            "\t" "sop get <key> <count> [delete|drop]\\r\\n" "\n"
-            "\t" "sop exist <key> <bytes> [pipe]\\r\\n<data>\\r\\n" "\n"
-            "\n"
-            "\t" "* <attributes> : <flags> <exptime> <maxcount> [<ovflaction>] [unreadable]" "\n"
-            );
-
-        } else if (ntokens > 2 && strcmp(type, "btree") == 0) {
-
-            out_string(c,
-            "\t" "bop create <key> <attributes> [noreply]\\r\\n" "\n"
-            "\t" "bop insert|upsert <key> <bkey> [<eflag>] <bytes> [create <attributes>] [noreply|pipe|getrim]\\r\\n<data>\\r\\n" "\n"
-            "\t" "bop update <key> <bkey> [<eflag_update>] <bytes> [noreply|pipe]\\r\\n<data>\\r\\n" "\n"
-            "\t" "bop delete <key> <bkey or \"bkey range\"> [<eflag_filter>] [<count>] [drop] [noreply|pipe]\\r\\n" "\n"
-            "\t" "bop get <key> <bkey or \"bkey range\"> [<eflag_filter>] [[<offset>] <count>] [delete|drop]\\r\\n" "\n"
-            "\t" "bop count <key> <bkey or \"bkey range\"> [<eflag_filter>] \\r\\n" "\n"
-            "\t" "bop incr|decr <key> <bkey> <value> [noreply|pipe]\\r\\n" "\n"
-            "\t" "bop mget <lenkeys> <numkeys> <bkey or \"bkey range\"> [<eflag_filter>] [<offset>] <count>\\r\\n<\"comma separated keys\">\\r\\n" "\n"
-            "\t" "bop smget <lenkeys> <numkeys> <bkey or \"bkey range\"> [<eflag_filter>] [<offset>] <count>\\r\\n<\"comma separated keys\">\\r\\n" "\n"
-            "\t" "bop position <key> <bkey> <order>\\r\\n" "\n"
-            "\t" "bop gbp <key> <order> <position or \"position range\">\\r\\n" "\n"
-            "\n"
-            "\t" "* <attributes> : <flags> <exptime> <maxcount> [<ovflaction>] [unreadable]" "\n"
-            "\t" "* <eflag_update> : [<fwhere> <bitwop>] <fvalue>" "\n"
-            "\t" "* <eflag_filter> : <fwhere> [<bitwop> <foperand>] <compop> <fvalue>" "\n"
-            "\t" "                 : <fwhere> [<bitwop> <foperand>] EQ|NE <comma separated fvalue list>" "\n"
-            "\t" "* <bitwop> : &, |, ^" "\n"
-            "\t" "* <compop> : EQ, NE, LT, LE, GT, GE" "\n"
-            );
-
-        } else if (ntokens > 2 && strcmp(type, "attr") == 0) {
-
-            out_string(c,
-            "\t" "getattr <key> [<attribute name> ...]\\r\\n" "\n"
-            "\t" "setattr <key> <name>=<value> [<name>=value> ...]\\r\\n" "\n"
-            );
-
-        } else if (ntokens > 2 && strcmp(type, "admin") == 0) {
-
-            out_string(c,
-            "\t" "flush_all [<delay>] [noreply]\\r\\n" "\n"
-            "\t" "flush_prefix <prefix> [<delay>] [noreply]\\r\\n" "\n"
-            "\n"
-            "\t" "scrub [stale]\\r\\n" "\n"
-            "\n"
-            "\t" "stats\\r\\n" "\n"
-            "\t" "stats settings\\r\\n" "\n"
-            "\t" "stats items\\r\\n" "\n"
-            "\t" "stats slabs\\r\\n" "\n"
-            "\t" "stats prefixes\\r\\n" "\n"
-            "\t" "stats detail [on|off|dump]\\r\\n" "\n"
-            "\t" "stats scrub\\r\\n" "\n"
-            "\t" "stats cachedump <slab_clsid> <limit> [forward|backward [sticky]]\\r\\n" "\n"
-            "\t" "stats reset\\r\\n" "\n"
-            "\n"
-            "\t" "config verbosity [<verbose>]\\r\\n" "\n"
-            "\t" "config memlimit [<memsize(MB)>]\\r\\n" "\n"
-            "\t" "config maxconns [<maxconn>]\\r\\n" "\n"
-            );
-
-        } else {
-           out_string(c,
-           "\t" "* Usage: help [kv | list | set | btree | attr | admin ]" "\n"
-           );
-        }
-    } else if (settings.extensions.ascii != NULL) {
-        EXTENSION_ASCII_PROTOCOL_DESCRIPTOR *cmd;
-        size_t nbytes = 0;
-        char *ptr;
-
-        if (ntokens > 0) {
-            if (ntokens == MAX_TOKENS) {
-                out_string(c, "ERROR too many arguments");
-                return;
-            }
-
-            if (tokens[ntokens - 1].length == 0) {
-                --ntokens;
-            }
-        }
-
-        /* ntokens must be larger than 0 in order to avoid segfault in the next for statement. */
-        if (ntokens <= 0) {
-            out_string(c, "ERROR");
-            return;
-        }
-
-        for (cmd = settings.extensions.ascii; cmd != NULL; cmd = cmd->next) {
-            if (cmd->accept(cmd->cookie, c, ntokens, tokens, &nbytes, &ptr)) {
-                break;
-            }
-        }
-
-        if (cmd == NULL) {
-            /* Unify the response string in case of command mismatch */
-            /* out_string(c, "ERROR unknown command"); */
-            out_string(c, "ERROR");
-        } else if (nbytes == 0) {
-            if (!cmd->execute(cmd->cookie, c, ntokens, tokens,
-                              ascii_response_handler)) {
-                conn_set_state(c, conn_closing);
-            } else {
-                if (c->dynamic_buffer.buffer != NULL) {
-                    write_and_free(c, c->dynamic_buffer.buffer,
-                                   c->dynamic_buffer.offset);
-                    c->dynamic_buffer.buffer = NULL;
-                } else {
-                    conn_set_state(c, conn_new_cmd);
-                }
-            }
-        } else {
-            c->rlbytes = nbytes;
-            c->ritem = ptr;
-            c->ascii_cmd = cmd;
-            /* NOT SUPPORTED YET! */
-            conn_set_state(c, conn_nread);
-        }
-    } else {
-        out_string(c, "ERROR");
+    case ASCII_CMD_HELP:
+        process_help_command(c, tokens, ntokens);
+        break;
     }
-    return;
 }
 
 /*
@@ -11240,7 +12361,7 @@ static int try_read_command(conn *c) {
 
         assert(cont <= (c->rcurr + c->rbytes));
 
-        process_command(c, c->rcurr);
+        process_command(c, c->rcurr, el - c->rcurr);
 
         c->rbytes -= (cont - c->rcurr);
         c->rcurr = cont;
@@ -11275,15 +12396,89 @@ static enum try_read_result try_read_udp(conn *c) {
             return READ_NO_DATA_RECEIVED;
         }
 
-        /* Don't care about any of the rest of the header. */
-        res -= 8;
-        memmove(c->rbuf, c->rbuf + 8, res);
-
-        c->rbytes += res;
-        c->rcurr = c->rbuf;
-        return READ_DATA_RECEIVED;
+        /* Don't care about any of the rest of the header. */
+        res -= 8;
+        memmove(c->rbuf, c->rbuf + 8, res);
+
+        c->rbytes += res;
+        c->rcurr = c->rbuf;
+        return READ_DATA_RECEIVED;
+    }
+    return READ_NO_DATA_RECEIVED;
+}
+
+/*
+ * With -N io_uring, an ascii connection of a worker thread is read through
+ * a multishot recv of the thread's io_ring. The kernel fills the buffers
+ * provided to the ring as the data arrives, the completions queue them on
+ * the connection, and the reads just copy them out. The binary connections
+ * stay on read(), since TAP moves them to the tap thread. A connection also
+ * reads with read() while the ring is short of buffers, until it waits for
+ * input again.
+ */
+#define RECV_QUEUE_MAX 32 /* the buffers a connection holds before its recv is cancelled */
+
+static bool conn_recv_arm(conn *c) {
+    LIBEVENT_THREAD *me = c->thread;
+
+    if (c->recv_armed) {
+        return true;
+    }
+    if (!me->io_recv || IS_UDP(c->transport) || c->protocol != ascii_prot ||
+        c->recv_ended || io_ring_recv_space(me->io_ring) < RECV_QUEUE_MAX) {
+        return false;
+    }
+    if (!io_ring_recv(me->io_ring, c->sfd, c)) {
+        return false;
+    }
+    c->recv_armed = true;
+    c->recv_cancel = false;
+    return true;
+}
+
+static void conn_recv_cancel(conn *c) {
+    if (c->recv_armed && !c->recv_cancel &&
+        io_ring_cancel(c->thread->io_ring, IO_RING_RECV, c)) {
+        c->recv_cancel = true;
+    }
+}
+
+/* Is there input to read without waiting for the socket? */
+static bool conn_recv_queued(conn *c) {
+    return c->recv_queue.count > 0 || c->recv_ended;
+}
+
+/* read() that takes what the recv has received first */
+static ssize_t conn_read_socket(conn *c, void *buf, size_t len) {
+    if (c->recv_queue.count > 0) {
+        return io_ring_recvq_read(c->thread->io_ring, &c->recv_queue, buf, len);
+    }
+    if (c->recv_armed) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (c->recv_ended) {
+        if (c->recv_res == 0) {
+            return 0;
+        }
+        errno = -c->recv_res;
+        return -1;
+    }
+    return read(c->sfd, buf, len);
+}
+
+/*
+ * Waits for more input of the connection. An armed recv resumes the state
+ * machine with its completion, so the socket event is removed meanwhile.
+ */
+static bool conn_wait_input(conn *c) {
+    if (conn_recv_arm(c)) {
+        event_del(&c->event);
+        c->ev_flags = 0;
+        c->recv_wait = true;
+        return true;
     }
-    return READ_NO_DATA_RECEIVED;
+    return update_event(c, EV_READ | EV_PERSIST);
 }
 
 /*
@@ -11304,20 +12499,30 @@ static enum try_read_result try_read_network(conn *c) {
     int num_allocs = 0;
     assert(c != NULL);
 
-    if (c->rcurr != c->rbuf) {
-        if (c->rbytes != 0) /* otherwise there's nothing to copy */
-            memmove(c->rbuf, c->rcurr, c->rbytes);
+    /* The input is consumed from rcurr on. The unread bytes are moved to
+     * the front of the buffer only when little room is left behind them.
+     */
+    if (c->rbytes == 0) {
+        c->rcurr = c->rbuf;
+    } else if (c->rcurr != c->rbuf &&
+               c->rsize - (c->rcurr - c->rbuf) - c->rbytes < RBUF_MIN_ROOM) {
+        memmove(c->rbuf, c->rcurr, c->rbytes);
         c->rcurr = c->rbuf;
     }
 
     while (1) {
-        if (c->rbytes >= c->rsize) {
+        int used = (c->rcurr - c->rbuf) + c->rbytes;
+        if (used >= c->rsize) {
+            if (c->rcurr != c->rbuf) {
+                memmove(c->rbuf, c->rcurr, c->rbytes);
+                c->rcurr = c->rbuf;
+                continue;
+            }
             if (num_allocs == 4) {
-                return gotdata;
+                break;
             }
             ++num_allocs;
-            char *new_rbuf = realloc(c->rbuf, c->rsize * 2);
-            if (!new_rbuf) {
+            if (!conn_rbuf_resize(c, rbuf_size_for(c->rsize + 1))) {
                 if (settings.verbose > 0) {
                  settings.extensions.logger->log(EXTENSION_LOG_INFO, c,
                           "Couldn't realloc input buffer\n");
@@ -11327,12 +12532,11 @@ static enum try_read_result try_read_network(conn *c) {
                 c->write_and_go = conn_closing;
                 return READ_MEMORY_ERROR;
             }
-            c->rcurr = c->rbuf = new_rbuf;
-            c->rsize *= 2;
+            continue;
         }
 
-        int avail = c->rsize - c->rbytes;
-        res = read(c->sfd, c->rbuf + c->rbytes, avail);
+        int avail = c->rsize - used;
+        res = conn_read_socket(c, c->rcurr + c->rbytes, avail);
         if (res > 0) {
             STATS_ADD(c, bytes_read, res);
             gotdata = READ_DATA_RECEIVED;
@@ -11353,6 +12557,10 @@ static enum try_read_result try_read_network(conn *c) {
             return READ_ERROR;
         }
     }
+    if (gotdata == READ_DATA_RECEIVED) {
+        /* conn_shrink() sizes the read buffer by this average */
+        c->rbuf_want = (c->rbuf_want * 7 + c->rbytes) / 8;
+    }
     return gotdata;
 }
 
@@ -11376,6 +12584,212 @@ static bool update_event(conn *c, const int new_flags) {
     return true;
 }
 
+#ifdef USE_ZEROCOPY
+/*
+ * Make room to hold the items of the response before it is sent with
+ * MSG_ZEROCOPY. Returns false if there is no memory for it, and then
+ * the response must be copied instead.
+ */
+static bool conn_zerocopy_reserve(conn *c) {
+    int nitems = c->ileft + (c->item != NULL ? 1 : 0);
+
+    if (c->zcused + nitems > c->zcsize) {
+        int size = (c->zcsize > 0 ? c->zcsize : ZC_LIST_INITIAL);
+        while (size < c->zcused + nitems) {
+            size *= 2;
+        }
+        zc_hold *list = realloc(c->zclist, size * sizeof(zc_hold));
+        if (list == NULL) {
+            return false;
+        }
+        c->zclist = list;
+        c->zcsize = size;
+    }
+    return true;
+}
+#endif
+
+/*
+ * Hold the items of a response sent with MSG_ZEROCOPY. Their values may
+ * still be read by the kernel, so they are released only after the sends
+ * done so far are completed.
+ */
+static void conn_zerocopy_hold(conn *c) {
+    c->zc_used = false;
+    /* the space was reserved by transmit() before the zerocopy send */
+    assert(c->zcused + c->ileft + (c->item != NULL ? 1 : 0) <= c->zcsize);
+    for (; c->ileft > 0; c->ileft--, c->icurr++) {
+        c->zclist[c->zcused].it = *(c->icurr);
+        c->zclist[c->zcused].seq = c->zc_sent;
+        c->zcused++;
+    }
+    if (c->item != NULL) {
+        c->zclist[c->zcused].it = c->item;
+        c->zclist[c->zcused].seq = c->zc_sent;
+        c->zcused++;
+        c->item = NULL;
+    }
+}
+
+/*
+ * Release the held items whose zerocopy sends are completed,
+ * or all of them if the connection is being closed.
+ */
+static void conn_zerocopy_release(conn *c, bool all) {
+    int i;
+
+    for (i = 0; i < c->zcused; i++) {
+        if (!all && (int32_t)(c->zc_done - c->zclist[i].seq) < 0) {
+            break;
+        }
+        settings.engine.v1->release(settings.engine.v0, c, c->zclist[i].it);
+    }
+    if (i > 0) {
+        c->zcused -= i;
+        memmove(c->zclist, c->zclist + i, c->zcused * sizeof(zc_hold));
+    }
+}
+
+#ifdef USE_ZEROCOPY
+/*
+ * Account the completion of the zerocopy sends [lo, hi]. They usually
+ * complete in order; a range completed ahead of time is kept aside until
+ * the sends before it are completed. If too many of them are, the items
+ * are held until the connection is closed.
+ */
+static void conn_zerocopy_complete(conn *c, uint32_t lo, uint32_t hi) {
+    int i;
+
+    if (lo != c->zc_done) {
+        if (c->zc_nooo < ZC_OOO_MAX) {
+            c->zc_ooo[c->zc_nooo][0] = lo;
+            c->zc_ooo[c->zc_nooo][1] = hi;
+            c->zc_nooo++;
+        }
+        return;
+    }
+    c->zc_done = hi + 1;
+    for (i = 0; i < c->zc_nooo; i++) {
+        if (c->zc_ooo[i][0] == c->zc_done) {
+            c->zc_done = c->zc_ooo[i][1] + 1;
+            c->zc_nooo--;
+            c->zc_ooo[i][0] = c->zc_ooo[c->zc_nooo][0];
+            c->zc_ooo[i][1] = c->zc_ooo[c->zc_nooo][1];
+            i = -1; /* rescan */
+        }
+    }
+}
+
+/*
+ * Read the zerocopy completions from the error queue of the socket and
+ * release the items that are no longer referenced by the kernel.
+ */
+static void conn_zerocopy_reap(conn *c) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+                            sizeof(struct sockaddr_in6))];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+
+    while (c->zc_done != c->zc_sent) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(c->sfd, &msg, MSG_ERRQUEUE) == -1) {
+            break; /* no more completions for now */
+        }
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                /* the kernel copied the data anyway (loopback, or a device
+                 * without scatter-gather), so zerocopy only costs here.
+                 */
+                STATS_ADD(c, zerocopy_fallbacks, serr->ee_data - serr->ee_info + 1);
+                c->zerocopy = false;
+            }
+            conn_zerocopy_complete(c, serr->ee_info, serr->ee_data);
+        }
+    }
+    conn_zerocopy_release(c, false);
+}
+
+/*
+ * A closed connection with zerocopy sends in flight is parked on its thread
+ * with its socket and held items, until the kernel reports the completions.
+ * If the peer doesn't read for ZC_PARK_TIMEOUT seconds, the connection is
+ * reset, which purges its send queue, and the conn is freed after another
+ * ZC_PARK_TIMEOUT at the latest. The parked list is used by the thread only.
+ */
+static void conn_zerocopy_parked_handler(const int fd, const short which, void *arg);
+
+static void conn_zerocopy_arm(LIBEVENT_THREAD *me) {
+    struct timeval t = {.tv_sec = 0, .tv_usec = ZC_REAP_INTERVAL};
+
+    evtimer_set(&me->zc_event, conn_zerocopy_parked_handler, me);
+    event_base_set(me->base, &me->zc_event);
+    evtimer_add(&me->zc_event, &t);
+}
+
+static void conn_zerocopy_park(conn *c, LIBEVENT_THREAD *thread, int sfd) {
+    c->sfd = sfd;
+    c->thread = thread;
+    c->zc_timeout = current_time + ZC_PARK_TIMEOUT;
+    c->next = thread->zc_parked;
+    thread->zc_parked = c;
+    if (c->next == NULL) {
+        conn_zerocopy_arm(thread);
+    }
+}
+
+static void conn_zerocopy_unpark(conn *c) {
+    conn_zerocopy_release(c, true);
+    safe_close(c->sfd);
+    c->sfd = -1;
+    c->next = NULL;
+    c->thread = NULL;
+    c->zc_parked = false;
+    c->zc_reset = false;
+    cache_free(conn_cache, c);
+}
+
+static void conn_zerocopy_parked_handler(const int fd, const short which, void *arg) {
+    LIBEVENT_THREAD *me = arg;
+    conn **prev = &me->zc_parked;
+    conn *c;
+
+    while ((c = *prev) != NULL) {
+        conn_zerocopy_reap(c);
+        if (c->zc_done == c->zc_sent || (c->zc_reset && c->zc_timeout < current_time)) {
+            *prev = c->next;
+            conn_zerocopy_unpark(c);
+            continue;
+        }
+        if (!c->zc_reset && c->zc_timeout < current_time) {
+            /* connect() with AF_UNSPEC resets the connection and frees
+             * its send queue, but keeps the socket for the completions.
+             */
+            struct sockaddr sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_family = AF_UNSPEC;
+            (void)connect(c->sfd, &sa, sizeof(sa));
+            c->zc_reset = true;
+            c->zc_timeout = current_time + ZC_PARK_TIMEOUT;
+        }
+        prev = &c->next;
+    }
+    if (me->zc_parked != NULL) {
+        conn_zerocopy_arm(me);
+    }
+}
+#endif
+
 /*
  * Transmit the next chunk of data from our list of msgbuf structures.
  *
@@ -11384,12 +12798,14 @@ static bool update_event(conn *c, const int new_flags) {
  *   TRANSMIT_INCOMPLETE More data remaining to write.
  *   TRANSMIT_SOFT_ERROR Can't write any more right now.
  *   TRANSMIT_HARD_ERROR Can't write (c->state is set to conn_closing)
+ *   TRANSMIT_DEFERRED   Queued to the batched sends of the thread,
+ *                       the state machine is resumed with its result.
  */
 static enum transmit_result transmit(conn *c) {
     assert(c != NULL);
 
-    if (c->msgcurr < c->msgused &&
-            c->msglist[c->msgcurr].msg_iovlen == 0) {
+    while (c->msgcurr < c->msgused &&
+           c->msglist[c->msgcurr].msg_iovlen == 0) {
         /* Finished writing the current msg; advance to the next. */
         c->msgcurr++;
     }
@@ -11397,7 +12813,44 @@ static enum transmit_result transmit(conn *c) {
         ssize_t res;
         struct msghdr *m = &c->msglist[c->msgcurr];
 
-        res = sendmsg(c->sfd, m, 0);
+        if (c->send_state == SEND_STATE_QUEUED) {
+            /* re-entered before its batched send is completed */
+            return TRANSMIT_DEFERRED;
+        } else if (c->send_state == SEND_STATE_DONE) {
+            /* the result of the batched send */
+            c->send_state = SEND_STATE_NONE;
+            res = c->send_res;
+            if (res < 0) {
+                errno = -c->send_res;
+                res = -1;
+            }
+        } else if (c->thread != NULL && c->thread->io_ring != NULL &&
+                   !IS_UDP(c->transport)) {
+            c->send_state = SEND_STATE_QUEUED;
+            c->send_next = c->thread->send_queue;
+            c->thread->send_queue = c;
+            return TRANSMIT_DEFERRED;
+#ifdef USE_ZEROCOPY
+        } else if (m->msg_flags & MSG_ZEROCOPY) {
+            /* the items must be held until the send is completed,
+             * copy the value if there is no room to hold them */
+            if (!conn_zerocopy_reserve(c)) {
+                STATS_NOKEY(c, zerocopy_fallbacks);
+                res = sendmsg(c->sfd, m, 0);
+            } else if ((res = sendmsg(c->sfd, m, MSG_ZEROCOPY)) > 0) {
+                c->zc_sent++;
+                c->zc_used = true;
+                STATS_NOKEY(c, zerocopy_sends);
+                STATS_ADD(c, zerocopy_bytes, res);
+            } else if (res == -1 && errno == ENOBUFS) {
+                /* out of the memory to pin the pages, copy it */
+                STATS_NOKEY(c, zerocopy_fallbacks);
+                res = sendmsg(c->sfd, m, 0);
+            }
+#endif
+        } else {
+            res = sendmsg(c->sfd, m, 0);
+        }
         if (res > 0) {
             STATS_ADD(c, bytes_written, res);
 
@@ -11497,8 +12950,24 @@ bool conn_listening(conn *c)
         return false;
     }
 
-    dispatch_conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
-                      DATA_BUFFER_SIZE, tcp_transport);
+    if (c->thread != NULL) {
+        /* a listener of the worker thread (-A), serve the connection here */
+        conn *nc = conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
+                            DATA_BUFFER_SIZE, tcp_transport, c->thread->base, NULL);
+        if (nc == NULL) {
+            if (settings.verbose > 0) {
+                settings.extensions.logger->log(EXTENSION_LOG_INFO, c,
+                        "Can't listen for events on fd %d\n", sfd);
+            }
+            close(sfd);
+        } else {
+            nc->thread = c->thread;
+            thread_conn_count(c->thread, 1);
+        }
+    } else {
+        dispatch_conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
+                          DATA_BUFFER_SIZE, tcp_transport);
+    }
 
     return false;
 }
@@ -11562,8 +13031,55 @@ bool conn_ship_log(conn *c) {
     return cont;
 }
 
+/*
+ * Moves an idle connection to the thread chosen by threads_update_load().
+ * Only a connection without any buffered request or response is moved,
+ * so the new thread just starts reading from it.
+ */
+static bool conn_migrate(conn *c) {
+    LIBEVENT_THREAD *to;
+
+    if (IS_UDP(c->transport) || c->rbytes > 0 || c->pipe_response != NULL ||
+        c->send_state != SEND_STATE_NONE || c->thread->type != GENERAL ||
+        conn_recv_queued(c)) {
+        return false;
+    }
+    if (c->recv_armed) {
+        /* the recv completions come to this thread,
+         * move it when it waits again after the recv is cancelled.
+         */
+        conn_recv_cancel(c);
+        return false;
+    }
+    if ((to = thread_migration_target(c->thread)) == NULL) {
+        return false;
+    }
+    STATS_NOKEY(c, conn_migrations);
+    event_del(&c->event);
+    if (settings.verbose > 1) {
+        settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
+                                        "Moving %d conn from %p to %p\n",
+                                        c->sfd, (void*)c->thread, (void*)to);
+    }
+    c->ev_flags = EV_READ | EV_PERSIST;
+    event_set(&c->event, c->sfd, c->ev_flags, event_handler, (void *)c);
+    event_base_set(to->base, &c->event);
+    conn_set_state(c, conn_read);
+    assert(c->next == NULL);
+    dispatch_conn_migrate(c, to);
+    return true;
+}
+
 bool conn_waiting(conn *c) {
-    if (!update_event(c, EV_READ | EV_PERSIST)) {
+    if (conn_recv_queued(c)) {
+        /* the recv has more input already */
+        conn_set_state(c, conn_read);
+        return true;
+    }
+    if (c->thread->migrate_quota > 0 && conn_migrate(c)) {
+        return false;
+    }
+    if (!conn_wait_input(c)) {
         if (settings.verbose > 0) {
             settings.extensions.logger->log(EXTENSION_LOG_INFO, c,
                                             "Couldn't update event\n");
@@ -11611,12 +13127,13 @@ bool conn_new_cmd(conn *c) {
         reset_cmd_handler(c);
     } else {
         STATS_NOKEY(c, conn_yields);
-        if (c->rbytes > 0) {
-            /* We have already read in data into the input buffer,
-               so libevent will most likely not signal read events
-               on the socket (unless more data is available. As a
-               hack we should just put in a request to write data,
-               because that should be possible ;-)
+        if (c->rbytes > 0 || conn_recv_queued(c)) {
+            /* We have already read in data into the input buffer
+               (or the recv has), so libevent will most likely not
+               signal read events on the socket (unless more data
+               is available. As a hack we should just put in a
+               request to write data, because that should be
+               possible ;-)
             */
             if (!update_event(c, EV_WRITE | EV_PERSIST)) {
                 if (settings.verbose > 0) {
@@ -11626,6 +13143,13 @@ bool conn_new_cmd(conn *c) {
                 conn_set_state(c, conn_closing);
                 return true;
             }
+        } else if (!conn_wait_input(c)) {
+            if (settings.verbose > 0) {
+                settings.extensions.logger->log(EXTENSION_LOG_INFO,
+                                                c, "Couldn't update event\n");
+            }
+            conn_set_state(c, conn_closing);
+            return true;
         }
         return false;
     }
@@ -11652,7 +13176,7 @@ bool conn_swallow(conn *c) {
     }
 
     /*  now try reading from the socket */
-    res = read(c->sfd, c->rbuf, c->rsize > c->sbytes ? c->sbytes : c->rsize);
+    res = conn_read_socket(c, c->rbuf, c->rsize > c->sbytes ? c->sbytes : c->rsize);
     if (res > 0) {
         STATS_ADD(c, bytes_read, res);
         c->sbytes -= res;
@@ -11663,7 +13187,7 @@ bool conn_swallow(conn *c) {
         return true;
     }
     if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-        if (!update_event(c, EV_READ | EV_PERSIST)) {
+        if (!conn_wait_input(c)) {
             if (settings.verbose > 0) {
                 settings.extensions.logger->log(EXTENSION_LOG_INFO, c,
                                                 "Couldn't update event\n");
@@ -11723,7 +13247,7 @@ bool conn_nread(conn *c) {
     }
 
     /*  now try reading from the socket */
-    res = read(c->sfd, c->ritem, c->rlbytes);
+    res = conn_read_socket(c, c->ritem, c->rlbytes);
     if (res > 0) {
         STATS_ADD(c, bytes_read, res);
         if (c->rcurr == c->ritem) {
@@ -11738,7 +13262,7 @@ bool conn_nread(conn *c) {
         return true;
     }
     if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-        if (!update_event(c, EV_READ | EV_PERSIST)) {
+        if (!conn_wait_input(c)) {
             if (settings.verbose > 0) {
                 settings.extensions.logger->log(EXTENSION_LOG_INFO, c,
                                                 "Couldn't update event\n");
@@ -11796,19 +13320,17 @@ bool conn_mwrite(conn *c) {
     switch (transmit(c)) {
     case TRANSMIT_COMPLETE:
         if (c->state == conn_mwrite) {
+            if (c->zc_used) {
+                conn_zerocopy_hold(c);
+            }
             while (c->ileft > 0) {
                 item *it = *(c->icurr);
                 settings.engine.v1->release(settings.engine.v0, c, it);
                 c->icurr++;
                 c->ileft--;
             }
-            while (c->suffixleft > 0) {
-                char *suffix = *(c->suffixcurr);
-                cache_free(c->thread->suffix_cache, suffix);
-                c->suffixcurr++;
-                c->suffixleft--;
-            }
-            if (c->coll_eitem != NULL) {
+            obuf_release(c, true);
+            if (c->coll_eitem != NULL || c->coll_mkeys != NULL) {
                 conn_coll_eitem_free(c);
             }
             /* XXX:  I don't know why this wasn't the general case */
@@ -11838,12 +13360,133 @@ bool conn_mwrite(conn *c) {
         break;                   /* Continue in state machine. */
 
     case TRANSMIT_SOFT_ERROR:
+    case TRANSMIT_DEFERRED:
         return false;
     }
 
     return true;
 }
 
+/* Resume the state machine of a connection with its ring completions. */
+static void conn_ring_resume(conn *c) {
+    perform_callbacks(ON_SWITCH_CONN, c, c);
+    c->nevents = settings.reqs_per_event;
+    while (c->state(c)) {
+        /* do task */
+    }
+}
+
+/*
+ * Queues the buffer of a recv completion on its connection.
+ * Returns true if the connection waits for it to go on.
+ */
+static bool conn_recv_complete(LIBEVENT_THREAD *me, conn *c, io_ring_cqe_t *cqe) {
+    if (cqe->bid >= 0) {
+        io_ring_recvq_push(me->io_ring, &c->recv_queue, cqe->bid, cqe->res);
+        if (c->recv_parked) {
+            io_ring_recvq_drop(me->io_ring, &c->recv_queue);
+        } else {
+            STATS_NOKEY(c, io_uring_recvs);
+        }
+    }
+    if (!cqe->more) {
+        /* the recv is over */
+        c->recv_armed = false;
+        c->recv_cancel = false;
+        if (c->recv_parked) {
+            c->recv_parked = false;
+            c->thread = NULL;
+            cache_free(conn_cache, c);
+            return false;
+        }
+        if (cqe->res == -EINVAL) {
+            /* no multishot recv in this kernel, read() from now on */
+            me->io_recv = false;
+        } else if (cqe->res <= 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+            c->recv_ended = true;
+            c->recv_res = cqe->res;
+        }
+    } else if (c->recv_queue.count >= RECV_QUEUE_MAX) {
+        /* a connection that doesn't read must not hold all the buffers */
+        conn_recv_cancel(c);
+    }
+    if (c->recv_parked || !c->recv_wait) {
+        return false;
+    }
+    c->recv_wait = false;
+    return true;
+}
+
+/* Resume the connections whose sends are done, or whose recvs have data. */
+static void conn_ring_complete(LIBEVENT_THREAD *me) {
+    conn *list = NULL, *c, *next;
+    io_ring_cqe_t cqe;
+
+    while (io_ring_reap(me->io_ring, &cqe)) {
+        c = (conn *)cqe.data;
+        if (cqe.op == IO_RING_SEND) {
+            c->send_res = cqe.res;
+            c->send_state = SEND_STATE_DONE;
+            STATS_NOKEY(c, io_uring_sends);
+        } else if (cqe.op != IO_RING_RECV || !conn_recv_complete(me, c, &cqe)) {
+            continue; /* nothing to resume */
+        }
+        c->send_next = list;
+        list = c;
+    }
+    for (c = list; c != NULL; c = next) {
+        next = c->send_next;
+        c->send_next = NULL;
+        conn_ring_resume(c);
+    }
+}
+
+/*
+ * Send the responses queued by transmit() during the last event loop pass
+ * of the thread with one io_uring submission per ring full of connections.
+ * The submission doesn't wait: the sends done inline are completed right
+ * away, and the others are reaped by conn_reap_ring() from the event loop
+ * when the ring polls readable. The resumed connections may queue their
+ * next responses again, and the ones that don't fit in the ring wait for
+ * the completions.
+ */
+void conn_flush_sends(LIBEVENT_THREAD *me) {
+    conn *list, *last, *c, *next;
+    int submitted;
+
+    while ((list = me->send_queue) != NULL && io_ring_space(me->io_ring) > 0) {
+        last = NULL;
+        for (c = list; c != NULL && io_ring_space(me->io_ring) > 0; c = c->send_next) {
+            io_ring_prep_sendmsg(me->io_ring, c->sfd, &c->msglist[c->msgcurr],
+                                 MSG_DONTWAIT, c);
+            last = c;
+        }
+        me->send_queue = last->send_next;
+        last->send_next = NULL;
+
+        submitted = io_ring_submit(me->io_ring);
+        STATS_NOKEY(list, io_uring_submits);
+        for (c = list; c != NULL; c = next) {
+            next = c->send_next;
+            c->send_next = NULL;
+            if (submitted > 0) {
+                submitted--; /* in flight */
+                continue;
+            }
+            /* not submitted, send it by ourselves */
+            ssize_t sent = sendmsg(c->sfd, &c->msglist[c->msgcurr], 0);
+            c->send_res = (sent < 0) ? -errno : (int)sent;
+            c->send_state = SEND_STATE_DONE;
+            conn_ring_resume(c);
+        }
+        conn_ring_complete(me);
+    }
+}
+
+void conn_reap_ring(const int fd, const short which, void *arg) {
+    conn_ring_complete((LIBEVENT_THREAD *)arg);
+}
+
 bool conn_pending_close(conn *c) {
     assert(!c->pending_close.active);
     assert(c->sfd != -1);
@@ -11903,6 +13546,7 @@ bool conn_closing(conn *c) {
 
 bool conn_add_tap_client(conn *c) {
     LIBEVENT_THREAD *tp = &tap_thread;
+    assert(!c->recv_armed);
     c->ewouldblock = true;
 
     event_del(&c->event);
@@ -11913,6 +13557,7 @@ bool conn_add_tap_client(conn *c) {
     settings.extensions.logger->log(EXTENSION_LOG_DEBUG, NULL,
                                     "Moving %d conn from %p to %p\n",
                                     c->sfd, (void*)c->thread, (void*)tp);
+    thread_conn_count(c->thread, -1);
     c->thread = tp;
     c->event.ev_base = tp->base;
     assert(c->next == NULL);
@@ -11946,6 +13591,7 @@ void event_handler(const int fd, const short which, void *arg) {
     }
 
     c->which = which;
+    c->recv_wait = false;
 
     /* sanity */
     if (fd != c->sfd) {
@@ -11957,6 +13603,12 @@ void event_handler(const int fd, const short which, void *arg) {
         return;
     }
 
+#ifdef USE_ZEROCOPY
+    if (c->zc_done != c->zc_sent) {
+        conn_zerocopy_reap(c);
+    }
+#endif
+
     perform_callbacks(ON_SWITCH_CONN, c, c);
 
     c->nevents = settings.reqs_per_event;
@@ -12061,6 +13713,45 @@ static void maximize_sndbuf(const int sfd) {
 
 
 
+/*
+ * Create one more listening socket bound to the address of sfd.
+ * Both sockets have SO_REUSEPORT, so the kernel spreads the incoming
+ * connections over them.
+ */
+static int new_reuseport_socket(struct addrinfo *ai, const int sfd) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    struct linger ling = {0, 0};
+    int nsfd;
+    int flags = 1;
+
+    if (getsockname(sfd, (struct sockaddr *)&addr, &addrlen) != 0) {
+        return -1;
+    }
+    if ((nsfd = new_socket(ai)) == -1) {
+        return -1;
+    }
+#ifdef IPV6_V6ONLY
+    if (ai->ai_family == AF_INET6) {
+        setsockopt(nsfd, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &flags, sizeof(flags));
+    }
+#endif
+    setsockopt(nsfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
+#ifdef SO_REUSEPORT
+    setsockopt(nsfd, SOL_SOCKET, SO_REUSEPORT, (void *)&flags, sizeof(flags));
+#endif
+    setsockopt(nsfd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
+    setsockopt(nsfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
+    setsockopt(nsfd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags, sizeof(flags));
+
+    if (bind(nsfd, (struct sockaddr *)&addr, addrlen) == -1 ||
+        listen(nsfd, settings.backlog) == -1) {
+        safe_close(nsfd);
+        return -1;
+    }
+    return nsfd;
+}
+
 /**
  * Create a socket and bind it to a specific port number
  * @param port the port number to bind to
@@ -12121,6 +13812,17 @@ static int server_socket(int port, enum network_transport transport,
 #endif
 
         setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
+#ifdef SO_REUSEPORT
+        if (settings.reuseport && !IS_UDP(transport)) {
+            error = setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, (void *)&flags, sizeof(flags));
+            if (error != 0) {
+                perror("setsockopt(SO_REUSEPORT)");
+                safe_close(sfd);
+                freeaddrinfo(ai);
+                return 1;
+            }
+        }
+#endif
         if (IS_UDP(transport)) {
             maximize_sndbuf(sfd);
         } else {
@@ -12187,6 +13889,23 @@ static int server_socket(int port, enum network_transport transport,
                 ++stats.daemon_conns;
                 STATS_UNLOCK();
             }
+        } else if (settings.reuseport) {
+            int c, lsfd = sfd;
+
+            /* every worker thread accepts on its own listening socket */
+            for (c = 0; c < settings.num_threads; c++) {
+                if (c > 0 && (lsfd = new_reuseport_socket(next, sfd)) == -1) {
+                    perror("listen socket with SO_REUSEPORT");
+                    freeaddrinfo(ai);
+                    return 1;
+                }
+                /* this is guaranteed to hit all threads because we round-robin */
+                dispatch_conn_new(lsfd, conn_listening, EV_READ | EV_PERSIST, 1,
+                                  transport);
+                STATS_LOCK();
+                ++stats.daemon_conns;
+                STATS_UNLOCK();
+            }
         } else {
             if (!(listen_conn_add = conn_new(sfd, conn_listening,
                                              EV_READ | EV_PERSIST, 1,
@@ -12324,6 +14043,7 @@ static void clock_handler(const int fd, const short which, void *arg) {
     evtimer_add(&clockevent, &t);
 
     set_current_time();
+    threads_update_load();
 }
 
 static void usage(void) {
@@ -12376,9 +14096,20 @@ static void usage(void) {
     printf("-C            Disable use of CAS\n");
     printf("-b            Set the backlog queue limit (default: 1024)\n");
     printf("-B            Binding protocol - one of ascii, binary, or auto (default)\n");
+    printf("-A            Accept TCP connections on every worker thread, each with\n"
+           "              its own SO_REUSEPORT listening socket, instead of handing\n"
+           "              them over from the dispatcher thread\n");
+    printf("-N <backend>  Network I/O backend - epoll (default) or io_uring.\n"
+           "              io_uring sends the responses of all connections handled\n"
+           "              in an event loop pass with one system call, and receives\n"
+           "              the ascii requests with multishot recvs (Linux only).\n");
+    printf("-Z <bytes>    Send item values of at least <bytes> with MSG_ZEROCOPY\n"
+           "              instead of copying them into the socket buffer (Linux\n"
+           "              only, default: 0 (off), min: %d).\n", ZEROCOPY_MIN_SIZE);
     printf("-I            Override the size of each slab page. Adjusts max item size\n"
            "              (default: 1mb, min: 1k, max: 128m)\n");
     printf("-E <engine>   Engine to load, must be given (for example, -E .libs/default_engine.so)\n");
+    printf("-e <options>  Engine options separated by ';', may be given more than once\n");
     printf("-q            Disable detailed stats commands\n");
 #ifdef SASL_ENABLED
     printf("-S            Require SASL authentication\n");
@@ -12466,6 +14197,19 @@ static void usage_license(void) {
     return;
 }
 
+/*
+ * -e may be given more than once. The engine options of each one are
+ * appended to the options given so far, separated by ';'.
+ * Returns false if they do not fit in the options buffer.
+ */
+static bool add_engine_options(char *options, const size_t size, const char *opts) {
+    size_t len = strlen(options);
+    size_t remain = size - len;
+
+    return snprintf(options + len, remain, "%s%s",
+                    (len > 0 ? ";" : ""), opts) < (int)remain;
+}
+
 static void save_pid(const pid_t pid, const char *pid_file) {
     FILE *fp;
     if (pid_file == NULL) {
@@ -12605,24 +14349,21 @@ static int num_independent_stats(void) {
 }
 
 static void *new_independent_stats(void) {
-    int ii;
     int nrecords = num_independent_stats();
-    struct independent_stats *independent_stats = calloc(sizeof(independent_stats) + sizeof(struct thread_stats) * nrecords, 1);
+    /* the counters of the threads, followed by their reset bases */
+    struct independent_stats *independent_stats = calloc(sizeof(struct independent_stats) + sizeof(struct thread_stats) * nrecords * 2, 1);
+    if (independent_stats == NULL)
+        return NULL;
     if (settings.topkeys > 0)
         independent_stats->topkeys = topkeys_init(settings.topkeys);
-    for (ii = 0; ii < nrecords; ii++)
-        pthread_mutex_init(&independent_stats->thread_stats[ii].mutex, NULL);
+    independent_stats->reset_base = &independent_stats->thread_stats[nrecords];
     return independent_stats;
 }
 
 static void release_independent_stats(void *stats) {
-    int ii;
-    int nrecords = num_independent_stats();
     struct independent_stats *independent_stats = stats;
     if (independent_stats->topkeys)
         topkeys_free(independent_stats->topkeys);
-    for (ii = 0; ii < nrecords; ii++)
-        pthread_mutex_destroy(&independent_stats->thread_stats[ii].mutex);
     free(independent_stats);
 }
 
@@ -13136,6 +14877,7 @@ int main (int argc, char **argv) {
 
     const char *engine = NULL;
     const char *engine_config = NULL;
+    char engine_options[1024] = { [0] = '\0' };
     char old_options[1024] = { [0] = '\0' };
     char *old_opts = old_options;
 
@@ -13187,6 +14929,9 @@ int main (int argc, char **argv) {
           "C"   /* Disable use of CAS */
           "b:"  /* backlog queue limit */
           "B:"  /* Binding protocol */
+          "N:"  /* Network I/O backend */
+          "A"   /* Accept on the worker threads */
+          "Z:"  /* Min value size sent with MSG_ZEROCOPY */
           "I:"  /* Max item size */
           "S"   /* Sasl ON */
           "E:"  /* Engine to load */
@@ -13359,6 +15104,42 @@ int main (int argc, char **argv) {
                 exit(EX_USAGE);
             }
             break;
+        case 'A':
+#ifdef SO_REUSEPORT
+            settings.reuseport = true;
+#else
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "SO_REUSEPORT is not supported on this platform\n");
+            exit(EX_USAGE);
+#endif
+            break;
+        case 'N':
+            if (strcmp(optarg, "epoll") == 0) {
+                settings.io_uring = false;
+            } else if (strcmp(optarg, "io_uring") == 0) {
+                settings.io_uring = true;
+            } else {
+                settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                        "Invalid value for network I/O backend: %s\n"
+                        " -- should be one of epoll or io_uring\n", optarg);
+                exit(EX_USAGE);
+            }
+            break;
+        case 'Z':
+#ifdef USE_ZEROCOPY
+            settings.zerocopy_min = atoi(optarg);
+            if (settings.zerocopy_min < ZEROCOPY_MIN_SIZE) {
+                settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                        "The minimum value size for MSG_ZEROCOPY must be"
+                        " at least %d bytes\n", ZEROCOPY_MIN_SIZE);
+                exit(EX_USAGE);
+            }
+#else
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "MSG_ZEROCOPY is not supported on this platform\n");
+            exit(EX_USAGE);
+#endif
+            break;
         case 'I':
             unit = optarg[strlen(optarg)-1];
             if (unit == 'k' || unit == 'm' ||
@@ -13405,7 +15186,12 @@ int main (int argc, char **argv) {
             engine = optarg;
             break;
         case 'e':
-            engine_config = optarg;
+            if (!add_engine_options(engine_options, sizeof(engine_options), optarg)) {
+                settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                        "ERROR: Too long engine options given with -e\n");
+                return EX_USAGE;
+            }
+            engine_config = engine_options;
             break;
         case 'q':
             settings.allow_detailed = false;
@@ -13517,9 +15303,17 @@ int main (int argc, char **argv) {
     }
 
     if (engine_config != NULL && strlen(old_options) > 0) {
-        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
-                "ERROR: You can't mix -e with the old options\n");
-        return EX_USAGE;
+        /* The old options always have num_threads (and sticky_limit).
+         * So, append the -e options to them instead of rejecting the mix.
+         * The -e options are placed last, so they take precedence.
+         */
+        size_t remain = sizeof(old_options) - (old_opts - old_options);
+        if (snprintf(old_opts, remain, "%s", engine_config) >= (int)remain) {
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "ERROR: Too long engine options given with -e\n");
+            return EX_USAGE;
+        }
+        engine_config = old_options;
     } else if (engine_config == NULL && strlen(old_options) > 0) {
         engine_config = old_options;
     }
@@ -30,6 +30,7 @@
 #include <memcached/extension.h>
 
 #include "cache.h"
+#include "iouring.h"
 #include "topkeys.h"
 #include "engine_loader.h"
 
@@ -51,28 +52,42 @@
 #define INCR_MAX_STORAGE_LEN 24
 
 #define DATA_BUFFER_SIZE 2048
+/** Grown read buffers of DATA_BUFFER_SIZE << (2 * n) bytes (0 < n <= RBUF_CLASSES),
+ *  that is 8KB, 32KB and 128KB, are pooled per worker thread. */
+#define RBUF_CLASSES 3
+/** Unread input is moved to the front of the read buffer only if less
+ *  than this room is left behind it. */
+#define RBUF_MIN_ROOM 1024
 #define UDP_READ_BUFFER_SIZE 65536
 #define UDP_MAX_PAYLOAD_SIZE 1400
 #define UDP_HEADER_SIZE 8
 #define MAX_SENDBUF_SIZE (256 * 1024 * 1024)
-/* I'm told the max length of a 64-bit num converted to string is 20 bytes.
- * Plus a few for spaces, \r\n, \0 */
-#define SUFFIX_SIZE 24
 
-/** Initial size of list of items being returned by "get". */
-#define ITEM_LIST_INITIAL 200
+/** Initial size of list of items being returned by "get".
+ *  Kept small for idle connections, it grows by doubling on demand. */
+#define ITEM_LIST_INITIAL 32
 
-/** Initial size of list of CAS suffixes appended to "gets" lines. */
-#define SUFFIX_LIST_INITIAL 20
+/** Output arena: small response fragments are copied into it. */
+#define OBUF_BLOCK_SIZE 4096
+#define OBUF_COPY_MAX   512  /* larger values are referenced by iovec */
+#define OBUF_FMT_MAX    512  /* max length of a formatted fragment,
+                                * a "VALUE" line with the longest key fits */
 
-/** Initial size of the sendmsg() scatter/gather array. */
-#define IOV_LIST_INITIAL 400
+/** Items held for MSG_ZEROCOPY sends (-Z option). */
+#define ZC_LIST_INITIAL 16
+#define ZC_OOO_MAX      8    /* completions tracked out of order */
+#define ZC_REAP_INTERVAL 10000 /* usec between the reaps of parked conns */
+#define ZC_PARK_TIMEOUT  10    /* sec before a parked conn is reset */
+#define ZEROCOPY_MIN_SIZE (10 * 1024) /* smaller sends do not pay off */
+
+/** Initial size of the sendmsg() scatter/gather array.
+ *  Kept small for idle connections, it grows by doubling on demand. */
+#define IOV_LIST_INITIAL 64
 
 /** Initial number of sendmsg() argument structures to allocate. */
 #define MSG_LIST_INITIAL 10
 
 /** High water marks for buffer shrinking */
-#define READ_BUFFER_HIGHWAT 8192
 #define ITEM_LIST_HIGHWAT 400
 #define IOV_LIST_HIGHWAT 600
 #define MSG_LIST_HIGHWAT 100
@@ -96,6 +111,11 @@
 /* Max element value size */
 #define MAX_ELEMENT_BYTES  (4*1024)
 
+/* In sop mexist, max limit on the number of given values */
+#define MAX_SOP_MEXIST_COUNT    1000
+/* In sop inter/union/diff, max limit on the number of given keys */
+#define MAX_SOP_SETOP_KEY_COUNT 100
+
 #ifdef SUPPORT_BOP_MGET
 /* In bop mget, max limit on the number of given keys */
 #define MAX_BMGET_KEY_COUNT     200
@@ -185,6 +205,7 @@ enum bin_substates {
     bin_reading_bop_count,
     bin_reading_bop_position,
     bin_reading_bop_gbp,
+    bin_reading_bop_arithmetic,
 #if defined(SUPPORT_BOP_MGET) || defined(SUPPORT_BOP_SMGET)
     bin_reading_bop_prepare_nread_keys,
     bin_reading_bop_nread_keys_complete,
@@ -217,9 +238,11 @@ struct slab_stats {
 
 /**
  * Stats stored per-thread.
+ * Only the owning thread updates its counters, so they are updated
+ * without a lock. "stats" reads them with relaxed loads, which is why
+ * every member must be a uint64_t counter (see threadlocal_stats_aggregate).
  */
 struct thread_stats {
-    pthread_mutex_t   mutex;
     uint64_t          cmd_get;
     uint64_t          get_misses;
     uint64_t          delete_misses;
@@ -233,6 +256,13 @@ struct thread_stats {
     uint64_t          cmd_flush;
     uint64_t          cmd_flush_prefix;
     uint64_t          conn_yields; /* # of yields for connections (-R option)*/
+    uint64_t          io_uring_submits; /* # of batched send submissions (-N io_uring) */
+    uint64_t          io_uring_sends;   /* # of sends done through io_uring */
+    uint64_t          io_uring_recvs;   /* # of buffers received through io_uring */
+    uint64_t          conn_migrations;  /* # of idle connections moved to another thread */
+    uint64_t          zerocopy_sends;     /* # of sends done with MSG_ZEROCOPY (-Z option) */
+    uint64_t          zerocopy_bytes;     /* bytes sent with MSG_ZEROCOPY */
+    uint64_t          zerocopy_fallbacks; /* # of zerocopy sends the kernel copied */
     uint64_t          auth_cmds;
     uint64_t          auth_errors;
     /* list command stats */
@@ -246,6 +276,7 @@ struct thread_stats {
     uint64_t          cmd_sop_delete;
     uint64_t          cmd_sop_get;
     uint64_t          cmd_sop_exist;
+    uint64_t          cmd_sop_setop;
     /* btree command stats */
     uint64_t          cmd_bop_create;
     uint64_t          cmd_bop_insert;
@@ -288,6 +319,7 @@ struct thread_stats {
     uint64_t          sop_get_misses;
     uint64_t          sop_exist_hits;
     uint64_t          sop_exist_misses;
+    uint64_t          sop_setop_oks;
     /* btree hit & miss stats */
     uint64_t          bop_create_oks;
     uint64_t          bop_insert_hits;
@@ -335,9 +367,23 @@ struct thread_stats {
  */
 struct independent_stats {
     topkeys_t *topkeys;
+    struct thread_stats *reset_base; /* counters at the last "stats reset" */
     struct thread_stats thread_stats[];
 };
 
+/*
+ * Update and read a thread stats counter. Relaxed atomics compile to plain
+ * loads and stores, but keep a 64-bit counter from being torn for a reader.
+ */
+#if defined(__GNUC__) && defined(__ATOMIC_RELAXED)
+#define THREAD_STATS_ADD(var, amt) \
+    __atomic_store_n(&(var), __atomic_load_n(&(var), __ATOMIC_RELAXED) + (amt), __ATOMIC_RELAXED)
+#define THREAD_STATS_GET(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#else
+#define THREAD_STATS_ADD(var, amt) ((var) += (amt))
+#define THREAD_STATS_GET(var) (var)
+#endif
+
 /**
  * Global stats.
  */
@@ -347,6 +393,13 @@ struct stats {
     unsigned int  curr_conns;
     unsigned int  total_conns;
     unsigned int  conn_structs;
+    /* memory of the connection structures' buffers */
+    uint64_t      conn_rbuf_bytes;  /* read buffers */
+    uint64_t      conn_wbuf_bytes;  /* write buffers */
+    uint64_t      conn_iov_bytes;   /* iovec, msghdr and udp header lists */
+    uint64_t      conn_list_bytes;  /* item lists */
+    uint64_t      conn_pipe_bytes;  /* attached pipe response buffers */
+    uint64_t      conn_obuf_bytes;  /* output arenas */
     time_t        started;          /* when the process was started */
     uint64_t      rejected_conns; /* number of times I reject a client */
 };
@@ -387,6 +440,9 @@ struct settings {
     bool sasl;              /* SASL on/off */
     bool require_sasl;      /* require SASL auth */
     int topkeys;            /* Number of top keys to track */
+    bool io_uring;          /* batch the sends of worker threads with io_uring */
+    bool reuseport;         /* worker threads accept on SO_REUSEPORT sockets */
+    uint32_t zerocopy_min;  /* send values of at least this size with MSG_ZEROCOPY, 0 = off */
     union {
         ENGINE_HANDLE *v0;
         ENGINE_HANDLE_V1 *v1;
@@ -419,7 +475,14 @@ typedef struct {
     int notify_receive_fd;      /* receiving end of notify pipe */
     int notify_send_fd;         /* sending end of notify pipe */
     struct conn_queue *new_conn_queue; /* queue of new connections to handle */
-    cache_t *suffix_cache;      /* suffix cache */
+    cache_t *pipe_cache;        /* pipe response buffer cache */
+    cache_t *rbuf_cache[RBUF_CLASSES]; /* read buffer caches */
+    io_ring_t *io_ring;         /* io_uring for the batched sends, or NULL */
+    bool io_recv;               /* io_ring also receives with multishot recvs */
+    struct event ring_event;    /* the completions of io_ring are ready */
+    struct conn *send_queue;    /* connections waiting for a batched send */
+    struct conn *zc_parked;     /* closed connections with zerocopy sends in flight */
+    struct event zc_event;      /* reaps the completions of the parked connections */
     pthread_mutex_t mutex;      /* Mutex to lock protect access to the pending_io */
     bool is_locked;
     struct conn *pending_io;    /* List of connection with pending async io ops */
@@ -428,6 +491,13 @@ typedef struct {
 
     rel_time_t last_checked;
     struct conn *pending_close; /* list of connections close at a later time */
+
+    /* load-aware dispatch */
+    int conn_count;             /* # of client connections of this thread */
+    int cpu_permille;           /* recent CPU usage of this thread (1/1000) */
+    uint64_t cpu_usec;          /* CPU time of this thread at the last check */
+    int migrate_quota;          /* # of idle connections to move to migrate_to */
+    int migrate_to;             /* index of the thread taking over connections */
 } LIBEVENT_THREAD;
 
 #define LOCK_THREAD(t)                          \
@@ -457,6 +527,20 @@ typedef struct {
 typedef struct conn conn;
 typedef bool (*STATE_FUNC)(conn *);
 
+/* a block of the output arena of a connection */
+typedef struct obuf_block {
+    struct obuf_block *next;
+    uint32_t size;        /* size of data[] */
+    uint32_t used;        /* bytes handed out */
+    char     data[];
+} obuf_block;
+
+/* an item held until its zerocopy sends are completed */
+typedef struct {
+    item     *it;
+    uint32_t  seq;        /* released when zc_done passes it */
+} zc_hold;
+
 /* collection element value */
 typedef struct {
     uint32_t   nbytes;    /* The total size of the data (in bytes) */
@@ -480,6 +564,7 @@ struct conn {
     char   *rcurr;  /** but if we parsed some already, this is where we stopped */
     int    rsize;   /** total allocated size of rbuf */
     int    rbytes;  /** how much data, starting from rcur, do we have unparsed */
+    uint32_t rbuf_want; /** moving average of the input buffered by a read */
 
     char   *wbuf;
     char   *wcurr;
@@ -494,7 +579,6 @@ struct conn {
 
     /* collection processing fields */
     void        *coll_eitem;
-    char        *coll_resps;
     int          coll_ecount;
     ENGINE_COLL_OPERATION coll_op;
     char        *coll_key;
@@ -511,6 +595,8 @@ struct conn {
     uint32_t     coll_numkeys; /* number of keys */
     uint32_t     coll_lenkeys; /* length of keys */
     void        *coll_mkeys;   /* (comma separated) multiple keys */
+    ENGINE_SET_OPERATION coll_setop; /* set operation of sop inter/union/diff */
+    bool         coll_cntonly; /* return the result count only */
 
     /* data for the nread state */
 
@@ -543,10 +629,25 @@ struct conn {
     item   **icurr;
     int    ileft;
 
-    char   **suffixlist;
-    int    suffixsize;
-    char   **suffixcurr;
-    int    suffixleft;
+    /* items whose values were sent with MSG_ZEROCOPY. They are held
+     * until the kernel reports the completion of the sends.
+     */
+    zc_hold *zclist;
+    int      zcsize;
+    int      zcused;
+    uint32_t zc_sent;      /* # of zerocopy sends done on the socket */
+    uint32_t zc_done;      /* the sends before this one are all completed */
+    uint32_t zc_ooo[ZC_OOO_MAX][2]; /* completions received out of order */
+    int      zc_nooo;
+    bool     zc_used;      /* the current response was sent with zerocopy */
+    bool     zerocopy;     /* SO_ZEROCOPY is enabled on the socket */
+    bool     zc_parked;    /* closed, the socket waits for the completions */
+    bool     zc_reset;     /* parked and reset, the send queue is purged */
+    rel_time_t zc_timeout; /* parked until then */
+
+    obuf_block *obuf;      /* output arena, the first block is kept */
+    obuf_block *obuf_tail; /* block the fragments are added to */
+    uint32_t obuf_bytes;   /* memory of the output arena */
 
     enum protocol protocol;   /* which protocol this connection speaks */
     enum network_transport transport; /* what transport is used by this connection */
@@ -563,13 +664,27 @@ struct conn {
     int               pipe_count;
     int               pipe_reslen;
     char             *pipe_resptr;
-    char              pipe_response[PIPE_MAX_RES_SIZE];
+    char             *pipe_response; /* attached from the thread's pipe_cache while pipelining */
     /*******
     int               pipe_cmd[PIPE_MAX_CMD_COUNT];
     ENGINE_ERROR_CODE pipe_res[PIPE_MAX_CMD_COUNT];
     bool              pipe_cod[PIPE_MAX_CMD_COUNT]; // create or drop
     *******/
 
+    /* batched send through the thread's io_ring */
+    struct conn      *send_next;
+    int               send_state;
+    int               send_res;
+
+    /* multishot recv through the thread's io_ring */
+    io_ring_recvq_t   recv_queue;  /* received, not yet read */
+    bool              recv_armed;  /* the recv is in flight */
+    bool              recv_cancel; /* the recv is being cancelled */
+    bool              recv_wait;   /* resume the state machine on the next recv */
+    bool              recv_ended;  /* the socket is read through, see recv_res */
+    bool              recv_parked; /* closed, freed on the last recv completion */
+    int               recv_res;    /* 0 on the end of stream, or -errno */
+
     char   client_ip[16];
 
     bool   noreply;   /* True if the reply should not be sent. */
@@ -605,6 +720,16 @@ struct conn {
         bool active;
         rel_time_t  timeout;
     } pending_close;
+
+    /* buffer sizes last accounted in the global stats */
+    struct {
+        uint32_t rbuf;
+        uint32_t wbuf;
+        uint32_t iov;
+        uint32_t list;
+        uint32_t pipe;
+        uint32_t obuf;
+    } membytes;
 };
 
 /*
@@ -635,6 +760,12 @@ void threads_shutdown(void);
 int  dispatch_event_add(int thread, conn *c);
 void dispatch_conn_new(int sfd, STATE_FUNC init_state, int event_flags,
                        int read_buffer_size, enum network_transport transport);
+void dispatch_conn_migrate(conn *c, LIBEVENT_THREAD *to);
+LIBEVENT_THREAD *thread_migration_target(LIBEVENT_THREAD *me);
+void thread_conn_count(LIBEVENT_THREAD *me, int delta);
+void threads_update_load(void);
+void threads_load_stats(ADD_STAT add_stats, conn *c);
+bool threads_use_io_uring(void);
 
 /* Lock wrappers for cache functions that are called from main loop. */
 void accept_new_conns(const bool do_accept);
@@ -645,8 +776,8 @@ int   is_listen_thread(void);
 void STATS_LOCK(void);
 void STATS_UNLOCK(void);
 void threadlocal_stats_clear(struct thread_stats *stats);
-void threadlocal_stats_reset(struct thread_stats *thread_stats);
-void threadlocal_stats_aggregate(struct thread_stats *thread_stats, struct thread_stats *stats);
+void threadlocal_stats_reset(struct independent_stats *independent_stats);
+void threadlocal_stats_aggregate(struct independent_stats *independent_stats, struct thread_stats *stats);
 void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out);
 
 /* Stat processing functions */
@@ -671,6 +802,8 @@ size_t list_to_array(conn **dest, size_t max_items, conn **l);
 void init_check_stdin(struct event_base *base);
 
 void conn_close(conn *c);
+void conn_flush_sends(LIBEVENT_THREAD *me);
+void conn_reap_ring(const int fd, const short which, void *arg);
 
 
 #if HAVE_DROP_PRIVILEGES
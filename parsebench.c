@@ -0,0 +1,153 @@
+/*
+ * arcus-memcached - Arcus memory cache server
+ * Copyright 2010-2014 NAVER Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Micro benchmark of the ascii command line parsing.
+ * It splits a pipelined request buffer into lines and tokenizes each line,
+ * once with a plain byte-by-byte tokenizer and once with tokenize_command().
+ *
+ * usage: parsebench [<loop count>]
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <memcached/util.h>
+
+#define MAX_TOKENS 30
+#define NUM_LINES  4096
+
+/* the byte-by-byte tokenizer used before, kept as the baseline */
+static size_t tokenize_command_plain(char *command, token_t *tokens, const size_t max_tokens) {
+    char *s, *e;
+    size_t ntokens = 0;
+
+    for (s = e = command; ntokens < max_tokens - 1; ++e) {
+        if (*e == ' ') {
+            if (s != e) {
+                tokens[ntokens].value = s;
+                tokens[ntokens].length = e - s;
+                ntokens++;
+                *e = '\0';
+            }
+            s = e + 1;
+        }
+        else if (*e == '\0') {
+            if (s != e) {
+                tokens[ntokens].value = s;
+                tokens[ntokens].length = e - s;
+                ntokens++;
+            }
+            break; /* string end */
+        }
+    }
+    tokens[ntokens].value =  *e == '\0' ? NULL : e;
+    tokens[ntokens].length = 0;
+    ntokens++;
+    return ntokens;
+}
+
+static size_t build_requests(char *buf) {
+    char *p = buf;
+    int i;
+
+    for (i = 0; i < NUM_LINES; i++) {
+        switch (i % 4) {
+        case 0:
+            p += sprintf(p, "bop insert arcus:bench:btree:key%06d %d 0x%08X 10 pipe\r\n",
+                         i % 1000, i, i);
+            break;
+        case 1:
+            p += sprintf(p, "get arcus:bench:kv:key%06d arcus:bench:kv:key%06d\r\n", i, i + 1);
+            break;
+        case 2:
+            p += sprintf(p, "sop exist arcus:bench:set:key%06d 10 pipe\r\n", i % 1000);
+            break;
+        default:
+            p += sprintf(p, "bop get arcus:bench:btree:key%06d 0..%d 0 50\r\n", i % 1000, i);
+            break;
+        }
+    }
+    return p - buf;
+}
+
+static double run(const char *src, char *buf, const size_t size, const int loops, const bool plain,
+                  size_t *total_tokens) {
+    token_t tokens[MAX_TOKENS];
+    struct timeval tv_beg, tv_end;
+    char *curr, *el;
+    size_t left;
+    int i;
+
+    *total_tokens = 0;
+    gettimeofday(&tv_beg, NULL);
+    for (i = 0; i < loops; i++) {
+        memcpy(buf, src, size);
+        curr = buf;
+        left = size;
+        while (left > 0 && (el = memchr(curr, '\n', left)) != NULL) {
+            char *cont = el + 1;
+            if ((el - curr) > 1 && *(el - 1) == '\r') {
+                el--;
+            }
+            *el = '\0';
+            if (plain) {
+                *total_tokens += tokenize_command_plain(curr, tokens, MAX_TOKENS);
+            } else {
+                *total_tokens += tokenize_command(curr, el - curr, tokens, MAX_TOKENS);
+            }
+            left -= (cont - curr);
+            curr = cont;
+        }
+    }
+    gettimeofday(&tv_end, NULL);
+    return (tv_end.tv_sec - tv_beg.tv_sec) * 1000.0
+         + (tv_end.tv_usec - tv_beg.tv_usec) / 1000.0;
+}
+
+int main(int argc, char **argv) {
+    int loops = (argc > 1 ? atoi(argv[1]) : 1000);
+    char *src = malloc(NUM_LINES * 128);
+    char *buf = malloc(NUM_LINES * 128);
+    size_t size, plain_tokens, tokens;
+    double plain_ms, ms;
+
+    if (src == NULL || buf == NULL || loops <= 0) {
+        fprintf(stderr, "usage: %s [<loop count>]\n", argv[0]);
+        return 1;
+    }
+    size = build_requests(src);
+
+    plain_ms = run(src, buf, size, loops, true, &plain_tokens);
+    ms = run(src, buf, size, loops, false, &tokens);
+    if (plain_tokens != tokens) {
+        fprintf(stderr, "token count mismatch: %lu != %lu\n",
+                (unsigned long)plain_tokens, (unsigned long)tokens);
+        return 1;
+    }
+
+    printf("lines\t%d x %d loops (%lu bytes per loop)\n", NUM_LINES, loops, (unsigned long)size);
+    printf("plain\t%.1f ms (%.1f ns/line)\n", plain_ms,
+           plain_ms * 1000000.0 / ((double)NUM_LINES * loops));
+    printf("tokenize_command\t%.1f ms (%.1f ns/line)\n", ms,
+           ms * 1000000.0 / ((double)NUM_LINES * loops));
+
+    free(src);
+    free(buf);
+    return 0;
+}
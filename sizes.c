@@ -2,6 +2,9 @@
 #include <stdio.h>
 
 #include "memcached.h"
+/* Forward decl for the engine headers */
+struct default_engine;
+#include "items.h"
 
 static void display(const char *name, size_t size) {
     printf("%s\t%d\n", name, (int)size);
@@ -18,6 +21,9 @@ int main(int argc, char **argv) {
     display("Libevent thread",
             sizeof(LIBEVENT_THREAD));
     display("Connection", sizeof(conn));
+    display("Item header", sizeof(hash_item));
+    display("Item links", sizeof(item_links));
+    display("Item CAS", sizeof(uint64_t));
 
     printf("----------------------------------------\n");
 
@@ -215,7 +215,9 @@ int slabs_short_of_free_space(struct default_engine *engine)
                 } else {
                     space_shortage_level = limit_nchunk / avail_nchunk;
                     if (space_shortage_level == 1) {
-                        space_shortage_level += (limit_nchunk-avail_nchunk) / (limit_nchunk/6);
+                        /* limit_nchunk is less than 6 with a small memory limit */
+                        size_t level_nchunk = (limit_nchunk >= 6 ? limit_nchunk/6 : 1);
+                        space_shortage_level += (limit_nchunk-avail_nchunk) / level_nchunk;
                         /* space_shortage_level: 1 ~ 3 */
                     } else { /* space_shortage_level >= 2 */
                         space_shortage_level += 2;
@@ -1110,7 +1112,7 @@ ENGINE_ERROR_CODE slabs_init(struct default_engine *engine,
                              const size_t limit, const double factor, const bool prealloc)
 {
     int i = POWER_SMALLEST - 1;
-    unsigned int size = sizeof(hash_item) + engine->config.chunk_size;
+    unsigned int size = ITEM_HEADER_SIZE(engine) + engine->config.chunk_size;
 
     logger = engine->server.log->get_logger();
 
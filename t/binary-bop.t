@@ -0,0 +1,171 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 28;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+use Socket qw(MSG_WAITALL);
+
+my $server = new_memcached();
+my $sock = $server->sock;
+my $bsock = $server->new_sock;
+
+use constant CMD_NOOP         => 0x0A;
+use constant CMD_SETATTRQ     => 0x4D;
+use constant CMD_BOP_POSITION => 0x77;
+use constant CMD_BOP_GBP      => 0x78;
+use constant CMD_BOP_CREATEQ  => 0x7F;
+use constant CMD_BOP_INCR     => 0x80;
+use constant CMD_BOP_DECR     => 0x81;
+use constant CMD_BOP_INCRQ    => 0x82;
+use constant CMD_BOP_DECRQ    => 0x83;
+
+use constant ERR_KEY_ENOENT   => 0x01;
+use constant ERR_EINVAL       => 0x04;
+use constant ERR_ELEM_ENOENT  => 0x37;
+
+use constant ASC  => 1;
+use constant DESC => 2;
+
+my $opaque = 0;
+
+sub send_bin {
+    my ($cmd, $key, $extra) = @_;
+    my $msg = pack("CCnCCnNNNN", 0x80, $cmd, length($key), length($extra),
+                   0, 0, length($key) + length($extra), ++$opaque, 0, 0);
+    print $bsock $msg . $extra . $key;
+    return $opaque;
+}
+
+sub recv_bin {
+    $bsock->recv(my $header, 24, MSG_WAITALL);
+    my ($magic, $cmd, $keylen, $extlen, $datatype, $status, $bodylen,
+        $ropaque) = unpack("CCnCCnNN", $header);
+    my $body = "";
+    $bsock->recv($body, $bodylen, MSG_WAITALL) if ($bodylen > 0);
+    return ($status, $body, $ropaque);
+}
+
+sub bkey_bin {
+    my $bkey = shift;
+    return pack("NN", int($bkey / 2 ** 32), $bkey % 2 ** 32) . ("\0" x 23) . "\0";
+}
+
+sub position_extra {
+    my ($bkey, $order) = @_;
+    return bkey_bin($bkey) . pack("C", $order) . ("\0" x 7);
+}
+
+sub gbp_extra {
+    my ($from, $to, $order) = @_;
+    return pack("NNCCCC", $from, $to, $order, 0, 0, 0);
+}
+
+sub incr_extra {
+    my ($bkey, $delta, $initial, $create) = @_;
+    return bkey_bin($bkey) . ("\0" x 32) .
+           pack("NNNNC", 0, $delta, 0, $initial, $create) . ("\0" x 7);
+}
+
+sub unpack_u64 {
+    my ($hi, $lo) = unpack("NN", shift);
+    return $hi * 2 ** 32 + $lo;
+}
+
+my ($status, $body, $ropaque);
+
+print $sock "bop create bkey 0 0 0\r\n";
+is(scalar <$sock>, "CREATED\r\n", "bop create bkey");
+foreach my $i (1..3) {
+    print $sock "bop insert bkey " . ($i * 10) . " 4\r\nval$i\r\n";
+    is(scalar <$sock>, "STORED\r\n", "bop insert bkey " . ($i * 10));
+}
+print $sock "bop insert bkey 40 1\r\n5\r\n";
+is(scalar <$sock>, "STORED\r\n", "bop insert bkey 40");
+
+# bop position
+send_bin(CMD_BOP_POSITION, "bkey", position_extra(20, ASC));
+($status, $body) = recv_bin();
+is(unpack("N", $body), 1, "bop position asc");
+send_bin(CMD_BOP_POSITION, "bkey", position_extra(10, DESC));
+($status, $body) = recv_bin();
+is(unpack("N", $body), 3, "bop position desc");
+send_bin(CMD_BOP_POSITION, "bkey", position_extra(25, ASC));
+($status, $body) = recv_bin();
+is($status, ERR_ELEM_ENOENT, "bop position: element not found");
+send_bin(CMD_BOP_POSITION, "nokey", position_extra(10, ASC));
+($status, $body) = recv_bin();
+is($status, ERR_KEY_ENOENT, "bop position: key not found");
+send_bin(CMD_BOP_POSITION, "bkey", position_extra(10, 3));
+($status, $body) = recv_bin();
+is($status, ERR_EINVAL, "bop position: bad order");
+
+send_bin(CMD_BOP_POSITION, "bkey", ("\0" x 31) . pack("CC", 200, ASC) . ("\0" x 7));
+($status, $body) = recv_bin();
+is($status, ERR_EINVAL, "bop position: bad bkey length");
+
+# bop gbp: a bkey slot of 32 bytes per element, bkey and its length
+send_bin(CMD_BOP_GBP, "bkey", gbp_extra(0, 1, ASC));
+($status, $body) = recv_bin();
+my ($flags, $count) = unpack("NN", $body);
+my $bkey1 = unpack_u64(substr($body, 8, 8));
+my $bkey2 = unpack_u64(substr($body, 8 + 32, 8));
+my ($vlen1, $vlen2) = unpack("NN", substr($body, 8 + 64, 8));
+is($count, 2, "bop gbp asc: count");
+is("$bkey1 $bkey2", "10 20", "bop gbp asc: bkeys");
+is(substr($body, 8 + 64 + 8), "val1val2", "bop gbp asc: values");
+send_bin(CMD_BOP_GBP, "bkey", gbp_extra(1, 1, DESC));
+($status, $body) = recv_bin();
+is(substr($body, 8 + 32 + 4), "val3", "bop gbp desc");
+
+print $sock "bop insert hkey 0x0A0B0C 4 create 0 0 0\r\nhval\r\n";
+is(scalar <$sock>, "CREATED_STORED\r\n", "bop insert hkey 0x0A0B0C");
+send_bin(CMD_BOP_GBP, "hkey", gbp_extra(0, 0, ASC));
+($status, $body) = recv_bin();
+is(unpack("H6", substr($body, 8, 3)) . " " . unpack("C", substr($body, 8 + 31, 1)),
+   "0a0b0c 3", "bop gbp: byte array bkey");
+
+# bop incr/decr
+send_bin(CMD_BOP_INCR, "bkey", incr_extra(40, 3, 0, 0));
+($status, $body) = recv_bin();
+is(unpack_u64($body), 8, "bop incr");
+send_bin(CMD_BOP_DECR, "bkey", incr_extra(40, 2, 0, 0));
+($status, $body) = recv_bin();
+is(unpack_u64($body), 6, "bop decr");
+send_bin(CMD_BOP_INCR, "bkey", incr_extra(50, 1, 100, 1));
+($status, $body) = recv_bin();
+is(unpack_u64($body), 100, "bop incr: create with initial");
+send_bin(CMD_BOP_INCR, "bkey", incr_extra(60, 1, 0, 0));
+($status, $body) = recv_bin();
+is($status, ERR_ELEM_ENOENT, "bop incr: element not found");
+send_bin(CMD_BOP_INCR, "bkey", ("\0" x 31) . pack("C", 255) . ("\0" x 32) .
+                               pack("NNNNC", 0, 1, 0, 0, 0) . ("\0" x 7));
+($status, $body) = recv_bin();
+is($status, ERR_EINVAL, "bop incr: bad bkey length");
+
+# quiet variants only respond on error
+send_bin(CMD_BOP_INCRQ, "bkey", incr_extra(40, 10, 0, 0));
+send_bin(CMD_BOP_DECRQ, "bkey", incr_extra(40, 1, 0, 0));
+send_bin(CMD_BOP_INCRQ, "bkey", incr_extra(60, 1, 0, 0));
+my $noop = send_bin(CMD_NOOP, "", "");
+($status, $body, $ropaque) = recv_bin();
+is($status, ERR_ELEM_ENOENT, "bop incrq: error is returned");
+($status, $body, $ropaque) = recv_bin();
+is($ropaque, $noop, "bop incrq/decrq: no response on success");
+print $sock "bop get bkey 40\r\n";
+is(scalar <$sock>, "VALUE 0 1\r\n", "bop get after incrq/decrq");
+is(scalar <$sock>, "40 2 15\r\n", "bop get after incrq/decrq: value");
+scalar <$sock>; # END
+
+# bop createq and setattrq
+send_bin(CMD_BOP_CREATEQ, "bkey2", pack("NNNCCCC", 0, 0, 0, 0, 1, 0, 0));
+send_bin(CMD_SETATTRQ, "bkey2", pack("NN", 0, 100) . ("\0" x 31) .
+                                pack("CCCCC", 255, 0, 0, 0, 1));
+$noop = send_bin(CMD_NOOP, "", "");
+($status, $body, $ropaque) = recv_bin();
+is($ropaque, $noop, "bop createq/setattrq: no response on success");
+print $sock "getattr bkey2 maxcount\r\n";
+is(scalar <$sock>, "ATTR maxcount=100\r\n", "getattr after setattrq");
+scalar <$sock>; # END
@@ -459,6 +459,7 @@ use strict;
 use warnings;
 use fields qw(socket);
 use IO::Socket::INET;
+use Socket qw(MSG_WAITALL);
 
 sub new {
     my $self = shift;
@@ -543,7 +544,8 @@ sub _handle_single_response {
     my $self = shift;
     my $myopaque = shift;
 
-    $self->{socket}->recv(my $response, ::MIN_RECV_BYTES);
+    # the header may arrive in pieces if a long response is split
+    $self->{socket}->recv(my $response, ::MIN_RECV_BYTES, MSG_WAITALL);
 #    Test::More::is(length($response), ::MIN_RECV_BYTES, "Expected read length");
 
     my ($magic, $cmd, $keylen, $extralen, $datatype, $status, $remaining,
@@ -0,0 +1,40 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 9;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# The collection delete thread drops at most 10 elements per cache lock hold.
+my $server = new_memcached("-e coll_del_batch=10");
+my $sock = $server->sock;
+my $ecnt = 2000;
+my $eidx;
+my $val;
+my $len;
+my $stats;
+
+$stats = mem_stats($sock);
+is ($stats->{"coll_del_items"}, 0, "initial coll_del_items is zero");
+is ($stats->{"coll_del_queue_size"}, 0, "initial coll_del_queue_size is zero");
+
+print $sock "bop create bkey1 11 0 -1\r\n";
+is (scalar <$sock>, "CREATED\r\n", "bop create bkey1");
+for ($eidx = 0; $eidx < $ecnt; $eidx++) {
+    $val = "datum_$eidx";
+    $len = length($val);
+    print $sock "bop insert bkey1 $eidx $len noreply\r\n$val\r\n";
+}
+print $sock "bop count bkey1 0..$ecnt\r\n";
+is (scalar <$sock>, "COUNT=$ecnt\r\n", "bop count bkey1");
+
+print $sock "delete bkey1\r\n";
+is (scalar <$sock>, "DELETED\r\n", "delete bkey1");
+sleep(1);
+
+$stats = mem_stats($sock);
+is ($stats->{"coll_del_items"}, 1, "coll_del_items after drop");
+is ($stats->{"coll_del_elems"}, $ecnt, "coll_del_elems after drop");
+is ($stats->{"coll_del_queue_size"}, 0, "coll_del_queue_size after drop");
+ok ($stats->{"coll_del_slices"} >= $ecnt/10, "coll_del_slices after drop");
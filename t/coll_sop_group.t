@@ -0,0 +1,104 @@
+#!/usr/bin/perl
+# Test that set elements are kept in element groups correctly while the
+# groups grow and split into child nodes, shrink on deletions, and lose
+# elements in the middle of a traversal by sop get with delete.
+
+use strict;
+use Test::More tests => 17;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+my $empty_bytes = mem_stats($sock)->{bytes};
+my $count = 3000;
+
+sub value_of {
+    return sprintf("value%05d", shift);
+}
+
+# returns the number of the given elements found in the set
+sub exist_count {
+    my ($from, $to) = @_;
+    my $found = 0;
+    for (my $i = $from; $i < $to; $i++) {
+        print $sock "sop exist skey 10\r\n" . value_of($i) . "\r\n";
+        $found++ if (scalar <$sock> eq "EXIST\r\n");
+    }
+    return $found;
+}
+
+# returns the head line and the element values of sop get
+sub sop_get_values {
+    my $args = shift;
+    my @values = ();
+    print $sock "sop get skey $args\r\n";
+    my $head = scalar <$sock>;
+    if ($head =~ /^VALUE \d+ (\d+)/) {
+        for (my $i = 0; $i < $1; $i++) {
+            my $line = scalar <$sock>;
+            $line =~ /^\d+ (.*)\r\n/;
+            push(@values, $1);
+        }
+        scalar <$sock>;
+    }
+    return ($head, @values);
+}
+
+# growth: the groups are doubled and split into child nodes
+my $stored = 0;
+print $sock "sop create skey 0 0 10000\r\n";
+is(scalar <$sock>, "CREATED\r\n", "sop create skey");
+for (my $i = 0; $i < $count; $i++) {
+    print $sock "sop insert skey 10\r\n" . value_of($i) . "\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, $count, "inserted $count elements");
+print $sock "sop insert skey 10\r\n" . value_of(0) . "\r\n";
+is(scalar <$sock>, "ELEMENT_EXISTS\r\n", "duplicate element is found");
+is(exist_count(0, $count), $count, "all elements exist");
+my ($head, @values) = sop_get_values("0");
+my %seen = map { ($_ => 1) } @values;
+ok($head eq "VALUE 0 $count\r\n" && scalar(keys %seen) == $count,
+   "sop get returns all elements once");
+
+# shrink: most of the elements are deleted
+my $deleted = 0;
+for (my $i = 100; $i < $count; $i++) {
+    print $sock "sop delete skey 10\r\n" . value_of($i) . "\r\n";
+    $deleted++ if (scalar <$sock> eq "DELETED\r\n");
+}
+is($deleted, $count - 100, "deleted elements");
+is(exist_count(0, 100), 100, "kept elements exist");
+is(exist_count(100, $count), 0, "deleted elements do not exist");
+getattr_is($sock, "skey count", "count=100");
+
+# growth again after the shrink
+$stored = 0;
+for (my $i = 100; $i < $count; $i++) {
+    print $sock "sop insert skey 10\r\n" . value_of($i) . "\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, $count - 100, "inserted the deleted elements again");
+is(exist_count(0, $count), $count, "all elements exist");
+
+# delete during the traversal of sop get
+($head, @values) = sop_get_values("1000 delete");
+%seen = map { ($_ => 1) } @values;
+ok($head eq "VALUE 0 1000\r\n" && scalar(keys %seen) == 1000,
+   "sop get 1000 delete returns distinct elements");
+my $left = 0;
+foreach my $v (@values) {
+    print $sock "sop exist skey 10\r\n$v\r\n";
+    $left++ if (scalar <$sock> eq "EXIST\r\n");
+}
+is($left, 0, "the returned elements are deleted");
+is(exist_count(0, $count), $count - 1000, "the other elements exist");
+($head, @values) = sop_get_values("0 drop");
+%seen = map { ($_ => 1) } @values;
+ok($head eq "VALUE 0 2000\r\n" && scalar(keys %seen) == 2000,
+   "sop get 0 drop returns the other elements");
+print $sock "sop exist skey 10\r\n" . value_of(0) . "\r\n";
+is(scalar <$sock>, "NOT_FOUND\r\n", "the set is dropped");
+is(mem_stats($sock)->{bytes}, $empty_bytes, "the space of the set is given back");
@@ -0,0 +1,77 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 16;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+my $cmd;
+my $val;
+my $rst;
+
+sub mexist_data {
+    my @values = @_;
+    my $data = join("", map { length($_) . " " . $_ . "\r\n" } @values);
+    # <lenvalues> does not include the last "\r\n"
+    return (length($data) - 2, scalar(@values), $data);
+}
+
+sub mexist_is {
+    my ($key, $values, $result, $msg) = @_;
+    my ($len, $num, $data) = mexist_data(@$values);
+    print $sock "sop mexist $key $len $num\r\n$data";
+    my $resp = scalar <$sock>;
+    if ($resp =~ /^RESULT/) {
+        $resp .= scalar <$sock>;
+        $resp .= scalar <$sock>;
+    }
+    is($resp, $result, $msg);
+}
+
+# set creation and insertion
+$cmd = "sop insert skey 6 create 13 60 1000"; $val = "datum1"; $rst = "CREATED_STORED";
+print $sock "$cmd\r\n$val\r\n"; is(scalar <$sock>, "$rst\r\n", "$cmd $val: $rst");
+$cmd = "sop insert skey 6"; $val = "datum2"; $rst = "STORED";
+print $sock "$cmd\r\n$val\r\n"; is(scalar <$sock>, "$rst\r\n", "$cmd $val: $rst");
+$cmd = "sop insert skey 11"; $val = "datum 3,sp!"; $rst = "STORED";
+print $sock "$cmd\r\n$val\r\n"; is(scalar <$sock>, "$rst\r\n", "$cmd $val: $rst");
+
+# multiple existence check
+mexist_is("skey", ["datum0", "datum1", "datum2", "datum 3,sp!", "datum4"],
+          "RESULT 5\r\n01110\r\nEND\r\n", "sop mexist: 01110");
+mexist_is("skey", ["datum2"], "RESULT 1\r\n1\r\nEND\r\n", "sop mexist single value");
+mexist_is("nokey", ["datum1"], "NOT_FOUND\r\n", "sop mexist: NOT_FOUND");
+
+# large sets with many values
+my @values = ();
+for (my $i = 0; $i < 3000; $i++) {
+    print $sock "sop insert bigset 6 create 0 0 5000 noreply\r\n" . sprintf("v%05d", $i*2) . "\r\n";
+}
+for (my $i = 0; $i < 1000; $i++) {
+    push(@values, sprintf("v%05d", $i));
+}
+mexist_is("bigset", \@values, "RESULT 1000\r\n" . ("10" x 500) . "\r\nEND\r\n",
+          "sop mexist: 1000 values");
+
+# error cases
+print $sock "set kvkey 0 0 5\r\nvalue\r\n"; is(scalar <$sock>, "STORED\r\n", "set kvkey");
+mexist_is("kvkey", ["datum1"], "TYPE_MISMATCH\r\n", "sop mexist: TYPE_MISMATCH");
+# the number of values is less than <numvalues>
+print $sock "sop mexist skey 8 2\r\n6 datum1\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad data chunk\r\n", "sop mexist: bad data chunk");
+print $sock "sop mexist skey 8 1\r\n7 datum1\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad data chunk\r\n", "sop mexist: wrong value length");
+# a value length near UINT32_MAX must not wrap around
+print $sock "sop mexist skey 13 1\r\n4294967295 ab\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad data chunk\r\n", "sop mexist: too long value length");
+mexist_is("skey", ["datum2"], "RESULT 1\r\n1\r\nEND\r\n", "sop mexist after a too long value length");
+print $sock "sop mexist skey 8 1001\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad value\r\n", "sop mexist: too many values");
+
+# readable attribute
+print $sock "sop create ukey 0 0 100 unreadable\r\n"; is(scalar <$sock>, "CREATED\r\n", "sop create unreadable");
+mexist_is("ukey", ["datum1"], "UNREADABLE\r\n", "sop mexist: UNREADABLE");
@@ -0,0 +1,111 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 17;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+my $cmd;
+my $val;
+my $rst;
+
+# returns (head line, reference to the element values, tail line)
+sub sop_get_random {
+    my ($key, $count) = @_;
+    print $sock "sop get $key $count random\r\n";
+    my $head = scalar <$sock>;
+    my @values = ();
+    if ($head =~ /^VALUE \d+ (\d+)/) {
+        for (my $i = 0; $i < $1; $i++) {
+            my $line = scalar <$sock>;
+            $line =~ s/\r\n$//;
+            my ($len, $data) = split(/ /, $line, 2);
+            push(@values, $data);
+        }
+        return ($head, \@values, scalar <$sock>);
+    }
+    return ($head, \@values, "");
+}
+
+sub all_distinct_members {
+    my ($values, $members) = @_;
+    my %seen = ();
+    foreach my $v (@$values) {
+        return 0 if (!exists $members->{$v} || exists $seen{$v});
+        $seen{$v} = 1;
+    }
+    return 1;
+}
+
+my ($head, $values, $tail);
+my %members = ();
+
+# small set
+$cmd = "sop insert skey 6 create 11 0 0"; $val = "datum1"; $rst = "CREATED_STORED";
+print $sock "$cmd\r\n$val\r\n"; is(scalar <$sock>, "$rst\r\n", "$cmd $val: $rst");
+for (my $i = 2; $i <= 3; $i++) {
+    print $sock "sop insert skey 6\r\ndatum$i\r\n";
+    is(scalar <$sock>, "STORED\r\n", "sop insert skey 6 datum$i: STORED");
+}
+%members = map { ("datum$_" => 1) } (1..3);
+
+($head, $values, $tail) = sop_get_random("skey", 2);
+ok($head eq "VALUE 11 2\r\n" && $tail eq "END\r\n" &&
+   all_distinct_members($values, \%members), "sop get skey 2 random");
+($head, $values, $tail) = sop_get_random("skey", 0);
+ok($head eq "VALUE 11 3\r\n" && all_distinct_members($values, \%members),
+   "sop get skey 0 random: all elements");
+($head, $values, $tail) = sop_get_random("skey", 10);
+ok($head eq "VALUE 11 3\r\n" && all_distinct_members($values, \%members),
+   "sop get skey 10 random: all elements");
+
+# large set spanning several hash nodes
+%members = ();
+for (my $i = 0; $i < 5000; $i++) {
+    my $v = sprintf("v%05d", $i);
+    print $sock "sop insert bigset 6 create 0 0 10000 noreply\r\n$v\r\n";
+    $members{$v} = 1;
+}
+($head, $values, $tail) = sop_get_random("bigset", 50);
+ok($head eq "VALUE 0 50\r\n" && all_distinct_members($values, \%members),
+   "sop get bigset 50 random");
+($head, $values, $tail) = sop_get_random("bigset", 1000);
+ok($head eq "VALUE 0 1000\r\n" && all_distinct_members($values, \%members),
+   "sop get bigset 1000 random");
+($head, $values, $tail) = sop_get_random("bigset", 5000);
+ok($head eq "VALUE 0 5000\r\n" && all_distinct_members($values, \%members),
+   "sop get bigset 5000 random: all elements");
+
+# sampling after deletion
+for (my $i = 0; $i < 5000; $i += 2) {
+    my $v = sprintf("v%05d", $i);
+    print $sock "sop delete bigset 6 noreply\r\n$v\r\n";
+    delete $members{$v};
+}
+print $sock "sop exist bigset 6\r\nv00000\r\n";
+is(scalar <$sock>, "NOT_EXIST\r\n", "sop exist bigset v00000: NOT_EXIST");
+($head, $values, $tail) = sop_get_random("bigset", 500);
+ok($head eq "VALUE 0 500\r\n" && all_distinct_members($values, \%members),
+   "sop get bigset 500 random after deletion");
+($head, $values, $tail) = sop_get_random("bigset", 0);
+ok($head eq "VALUE 0 2500\r\n" && all_distinct_members($values, \%members),
+   "sop get bigset 0 random after deletion: all elements");
+
+# the sampled elements are not deleted
+($head, $values, $tail) = sop_get_random("bigset", 2500);
+is($head, "VALUE 0 2500\r\n", "sop get bigset 2500 random: no element deleted");
+
+# error cases
+($head, $values, $tail) = sop_get_random("nokey", 2);
+is($head, "NOT_FOUND\r\n", "sop get nokey 2 random: NOT_FOUND");
+print $sock "sop create emptyset 0 0 0\r\n";
+is(scalar <$sock>, "CREATED\r\n", "sop create emptyset: CREATED");
+($head, $values, $tail) = sop_get_random("emptyset", 2);
+is($head, "NOT_FOUND_ELEMENT\r\n", "sop get emptyset 2 random: NOT_FOUND_ELEMENT");
+print $sock "sop get skey 2 random delete\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad command line format\r\n",
+   "sop get skey 2 random delete: CLIENT_ERROR");
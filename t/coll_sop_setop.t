@@ -0,0 +1,126 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 34;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+sub sop_insert_values {
+    my ($key, @values) = @_;
+    foreach my $val (@values) {
+        print $sock "sop insert $key " . length($val) . " create 0 0 1000 noreply\r\n$val\r\n";
+    }
+}
+
+sub setop_is {
+    my ($setop, $keys, $opts, $expected, $msg) = @_;
+    my $keystr = join(",", @$keys);
+    my $numkeys = scalar(@$keys);
+    my $cmd = "sop $setop " . length($keystr) . " $numkeys";
+    $cmd .= " $opts" if ($opts ne "");
+    print $sock "$cmd\r\n$keystr\r\n";
+
+    my $resp = scalar <$sock>;
+    if ($resp =~ /^RESULT (\d+)\r\n/) {
+        my @values = ();
+        for (my $i = 0; $i < $1; $i++) {
+            my $line = scalar <$sock>;
+            $line =~ /^\d+ (.*)\r\n/;
+            push(@values, $1);
+        }
+        $resp = "RESULT " . join(",", sort(@values)) . " " . scalar <$sock>;
+    }
+    is($resp, "$expected\r\n", $msg || "$cmd $keystr: $expected");
+}
+
+sop_insert_values("s1", "a", "b", "c", "d");
+sop_insert_values("s2", "b", "c", "d", "e", "f");
+sop_insert_values("s3", "c", "d", "x");
+
+# intersection
+setop_is("inter", ["s1", "s2"], "", "RESULT b,c,d END");
+setop_is("inter", ["s1", "s2", "s3"], "", "RESULT c,d END");
+setop_is("inter", ["s1", "s2", "s3"], "count", "COUNT=2");
+setop_is("inter", ["s1", "nokey"], "", "RESULT  END");
+
+# union
+setop_is("union", ["s1", "s2"], "", "RESULT a,b,c,d,e,f END");
+setop_is("union", ["s1", "s2", "s3", "nokey"], "", "RESULT a,b,c,d,e,f,x END");
+setop_is("union", ["s1", "s2", "s3"], "count", "COUNT=7");
+
+# difference
+setop_is("diff", ["s1", "s2"], "", "RESULT a END");
+setop_is("diff", ["s2", "s1", "s3"], "", "RESULT e,f END");
+setop_is("diff", ["s3", "nokey"], "count", "COUNT=3");
+setop_is("diff", ["nokey", "s1"], "", "RESULT  END");
+
+# store the result into a destination set
+setop_is("inter", ["s1", "s2"], "store dst 7 0 100", "STORED 3");
+sop_get_is($sock, "dst 0", 7, 3, "b,c,d");
+setop_is("union", ["dst", "s3"], "store dst 7 0 100", "STORED 4");
+sop_get_is($sock, "dst 0", 7, 4, "b,c,d,x");
+setop_is("union", ["s1", "s2"], "store dst 0 0 5", "OVERFLOWED");
+
+# error cases
+print $sock "set kvkey 0 0 5\r\nvalue\r\n"; is(scalar <$sock>, "STORED\r\n", "set kvkey");
+setop_is("inter", ["s1", "kvkey"], "", "TYPE_MISMATCH");
+print $sock "sop create ukey 0 0 100 unreadable\r\n"; is(scalar <$sock>, "CREATED\r\n", "sop create unreadable");
+setop_is("union", ["s1", "ukey"], "", "UNREADABLE");
+print $sock "sop inter 5 3\r\ns1,s2\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad data chunk\r\n", "sop inter: bad data chunk");
+print $sock "sop inter 5 101\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad value\r\n", "sop inter: too many keys");
+print $sock "sop inter 4294967295 2\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad value\r\n", "sop inter: too long key list");
+print $sock "sop inter 503 2\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad value\r\n", "sop inter: key list longer than the keys");
+
+# the result array grows with the number of result elements
+for (my $i = 0; $i < 1000; $i++) {
+    print $sock "sop insert g1 5 create 0 0 2000 noreply\r\n" . sprintf("a%04d", $i) . "\r\n";
+    print $sock "sop insert g2 5 create 0 0 2000 noreply\r\n" . sprintf("b%04d", $i) . "\r\n";
+}
+print $sock "sop union 5 2\r\ng1,g2\r\n";
+my $count = 0;
+if (scalar <$sock> =~ /^RESULT (\d+)\r\n/) {
+    $count = $1;
+    for (my $i = 0; $i < $count; $i++) { scalar <$sock>; }
+    scalar <$sock>;
+}
+is($count, 2000, "sop union of 2000 elements");
+setop_is("union", ["g1", "g2"], "store g3 0 0 2000", "STORED 2000");
+getattr_is($sock, "g3 count", "count=2000");
+
+# the stored set is accounted to its prefix, also when it is replaced
+sub prefix_tsz {
+    my $prefix = shift;
+    my $tsz;
+    print $sock "stats prefixes\r\n";
+    while (my $line = <$sock>) {
+        last if ($line =~ /^END/);
+        $tsz = $1 if ($line =~ /^PREFIX $prefix .* tsz (\d+) /);
+    }
+    return $tsz;
+}
+sop_insert_values("p:src", "a", "b", "c");
+setop_is("union", ["p:src"], "store q:dst 0 0 100", "STORED 3");
+is(prefix_tsz("q"), prefix_tsz("p"), "stored set is accounted to its prefix");
+setop_is("union", ["p:src"], "store q:dst 0 0 100", "STORED 3");
+is(prefix_tsz("q"), prefix_tsz("p"), "replaced set is accounted once");
+
+# a sticky destination set is kept within sticky_limit
+$server = new_memcached("-g 1");
+$sock = $server->sock;
+my $value = "S"x1000;
+print $sock "sop create src 0 0 5000\r\n";
+is(scalar <$sock>, "CREATED\r\n", "sop create src");
+for (my $i = 0; $i < 2000; $i++) {
+    print $sock sprintf("sop insert src 1004 noreply\r\n$value%04d\r\n", $i);
+}
+setop_is("union", ["src"], "store dst 0 -1 5000", "SERVER_ERROR out of memory");
+my $stats = mem_stats($sock);
+is($stats->{sticky_bytes}, 0, "sticky space is given back");
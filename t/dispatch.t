@@ -0,0 +1,52 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 14;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-t 4");
+my $sock = $server->sock;
+my $stats;
+
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+
+# idle threads take new connections in turn
+my @socks = ();
+for (my $i = 0; $i < 7; $i++) {
+    my $s = $server->new_sock;
+    mem_get_is($s, "foo", "fooval");
+    push(@socks, $s);
+}
+
+$stats = mem_stats($sock, "conns");
+my $total = 0;
+my $min = -1;
+my $max = -1;
+for (my $i = 0; $i < 4; $i++) {
+    my $n = $stats->{"thread:$i:conns"};
+    $total += $n;
+    $min = $n if ($min == -1 || $n < $min);
+    $max = $n if ($max == -1 || $n > $max);
+}
+is($total, 8, "stats conns: connections of the threads");
+cmp_ok($max - $min, '<=', 1, "stats conns: connections spread over the threads");
+
+foreach my $s (@socks) {
+    close($s);
+}
+sleep(1);
+$stats = mem_stats($sock, "conns");
+$total = 0;
+for (my $i = 0; $i < 4; $i++) {
+    $total += $stats->{"thread:$i:conns"};
+}
+is($total, 1, "stats conns: closed connections");
+
+$stats = mem_stats($sock);
+ok(defined $stats->{conn_migrations}, "stats: conn_migrations");
+is($stats->{conn_migrations}, 0, "stats: no migration between idle threads");
+ok(defined mem_stats($sock, "conns")->{"thread:0:cpu_permille"},
+   "stats conns: thread cpu_permille");
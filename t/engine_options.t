@@ -0,0 +1,25 @@
+#!/usr/bin/perl
+# Test that the engine options of every -e are applied, not only the last.
+
+use strict;
+use Test::More tests => 8;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+sub check_options {
+    my ($onoff) = @_;
+    my $server = new_memcached("-e lru_crawler=$onoff -e lru_segmented=$onoff -e expire_wheel=$onoff");
+    my $sock = $server->sock;
+    my $on = ($onoff eq "true");
+    print $sock "set key 0 0 6\r\nfooval\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored key");
+    my $stats = mem_stats($sock, "items");
+    is(defined $stats->{"items:0:crawler_reclaimed"}, $on, "the first -e is applied: $onoff");
+    is(defined $stats->{"items:0:number_hot"}, $on, "the second -e is applied: $onoff");
+    $stats = mem_stats($sock);
+    is(defined $stats->{"wheel_reclaimed"}, $on, "the last -e is applied: $onoff");
+}
+
+check_options("true");
+check_options("false");
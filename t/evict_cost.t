@@ -0,0 +1,48 @@
+#!/usr/bin/perl
+# Test that the cost-aware eviction trims a big b+tree trimmed on overflow,
+# instead of evicting it as a whole.
+
+use strict;
+use Test::More tests => 9;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# A plain LRU keeps the b+tree at the tail, where the victims are picked.
+my $server = new_memcached("-e lru_segmented=false -e evict_cost=true");
+my $sock = $server->sock;
+my $value = "D"x300;
+my $elem = "E"x1000;
+my $stats;
+my $stored;
+my $key;
+
+print $sock "bop create bkey 0 0 50000 smallest_trim\r\n";
+is(scalar <$sock>, "CREATED\r\n", "created bkey");
+for (my $i = 0; $i < 40000; $i++) {
+    print $sock "bop insert bkey $i 1000 noreply\r\n$elem\r\n";
+}
+print $sock "getattr bkey count\r\n";
+is(scalar <$sock>, "ATTR count=40000\r\n", "inserted elements");
+scalar <$sock>;
+
+# small items, enough to run out of memory
+$stored = 0;
+for ($key = 0; $key < 120000; $key++) {
+    print $sock "set kv$key 0 0 300\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, $key, "stored small items");
+mem_get_is($sock, "kv".($key-1), $value);
+
+$stats = mem_stats($sock);
+ok($stats->{evict_trimmed} > 0, "elements are trimmed");
+print $sock "getattr bkey count trimmed\r\n";
+my $count = scalar <$sock>;
+ok($count =~ /^ATTR count=(\d+)/ && $1 > 0 && $1 < 40000, "bkey is trimmed, not evicted");
+is(scalar <$sock>, "ATTR trimmed=1\r\n", "bkey is marked trimmed");
+scalar <$sock>;
+print $sock "bop get bkey 0\r\n";
+is(scalar <$sock>, "OUT_OF_RANGE\r\n", "the smallest elements are trimmed");
+print $sock "bop get bkey 39999\r\n";
+is(scalar <$sock>, "VALUE 0 1\r\n", "the largest elements are kept");
@@ -0,0 +1,47 @@
+#!/usr/bin/perl
+# Test that the expiration wheel unlinks expired items close to their
+# expiration, without accessing them.
+
+use strict;
+use Test::More tests => 11;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# The LRU crawler is turned off, not to reclaim the expired items first.
+my $server = new_memcached("-e lru_crawler=false -e expire_wheel=true");
+my $sock = $server->sock;
+my $stats;
+my $stored = 0;
+my $key;
+
+for ($key = 0; $key < 20; $key++) {
+    print $sock "set exp$key 0 2 6\r\nfooval\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 20, "stored items expiring in 2 seconds");
+print $sock "set noexp 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored noexp");
+print $sock "set longexp 0 1000 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored longexp");
+
+# a collection with many elements
+print $sock "bop create bkey 0 2 0\r\n";
+is(scalar <$sock>, "CREATED\r\n", "created bkey expiring in 2 seconds");
+for (my $i = 0; $i < 1000; $i++) {
+    print $sock "bop insert bkey $i 6 noreply\r\nbopval\r\n";
+}
+
+# an item whose exptime is extended
+print $sock "set extended 0 2 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored extended");
+print $sock "setattr extended expiretime=1000\r\n";
+is(scalar <$sock>, "OK\r\n", "extended the exptime");
+
+sleep(4);
+$stats = mem_stats($sock);
+is($stats->{wheel_reclaimed}, 21, "wheel_reclaimed after expiration");
+is($stats->{curr_items}, 3, "expired items are unlinked");
+is($stats->{coll_del_items}, 1, "the expired collection is dropped");
+mem_get_is($sock, "longexp", "fooval");
+mem_get_is($sock, "extended", "fooval");
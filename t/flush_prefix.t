@@ -0,0 +1,76 @@
+#!/usr/bin/perl
+# Test that flush_prefix reclaims the items of the prefix in the background,
+# without touching the items of other prefixes or the ones set after it.
+# Without the prefix item lists, it unlinks them by an LRU walk.
+
+use strict;
+use Test::More tests => 18;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# The LRU crawler is turned off, not to reclaim the flushed items first.
+my $server = new_memcached("-e lru_crawler=false -e prefix_lists=true");
+my $sock = $server->sock;
+my $stats;
+my $stored;
+my $key;
+
+$stored = 0;
+for ($key = 0; $key < 20; $key++) {
+    print $sock "set a:key$key 0 0 6\r\nfooval\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+for ($key = 0; $key < 10; $key++) {
+    print $sock "set b:key$key 0 0 6\r\nfooval\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+for ($key = 0; $key < 5; $key++) {
+    print $sock "set key$key 0 0 6\r\nfooval\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 35, "stored items of prefix a, b and null");
+
+# a collection with many elements
+print $sock "bop create a:bkey 0 0 0\r\n";
+is(scalar <$sock>, "CREATED\r\n", "created a:bkey");
+for (my $i = 0; $i < 1000; $i++) {
+    print $sock "bop insert a:bkey $i 6 noreply\r\nbopval\r\n";
+}
+
+print $sock "flush_prefix a\r\n";
+is(scalar <$sock>, "OK\r\n", "did flush_prefix a");
+print $sock "set a:new 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a:new after the flush");
+sleep(1);
+$stats = mem_stats($sock);
+is($stats->{flush_prefix_reclaimed}, 21, "flushed items of prefix a are reclaimed");
+is($stats->{curr_items}, 16, "other items are kept");
+is($stats->{coll_del_items}, 1, "the flushed collection is dropped");
+mem_get_is($sock, "a:new", "fooval");
+mem_get_is($sock, "b:key0", "fooval");
+mem_get_is($sock, "key0", "fooval");
+
+print $sock "flush_prefix null\r\n";
+is(scalar <$sock>, "OK\r\n", "did flush_prefix null");
+sleep(1);
+$stats = mem_stats($sock);
+is($stats->{flush_prefix_reclaimed}, 26, "flushed items of null prefix are reclaimed");
+is($stats->{curr_items}, 11, "other items are kept");
+
+# without the prefix item lists (default)
+$server = new_memcached("-e lru_crawler=false");
+$sock = $server->sock;
+$stored = 0;
+for ($key = 0; $key < 10; $key++) {
+    print $sock "set a:key$key 0 0 6\r\nfooval\r\nset b:key$key 0 0 6\r\nfooval\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 20, "stored items of prefix a and b");
+print $sock "flush_prefix a\r\n";
+is(scalar <$sock>, "OK\r\n", "did flush_prefix a");
+$stats = mem_stats($sock);
+is($stats->{curr_items}, 10, "flushed items of prefix a are unlinked by the LRU walk");
+ok(!defined $stats->{flush_prefix_reclaimed}, "no prefix item lists");
+mem_get_is($sock, "b:key0", "fooval");
@@ -0,0 +1,45 @@
+#!/usr/bin/perl
+# Test that items keep the links to the expiration wheel and to the item
+# list of their prefix only if one of them is turned on, and work without.
+
+use strict;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+sub bytes_per_item {
+    my $sock = shift;
+    for (my $i = 0; $i < 1000; $i++) {
+        print $sock "set counter:$i 0 0 10\r\n0123456789\r\n";
+        scalar <$sock>;
+    }
+    my $stats = mem_stats($sock);
+    return $stats->{bytes} / $stats->{curr_items};
+}
+
+my $server = new_memcached("-e expire_wheel=true");
+my $wheel = bytes_per_item($server->sock);
+$server = new_memcached("-e prefix_lists=true");
+my $lists = bytes_per_item($server->sock);
+$server = new_memcached();
+my $sock = $server->sock;
+my $plain = bytes_per_item($sock);
+ok($plain < $wheel, "items without links take less memory than with the wheel");
+ok($plain < $lists, "items without links take less memory than with the prefix lists");
+is($wheel, $lists, "the wheel and the prefix lists share the links");
+
+my $stats = mem_stats($sock);
+ok(!defined $stats->{wheel_reclaimed}, "no expiration wheel by default");
+mem_get_is($sock, "counter:999", "0123456789");
+print $sock "incr counter:999 1\r\n";
+is(scalar <$sock>, "123456790\r\n", "incr an item without links");
+
+# flushed and expired items are still invalid
+print $sock "flush_prefix counter\r\n";
+is(scalar <$sock>, "OK\r\n", "did flush_prefix counter");
+mem_get_is($sock, "counter:0", undef);
+print $sock "set exp 0 1 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored exp");
+sleep(2);
+mem_get_is($sock, "exp", undef);
@@ -1,7 +1,7 @@
 #!/usr/bin/perl
 
 use strict;
-use Test::More tests => 149;
+use Test::More tests => 295;
 use FindBin qw($Bin);
 use lib "$Bin/lib";
 use MemcachedTest;
@@ -56,3 +56,37 @@ for (my $i = 0; $i < $evictions - 1; $i++) {
 for (my $i = $evictions - 1; $i < $evictions + 4; $i++) {
   mem_get_is($sock, "item_$i", $big);
 }
+
+# The segmented LRU evicts the unread items in the order stored,
+# and keeps the read one. Whether the maintainer moves an item out of the hot
+# segment before or after it is read, a read item ends up in the warm segment:
+# by the maintainer from the hot segment, or by a second chance at the tail
+# of the cold segment. So the order doesn't depend on the maintainer timing.
+# The item is read once the LRU has enough items for the warm segment to
+# hold one, or the maintainer could push it on to the cold segment.
+$server = new_memcached("-e lru_segmented=true");
+$sock = $server->sock;
+
+print $sock "set big 0 0 $len\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "segmented: stored big");
+
+for (my $i = 0; $i < 100; $i++) {
+  print $sock "set item_$i 0 0 $len\r\n$big\r\n";
+  is(scalar <$sock>, "STORED\r\n", "segmented: stored item_$i");
+  mem_get_is($sock, "big", $big) if ($i == 9);
+}
+
+$stats = mem_stats($sock);
+is($stats->{"evictions"}, $evictions, "segmented: as many evictions as a plain LRU");
+
+# the read item is kept in place of the next unread one
+mem_get_is($sock, "big", $big);
+for (my $i = 0; $i < $evictions; $i++) {
+  mem_get_is($sock, "item_$i", undef);
+}
+for (my $i = $evictions; $i < $evictions + 4; $i++) {
+  mem_get_is($sock, "item_$i", $big);
+}
+$stats = mem_stats($sock, "items");
+my ($warm) = grep { /^items:\d+:moves_to_warm$/ && $stats->{$_} > 0 } keys %$stats;
+ok(defined $warm, "segmented: the read item moved to warm");
@@ -0,0 +1,55 @@
+#!/usr/bin/perl
+# Test that the admission filter keeps frequent keys against one-shot keys.
+
+use strict;
+use Test::More tests => 8;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-m 3 -e lru_segmented=false -e lru_admission=true");
+my $sock = $server->sock;
+my $value = "B"x66560;
+my $stats;
+my $stored = 0;
+my $key;
+
+# misses count as accesses as well, and the hot keys stay at the LRU tail
+for (my $i = 0; $i < 3; $i++) {
+    for ($key = 0; $key < 5; $key++) {
+        print $sock "get hot$key\r\n";
+        scalar <$sock>;
+    }
+}
+for ($key = 0; $key < 5; $key++) {
+    print $sock "set hot$key 0 0 66560\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 5, "stored hot keys");
+
+# a scan of one-shot keys, enough to get evictions
+$stored = 0;
+for ($key = 0; $key < 60; $key++) {
+    print $sock "set scan$key 0 0 66560\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 60, "stored one-shot keys");
+
+# only the first victim of the scan is lost
+my $kept = 0;
+for ($key = 0; $key < 5; $key++) {
+    print $sock "get hot$key\r\n";
+    if (scalar <$sock> =~ /^VALUE/) {
+        $kept++;
+        scalar <$sock>; scalar <$sock>;
+    }
+}
+ok($kept >= 4, "frequent keys survive the scan");
+mem_get_is($sock, "scan59", $value);
+
+$stats = mem_stats($sock, "items");
+ok(!defined $stats->{"items:31:number_hot"}, "the LRU is not segmented");
+$stats = mem_stats($sock);
+ok($stats->{"admission_tested"} > 0, "check admission_tested");
+ok($stats->{"admission_rejected"} > 0, "check admission_rejected");
+ok($stats->{"get_hit_ratio"} > 0, "check get_hit_ratio");
@@ -0,0 +1,55 @@
+#!/usr/bin/perl
+# Test that the LRU crawler reclaims expired and flushed items
+# without accessing them.
+
+use strict;
+use Test::More tests => 8;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# The expiration wheel is turned off, not to reclaim the expired items first.
+my $server = new_memcached("-g 10 -e lru_crawler=true -e expire_wheel=false");
+my $sock = $server->sock;
+my $stats;
+my $stored;
+my $key;
+
+sub crawler_reclaimed {
+    my $items = mem_stats($sock, "items");
+    my $sum = 0;
+    foreach my $name (keys %$items) {
+        $sum += $items->{$name} if ($name =~ /:crawler_reclaimed$/);
+    }
+    return $sum;
+}
+
+is(crawler_reclaimed(), 0, "no crawler_reclaimed to start");
+
+# expired items
+$stored = 0;
+for ($key = 0; $key < 10; $key++) {
+    print $sock "set exp$key 0 1 6\r\nfooval\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+print $sock "set noexp 0 0 6\r\nfooval\r\n";
+$stored++ if (scalar <$sock> eq "STORED\r\n");
+is($stored, 11, "stored items");
+sleep(4);
+$stats = mem_stats($sock);
+is($stats->{curr_items}, 1, "expired items are reclaimed");
+is(crawler_reclaimed(), 10, "crawler_reclaimed after expiration");
+mem_get_is($sock, "noexp", "fooval");
+
+# flushed items, sticky or not
+$stored = 0;
+for ($key = 0; $key < 5; $key++) {
+    print $sock "set sticky$key 0 -1 6\r\nfooval\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 5, "stored sticky items");
+print $sock "flush_all 1\r\n";
+is(scalar <$sock>, "OK\r\n", "did flush_all in 1 second");
+sleep(4);
+$stats = mem_stats($sock);
+is($stats->{curr_items}, 0, "flushed items are reclaimed");
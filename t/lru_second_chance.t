@@ -0,0 +1,56 @@
+#!/usr/bin/perl
+# Test that the second chance replacement keeps the items read since the
+# evictor last passed them, without relinking them on the read.
+
+use strict;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-m 3 -e lru_second_chance=true");
+my $sock = $server->sock;
+my $value = "B"x66560;
+my $stats;
+my $stored = 0;
+my $key;
+
+sub second_chances {
+    my $items = mem_stats($sock, "items");
+    my $sum = 0;
+    foreach my $name (keys %$items) {
+        $sum += $items->{$name} if ($name =~ /:second_chances$/);
+    }
+    return $sum;
+}
+
+for ($key = 0; $key < 5; $key++) {
+    print $sock "set hot$key 0 0 66560\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 5, "stored hot keys");
+# a read sets the reference bit only, within ITEM_UPDATE_INTERVAL as well
+for ($key = 0; $key < 5; $key++) {
+    mem_get_is($sock, "hot$key", $value);
+}
+
+# a scan of one-shot keys, enough to get evictions
+$stored = 0;
+for ($key = 0; $key < 80; $key++) {
+    print $sock "set scan$key 0 0 66560\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 80, "stored one-shot keys");
+
+my $kept = 0;
+for ($key = 0; $key < 5; $key++) {
+    print $sock "get hot$key\r\n";
+    if (scalar <$sock> =~ /^VALUE/) {
+        $kept++;
+        scalar <$sock>; scalar <$sock>;
+    }
+}
+is($kept, 5, "referenced keys survive the scan");
+is(second_chances(), 5, "the referenced keys got a second chance");
+$stats = mem_stats($sock);
+ok($stats->{evictions} > 0, "one-shot keys are evicted");
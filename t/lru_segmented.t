@@ -0,0 +1,89 @@
+#!/usr/bin/perl
+# Test that a segmented LRU keeps read items against a scan of new items.
+
+use strict;
+use Test::More tests => 18;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $value = "B"x66560;
+my $server;
+my $sock;
+my $stats;
+my $key;
+
+sub scan_after_read {
+    my $stored = 0;
+    for ($key = 0; $key < 5; $key++) {
+        print $sock "set hot$key 0 0 66560\r\n$value\r\n";
+        $stored++ if (scalar <$sock> eq "STORED\r\n");
+    }
+    is($stored, 5, "stored hot keys");
+    # let the LRU maintainer move the hot keys out of the hot segment
+    sleep(2);
+    for ($key = 0; $key < 5; $key++) {
+        print $sock "get hot$key\r\n";
+        scalar <$sock>; scalar <$sock>; scalar <$sock>;
+    }
+    # a scan of new items, enough to get evictions
+    for ($key = 0; $key < 60; $key++) {
+        print $sock "set scan$key 0 0 66560\r\n$value\r\n";
+        scalar <$sock>;
+    }
+    my $kept = 0;
+    for ($key = 0; $key < 5; $key++) {
+        print $sock "get hot$key\r\n";
+        if (scalar <$sock> =~ /^VALUE/) {
+            $kept++;
+            scalar <$sock>; scalar <$sock>;
+        }
+    }
+    return $kept;
+}
+
+# segmented LRU
+$server = new_memcached("-m 3 -e lru_segmented=true");
+$sock = $server->sock;
+is(scan_after_read(), 5, "read items survive the scan");
+$stats = mem_stats($sock, "items");
+isnt($stats->{"items:31:evicted"}, "0", "check evicted");
+ok($stats->{"items:31:moves_to_cold"} > 0, "check moves_to_cold");
+ok($stats->{"items:31:moves_to_warm"} >= 5, "check moves_to_warm");
+ok(defined $stats->{"items:31:moves_within_warm"}, "check moves_within_warm");
+is($stats->{"items:31:number_hot"} + $stats->{"items:31:number_warm"} +
+   $stats->{"items:31:number_cold"}, $stats->{"items:31:number"},
+   "segments add up to number");
+ok($stats->{"items:31:number_warm"} >= 5, "read items are in the warm segment");
+
+# flush_all expires the items of every segment
+print $sock "flush_all\r\n";
+is(scalar <$sock>, "OK\r\n", "did flush_all");
+mem_get_is($sock, "hot0", undef);
+mem_get_is($sock, "scan59", undef);
+
+# classic LRU (default)
+$server = new_memcached("-m 3");
+$sock = $server->sock;
+is(scan_after_read(), 0, "read items are evicted by the scan");
+$stats = mem_stats($sock, "items");
+ok(!defined $stats->{"items:31:number_hot"}, "no segment stats");
+
+# without CAS, flush_all expires the items by time, not walking the LRU
+$server = new_memcached("-C -e lru_segmented=true");
+$sock = $server->sock;
+my $stored = 0;
+for ($key = 0; $key < 10; $key++) {
+    print $sock "set key$key 0 0 6\r\nfooval\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 10, "stored keys without CAS");
+mem_get_is($sock, "key0", "fooval");
+print $sock "flush_all\r\n";
+is(scalar <$sock>, "OK\r\n", "did flush_all without CAS");
+my $found = 0;
+for ($key = 0; $key < 10; $key++) {
+    print $sock "get key$key\r\n";
+    $found++ if (scalar <$sock> =~ /^VALUE/);
+}
+is($found, 0, "flushed all items without CAS");
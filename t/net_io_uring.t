@@ -0,0 +1,76 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 13;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-N io_uring");
+my $sock = $server->sock;
+my $stats;
+
+# falls back to epoll if the kernel does not support io_uring
+$stats = mem_stats($sock, "settings");
+like($stats->{net_io_backend}, qr/^(io_uring|epoll)$/, "stats settings: net_io_backend");
+my $uring = ($stats->{net_io_backend} eq "io_uring");
+
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+mem_get_is($sock, "foo", "fooval");
+
+# pipelined requests
+print $sock "set bar 0 0 6\r\nbarval\r\nget foo\r\nget bar\r\ndelete foo\r\n";
+is(scalar <$sock>, "STORED\r\n", "pipelined: stored bar");
+is(scalar <$sock>, "VALUE foo 0 6\r\n", "pipelined: get foo");
+scalar <$sock>; scalar <$sock>; # value, END
+is(scalar <$sock>, "VALUE bar 0 6\r\n", "pipelined: get bar");
+scalar <$sock>; scalar <$sock>; # value, END
+is(scalar <$sock>, "DELETED\r\n", "pipelined: deleted foo");
+
+# a large value does not fit in the socket buffer at once
+my $big = "x" x (512 * 1024);
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored big");
+print $sock "get big\r\nget big\r\nget big\r\n";
+sleep(1); # let the sends of the server fill the socket buffer
+my $ok = 0;
+for (my $i = 0; $i < 3; $i++) {
+    my $head = scalar <$sock>;
+    my $val = scalar <$sock>;
+    my $end = scalar <$sock>;
+    $ok++ if ($head eq "VALUE big 0 " . length($big) . "\r\n" &&
+              $val eq "$big\r\n" && $end eq "END\r\n");
+}
+is($ok, 3, "get big 3 times");
+
+# many connections are served in the same loop pass
+my @socks = ();
+for (my $i = 0; $i < 20; $i++) {
+    push(@socks, $server->new_sock);
+}
+foreach my $s (@socks) {
+    print $s "get bar\r\n";
+}
+my $hits = 0;
+foreach my $s (@socks) {
+    $hits++ if (scalar <$s> eq "VALUE bar 0 6\r\n" &&
+                scalar <$s> eq "barval\r\n" && scalar <$s> eq "END\r\n");
+}
+is($hits, 20, "get bar on 20 connections");
+
+# the server closes a connection while its recv is in flight
+my $quit = $server->new_sock;
+print $quit "get bar\r\n";
+scalar <$quit>; scalar <$quit>; scalar <$quit>;
+print $quit "quit\r\n";
+ok(!defined(scalar <$quit>), "quit closes the connection");
+
+$stats = mem_stats($sock);
+if ($uring) {
+    cmp_ok($stats->{io_uring_sends}, '>', 0, "stats: io_uring_sends");
+    cmp_ok($stats->{io_uring_recvs}, '>', 0, "stats: io_uring_recvs");
+} else {
+    ok(!exists $stats->{io_uring_sends}, "stats: no io_uring_sends on epoll");
+    ok(!exists $stats->{io_uring_recvs}, "stats: no io_uring_recvs on epoll");
+}
@@ -0,0 +1,118 @@
+#!/usr/bin/perl
+# Test that a prefix over its memory quota evicts its own items,
+# not the items of other prefixes.
+
+use strict;
+use Test::More tests => 26;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-e prefix_maxbytes=100k");
+my $sock = $server->sock;
+my $value = "A"x1000;
+my $stats;
+my $stored;
+my $key;
+
+$stored = 0;
+for ($key = 0; $key < 10; $key++) {
+    print $sock "set b:key$key 0 0 1000\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 10, "stored items of prefix b");
+
+# prefix a is filled up to 5 times its quota
+$stored = 0;
+for ($key = 0; $key < 500; $key++) {
+    print $sock "set a:key$key 0 0 1000\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 500, "stored items of prefix a over its quota");
+
+mem_get_is($sock, "a:key0", undef);
+mem_get_is($sock, "a:key499", $value);
+my $kept = 0;
+for ($key = 0; $key < 10; $key++) {
+    print $sock "get b:key$key\r\n";
+    if (scalar <$sock> =~ /^VALUE/) {
+        $kept++;
+        scalar <$sock>; scalar <$sock>;
+    }
+}
+is($kept, 10, "items of prefix b are kept");
+
+$stats = mem_stats($sock);
+ok($stats->{prefix_evictions} > 0, "check prefix_evictions");
+is($stats->{evictions}, 0, "no global evictions");
+
+# prefixes are one level deep: the items of c:d:* count against prefix c
+$stored = 0;
+for ($key = 0; $key < 500; $key++) {
+    print $sock "set c:d:key$key 0 0 1000\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 500, "stored items of prefix c over its quota");
+mem_get_is($sock, "c:d:key0", undef);
+
+# the elements of a collection count against its prefix
+$stored = 0;
+for ($key = 0; $key < 50; $key++) {
+    print $sock "set e:key$key 0 0 1000\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 50, "stored items of prefix e");
+print $sock "bop create e:btree 0 0 1000\r\n";
+is(scalar <$sock>, "CREATED\r\n", "created e:btree");
+$stored = 0;
+my $nomem = 0;
+for ($key = 0; $key < 200; $key++) {
+    print $sock "bop insert e:btree $key 1000\r\n$value\r\n";
+    my $res = scalar <$sock>;
+    $stored++ if ($res eq "STORED\r\n");
+    $nomem++ if ($res eq "SERVER_ERROR out of memory\r\n");
+}
+ok($stored > 50 && $stored < 200, "inserted elements of e:btree up to the quota");
+is($stored + $nomem, 200, "the other elements are out of the quota");
+mem_get_is($sock, "e:key0", undef);
+
+sub prefix_stats {
+    my $sock = shift;
+    my %prefixes;
+    print $sock "stats prefixes\r\n";
+    while (my $line = <$sock>) {
+        last if ($line =~ /^END/);
+        if ($line =~ /^PREFIX (\S+) .* tsz (\d+) .* qsz (\d+) qevt (\d+) time/) {
+            $prefixes{$1} = { tsz => $2, qsz => $3, qevt => $4 };
+        }
+    }
+    return %prefixes;
+}
+
+my %prefixes = prefix_stats($sock);
+ok($prefixes{a}{tsz} <= 102400, "prefix a is within its quota");
+is($prefixes{a}{qevt}, $stats->{prefix_evictions}, "prefix a evicted its own items");
+is($prefixes{b}{qevt}, 0, "prefix b evicted nothing");
+ok($prefixes{c}{tsz} <= 102400, "prefix c is within its quota");
+ok($prefixes{e}{tsz} <= 102400, "prefix e is within its quota");
+is($prefixes{e}{qevt}, 50, "prefix e evicted its items for the elements");
+
+# quotas of named prefixes
+$server = new_memcached("-e prefix_maxbytes=100k -e prefix_limits=f=20k,g=0");
+$sock = $server->sock;
+$stored = 0;
+for ($key = 0; $key < 200; $key++) {
+    print $sock "set f:key$key 0 0 1000\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+    print $sock "set g:key$key 0 0 1000\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+    print $sock "set h:key$key 0 0 1000\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, 600, "stored items of prefix f, g and h");
+mem_get_is($sock, "g:key0", $value);
+%prefixes = prefix_stats($sock);
+ok($prefixes{f}{tsz} <= 20480 && $prefixes{f}{qevt} > 0, "prefix f is within its own quota");
+is($prefixes{f}{qsz}, 20480, "check qsz of prefix f");
+ok($prefixes{g}{tsz} > 102400 && $prefixes{g}{qevt} == 0, "prefix g has no limit");
+ok($prefixes{h}{tsz} <= 102400 && $prefixes{h}{qsz} == 102400, "prefix h has the default quota");
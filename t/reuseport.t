@@ -0,0 +1,33 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 5;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-A -t 4");
+my $sock = $server->sock;
+my $stats;
+
+$stats = mem_stats($sock, "settings");
+is($stats->{reuseport}, "yes", "stats settings: reuseport");
+$stats = mem_stats($sock);
+cmp_ok($stats->{daemon_connections}, '>=', 4, "stats: a listener per worker thread");
+my $total_conns = $stats->{total_connections};
+
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+
+# connections accepted by any of the worker threads
+my $hits = 0;
+for (my $i = 0; $i < 40; $i++) {
+    my $s = $server->new_sock;
+    print $s "get foo\r\n";
+    $hits++ if (scalar <$s> eq "VALUE foo 0 6\r\n" &&
+                scalar <$s> eq "fooval\r\n" && scalar <$s> eq "END\r\n");
+    close($s);
+}
+is($hits, 40, "get foo on 40 new connections");
+$stats = mem_stats($sock);
+is($stats->{total_connections}, $total_conns + 40, "stats: total_connections");
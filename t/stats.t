@@ -80,6 +80,7 @@ my $sock = $server->sock;
 ## STAT cmd_sop_delete 0
 ## STAT cmd_sop_get 0
 ## STAT cmd_sop_exist 0
+## STAT cmd_sop_setop 0
 ## STAT cmd_bop_create 0
 ## STAT cmd_bop_insert 0
 ## STAT cmd_bop_update 0
@@ -125,6 +126,7 @@ my $sock = $server->sock;
 ## STAT sop_get_none_hits 0
 ## STAT sop_exist_misses 0
 ## STAT sop_exist_hits 0
+## STAT sop_setop_oks 0
 ## STAT bop_create_oks 0
 ## STAT bop_insert_misses 0
 ## STAT bop_insert_hits 0
@@ -0,0 +1,72 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 18;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+my $stats;
+
+$stats = mem_stats($sock, "conns");
+ok(exists $stats->{conn_total_bytes}, "stats conns: conn_total_bytes");
+is($stats->{curr_connections} > 0, 1, "stats conns: curr_connections");
+is($stats->{conn_pipe_bytes}, 0, "stats conns: no pipe buffer attached");
+is($stats->{conn_struct_bytes},
+   $stats->{connection_structures} * $stats->{conn_struct_size},
+   "stats conns: conn_struct_bytes");
+is($stats->{conn_total_bytes},
+   $stats->{conn_struct_bytes} + $stats->{conn_rbuf_bytes} + $stats->{conn_wbuf_bytes} +
+   $stats->{conn_iov_bytes} + $stats->{conn_list_bytes} + $stats->{conn_pipe_bytes} +
+   $stats->{conn_obuf_bytes},
+   "stats conns: conn_total_bytes is the sum of the others");
+my $rbuf_bytes = $stats->{conn_rbuf_bytes};
+
+# connection memory grows with the connections
+my @socks = ();
+for (my $i = 0; $i < 10; $i++) {
+    push(@socks, $server->new_sock);
+}
+my $versions = 0;
+foreach my $s (@socks) {
+    print $s "version\r\n";
+    $versions++ if (scalar readline($s)) =~ /^VERSION/;
+}
+is($versions, 10, "version on the new connections");
+$stats = mem_stats($sock, "conns");
+cmp_ok($stats->{conn_rbuf_bytes}, '>', $rbuf_bytes, "stats conns: more read buffers");
+
+# a pipe buffer is attached only while pipelining
+print $sock "lop insert lkey 0 6 create 0 0 0 pipe\r\ndatum0\r\n";
+print $sock "lop insert lkey 0 6 pipe\r\ndatum1\r\n";
+print $sock "lop insert lkey 0 6\r\ndatum2\r\n";
+is(scalar <$sock>, "RESPONSE   3\r\n", "pipelined lop insert: RESPONSE 3");
+is(scalar <$sock>, "CREATED_STORED\r\n", "pipelined lop insert: CREATED_STORED");
+is(scalar <$sock>, "STORED\r\n", "pipelined lop insert: STORED");
+is(scalar <$sock>, "STORED\r\n", "pipelined lop insert: STORED");
+scalar <$sock>; # END
+$stats = mem_stats($sock, "conns");
+is($stats->{conn_pipe_bytes}, 0, "stats conns: pipe buffer detached after pipelining");
+
+# the output arena keeps its first block after a response
+print $sock "set okey 0 0 6\r\novalue\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored okey");
+mem_get_is($sock, "okey", "ovalue");
+$stats = mem_stats($sock, "conns");
+cmp_ok($stats->{conn_obuf_bytes}, '>', 0, "stats conns: output arena attached");
+
+# a read buffer grown for a large request shrinks back with small requests
+my $base = $stats->{conn_rbuf_bytes};
+my $keys = join(" ", map { sprintf("key%05d", $_) } (1..2000));
+print $sock "get $keys\r\n";
+is(scalar <$sock>, "END\r\n", "get with a long key list");
+$stats = mem_stats($sock, "conns");
+cmp_ok($stats->{conn_rbuf_bytes}, '>', $base, "stats conns: read buffer grown");
+for (my $i = 0; $i < 40; $i++) {
+    print $sock "get okey\r\n";
+    scalar <$sock>; scalar <$sock>; scalar <$sock>;
+}
+$stats = mem_stats($sock, "conns");
+is($stats->{conn_rbuf_bytes}, $base, "stats conns: read buffer shrunk back");
@@ -0,0 +1,61 @@
+#!/usr/bin/perl
+# Test that the sticky manager reclaims flushed sticky items, so that the
+# sticky space is given back right after a flush_all.
+
+use strict;
+use Test::More tests => 7;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# The other reclaimers are turned off, to leave the flushed items to it.
+my $server = new_memcached("-m 10 -g 10 -e lru_crawler=false -e expire_wheel=false");
+my $sock = $server->sock;
+my $value = "C"x1000;
+my $stats;
+my $stored;
+my $key;
+
+sub sticky_stats {
+    my $items = mem_stats($sock, "items");
+    my ($bytes, $reclaimed) = (0, 0);
+    foreach my $name (keys %$items) {
+        $bytes += $items->{$name} if ($name =~ /:sticky_bytes$/);
+        $reclaimed += $items->{$name} if ($name =~ /:sticky_reclaimed$/);
+    }
+    return ($bytes, $reclaimed);
+}
+
+# fill the sticky space up to sticky_limit
+my $filled = 0;
+for ($key = 0; $key < 5000; $key++) {
+    print $sock "set old$key 0 -1 1000\r\n$value\r\n";
+    last if (scalar <$sock> ne "STORED\r\n");
+    $filled++;
+}
+ok($filled > 0 && $filled < 5000, "filled the sticky space");
+$stats = mem_stats($sock);
+my ($bytes, $reclaimed) = sticky_stats();
+is($bytes, $stats->{sticky_bytes}, "sticky_bytes of the classes add up");
+
+# the flushed sticky items are reclaimed in the background.
+# flush_all itself unlinks the items set within the last second.
+sleep(2);
+print $sock "flush_all\r\n";
+is(scalar <$sock>, "OK\r\n", "did flush_all");
+sleep(1);
+$stats = mem_stats($sock);
+is($stats->{curr_items}, 0, "flushed sticky items are reclaimed");
+# an empty LRU is not shown in the item stats
+print $sock "set keep 0 0 1000\r\n$value\r\n";
+scalar <$sock>;
+($bytes, $reclaimed) = sticky_stats();
+is($reclaimed, $filled, "sticky_reclaimed after flush_all");
+
+$stored = 0;
+for ($key = 0; $key < $filled - 1; $key++) {
+    print $sock "set new$key 0 -1 1000\r\n$value\r\n";
+    $stored++ if (scalar <$sock> eq "STORED\r\n");
+}
+is($stored, $filled - 1, "stored sticky items after flush_all");
+mem_get_is($sock, "new0", $value);
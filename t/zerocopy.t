@@ -0,0 +1,64 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 13;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-Z 16384");
+my $sock = $server->sock;
+my $stats;
+my $big = "z" x (100 * 1024);
+
+sub get_big_is {
+    my $msg = shift;
+    print $sock "get big\r\n";
+    ok(scalar <$sock> eq "VALUE big 0 " . length($big) . "\r\n" &&
+       scalar <$sock> eq "$big\r\n" && scalar <$sock> eq "END\r\n", $msg);
+}
+
+$stats = mem_stats($sock, "settings");
+is($stats->{zerocopy_min}, 16384, "stats settings: zerocopy_min");
+
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored big");
+print $sock "set small 0 0 5\r\nsmall\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored small");
+
+# a large value is sent with MSG_ZEROCOPY, a small one is not
+get_big_is("get big");
+mem_get_is($sock, "small", "small");
+
+print $sock "get big small big\r\n";
+my $ok = (scalar <$sock> eq "VALUE big 0 " . length($big) . "\r\n" &&
+          scalar <$sock> eq "$big\r\n" &&
+          scalar <$sock> eq "VALUE small 0 5\r\n" &&
+          scalar <$sock> eq "small\r\n" &&
+          scalar <$sock> eq "VALUE big 0 " . length($big) . "\r\n" &&
+          scalar <$sock> eq "$big\r\n" &&
+          scalar <$sock> eq "END\r\n");
+ok($ok, "get big small big");
+
+$stats = mem_stats($sock);
+cmp_ok($stats->{zerocopy_sends}, '>', 0, "stats: zerocopy_sends");
+cmp_ok($stats->{zerocopy_bytes}, '>=', length($big), "stats: zerocopy_bytes");
+
+# the kernel copies the data on loopback, so the connection stops using
+# MSG_ZEROCOPY once it is told so
+my $sends = $stats->{zerocopy_sends};
+cmp_ok($stats->{zerocopy_fallbacks}, '>', 0, "stats: zerocopy_fallbacks on loopback");
+get_big_is("get big after the fallback");
+$stats = mem_stats($sock);
+is($stats->{zerocopy_sends}, $sends, "stats: no more zerocopy sends");
+
+# a connection closed with zerocopy sends unread keeps the items
+# until the sends are completed
+my $csock = $server->new_sock;
+print $csock "get big\r\n" x 20;
+sleep(1);
+close($csock);
+$big = "y" x (100 * 1024);
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored big after a closed reader");
+get_big_is("get big after a closed reader");
@@ -272,6 +272,44 @@ static enum test_return test_safe_strtof(void) {
     return TEST_PASS;
 }
 
+static enum test_return test_tokenize_command(void) {
+    token_t tokens[8];
+    size_t ntokens;
+    char cmd1[] = "bop insert  bkey1 10 6 create 0 0 100";
+    char cmd2[] = "  get ";
+    char cmd3[] = "get a b c d e f g h i";
+    char cmd4[] = "set key_longer_than_sixteen_bytes_\0trailing";
+
+    ntokens = tokenize_command(cmd1, strlen(cmd1), tokens, 8);
+    assert(ntokens == 8);
+    assert(strcmp(tokens[0].value, "bop") == 0 && tokens[0].length == 3);
+    assert(strcmp(tokens[2].value, "bkey1") == 0 && tokens[2].length == 5);
+    assert(strcmp(tokens[6].value, "0") == 0);
+    /* not fully scanned: the terminal token points to the rest */
+    assert(tokens[7].length == 0 && strcmp(tokens[7].value, "0 100") == 0);
+
+    ntokens = tokenize_command(cmd2, strlen(cmd2), tokens, 8);
+    assert(ntokens == 2);
+    assert(strcmp(tokens[0].value, "get") == 0 && tokens[0].length == 3);
+    assert(tokens[1].value == NULL && tokens[1].length == 0);
+
+    ntokens = tokenize_command(cmd3, strlen(cmd3), tokens, 8);
+    assert(ntokens == 8);
+    assert(strcmp(tokens[6].value, "f") == 0);
+    assert(strcmp(tokens[7].value, "g h i") == 0);
+    ntokens = tokenize_command(tokens[7].value, strlen(tokens[7].value), tokens, 8);
+    assert(ntokens == 4);
+    assert(strcmp(tokens[2].value, "i") == 0 && tokens[3].value == NULL);
+
+    /* a '\0' ends the string even if the given length is longer */
+    ntokens = tokenize_command(cmd4, sizeof(cmd4) - 1, tokens, 8);
+    assert(ntokens == 3);
+    assert(tokens[1].length == strlen("key_longer_than_sixteen_bytes_"));
+    assert(tokens[2].value == NULL);
+
+    return TEST_PASS;
+}
+
 /**
  * Function to start the server and let it listen on a random port
  *
@@ -2049,6 +2087,7 @@ struct testcase testcases[] = {
     { "strtoll", test_safe_strtoll },
     { "strtoul", test_safe_strtoul },
     { "strtoull", test_safe_strtoull },
+    { "tokenize_command", test_tokenize_command },
     { "issue_44", test_issue_44 },
     { "vperror", test_vperror },
     { "issue_101", test_issue_101 },
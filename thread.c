@@ -29,9 +29,17 @@
 #include <stdint.h>
 #include <signal.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
 
 #define ITEMS_PER_ALLOC 64
 
+/* The number of io_uring entries of a worker thread */
+#define IO_RING_ENTRIES 256
+/* The buffers provided for the io_uring recvs of a worker thread */
+#define IO_RING_RECV_BUFS    256
+#define IO_RING_RECV_BUFSIZE 4096
+
 extern volatile sig_atomic_t memcached_shutdown;
 
 /* An item in the connection queue. */
@@ -245,13 +253,52 @@ static void setup_thread(LIBEVENT_THREAD *me, bool tap) {
         exit(EXIT_FAILURE);
     }
 
-    me->suffix_cache = cache_create("suffix", SUFFIX_SIZE, sizeof(char*),
-                                    NULL, NULL);
-    if (me->suffix_cache == NULL) {
+    me->pipe_cache = cache_create("pipe", PIPE_MAX_RES_SIZE, sizeof(char*),
+                                  NULL, NULL);
+    if (me->pipe_cache == NULL) {
         settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
-                                        "Failed to create suffix cache\n");
+                                        "Failed to create pipe cache\n");
         exit(EXIT_FAILURE);
     }
+
+    for (int i = 0; i < RBUF_CLASSES; i++) {
+        me->rbuf_cache[i] = cache_create("rbuf", DATA_BUFFER_SIZE << (2 * (i + 1)),
+                                         sizeof(char*), NULL, NULL);
+        if (me->rbuf_cache[i] == NULL) {
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                            "Failed to create read buffer cache\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    me->io_ring = NULL;
+    me->io_recv = false;
+    me->send_queue = NULL;
+    if (!tap && settings.io_uring) {
+        me->io_ring = io_ring_create(IO_RING_ENTRIES);
+        if (me->io_ring == NULL) {
+            /* this thread falls back to epoll sends by itself */
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Failed to set up io_uring (%s), use epoll sends instead\n",
+                    strerror(errno));
+        } else {
+            me->io_recv = io_ring_setup_recv(me->io_ring, IO_RING_RECV_BUFS,
+                                             IO_RING_RECV_BUFSIZE);
+            if (!me->io_recv) {
+                settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                        "Failed to set up io_uring recvs (%s), use epoll reads instead\n",
+                        strerror(errno));
+            }
+            event_set(&me->ring_event, io_ring_fd(me->io_ring),
+                      EV_READ | EV_PERSIST, conn_reap_ring, me);
+            event_base_set(me->base, &me->ring_event);
+            if (event_add(&me->ring_event, 0) == -1) {
+                settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                                "Can't monitor the io_uring completions\n");
+                exit(1);
+            }
+        }
+    }
 }
 
 /*
@@ -269,7 +316,18 @@ static void *worker_libevent(void *arg) {
     pthread_cond_signal(&init_cond);
     pthread_mutex_unlock(&init_lock);
 
-    event_base_loop(me->base, 0);
+    if (me->io_ring == NULL) {
+        event_base_loop(me->base, 0);
+    } else {
+        /* send the responses made in each loop pass at once */
+        while (!memcached_shutdown) {
+            event_base_loop(me->base, EVLOOP_ONCE);
+            conn_flush_sends(me);
+        }
+        event_del(&me->ring_event);
+        io_ring_destroy(me->io_ring);
+        me->io_ring = NULL;
+    }
     return NULL;
 }
 
@@ -321,6 +379,9 @@ static void thread_libevent_process(int fd, short which, void *arg) {
                             item->sfd);
                 }
                 close(item->sfd);
+                if (item->init_state == conn_new_cmd) {
+                    thread_conn_count(me, -1);
+                }
             }
         } else {
             assert(c->thread == NULL);
@@ -593,6 +654,42 @@ void notify_io_complete(const void *cookie, ENGINE_ERROR_CODE status)
 /* Which thread we assigned a connection to most recently. */
 static int last_thread = -1;
 
+/*
+ * Load of a worker thread used to place new connections.
+ * Every DISPATCH_CPU_UNIT of recent CPU usage (permille) counts as
+ * one more connection, so that a thread busy with a few heavy clients
+ * is not given more of them.
+ */
+#define DISPATCH_CPU_UNIT    50
+#define MIGRATE_LOAD_GAP     200  /* CPU permille gap to move connections */
+#define MIGRATE_MAX_CONNS    16   /* max connections moved per second */
+
+static int thread_load(LIBEVENT_THREAD *t) {
+    return t->conn_count + t->cpu_permille / DISPATCH_CPU_UNIT;
+}
+
+/*
+ * Selects the least loaded thread, scanning from the thread next to
+ * the last one, so that threads of the same load are still taken
+ * in round robin.
+ */
+static int select_thread(void) {
+    int start = (last_thread + 1) % settings.num_threads;
+    int best = start;
+    int best_load = thread_load(threads + start);
+    int i, tid, load;
+
+    for (i = 1; i < settings.num_threads; i++) {
+        tid = (start + i) % settings.num_threads;
+        load = thread_load(threads + tid);
+        if (load < best_load) {
+            best = tid;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
 /*
  * Dispatches a new connection to another thread. This is only ever called
  * from the main thread, either during initialization (for UDP) or because
@@ -601,7 +698,16 @@ static int last_thread = -1;
 void dispatch_conn_new(int sfd, STATE_FUNC init_state, int event_flags,
                        int read_buffer_size, enum network_transport transport) {
     CQ_ITEM *item = cqi_new();
-    int tid = (last_thread + 1) % settings.num_threads;
+    int tid;
+
+    /* UDP sockets and listeners must be spread over all the threads */
+    if (init_state == conn_new_cmd) {
+        tid = select_thread();
+        /* counted here, so that a burst of connections is spread */
+        thread_conn_count(threads + tid, 1);
+    } else {
+        tid = (last_thread + 1) % settings.num_threads;
+    }
 
     LIBEVENT_THREAD *thread = threads + tid;
 
@@ -623,6 +729,142 @@ void dispatch_conn_new(int sfd, STATE_FUNC init_state, int event_flags,
     }
 }
 
+void thread_conn_count(LIBEVENT_THREAD *me, int delta) {
+    LOCK_THREAD(me);
+    me->conn_count += delta;
+    UNLOCK_THREAD(me);
+}
+
+/*
+ * Returns the thread an idle connection of this thread should be moved to,
+ * or NULL if this thread is not asked to give away its connections.
+ */
+LIBEVENT_THREAD *thread_migration_target(LIBEVENT_THREAD *me) {
+    LIBEVENT_THREAD *to = NULL;
+
+    LOCK_THREAD(me);
+    if (me->migrate_quota > 0) {
+        me->migrate_quota--;
+        me->conn_count--;
+        to = threads + me->migrate_to;
+    }
+    UNLOCK_THREAD(me);
+    return to;
+}
+
+/*
+ * Hands over a connection to another worker thread. The connection must be
+ * idle and already removed from the event base of the current thread.
+ */
+void dispatch_conn_migrate(conn *c, LIBEVENT_THREAD *to) {
+    LOCK_THREAD(to);
+    c->thread = to;
+    to->conn_count++;
+    c->next = to->pending_io;
+    to->pending_io = c;
+    UNLOCK_THREAD(to);
+
+    if (write(to->notify_send_fd, "", 1) != 1) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "Writing to thread notify pipe: %s",
+                                        strerror(errno));
+    }
+}
+
+static uint64_t thread_cpu_usec(LIBEVENT_THREAD *t) {
+#if defined(HAVE_PTHREAD_GETCPUCLOCKID) && defined(HAVE_CLOCK_GETTIME)
+    clockid_t cid;
+    struct timespec ts;
+
+    if (pthread_getcpuclockid(t->thread_id, &cid) == 0 &&
+        clock_gettime(cid, &ts) == 0) {
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * Refreshes the CPU usage of the worker threads. Called once a second
+ * from the clock handler of the main thread. When one thread is much
+ * busier than another, it is asked to move some of its idle connections.
+ */
+void threads_update_load(void) {
+    static struct timeval last_tv;
+    struct timeval tv;
+    uint64_t elapsed, usec;
+    int i, permille, busiest = -1, idlest = -1;
+
+    gettimeofday(&tv, NULL);
+    elapsed = (uint64_t)(tv.tv_sec - last_tv.tv_sec) * 1000000
+            + tv.tv_usec - last_tv.tv_usec;
+    if (last_tv.tv_sec == 0 || elapsed == 0) {
+        for (i = 0; i < settings.num_threads; i++) {
+            threads[i].cpu_usec = thread_cpu_usec(threads + i);
+        }
+        last_tv = tv;
+        return;
+    }
+    last_tv = tv;
+
+    for (i = 0; i < settings.num_threads; i++) {
+        LIBEVENT_THREAD *t = threads + i;
+        usec = thread_cpu_usec(t);
+        permille = (usec > t->cpu_usec) ? (int)((usec - t->cpu_usec) * 1000 / elapsed) : 0;
+        if (permille > 1000) permille = 1000;
+        t->cpu_usec = usec;
+        /* smooth out a single busy second */
+        t->cpu_permille = (t->cpu_permille + permille) / 2;
+
+        if (busiest == -1 || t->cpu_permille > threads[busiest].cpu_permille)
+            busiest = i;
+        if (idlest == -1 || t->cpu_permille < threads[idlest].cpu_permille)
+            idlest = i;
+    }
+
+    for (i = 0; i < settings.num_threads; i++) {
+        LIBEVENT_THREAD *t = threads + i;
+        LOCK_THREAD(t);
+        t->migrate_quota = 0;
+        if (i == busiest && busiest != idlest &&
+            t->cpu_permille - threads[idlest].cpu_permille > MIGRATE_LOAD_GAP &&
+            t->conn_count > 1) {
+            int quota = (t->conn_count - threads[idlest].conn_count) / 2;
+            if (quota < 1) quota = 1;
+            if (quota > MIGRATE_MAX_CONNS) quota = MIGRATE_MAX_CONNS;
+            t->migrate_quota = quota;
+            t->migrate_to = idlest;
+        }
+        UNLOCK_THREAD(t);
+    }
+}
+
+void threads_load_stats(ADD_STAT add_stats, conn *c) {
+    char name[32];
+    int i;
+
+    for (i = 0; i < settings.num_threads; i++) {
+        snprintf(name, sizeof(name), "thread:%d:conns", i);
+        append_stat(name, add_stats, c, "%d", threads[i].conn_count);
+        snprintf(name, sizeof(name), "thread:%d:cpu_permille", i);
+        append_stat(name, add_stats, c, "%d", threads[i].cpu_permille);
+    }
+}
+
+/*
+ * Returns true if any worker thread sends with io_uring.
+ * Each thread falls back to epoll sends by itself if its ring can't be set up.
+ */
+bool threads_use_io_uring(void) {
+    int i;
+
+    for (i = 0; i < settings.num_threads; i++) {
+        if (threads[i].io_ring != NULL)
+            return true;
+    }
+    return false;
+}
+
 /*
  * Returns true if this is the thread that listens for new TCP connections.
  */
@@ -660,6 +902,13 @@ void threadlocal_stats_clear(struct thread_stats *stats) {
     stats->cmd_flush = 0;
     stats->cmd_flush_prefix = 0;
     stats->conn_yields = 0;
+    stats->io_uring_submits = 0;
+    stats->io_uring_sends = 0;
+    stats->io_uring_recvs = 0;
+    stats->conn_migrations = 0;
+    stats->zerocopy_sends = 0;
+    stats->zerocopy_bytes = 0;
+    stats->zerocopy_fallbacks = 0;
     stats->auth_cmds = 0;
     stats->auth_errors = 0;
     stats->cmd_lop_create = 0;
@@ -671,6 +920,7 @@ void threadlocal_stats_clear(struct thread_stats *stats) {
     stats->cmd_sop_delete = 0;
     stats->cmd_sop_get = 0;
     stats->cmd_sop_exist = 0;
+    stats->cmd_sop_setop = 0;
     stats->cmd_bop_create = 0;
     stats->cmd_bop_insert = 0;
     stats->cmd_bop_update = 0;
@@ -709,6 +959,7 @@ void threadlocal_stats_clear(struct thread_stats *stats) {
     stats->sop_get_misses = 0;
     stats->sop_exist_hits = 0;
     stats->sop_exist_misses = 0;
+    stats->sop_setop_oks = 0;
     stats->bop_create_oks = 0;
     stats->bop_insert_hits = 0;
     stats->bop_insert_misses = 0;
@@ -750,134 +1001,46 @@ void threadlocal_stats_clear(struct thread_stats *stats) {
            sizeof(struct slab_stats) * MAX_NUMBER_OF_SLAB_CLASSES);
 }
 
-void threadlocal_stats_reset(struct thread_stats *thread_stats) {
+/*
+ * The counters of a thread are written only by the thread itself, so
+ * "stats reset" does not clear them. It records their current values
+ * as the reset base, and the aggregation reports the difference.
+ */
+#define THREAD_STATS_WORDS (sizeof(struct thread_stats) / sizeof(uint64_t))
+
+static pthread_mutex_t reset_base_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void threadlocal_stats_reset(struct independent_stats *independent_stats) {
+    uint64_t *cur, *base;
     int ii;
+    size_t w;
+
+    pthread_mutex_lock(&reset_base_lock);
     for (ii = 0; ii < settings.num_threads; ++ii) {
-        pthread_mutex_lock(&thread_stats[ii].mutex);
-        threadlocal_stats_clear(&thread_stats[ii]);
-        pthread_mutex_unlock(&thread_stats[ii].mutex);
+        cur = (uint64_t *)&independent_stats->thread_stats[ii];
+        base = (uint64_t *)&independent_stats->reset_base[ii];
+        for (w = 0; w < THREAD_STATS_WORDS; w++) {
+            base[w] = THREAD_STATS_GET(cur[w]);
+        }
     }
+    pthread_mutex_unlock(&reset_base_lock);
 }
 
-void threadlocal_stats_aggregate(struct thread_stats *thread_stats, struct thread_stats *stats) {
-    int ii, sid;
+void threadlocal_stats_aggregate(struct independent_stats *independent_stats, struct thread_stats *stats) {
+    uint64_t *cur, *base;
+    uint64_t *out = (uint64_t *)stats;
+    int ii;
+    size_t w;
+
+    pthread_mutex_lock(&reset_base_lock);
     for (ii = 0; ii < settings.num_threads; ++ii) {
-        pthread_mutex_lock(&thread_stats[ii].mutex);
-
-        stats->cmd_get += thread_stats[ii].cmd_get;
-        stats->get_misses += thread_stats[ii].get_misses;
-        stats->delete_misses += thread_stats[ii].delete_misses;
-        stats->decr_misses += thread_stats[ii].decr_misses;
-        stats->incr_misses += thread_stats[ii].incr_misses;
-        stats->decr_hits += thread_stats[ii].decr_hits;
-        stats->incr_hits += thread_stats[ii].incr_hits;
-        stats->cas_misses += thread_stats[ii].cas_misses;
-        stats->bytes_read += thread_stats[ii].bytes_read;
-        stats->bytes_written += thread_stats[ii].bytes_written;
-        stats->cmd_flush += thread_stats[ii].cmd_flush;
-        stats->cmd_flush_prefix += thread_stats[ii].cmd_flush_prefix;
-        stats->conn_yields += thread_stats[ii].conn_yields;
-        stats->auth_cmds += thread_stats[ii].auth_cmds;
-        stats->auth_errors += thread_stats[ii].auth_errors;
-        stats->cmd_lop_create += thread_stats[ii].cmd_lop_create;
-        stats->cmd_lop_insert += thread_stats[ii].cmd_lop_insert;
-        stats->cmd_lop_delete += thread_stats[ii].cmd_lop_delete;
-        stats->cmd_lop_get += thread_stats[ii].cmd_lop_get;
-        stats->cmd_sop_create += thread_stats[ii].cmd_sop_create;
-        stats->cmd_sop_insert += thread_stats[ii].cmd_sop_insert;
-        stats->cmd_sop_delete += thread_stats[ii].cmd_sop_delete;
-        stats->cmd_sop_get += thread_stats[ii].cmd_sop_get;
-        stats->cmd_sop_exist += thread_stats[ii].cmd_sop_exist;
-        stats->cmd_bop_create += thread_stats[ii].cmd_bop_create;
-        stats->cmd_bop_insert += thread_stats[ii].cmd_bop_insert;
-        stats->cmd_bop_update += thread_stats[ii].cmd_bop_update;
-        stats->cmd_bop_delete += thread_stats[ii].cmd_bop_delete;
-        stats->cmd_bop_get += thread_stats[ii].cmd_bop_get;
-        stats->cmd_bop_count += thread_stats[ii].cmd_bop_count;
-        stats->cmd_bop_position += thread_stats[ii].cmd_bop_position;
-        stats->cmd_bop_gbp += thread_stats[ii].cmd_bop_gbp;
-#ifdef SUPPORT_BOP_MGET
-        stats->cmd_bop_mget += thread_stats[ii].cmd_bop_mget;
-#endif
-#ifdef SUPPORT_BOP_SMGET
-        stats->cmd_bop_smget += thread_stats[ii].cmd_bop_smget;
-#endif
-        stats->cmd_bop_incr += thread_stats[ii].cmd_bop_incr;
-        stats->cmd_bop_decr += thread_stats[ii].cmd_bop_decr;
-        stats->cmd_getattr += thread_stats[ii].cmd_getattr;
-        stats->cmd_setattr += thread_stats[ii].cmd_setattr;
-        stats->lop_create_oks += thread_stats[ii].lop_create_oks;
-        stats->lop_insert_hits += thread_stats[ii].lop_insert_hits;
-        stats->lop_insert_misses += thread_stats[ii].lop_insert_misses;
-        stats->lop_delete_elem_hits += thread_stats[ii].lop_delete_elem_hits;
-        stats->lop_delete_none_hits += thread_stats[ii].lop_delete_none_hits;
-        stats->lop_delete_misses += thread_stats[ii].lop_delete_misses;
-        stats->lop_get_elem_hits += thread_stats[ii].lop_get_elem_hits;
-        stats->lop_get_none_hits += thread_stats[ii].lop_get_none_hits;
-        stats->lop_get_misses += thread_stats[ii].lop_get_misses;
-        stats->sop_create_oks += thread_stats[ii].sop_create_oks;
-        stats->sop_insert_hits += thread_stats[ii].sop_insert_hits;
-        stats->sop_insert_misses += thread_stats[ii].sop_insert_misses;
-        stats->sop_delete_elem_hits += thread_stats[ii].sop_delete_elem_hits;
-        stats->sop_delete_none_hits += thread_stats[ii].sop_delete_none_hits;
-        stats->sop_delete_misses += thread_stats[ii].sop_delete_misses;
-        stats->sop_get_elem_hits += thread_stats[ii].sop_get_elem_hits;
-        stats->sop_get_none_hits += thread_stats[ii].sop_get_none_hits;
-        stats->sop_get_misses += thread_stats[ii].sop_get_misses;
-        stats->sop_exist_hits += thread_stats[ii].sop_exist_hits;
-        stats->sop_exist_misses += thread_stats[ii].sop_exist_misses;
-        stats->bop_create_oks += thread_stats[ii].bop_create_oks;
-        stats->bop_insert_hits += thread_stats[ii].bop_insert_hits;
-        stats->bop_insert_misses += thread_stats[ii].bop_insert_misses;
-        stats->bop_update_elem_hits += thread_stats[ii].bop_update_elem_hits;
-        stats->bop_update_none_hits += thread_stats[ii].bop_update_none_hits;
-        stats->bop_update_misses += thread_stats[ii].bop_update_misses;
-        stats->bop_delete_elem_hits += thread_stats[ii].bop_delete_elem_hits;
-        stats->bop_delete_none_hits += thread_stats[ii].bop_delete_none_hits;
-        stats->bop_delete_misses += thread_stats[ii].bop_delete_misses;
-        stats->bop_get_elem_hits += thread_stats[ii].bop_get_elem_hits;
-        stats->bop_get_none_hits += thread_stats[ii].bop_get_none_hits;
-        stats->bop_get_misses += thread_stats[ii].bop_get_misses;
-        stats->bop_count_hits += thread_stats[ii].bop_count_hits;
-        stats->bop_count_misses += thread_stats[ii].bop_count_misses;
-        stats->bop_position_elem_hits += thread_stats[ii].bop_position_elem_hits;
-        stats->bop_position_none_hits += thread_stats[ii].bop_position_none_hits;
-        stats->bop_position_misses += thread_stats[ii].bop_position_misses;
-        stats->bop_gbp_elem_hits += thread_stats[ii].bop_gbp_elem_hits;
-        stats->bop_gbp_none_hits += thread_stats[ii].bop_gbp_none_hits;
-        stats->bop_gbp_misses += thread_stats[ii].bop_gbp_misses;
-#ifdef SUPPORT_BOP_MGET
-        stats->bop_mget_oks += thread_stats[ii].bop_mget_oks;
-#endif
-#ifdef SUPPORT_BOP_SMGET
-        stats->bop_smget_oks += thread_stats[ii].bop_smget_oks;
-#endif
-        stats->bop_incr_elem_hits += thread_stats[ii].bop_incr_elem_hits;
-        stats->bop_incr_none_hits += thread_stats[ii].bop_incr_none_hits;
-        stats->bop_incr_misses += thread_stats[ii].bop_incr_misses;
-        stats->bop_decr_elem_hits += thread_stats[ii].bop_decr_elem_hits;
-        stats->bop_decr_none_hits += thread_stats[ii].bop_decr_none_hits;
-        stats->bop_decr_misses += thread_stats[ii].bop_decr_misses;
-        stats->getattr_hits += thread_stats[ii].getattr_hits;
-        stats->getattr_misses += thread_stats[ii].getattr_misses;
-        stats->setattr_hits += thread_stats[ii].setattr_hits;
-        stats->setattr_misses += thread_stats[ii].setattr_misses;
-
-        for (sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
-            stats->slab_stats[sid].cmd_set +=
-                thread_stats[ii].slab_stats[sid].cmd_set;
-            stats->slab_stats[sid].get_hits +=
-                thread_stats[ii].slab_stats[sid].get_hits;
-            stats->slab_stats[sid].delete_hits +=
-                thread_stats[ii].slab_stats[sid].delete_hits;
-            stats->slab_stats[sid].cas_hits +=
-                thread_stats[ii].slab_stats[sid].cas_hits;
-            stats->slab_stats[sid].cas_badval +=
-                thread_stats[ii].slab_stats[sid].cas_badval;
+        cur = (uint64_t *)&independent_stats->thread_stats[ii];
+        base = (uint64_t *)&independent_stats->reset_base[ii];
+        for (w = 0; w < THREAD_STATS_WORDS; w++) {
+            out[w] += THREAD_STATS_GET(cur[w]) - base[w];
         }
-
-        pthread_mutex_unlock(&thread_stats[ii].mutex);
     }
+    pthread_mutex_unlock(&reset_base_lock);
 }
 
 void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out) {
@@ -915,6 +1078,8 @@ void SETTING_UNLOCK() {
 void thread_init(int nthr, struct event_base *main_base) {
     int i;
     nthreads = nthr;
+    /* threadlocal_stats_aggregate() walks the counters as an array */
+    assert(sizeof(struct thread_stats) == THREAD_STATS_WORDS * sizeof(uint64_t));
 #ifdef __WIN32__
     struct sockaddr_in serv_addr;
     int sockfd;
@@ -22,9 +22,71 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "memcached.h"
 
+/* find the next space or '\0' in [p, end), or return end */
+static inline char *tokenize_find_delim(char *p, char *end) {
+#ifdef __SSE2__
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i zeros = _mm_setzero_si128();
+    __m128i chunk;
+    int mask;
+
+    while (end - p >= 16) {
+        chunk = _mm_loadu_si128((const __m128i *)p);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, spaces),
+                                              _mm_cmpeq_epi8(chunk, zeros)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != ' ' && *p != '\0') {
+        p++;
+    }
+    return p;
+}
+
+size_t tokenize_command(char *command, const size_t length,
+                        token_t *tokens, const size_t max_tokens) {
+    char *end = command + length;
+    char *s, *e;
+    size_t ntokens = 0;
+
+    assert(command != NULL && tokens != NULL && max_tokens > 1);
+
+    for (s = command; ntokens < max_tokens - 1; s = e + 1) {
+        e = tokenize_find_delim(s, end);
+        if (s != e) {
+            tokens[ntokens].value = s;
+            tokens[ntokens].length = e - s;
+            ntokens++;
+        }
+        if (e == end || *e == '\0') {
+            s = e;
+            break; /* string end */
+        }
+        if (s != e) {
+            *e = '\0';
+        }
+    }
+
+    /*
+     * If we scanned the whole string, the terminal value pointer is null,
+     * otherwise it is the first unprocessed character.
+     */
+    tokens[ntokens].value = (s == end || *s == '\0') ? NULL : s;
+    tokens[ntokens].length = 0;
+    ntokens++;
+
+    return ntokens;
+}
+
 bool safe_strtoull(const char *str, uint64_t *out) {
     assert(out != NULL);
     errno = 0;